@@ -1,4 +1,5 @@
 #include "application.h"
+#include "cluster.h"
 #include "connection.h"
 #include "log.h"
 #include "reactor.h"
@@ -144,7 +145,7 @@ public:
       });
 
       conn->when_disconnect([this] (const connptr& conn) {
-        conn->reconnect();
+        engine().reconnects().disconnected(conn);
       });
 
       conn->when_ready([http_conn] (const connptr& conn){
@@ -182,6 +183,91 @@ public:
   }
 };
 
+/// The http workload of a worker: runs the clients once the fleet starts and
+/// sends the master a single report when they are done (see cluster.h).
+class http_load {
+ public:
+  using params = command;
+
+  explicit http_load(std::string dest) : dest_(std::move(dest)) {}
+
+  void start(cluster_worker_base& c, const command& cmd) {
+    conns_ = cmd.conn();
+    duration_ = cmd.duration();
+    think_time_ = cmd.think_time();
+
+    fmt::print(
+        "configuration: \n\tconnections: {}\n\tduration: {}\n\tthreads:{}\n",
+        conns_, duration_, smp::count-1);
+    if (conns_ % (smp::count-1) != 0) {
+      fmt::print("error: conn needs to be n * cpu_nr \n");
+      exit(-1);
+    }
+
+    engine().add_oneshot_task_at(c.start_time(), [this, &c] {
+      clients_->start(duration_, conns_, think_time_);
+
+      started_ = system_clock::now();
+      fmt::print("connections: {}\n", conns_);
+
+      clients_->invoke_on_all(&http_client::connect, ipv4_addr(dest_, 80));
+      clients_->invoke_on_all(&http_client::run);
+
+      finished_ = started_;
+
+      clients_->when_done([this, &c] {
+        app_logger.info("load test finished, running stats collect process...");
+        finished_ = system_clock::now();
+        clients_->map_reduce(reqs_, &http_client::total_reqs);
+        clients_->map_reduce(bytes_, &http_client::rx_bytes);
+        clients_->map_reduce(total_delay_, &http_client::acc_delay);
+
+        engine().add_oneshot_task_after(1s, [this, &c] { finish(c); });
+      });
+    });
+  }
+
+  void retune(cluster_worker_base& c, const command& cmd) {
+    app_logger.warn("re-tuning is not supported by this worker, keeping the current load");
+  }
+
+  void stop() {
+    engine().stop();
+  }
+
+ private:
+  void finish(cluster_worker_base& c) {
+    auto total_reqs = reqs_.result();
+    auto rx_bytes = bytes_.result();
+    auto avg_delay = total_reqs ? total_delay_.result() / total_reqs : 0;
+    auto elapsed = duration_cast<seconds>(finished_ - started_);
+    auto secs = elapsed.count();
+    fmt::print("total cpus: {}\n", smp::count-1);
+    fmt::print("=============== summary =========================\n");
+    fmt::print("{} requests in {}s, {}MB read\n", total_reqs, secs, rx_bytes / 1024 / 1024);
+    fmt::print("request/sec:  {}\n", static_cast<double>(total_reqs) / secs);
+    fmt::print("transfer/sec: {}MB\n", static_cast<double>(rx_bytes) / 1024 / 1024 / secs);
+    fmt::print("average delay: {}us\n", avg_delay);
+    fmt::print("=============== done ============================\n");
+
+    report r;
+    r.set_client_id(c.id());
+    r.set_completes(total_reqs);
+    r.set_delay(avg_delay);
+    r.set_rx_bytes(rx_bytes);
+    c.send(HTTP_REPORT, r);
+
+    engine().add_oneshot_task_after(1s, [this] { stop(); });
+  }
+
+  std::string dest_;
+  uint64_t conns_{0}, duration_{0};
+  int think_time_{0};
+  system_clock::time_point started_, finished_;
+  adder reqs_, bytes_, total_delay_;
+  distributor<http_client>* clients_{new distributor<http_client>};
+};
+
 int main(int argc, char **argv) {
   application app;
   app.add_options()
@@ -201,106 +287,11 @@ int main(int argc, char **argv) {
     ipv4_addr server_addr(ip, port);
     ipv4_addr local_addr(local_ip);
 
-    uint64_t conns, duration;
-		int think_time;
-    int64_t start_ts;
-    system_clock::time_point start_tp;
-
-    system_clock::time_point started, finished;
-    adder reqs, bytes, total_delay;
-
-    auto clients = new distributor<http_client>;
-
-    auto conn = engine().connect(make_ipv4_address(server_addr), make_ipv4_address(local_addr));
-    conn->when_ready([&](const connptr& con) {
-      app_logger.info("server connected!");
-      report r;
-      r.set_client_id(id);
-      report::notice *n = r.mutable_note();
-      n->set_online(true);
-      std::string packet;
-      r.SerializeToString(&packet);
-      conn->send_packet(packet);
-    });
-
-    conn->on_message([&](const connptr& conn, std::string msg) mutable {
-      command cmd;
-      conn->get_input().consume(msg.size());
-      if (!cmd.ParseFromString(msg)) {
-        app_logger.error("Failed to parse message!");
-      }
-
-      conns = cmd.conn();
-      duration = cmd.duration();
-			think_time = cmd.think_time();
-      start_ts = cmd.start_ts();
-
-      start_tp = start_tp + milliseconds(start_ts);
-
-
-      fmt::print(
-          "configuration: \n\tconnections: {}\n\tduration: {}\n\tthreads:{}\n",
-          conns, duration, smp::count-1);
-      if (conns % (smp::count-1) != 0) {
-        fmt::print("error: conn needs to be n * cpu_nr \n");
-        exit(-1);
-      }
-
-      engine().add_oneshot_task_at(start_tp, [&, conn]() mutable {
-        clients->start(duration, conns, think_time);
-
-        started = system_clock::now();
-        fmt::print("connections: {}\n", conns);
-
-        clients->invoke_on_all(&http_client::connect, ipv4_addr(dest, 80));
-        clients->invoke_on_all(&http_client::run);
-
-        finished = started;
-
-        clients->when_done([&, clients, conn]() mutable {
-          app_logger.info("load test finished, running stats collect process...");
-          finished = system_clock::now();
-          clients->map_reduce(reqs, &http_client::total_reqs);
-          clients->map_reduce(bytes, &http_client::rx_bytes);
-          clients->map_reduce(total_delay, &http_client::acc_delay);
-
-          engine().add_oneshot_task_after(1s, [&, clients, conn] {
-            auto total_reqs = reqs.result();
-            auto rx_bytes = bytes.result();
-            auto avg_delay = total_delay.result() / total_reqs;
-            auto elapsed = duration_cast<seconds>(finished - started);
-            auto secs = elapsed.count();
-            fmt::print("total cpus: {}\n", smp::count-1);
-            fmt::print("=============== summary =========================\n");
-            fmt::print("{} requests in {}s, {}MB read\n", total_reqs, secs, rx_bytes / 1024 / 1024);
-            fmt::print("request/sec:  {}\n", static_cast<double>(total_reqs) / secs);
-            fmt::print("transfer/sec: {}MB\n", static_cast<double>(rx_bytes) / 1024 / 1024 / secs);
-            fmt::print("average delay: {}us\n", avg_delay);
-            fmt::print("=============== done ============================\n");
-
-            report r;
-            r.set_client_id(id);
-            r.set_completes(total_reqs);
-            r.set_delay(avg_delay);
-            r.set_rx_bytes(rx_bytes);
-            std::string packet;
-            r.SerializeToString(&packet);
-            conn->send_packet(packet);
-
-            engine().add_oneshot_task_after(1s, [&, clients, conn] {
-              //clients->stop();
-              engine().stop();
-            });
-          });
-        });
-
-      });
-
-    });
+    auto load = new http_load(dest);
+    auto worker = new cluster_worker<http_load>(cluster_config{}, *load, id,
+        make_ipv4_address(server_addr), make_ipv4_address(local_addr));
+    worker->connect();
     engine().run();
-
-
-    delete clients;
   });
   return 0;
 }
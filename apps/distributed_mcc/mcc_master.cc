@@ -1,12 +1,137 @@
 #include "proto/mcc.pb.h"
 #include "application.h"
 #include "reactor.h"
-#include "tcp_server.h"
 #include "log.h"
+#include "cluster.h"
+#include "control.h"
+#include "histogram.h"
+#include "stats.h"
+#include "ramp.h"
+
+#include <google/protobuf/arena.h>
 
 using namespace infgen;
 namespace bpo = boost::program_options;
 
+/// Statistics of one worker. Slots are allocated once for all workers,
+/// reports and deltas are folded into them in place. Deltas only count on
+/// top of a report and every delta since, so a slot takes none from a
+/// worker that just (re)registered, or lost one, until the next report.
+struct worker_slot {
+  uint32_t seq{0};
+  bool synced{false};
+  uint64_t connected{0};
+  uint64_t tx_packets{0};
+  uint64_t rx_packets{0};
+  uint64_t requests{0};
+  uint64_t retry{0};
+  histogram latency;
+  // totals at the last dashboard refresh, for the rates
+  uint64_t last_tx{0};
+  uint64_t last_rx{0};
+
+  void clear() { *this = worker_slot{}; }
+
+  void apply(const report& r) {
+    seq = r.seq();
+    connected = r.connected();
+    tx_packets = r.tx_packets();
+    rx_packets = r.rx_packets();
+    requests = r.requests();
+    retry = r.retry();
+    latency.reset();
+    decode_histogram(r.latency(), latency);
+    synced = true;
+  }
+
+  void apply(const delta& d) {
+    if (!synced || d.seq() != seq + 1) {
+      synced = false;
+      return;
+    }
+    seq = d.seq();
+    connected += d.connected();
+    tx_packets += d.tx_packets();
+    rx_packets += d.rx_packets();
+    requests += d.requests();
+    retry += d.retry();
+    decode_histogram(d.latency(), latency);
+  }
+};
+
+/// The mcc workload on the master: the same command for every worker apart
+/// from the stagger, statistics shown on a dashboard (see cluster.h).
+class mcc_fleet {
+ public:
+  using params = command;
+
+  explicit mcc_fleet(unsigned workers) : slots_(workers) {}
+
+  void split(const command& fleet, unsigned id, unsigned workers, command& out) {
+    out = fleet;
+    //add by songhui
+    out.set_stagger_time(fleet.stagger_time() * id);
+  }
+
+  void on_stats(cluster_master_base& c, unsigned id, uint8_t type, const char* p, size_t len) {
+    if (type == REPORT) {
+      auto r = google::protobuf::Arena::CreateMessage<report>(&c.arena());
+      if (!r->ParseFromArray(p, len)) {
+        app_logger.error("bad report from worker {}", id);
+        return;
+      }
+      slots_[id].apply(*r);
+    } else if (type == DELTA) {
+      auto d = google::protobuf::Arena::CreateMessage<delta>(&c.arena());
+      if (!d->ParseFromArray(p, len)) {
+        app_logger.error("bad delta from worker {}", id);
+        return;
+      }
+      slots_[id].apply(*d);
+    } else {
+      app_logger.error("unexpected frame type {} from worker {}", type, id);
+    }
+  }
+
+  void dashboard(cluster_master_base& c) {
+    system("clear");
+    uint64_t total_connected = 0, total_tx = 0, total_rx = 0;
+    total_latency_.reset();
+    std::time_t t = std::time(nullptr);
+    fmt::print("{:%Y-%m-%d %T}\n", fmt::localtime(t));
+    fmt::print("\n");
+    fmt::print("Node\tStatus\tConnected\tTx\t\tRx\t\tTx/s\tRx/s\tp50(us)\tp99(us)\tClock(us)\n");
+    for (unsigned i = 0; i < slots_.size(); i++) {
+      auto& w = slots_[i];
+      auto& m = c.worker(i);
+      if (!m.online) {
+        // whatever it sent is gone with it
+        w.clear();
+      }
+      fmt::print("{}\t{}\t{}\t\t{}\t\t{}\t\t{}\t{}\t{}\t{}\t{}+/-{}\n", i, status_[m.online],
+          w.connected, w.tx_packets, w.rx_packets, w.tx_packets - w.last_tx,
+          w.rx_packets - w.last_rx, w.latency.percentile(50), w.latency.percentile(99),
+          m.clock_offset, m.clock_error);
+      total_connected += w.connected;
+      total_tx += w.tx_packets - w.last_tx;
+      total_rx += w.rx_packets - w.last_rx;
+      total_latency_(w.latency);
+      w.last_tx = w.tx_packets;
+      w.last_rx = w.rx_packets;
+    }
+    fmt::print("\nTotal connected: {}\tTx/s: {}\tRx/s: {}\n", total_connected,
+        total_tx, total_rx);
+    fmt::print("Latency(us) avg: {}\tp50: {}\tp99: {}\tp999: {}\tmax: {}\n",
+        total_latency_.mean(), total_latency_.percentile(50), total_latency_.percentile(99),
+        total_latency_.percentile(99.9), total_latency_.max());
+  }
+
+ private:
+  std::vector<worker_slot> slots_;
+  histogram total_latency_;
+  std::array<std::string, 2> status_ = {"OFF", "ON"};
+};
+
 int main(int argc, char* argv[]) {
   application app;
   app.add_options()
@@ -16,6 +141,10 @@ int main(int argc, char* argv[]) {
      "number of concurrent connections")
     ("setup-time,s", bpo::value<unsigned>()->default_value(1),
      "connection setup time(s)")
+    ("ramp", bpo::value<std::string>()->default_value("staircase"),
+     "shape of the fleet-wide connection ramp over setup time: linear or staircase")
+    ("ramp-steps", bpo::value<unsigned>()->default_value(0),
+     "steps of a staircase ramp (default: one per second of setup time)")
     ("wait-time,w", bpo::value<unsigned>()->default_value(1),
      "wait time after connection setup(s)")
     ("stagger-time,g", bpo::value<unsigned>()->default_value(0),
@@ -33,12 +162,20 @@ int main(int argc, char* argv[]) {
 		("think-time,t", bpo::value<int>()->default_value(50000), 
 		 "think time between requests (ns)")
     ("workers,n", bpo::value<unsigned>()->default_value(1),
-     "number of workers");
+     "number of workers")
+    ("control-port", bpo::value<unsigned>()->default_value(0),
+     "local port to re-tune epoch, burst, ratio and connections of the running fleet (0 for none)");
   app.run(argc, argv, [&]() {
     auto config = app.configuration();
     auto epoch = static_cast<unsigned>(1000 * config["epoch"].as<float>()); // Milliseconds
     auto conn = config["connections"].as<unsigned>();
     auto setup_time = config["setup-time"].as<unsigned>();
+    auto ramp_steps = config["ramp-steps"].as<unsigned>();
+    ramp::shape ramp_shape;
+    if (!ramp::parse(config["ramp"].as<std::string>(), ramp_shape)) {
+      fmt::print("Error: ramp needs to be linear or staircase\n");
+      exit(-1);
+    }
     auto wait_time = config["wait-time"].as<unsigned>();
 	auto stagger_time = config["stagger-time"].as<unsigned>();
     auto duration = config["duration"].as<unsigned>();
@@ -49,104 +186,75 @@ int main(int argc, char* argv[]) {
 		auto think_time = config["think-time"].as<int>();
     auto workers = config["workers"].as<unsigned>();
 
-    unsigned workers_online = 0;
-
-    pin_this_thread(10);
-
-    ipv4_addr addr("0.0.0.0", port);
-    std::vector<connptr> worker_conns(workers, nullptr);
-    std::vector<int> worker_desc(workers, 0);
-    std::vector<int> connected(workers, 0);
-    std::vector<int> tx_packets(workers, 0);
-    std::vector<int> rx_packets(workers, 0);
-
-    std::array<std::string, 2> status = {"OFF", "ON"};
+    command cmd;
+    cmd.set_conn(conn);
+    cmd.set_burst(burst);
+    cmd.set_epoch(epoch);
+    cmd.set_setup_time(setup_time);
+    cmd.set_wait_time(wait_time);
+    cmd.set_stagger_time(stagger_time);
+    cmd.set_duration(duration);
+    cmd.set_length(length);
+    cmd.set_think_time(think_time);
+    cmd.set_ratio(ratio);
+    cmd.set_ramp(ramp_shape == ramp::shape::linear ? LINEAR : STAIRCASE);
+    cmd.set_ramp_steps(ramp_steps);
 
-    auto svr = tcp_server::create_tcp_server(make_ipv4_address(addr));
-    if (svr == nullptr) {
+    cluster_config cfg;
+    cfg.workers = workers;
+    cfg.port = port;
+    cfg.dashboard = 1s;
+    auto fleet = new mcc_fleet(workers);
+    auto master = new cluster_master<mcc_fleet>(cfg, *fleet, cmd);
+    if (!master->listen()) {
       app_logger.error("create server failed");
       exit(-1);
     }
 
-    svr->when_disconnect([&] (const connptr& con) mutable {
-      app_logger.info("client {} offline", con->get_id());
-      connected[con->get_id()] = 0;
-			tx_packets[con->get_id()] = 0;
-			rx_packets[con->get_id()] = 0;
-
-      worker_desc[con->get_id()] = 0;
-      
-			workers_online--;
-    });
-
-    engine().add_periodic_task_at<infinite>(system_clock::now(), 1s, [&] {
-      system("clear");
-			uint64_t total_connected = 0;
-      std::time_t t = std::time(nullptr);
-      fmt::print("{:%Y-%m-%d %T}\n", fmt::localtime(t));
-      fmt::print("\n");
-      fmt::print("Node\tStatus\tConnected\tTx\t\tRx\t\n");
-      for (unsigned i = 0; i < workers; i++) {
-        fmt::print("{}\t{}\t{}\t\t{}\t\t{}\n", i, status[worker_desc[i]],
-            connected[i], tx_packets[i], rx_packets[i]);
-        //tx_packets[i] = 0;
-        //rx_packets[i] = 0;
-				total_connected += connected[i];
-      }
-			fmt::print("\nTotal connected: {}\n", total_connected);
-    });
-
-    svr->on_message([&] (const connptr& con, std::string msg) mutable {
-      report r;
-      con->get_input().consume(msg.size());
-      if (!r.ParseFromString(msg)) {
-        app_logger.error("failed to parse message!");
-      }
-
-      if (r.has_note()) {
-      // the first packet is for status report
-        auto client_id = r.client_id();
-        con->set_id(client_id);
-        app_logger.info("client {} online", client_id);
-        worker_desc[client_id] = 1;
-        worker_conns[client_id] = con;
-        workers_online++;
-
-        if (workers_online >= workers) {
-          // start distributing workload
-          app_logger.info("all workers ready, distributing workloads");
-          command cmd;
-          cmd.set_conn(conn);
-          cmd.set_burst(burst);
-          cmd.set_epoch(epoch);
-          cmd.set_setup_time(setup_time);
-          cmd.set_wait_time(wait_time);
-          cmd.set_stagger_time(stagger_time);
-          cmd.set_duration(duration);
-		  cmd.set_length(length);
-		  cmd.set_think_time(think_time);
-          cmd.set_ratio(ratio);
-          auto tp = system_clock::now() + 3000ms;
-          auto start_ts = duration_cast<milliseconds>(tp.time_since_epoch()).count();
-          cmd.set_start_ts(start_ts);
-          std::string packet;
-          cmd.SerializeToString(&packet);
-
-          for (auto& c: worker_conns) {
-            if (c) {
-              c->send_packet(packet);
-            }
-          }
-          
+    // knobs take the same values as their command line options and apply
+    // to the whole fleet, e.g. "echo 'epoch 0.5' | nc 127.0.0.1 <control-port>"
+    auto control_port = config["control-port"].as<unsigned>();
+    if (control_port) {
+      auto retune = [master] (auto&& set) {
+        auto p = master->fleet_params();
+        set(p);
+        master->retune(p);
+        return std::string();
+      };
+      auto ctl = new control_channel;
+      ctl->on("epoch", "the repeat period(s)", [=] (const std::string& v) {
+        float e;
+        if (!control_channel::parse(v, e) || e * 1000 < 1) {
+          return std::string("epoch needs to be at least 1ms");
+        }
+        return retune([=] (command& p) { p.set_epoch(static_cast<unsigned>(1000 * e)); });
+      });
+      ctl->on("burst", "number of bursted packets at one time", [=] (const std::string& v) {
+        unsigned b;
+        if (!control_channel::parse(v, b) || b == 0) {
+          return std::string("burst needs to be a positive number");
         }
-      } else {
-        // do the stat report
-        auto client_id = r.client_id();
-        connected[client_id] = r.connected();
-        tx_packets[client_id] = r.tx_packets();
-        rx_packets[client_id] = r.rx_packets();
+        return retune([=] (command& p) { p.set_burst(b); });
+      });
+      ctl->on("ratio", "ratio of request packets", [=] (const std::string& v) {
+        float r;
+        if (!control_channel::parse(v, r) || r < 0 || r > 1) {
+          return std::string("ratio needs to be in [0, 1]");
+        }
+        return retune([=] (command& p) { p.set_ratio(r); });
+      });
+      ctl->on("connections", "number of concurrent connections per worker",
+              [=] (const std::string& v) {
+        unsigned c;
+        if (!control_channel::parse(v, c)) {
+          return std::string("connections needs to be a number");
+        }
+        return retune([=] (command& p) { p.set_conn(c); });
+      });
+      if (!ctl->listen(control_port)) {
+        exit(-1);
       }
-    });
+    }
     engine().run();
   });
 }
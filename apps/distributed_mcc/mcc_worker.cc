@@ -2,7 +2,11 @@
 #include "connection.h"
 #include "reactor.h"
 #include "log.h"
-#include "proto/mcc.pb.h"
+#include "cluster.h"
+#include "histogram.h"
+#include "stats.h"
+#include "ramp.h"
+#include "epoch_schedule.h"
 
 #include "smp.h"
 #include "distributor.h"
@@ -21,6 +25,12 @@ logger client_logger("client_log", true);
 class client {
 private:
   unsigned nr_conns_;
+  // this core's share of the fleet-wide connection ramp
+  ramp_shard shard_;
+  timer_id ramp_timer_;
+  unsigned worker_;
+  unsigned workers_;
+  ipv4_addr server_addr_;
   unsigned epoch_;
   unsigned burst_;
   unsigned setup_time_;
@@ -28,28 +38,38 @@ private:
   unsigned wait_time_;
   unsigned stagger_time_;
 
+  // every flow opened, connected or not; the load is planned over all of
+  // them so a flow keeps its slot in the epoch across reconnects
   std::vector<connptr> conns_;
   std::vector<int> ref_;
+  epoch_schedule load_;
+  bool loading_{false};
 
 	//@wuwenqing, for fixed length of payload
 	unsigned req_length_;
 	int think_time_; //ns
+	// start of the run, already converted to the local clock
 	system_clock::time_point start_tp_;
 
   distributor<client>* container_;
 
   struct metrics {
-    unsigned connected;
-    unsigned retry;
-    unsigned send;
-    unsigned request;
-    unsigned received;
+    uint64_t connected;
+    uint64_t retry;
+    uint64_t send;
+    uint64_t request;
+    uint64_t received;
   };
 
-  metrics stats_sec, stats_log;
+  // stats_total is never cleared, the reports to the master are built from it
+  metrics stats_sec, stats_log, stats_total;
+  histogram latency_;
 
+  // sent by reference on mTCP, so never changed after start()
   std::string heartbeat_;
   std::string request_;
+  int heartbeat_id_, request_id_;
+  unsigned think_sink_{0};
   unsigned duration_;
 
   void clear_stats(metrics& stats) {
@@ -59,17 +79,22 @@ private:
   }
 
   void send_request(unsigned j) {
-    conns_[j]->send_packet(request_);
+    clock_gettime(CLOCK_MONOTONIC, &conns_[j]->time_send);
+    conns_[j]->send_payload(request_id_, 0, request_.size());
     stats_sec.request++;
     stats_sec.send++;
     stats_log.request++;
     stats_log.send++;
+    stats_total.request++;
+    stats_total.send++;
   }
 
   void send_heartbeat(unsigned j) {
-    conns_[j]->send_packet(heartbeat_);
+    clock_gettime(CLOCK_MONOTONIC, &conns_[j]->time_send);
+    conns_[j]->send_payload(heartbeat_id_, 0, heartbeat_.size());
     stats_sec.send++;
     stats_log.send++;
+    stats_total.send++;
   }
 
   unsigned Fibonacci_service(int delay) { /// ns
@@ -86,9 +111,11 @@ private:
   }
 
 public:
-  client(unsigned conns, unsigned epoch, unsigned burst, unsigned setup_time, unsigned wait_time, unsigned stagger, unsigned duration, double ratio, unsigned length, int think_time, system_clock::time_point start_tp)
-      : nr_conns_(conns), epoch_(epoch), burst_(burst), setup_time_(setup_time),
-        request_ratio_(ratio), wait_time_(wait_time), stagger_time_(stagger), req_length_(length), think_time_(think_time), start_tp_(start_tp), stats_sec(metrics{}), stats_log(metrics{}),
+  client(ramp conn_ramp, unsigned worker, unsigned workers, unsigned epoch, unsigned burst, unsigned setup_time, unsigned wait_time, unsigned stagger, unsigned duration, double ratio, unsigned length, int think_time, system_clock::time_point start_tp)
+      : shard_(conn_ramp, worker, workers, engine().cpu_id() - 1, smp::count - 1),
+        worker_(worker), workers_(workers),
+        epoch_(epoch), burst_(burst), setup_time_(setup_time),
+        request_ratio_(ratio), wait_time_(wait_time), stagger_time_(stagger), req_length_(length), think_time_(think_time), start_tp_(start_tp), stats_sec(metrics{}), stats_log(metrics{}), stats_total(metrics{}),
         heartbeat_(length, 0), request_(length, 0), duration_(duration) {
       request_[5] = 0x01;
       request_[6] = 0x02;
@@ -96,6 +123,7 @@ public:
 			heartbeat_[5] = 0x00;
 			heartbeat_[6] = 0x02;
       heartbeat_[8] = 0x08;
+      nr_conns_ = shard_.size();
       app_logger.info("client created");
   }
 
@@ -114,6 +142,13 @@ public:
   uint64_t request_log() { return stats_log.request; }
   uint64_t received_log() { return stats_log.received; }
 
+  uint64_t connected_total() { return stats_total.connected; }
+  uint64_t send_total() { return stats_total.send; }
+  uint64_t request_total() { return stats_total.request; }
+  uint64_t received_total() { return stats_total.received; }
+  uint64_t retry_total() { return stats_total.retry; }
+  histogram latency() { return latency_; }
+
   void flush_log_stats() {
     stats_log.send = 0;
     stats_log.request = 0;
@@ -124,70 +159,27 @@ public:
   }
 
   void start(ipv4_addr server_addr) {
+    request_id_ = engine().register_payload(request_.data(), request_.size());
+    heartbeat_id_ = engine().register_payload(heartbeat_.data(), heartbeat_.size());
+
     ref_.resize(burst_);
     std::iota(ref_.begin(), ref_.end(), 0);
     std::random_device rd;
     std::mt19937 g(rd());
     std::shuffle(ref_.begin(), ref_.end(), g);
 
-    auto block = nr_conns_ / setup_time_;
+    server_addr_ = server_addr;
     app_logger.info("start loading...");
-    for (unsigned i = 0; i < setup_time_; i++) {
-      engine().add_oneshot_task_after(i * 1s, [=] {
-        for (unsigned j = 0; j < block; j++) {
-          auto conn = engine().connect(make_ipv4_address(server_addr));
-          conn->when_ready([this] (const connptr& conn) {
-            stats_log.connected++;
-            stats_sec.connected++;
-            conns_.push_back(conn);
-            if (conns_.size() >= nr_conns_) {
-              app_logger.trace("all connections ready!");
-            }
-          });
-          conn->when_recved([this] (const connptr& conn) {
-            stats_sec.received++;
-            stats_log.received++;
-            std::string s = conn->get_input().string();
-            conn->get_input().consume(s.size());
-      			// "Think time"
-						unsigned val = Fibonacci_service(think_time_); 
-            request_[9] = static_cast<int>(val % 127);
-          });
-
-          conn->when_closed([this] {
-            stats_sec.connected--;
-            stats_log.connected--;
-          });
-
-          conn->when_failed([this] (const connptr& conn) {
-						// @ wuwenqing
-            stats_sec.connected--;
-            stats_sec.retry++;
-
-            stats_log.connected--;
-            stats_log.retry++;
-            conn->reconnect();
-          });
-
-          conn->when_disconnect([this] (const connptr& conn) {
-            stats_sec.connected--;
-            stats_sec.retry++;
-
-            stats_log.connected--;
-            stats_log.retry++;
-            conn->reconnect();
-            //auto newconn = conn->reconnect();
-            //conns_.push_back(newconn);
-          });
-        }
-      });
+    if (!shard_.done()) {
+      ramp_timer_ = engine().add_oneshot_task_at(start_tp_ + shard_.due(), [this] { open_due(); });
     }
 
-    engine().add_oneshot_task_after(seconds(wait_time_ + setup_time_) + milliseconds(stagger_time_),
-    //engine().add_oneshot_task_at(start_tp_,
-                                    [this] { do_req(); });
+    // every worker and core derives the same timeline from start_tp_, so
+    // epochs line up across the fleet
+    engine().add_oneshot_task_at(start_tp_ + seconds(wait_time_ + setup_time_) +
+                                 milliseconds(stagger_time_), [this] { do_req(); });
 
-    engine().add_oneshot_task_after(seconds(duration_), [this] {
+    engine().add_oneshot_task_at(start_tp_ + seconds(duration_), [this] {
       for (auto c: conns_) {
         c->close();
       }
@@ -195,6 +187,77 @@ public:
     });
   }
 
+  /// Open the connections of the ramp that are due, then wait for the next.
+  void open_due() {
+    auto now = system_clock::now();
+    while (!shard_.done() && start_tp_ + shard_.due() <= now) {
+      shard_.next();
+      open_connection();
+    }
+    if (!shard_.done()) {
+      ramp_timer_ = engine().add_oneshot_task_at(start_tp_ + shard_.due(), [this] { open_due(); });
+    }
+  }
+
+  void open_connection() {
+    auto conn = engine().connect(make_ipv4_address(server_addr_));
+    conns_.push_back(conn);
+    conn->when_ready([this] (const connptr& conn) {
+      stats_log.connected++;
+      stats_sec.connected++;
+      stats_total.connected++;
+      clock_gettime(CLOCK_MONOTONIC, &conn->time_send);
+      if (conns_.size() >= nr_conns_) {
+        app_logger.trace("all connections ready!");
+      }
+    });
+    conn->when_recved([this] (const connptr& conn) {
+      stats_sec.received++;
+      stats_log.received++;
+      stats_total.received++;
+      clock_gettime(CLOCK_MONOTONIC, &conn->time_recv);
+      latency_.record((conn->time_recv.tv_sec - conn->time_send.tv_sec) * 1000000 +
+                      (conn->time_recv.tv_nsec - conn->time_send.tv_nsec) / 1000);
+      conn->get_input().consume(conn->get_input().size());
+      // "Think time", kept observable so it is not optimized out
+      think_sink_ += Fibonacci_service(think_time_);
+    });
+
+    conn->when_closed([this] {
+      stats_sec.connected--;
+      stats_log.connected--;
+      stats_total.connected--;
+    });
+
+    conn->when_failed([this] (const connptr& conn) {
+						// @ wuwenqing
+      stats_sec.connected--;
+      stats_sec.retry++;
+
+      stats_log.connected--;
+      stats_log.retry++;
+
+      stats_total.connected--;
+      stats_total.retry++;
+      engine().reconnects().schedule(conn);
+    });
+
+    conn->when_disconnect([this] (const connptr& conn) {
+      stats_sec.connected--;
+      stats_log.connected--;
+      stats_total.connected--;
+      // an orderly close is churn, not a retry
+      if (!conn->closed_by_peer()) {
+        stats_sec.retry++;
+        stats_log.retry++;
+        stats_total.retry++;
+      }
+      engine().reconnects().disconnected(conn);
+      //auto newconn = conn->reconnect();
+      //conns_.push_back(newconn);
+    });
+  }
+
   void print_stats() {
     fmt::print("[engine {}]\tconnected: {} \tretry: {}\tsend: {}\t"
                  "request: {}\treceived: {}\n", engine().cpu_id(),
@@ -204,35 +267,262 @@ public:
   }
 
   void do_req() {
+    loading_ = true;
+    plan_load();
+  }
+
+  /// Change the offered load in place. conn_ramp is the fleet-wide ramp for
+  /// the new connection count: flows already up stay, the rest of this
+  /// core's shard follows the new ramp (right away if it is past), a smaller
+  /// shard closes the flows it no longer has. Send timers are re-planned on
+  /// the fleet-wide epoch anchor.
+  void retune(ramp conn_ramp, unsigned epoch, unsigned burst, double ratio) {
+    epoch_ = epoch;
+    burst_ = burst;
+    request_ratio_ = ratio;
+    if (ref_.size() != burst_) {
+      ref_.resize(burst_);
+      std::iota(ref_.begin(), ref_.end(), 0);
+    }
+
+    engine().cancel_task(ramp_timer_);
+    shard_ = ramp_shard(conn_ramp, worker_, workers_, engine().cpu_id() - 1, smp::count - 1);
+    nr_conns_ = shard_.size();
+    while (conns_.size() > nr_conns_) {
+      // a retune took the flow away
+      conns_.back()->retire();
+      conns_.pop_back();
+    }
+    shard_.skip(conns_.size());
+    open_due();
+
+    if (loading_) {
+      plan_load();
+    }
+    app_logger.info("retuned: epoch {}ms, burst {}, ratio {}, {} of {} flows", epoch_, burst_,
+                    request_ratio_, conns_.size(), nr_conns_);
+  }
+
+private:
+  void plan_load() {
+    if (conns_.empty()) {
+      app_logger.warn("no connection established on engine {}", engine().cpu_id());
+      load_.cancel();
+      return;
+    }
+    // blocks are spread over the epoch from the aligned start, not from
+    // whenever this timer happened to fire
+    auto load_tp = start_tp_ + seconds(wait_time_ + setup_time_) + milliseconds(stagger_time_);
     auto blocks = conns_.size() / burst_;
 	auto remainder = conns_.size() % burst_;
 	blocks = remainder > 0 ? (blocks+1) : blocks;
-    auto interval = epoch_ / blocks;
+    load_.plan(load_tp, milliseconds(epoch_), blocks, [this] (unsigned i) { send_block(i); });
+  }
+
+  void send_block(unsigned i) {
 	int thre = (double)request_ratio_ * MAXRAND * 1.5;
-    for (unsigned i = 0; i < blocks; i++) {
+	int type_cnt = 0;
+	int pri = -1;
+    for (unsigned j = i * burst_;
+         j < (i + 1) * burst_ && j < conns_.size(); j++) {
+      if (conns_[j]->get_state() == tcp_connection::state::connected) {
+        //if (ref_[j % burst_] < static_cast<int>(burst_ * request_ratio_)) {
+          //pri = (double)rand() / (RAND_MAX+1.0) * MAXRAND;
+          //fmt::print("pri:{}\n", pri);
+          pri = (double)rand() / (RAND_MAX+1.0) * MAXRAND;
+          if ((pri < thre) &&
+          	(type_cnt < static_cast<int>(burst_ * request_ratio_))){
+		type_cnt++;
+          send_request(j);
+        } else {
+          send_heartbeat(j);
+        }
+      }
+    }
+  }
+};
+
+/// The mcc workload of a worker: runs the loaders it is told to and streams
+/// their statistics to the master (see cluster.h).
+class mcc_load {
+ public:
+  using params = command;
+
+  mcc_load(std::string dest, unsigned sample_interval, unsigned log_duration, unsigned verbose)
+      : dest_(std::move(dest)), sample_interval_(sample_interval),
+        log_duration_(log_duration), verbose_(verbose),
+        samples_per_report_(std::max(1u, 1000 / sample_interval)) {}
+
+  void start(cluster_worker_base& c, const command& cmd) {
+    auto workers = std::max(1u, c.workers());
+    auto setup = cmd.setup_time();
+    auto conn_ramp = make_ramp(c, cmd);
+
+    if (verbose_) {
+      fmt::print(
+          "configuration: \n\tconnections: {}\n\tepoch: {}s\n\t"
+          "burst: {}\n" "\tthreads: {}\n\t",
+          cmd.conn(), static_cast<float>(cmd.epoch())/1000, cmd.burst(), smp::count-1);
+    }
+
+    // loaders schedule themselves against the start time, so they are set
+    // up now; the master already staggered this worker
+    auto start_tp = c.start_time();
+    loaders_ = new distributor<client>;
+    loaders_->start(conn_ramp, c.id(), workers, cmd.epoch(), cmd.burst() / (smp::count-1),
+        setup, cmd.wait_time(), cmd.stagger_time(), cmd.duration(), cmd.ratio(),
+        cmd.length(), cmd.think_time(), start_tp);
+    loaders_->invoke_on_all(&client::start, ipv4_addr(dest_, 80));
+
+    engine().add_oneshot_task_at(start_tp, [this, &c] {
+      // the loader cores answer before the next tick, so each tick sends
+      // what the previous one collected and starts collecting again
+      engine().add_periodic_task_at<infinite>(
+          system_clock::now(), milliseconds(sample_interval_), [this, &c] { tick(c); });
+
       engine().add_periodic_task_at<infinite>(
-        system_clock::now() + i * milliseconds(interval), milliseconds(epoch_), [=] {
-		  int type_cnt = 0;
-		  int pri = -1;
-          for (unsigned j = i * burst_;
-               j < (i + 1) * burst_ && j < conns_.size(); j++) {
-            if (conns_[j]->get_state() == tcp_connection::state::connected) {
-              //if (ref_[j % burst_] < static_cast<int>(burst_ * request_ratio_)) {
-                //pri = (double)rand() / (RAND_MAX+1.0) * MAXRAND;
-                //fmt::print("pri:{}\n", pri);
-                pri = (double)rand() / (RAND_MAX+1.0) * MAXRAND;
-                if ((pri < thre) &&
-                	(type_cnt < static_cast<int>(burst_ * request_ratio_))){
-				type_cnt++;
-                send_request(j);
-              } else {
-                send_heartbeat(j);
-              }
-            }
-          }
+          system_clock::now(), seconds(log_duration_), [this] {
+            loaders_->map_reduce(connected_log_, &client::connected_log);
+            loaders_->map_reduce(request_log_, &client::request_log);
+            loaders_->map_reduce(send_log_, &client::send_log);
+            loaders_->map_reduce(received_log_, &client::received_log);
+            client_logger.info("connected: {}\tsend: {}\t request: {}\t received: {}",
+                       connected_log_.result(), send_log_.result(), request_log_.result(),
+                       received_log_.result());
+            loaders_->invoke_on_all(&client::flush_log_stats);
+            connected_log_.reset();
+            request_log_.reset();
+            send_log_.reset();
+            received_log_.reset();
       });
+    });
+
+    // @ wuwenqing
+    engine().add_oneshot_task_at(start_tp + seconds(cmd.duration() + 5), [this] { stop(); });
+  }
+
+  /// Loader cores pick the new parameters up in place, see client::retune.
+  void retune(cluster_worker_base& c, const command& cmd) {
+    if (cmd.burst() < smp::count - 1 || cmd.epoch() == 0) {
+      app_logger.error("burst needs to be at least {} and epoch non-zero, retune ignored",
+                       smp::count - 1);
+      return;
+    }
+    loaders_->invoke_on_all(&client::retune, make_ramp(c, cmd), unsigned(cmd.epoch()),
+                            unsigned(cmd.burst() / (smp::count-1)), double(cmd.ratio()));
+  }
+
+  void stop() {
+    if (loaders_) {
+      loaders_->stop();
     }
+    engine().stop();
+  }
+
+ private:
+  static ramp make_ramp(cluster_worker_base& c, const command& cmd) {
+    auto setup = cmd.setup_time();
+    return ramp(cmd.ramp() == LINEAR ? ramp::shape::linear : ramp::shape::staircase,
+                static_cast<uint64_t>(cmd.conn()) * std::max(1u, c.workers()), seconds(setup),
+                cmd.ramp_steps() ? cmd.ramp_steps() : setup);
   }
+
+  // what the master has been told so far: deltas are taken against it,
+  // reports repeat it
+  struct sample {
+    uint64_t connected, send, request, received, retry;
+    histogram latency;
+  };
+
+  void tick(cluster_worker_base& c) {
+    if (seq_ > 0) {
+      send_sample(c);
+    }
+    if (verbose_ && seq_ % samples_per_report_ == 0) {
+      loaders_->invoke_on_all(&client::print_stats);
+    }
+    seq_++;
+
+    connected_.reset();
+    request_.reset();
+    send_.reset();
+    received_.reset();
+    retry_.reset();
+    latency_.reset();
+    loaders_->map_reduce(connected_, &client::connected_total);
+    loaders_->map_reduce(request_, &client::request_total);
+    loaders_->map_reduce(send_, &client::send_total);
+    loaders_->map_reduce(received_, &client::received_total);
+    loaders_->map_reduce(retry_, &client::retry_total);
+    loaders_->map_reduce(latency_, &client::latency);
+  }
+
+  void send_sample(cluster_worker_base& c) {
+    sample cur{connected_.result(), send_.result(), request_.result(),
+               received_.result(), retry_.result(), {}};
+
+    d_.Clear();
+    d_.set_client_id(c.id());
+    d_.set_seq(seq_);
+    d_.set_interval_us(sample_interval_ * 1000);
+    d_.set_connected(static_cast<int64_t>(cur.connected - prev_.connected));
+    d_.set_tx_packets(static_cast<int64_t>(cur.send - prev_.send));
+    d_.set_rx_packets(static_cast<int64_t>(cur.received - prev_.received));
+    d_.set_requests(static_cast<int64_t>(cur.request - prev_.request));
+    d_.set_retry(static_cast<int64_t>(cur.retry - prev_.retry));
+    // a histogram missing some cores is left for the next sample
+    if (covers(latency_, prev_.latency)) {
+      encode_histogram(d_.mutable_latency(), latency_, &prev_.latency);
+      prev_.latency = latency_;
+    }
+    cur.latency = prev_.latency;
+    prev_ = cur;
+    c.send(DELTA, d_);
+
+    if (seq_ % samples_per_report_) {
+      return;
+    }
+    r_.Clear();
+    r_.set_client_id(c.id());
+    r_.set_seq(seq_);
+    r_.set_connected(prev_.connected);
+    r_.set_tx_packets(prev_.send);
+    r_.set_rx_packets(prev_.received);
+    r_.set_requests(prev_.request);
+    r_.set_retry(prev_.retry);
+    encode_histogram(r_.mutable_latency(), prev_.latency);
+    c.send(REPORT, r_);
+
+    auto sent = prev_.send - last_report_.send;
+    auto recved = prev_.received - last_report_.received;
+    if (verbose_) {
+      fmt::print("[ALL]\t\tconnected: {} \tretry: {}\t"
+                  "send: {}\trequest: {}\treceived: {}\n",
+                 prev_.connected, prev_.retry - last_report_.retry, sent,
+                 prev_.request - last_report_.request, recved);
+    }
+    //@ wuwenqing
+    fmt::print("Total Connected: {}\tsend: {}\treceived: {}\tp99: {}us\n\n",
+      prev_.connected, sent, recved, prev_.latency.percentile(99));
+    last_report_ = prev_;
+  }
+
+  std::string dest_;
+  unsigned sample_interval_;
+  unsigned log_duration_;
+  unsigned verbose_;
+  unsigned samples_per_report_;
+  distributor<client>* loaders_{nullptr};
+
+  // totals of all loader cores, collected once per sample interval
+  adder connected_, send_, request_, received_, retry_;
+  histogram latency_;
+  adder send_log_, request_log_, received_log_, connected_log_;
+
+  sample prev_{}, last_report_{};
+  uint32_t seq_{0};
+  report r_;
+  delta d_;
 };
 
 int main(int argc, char **argv) {
@@ -243,6 +533,8 @@ int main(int argc, char **argv) {
     ("local-ip,l", bpo::value<std::string>(), "local ip address")
     ("client-id,n", bpo::value<unsigned>(), "client id")
     ("log-duration", bpo::value<unsigned>()->default_value(10), "duration betwwen logs")
+    ("sample-interval", bpo::value<unsigned>()->default_value(100),
+     "interval of stats samples sent to the master (ms)")
     ("verbose,v", bpo::value<unsigned>()->default_value(0), "show verbose message");
 
   app.run(argc, argv, [&app] {
@@ -252,144 +544,18 @@ int main(int argc, char **argv) {
     auto port = config["server-port"].as<unsigned>();
     auto id = config["client-id"].as<unsigned>();
     auto log_duration = config["log-duration"].as<unsigned>();
+    auto sample_interval = std::max(1u, std::min(1000u, config["sample-interval"].as<unsigned>()));
     auto dest = config["dest"].as<std::string>();
     auto verbose = config["verbose"].as<unsigned>();
     ipv4_addr addr(ip, port);
     ipv4_addr local(local_ip);
 
-    uint64_t conns, burst, epoch, start_ts, wait, stagger, duration, setup, length;
-		int think_time;
-    double ratio;
-    system_clock::time_point start_tp;
-
-    adder connected, send, request, received, retry;
-    adder send_log, request_log, received_log, connected_log;
-    auto loaders = new distributor<client>;
-
-    auto conn = engine().connect(make_ipv4_address(addr), make_ipv4_address(local));
+    auto load = new mcc_load(dest, sample_interval, log_duration, verbose);
+    auto worker = new cluster_worker<mcc_load>(cluster_config{}, *load, id,
+        make_ipv4_address(addr), make_ipv4_address(local));
 	  app_logger.info("Worker Connecting.\n\n");
-    conn->when_ready([&](const connptr& con) {
-      app_logger.info("server connected");
-      report r;
-      r.set_client_id(id);
-      report::notice* n = r.mutable_note();
-      n->set_online(true);
-      std::string packet;
-      r.SerializeToString(&packet);
-      conn->send_packet(packet);
-    });
-
-    conn->when_recved([&](const connptr& con) mutable {
-      command cmd;
-      std::string s = conn->get_input().string();
-      conn->get_input().consume(s.size());
-      if (!cmd.ParseFromString(s)) {
-        app_logger.error("failed to parse message");
-      }
-
-      conns = cmd.conn();
-      burst = cmd.burst();
-      epoch = cmd.epoch();
-      setup = cmd.setup_time();
-      wait = cmd.wait_time();
-	  stagger = cmd.stagger_time();
-      duration = cmd.duration();
-      ratio = cmd.ratio();
-	  length = cmd.length();
-	  think_time = cmd.think_time();
-      start_ts = cmd.start_ts();
-
-      start_tp += milliseconds(start_ts);
-
-      if (verbose) {
-        fmt::print(
-            "configuration: \n\tconnections: {}\n\tepoch: {}s\n\t"
-            "burst: {}\n" "\tthreads: {}\n\t",
-            conns, static_cast<float>(epoch)/1000, burst, smp::count-1);
-      }
-
-	//add by songhui
-	stagger = id * stagger;	
-	system_clock::time_point start_point;
-    start_point += milliseconds(start_ts);
-	start_point += seconds(setup);
-	start_point += seconds(wait);
-    engine().add_oneshot_task_at(start_tp, [&]() mutable {
-      loaders->start(conns / (smp::count-1), epoch, burst / (smp::count-1),
-          setup, wait, stagger, duration, ratio, length, think_time, start_point);
-      loaders->invoke_on_all(&client::start, ipv4_addr(dest, 80));
-
-      engine().add_periodic_task_at<infinite> (
-          system_clock::now(), 1s, [&]() mutable {
-            loaders->map_reduce(connected, &client::connected_sec);
-            loaders->map_reduce(request, &client::request_sec);
-            loaders->map_reduce(send, &client::send_sec);
-            loaders->map_reduce(received, &client::received_sec);
-            loaders->map_reduce(retry, &client::retry_sec);
-            if (verbose) {
-              loaders->invoke_on_all(&client::print_stats);
-            }
-
-            engine().add_oneshot_task_after(100ms, [&] () mutable {
-              if (verbose) {
-                fmt::print("[ALL]\t\tconnected: {} \tretry: {}\t"
-                            "send: {}\trequest: {}\treceived: {}\n",
-                           connected.result(), retry.result(), send.result(),
-                           request.result(), received.result());
-              }
-              report r;
-              r.set_client_id(id);
-              r.set_connected(connected.result());
-              r.set_tx_packets(send.result());
-              r.set_rx_packets(received.result());
-              std::string packet;
-              r.SerializeToString(&packet);
-
-							//@ wuwenqing
-							fmt::print("Total Connected: {}\tsend: {}\treceived: {}\n", 
-								connected.result(), send.result(), received.result());
-              if (conn->get_state() == tcp_connection::state::connected) {
-                conn->send_packet(packet);
-              } else {
-                engine().stop();
-              }
-
-              connected.reset();
-              request.reset();
-              send.reset();
-              received.reset();
-              retry.reset();
-              fmt::print("\n");
-
-            });
-      });
-
-      engine().add_periodic_task_at<infinite>(
-        system_clock::now(), seconds(log_duration), [&]() mutable {
-          loaders->map_reduce(connected_log, &client::connected_log);
-          loaders->map_reduce(request_log, &client::request_log);
-          loaders->map_reduce(send_log, &client::send_log);
-          loaders->map_reduce(received_log, &client::received_log);
-          client_logger.info("connected: {}\tsend: {}\t request: {}\t received: {}",
-                     connected_log.result(), send_log.result(), request_log.result(),
-                     received_log.result());
-          loaders->invoke_on_all(&client::flush_log_stats);
-          connected_log.reset();
-          request_log.reset();
-          send_log.reset();
-          received_log.reset();
-      });
-			// @ wuwenqing
-   		engine().add_oneshot_task_after(seconds(duration + 5), [&] {
-      	loaders->stop();
-    	});
-
-    }); // engine().add_oneshot_task_at
-
-    }); //when_recved()
+    worker->connect();
 
     engine().run();
   });
 }
-
-
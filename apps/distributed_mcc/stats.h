@@ -0,0 +1,45 @@
+#pragma once
+
+#include "histogram.h"
+#include "proto/mcc.pb.h"
+
+#include <algorithm>
+
+namespace infgen {
+
+/// Put the buckets of h into m. With a base, only what was added to h since
+/// base was taken is stored, which is what a delta carries.
+inline void encode_histogram(latency_hist* m, const histogram& h,
+                             const histogram* base = nullptr) {
+  for (unsigned i = 0; i < histogram::nr_buckets; i++) {
+    uint64_t n = h.bucket(i) - (base ? base->bucket(i) : 0);
+    if (n) {
+      m->add_index(i);
+      m->add_count(n);
+    }
+  }
+  m->set_sum_us(h.sum() - (base ? base->sum() : 0));
+  m->set_max_us(h.max());
+}
+
+/// Add the samples carried by m to h.
+inline void decode_histogram(const latency_hist& m, histogram& h) {
+  int n = std::min(m.index_size(), m.count_size());
+  for (int i = 0; i < n; i++) {
+    h.add(m.index(i), m.count(i));
+  }
+  h.add_sum(m.sum_us(), m.max_us());
+}
+
+/// True if every bucket of h holds at least as many samples as in base,
+/// i.e. h was collected from all cores after base was.
+inline bool covers(const histogram& h, const histogram& base) {
+  for (unsigned i = 0; i < histogram::nr_buckets; i++) {
+    if (h.bucket(i) < base.bucket(i)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+}  // namespace infgen
@@ -1,4 +1,5 @@
 #include "application.h"
+#include "cluster.h"
 #include "connection.h"
 #include "log.h"
 #include "reactor.h"
@@ -232,7 +233,7 @@ public:
 
 			conn->when_disconnect([this] (const connptr& conn) {
 				stats.nr_connected--;
-				conn->reconnect();
+				engine().reconnects().disconnected(conn);
 			});
 		}
   }
@@ -296,12 +297,127 @@ public:
   }
 };
 
+/// The WAN workload of a worker: runs the clients once the fleet starts and
+/// sends the master a single report when they are done (see cluster.h).
+class wan_load {
+ public:
+  using params = command;
+
+  wan_load(std::string dest, unsigned verbose) : dest_(std::move(dest)), verbose_(verbose) {}
+
+  void start(cluster_worker_base& c, const command& cmd) {
+		conns_ = cmd.conn();
+		duration_ = cmd.duration();
+		len_mode_ = cmd.length_mode();
+		length_ = cmd.length();
+		idt_mode_ = cmd.idt_mode();
+		lambda_ = cmd.lambda();
+		nr_interact_ = cmd.interact_times();
+		think_time_ = cmd.think_time();
+
+    fmt::print(
+        "configuration: \n\tconnections: {}\n\tduration: {}\n\tthreads:{}\n",
+				conns_, duration_, smp::count-1);
+		if (conns_ % (smp::count-1) != 0) {
+  	  fmt::print("Error, Concurrency needs to be equal to an integral multiple of number of CPUs. \n");
+    	exit(-1);
+    }
+
+		if ((len_mode_ == 1 && length_ < 8) || (len_mode_ == 2 && lambda_ < 8)) {
+			fmt::print("\033[31mWarning, Length of payload should be larger than 8.\033[0m\n");
+			exit(-1);
+		}
+
+    engine().add_oneshot_task_at(c.start_time(), [this, &c] {
+			clients_->start(conns_, duration_, nr_interact_, len_mode_, idt_mode_, length_, lambda_, think_time_);
+
+      started_ = system_clock::now();
+      fmt::print("Concurrency set: {}\n", conns_);
+
+      clients_->invoke_on_all(&http_client::running, ipv4_addr(dest_, 80));
+      clients_->invoke_on_all(&http_client::end_test);
+
+			if (verbose_) {
+				engine().add_periodic_task_at<infinite>(system_clock::now(), 1s, [this] { print_stats(); });
+			}
+
+      finished_ = started_;
+
+      clients_->when_done([this, &c] {
+        app_logger.info("load test finished, running statistics collection process...");
+				finished_ = system_clock::now();
+        clients_->map_reduce(reqs_, &http_client::total_reqs);
+
+        engine().add_oneshot_task_after(1s, [this, &c] { finish(c); });
+      });
+    });
+  }
+
+  void retune(cluster_worker_base& c, const command& cmd) {
+    app_logger.warn("re-tuning is not supported by this worker, keeping the current load");
+  }
+
+  void stop() {
+    engine().stop();
+  }
+
+ private:
+  void print_stats() {
+		clients_->map_reduce(connected_, &http_client::connected_sec);
+		clients_->map_reduce(sent_, &http_client::sent_sec);
+		clients_->map_reduce(received_, &http_client::received_sec);
+		clients_->map_reduce(request_, &http_client::request_sec);
+		clients_->map_reduce(response_, &http_client::response_sec);
+		clients_->invoke_on_all(&http_client::print_stats);
+					clients_->invoke_on_all(&http_client::aggregate_stat);
+
+		engine().add_oneshot_task_after(150ms, [this] {
+			fmt::print("[ALL]\t\tconnected: {}\tsend: {}\treceive: {}\trequest: {}\tresponse: {}\n",
+				connected_.result(), sent_.result(), received_.result(), request_.result(), response_.result());
+			connected_.reset();
+			sent_.reset();
+			received_.reset();
+			request_.reset();
+			response_.reset();
+			fmt::print("\n");
+		});
+  }
+
+  void finish(cluster_worker_base& c) {
+    auto total_reqs = reqs_.result();
+    auto elapsed = duration_cast<seconds>(finished_ - started_);
+    auto secs = elapsed.count();
+		fmt::print("\n== WAN Loader ==================================\n");
+    fmt::print("Total CPUs: {}\n", smp::count-1);
+		fmt::print("{} requests in {}s\n", total_reqs, secs);
+		fmt::print("Request/sec:  {}\n", static_cast<double>(total_reqs) / secs);
+    fmt::print("================================================\n\n");
+
+    report r;
+    r.set_client_id(c.id());
+    r.set_completes(total_reqs);
+    c.send(WAN_REPORT, r); // Report final statistics
+
+    engine().add_oneshot_task_after(1s, [this] { stop(); });
+  }
+
+  std::string dest_;
+  unsigned verbose_;
+	uint32_t conns_{0}, duration_{0};
+	int think_time_{0};
+	uint32_t len_mode_{0}, length_{0}, idt_mode_{0}, lambda_{0}, nr_interact_{0};
+  system_clock::time_point started_, finished_;
+  adder reqs_;
+  adder connected_, sent_, received_, request_, response_;
+  distributor<http_client>* clients_{new distributor<http_client>};
+};
+
 int main(int argc, char **argv) {
   application app;
   app.add_options()
 		("verbose,v", bpo::value<unsigned>()->default_value(0), "Show verbose message")
     ("server-ip,s", bpo::value<std::string>(), "server ip address")
-    ("server-port,p", bpo::value<unsigned>()->default_value(2222), "server port")    
+    ("server-port,p", bpo::value<unsigned>()->default_value(2222), "server port")
 		("local-ip,l", bpo::value<std::string>(), "local ip address")
     ("client-id,n", bpo::value<unsigned>(), "client id");
 
@@ -317,138 +433,11 @@ int main(int argc, char **argv) {
     ipv4_addr server_addr(ip, port);
     ipv4_addr local_addr(local_ip);
 
-		uint32_t conns, duration;
-		int think_time;
-		uint32_t len_mode, length, idt_mode, lambda, nr_interact;
-		uint64_t start_ts;
-		system_clock::time_point start_tp;
-		
-    system_clock::time_point started, finished;
-    adder reqs;
-
-    auto clients = new distributor<http_client>;
-    
-    auto conn = engine().connect(make_ipv4_address(server_addr), make_ipv4_address(local_addr));    
-		
-		conn->when_ready([&](const connptr& con) {
-      app_logger.info("Connected to server!");
-      report r;
-      r.set_client_id(id);
-      report::notice *n = r.mutable_note();
-      n->set_online(true);
-      std::string packet;
-      r.SerializeToString(&packet);
-      conn->send_packet(packet); // Report status
-    }); 
-
-    conn->on_message([&](const connptr& conn, std::string msg) mutable {
-      command cmd;
-      conn->get_input().consume(msg.size());
-      if (!cmd.ParseFromString(msg)) {
-        app_logger.error("Failed to parse message!");
-      }
-
-      conns = cmd.conn();
-      duration = cmd.duration();
-      start_ts = cmd.start_ts();
-			len_mode = cmd.length_mode();
-			length = cmd.length();
-			idt_mode = cmd.idt_mode();
-			lambda = cmd.lambda();
-			nr_interact = cmd.interact_times();
-			think_time = cmd.think_time();
-
-      start_tp = start_tp + milliseconds(start_ts);
-
-      fmt::print(
-          "configuration: \n\tconnections: {}\n\tduration: {}\n\tthreads:{}\n",          
-					conns, duration, smp::count-1);
-      if (conns % (smp::count-1) != 0) {
-        fmt::print("error: conn needs to be n * cpu_nr \n");
-        exit(-1);
-      }
-
-			if (conns % (smp::count-1) != 0) {
-  	    fmt::print("Error, Concurrency needs to be equal to an integral multiple of number of CPUs. \n");
-    	  exit(-1);
-    	}
-
-			if ((len_mode == 1 && length < 8) || (len_mode == 2 && lambda < 8)) {
-				fmt::print("\033[31mWarning, Length of payload should be larger than 8.\033[0m\n");
-				exit(-1);
-			}
-
-      engine().add_oneshot_task_at(start_tp, [&, conn]() mutable {
-				clients->start(conns, duration, nr_interact, len_mode, idt_mode, length, lambda, think_time);
-
-        started = system_clock::now();
-        fmt::print("Concurrency set: {}\n", conns);
-
-        clients->invoke_on_all(&http_client::running, ipv4_addr(dest, 80));
-        clients->invoke_on_all(&http_client::end_test);
-				
-				if (verbose) {
-					adder connected, sent, received, request, response;
-					engine().add_periodic_task_at<infinite>(
-							system_clock::now(), 1s, [&, clients]() mutable {
-								clients->invoke_on_all(&http_client::aggregate_stat);
-								clients->map_reduce(connected, &http_client::connected_sec);
-								clients->map_reduce(sent, &http_client::sent_sec);
-								clients->map_reduce(received, &http_client::received_sec);
-								clients->map_reduce(request, &http_client::request_sec);
-								clients->map_reduce(response, &http_client::response_sec);
-								clients->invoke_on_all(&http_client::print_stats);
-							
-								engine().add_oneshot_task_after(150ms, [&] () mutable {
-								fmt::print("[ALL]\t\tconnected: {}\tsend: {}\treceive: {}\trequest: {}\tresponse: {}\n",
-									connected.result(), sent.result(), received.result(), request.result(), response.result());
-								connected.reset();
-								sent.reset();
-								received.reset();
-								request.reset();
-								response.reset();
-								fmt::print("\n");
-							});
-					});	
-				}
-
-        finished = started;
-
-        clients->when_done([&, clients, conn]() mutable {
-          app_logger.info("load test finished, running statistics collection process...");          
-					finished = system_clock::now();
-          clients->map_reduce(reqs, &http_client::total_reqs);
-
-          engine().add_oneshot_task_after(1s, [&, clients, conn] {
-            auto total_reqs = reqs.result();
-            auto elapsed = duration_cast<seconds>(finished - started);
-            auto secs = elapsed.count();
-						fmt::print("\n== WAN Loader ==================================\n");
-            fmt::print("Total CPUs: {}\n", smp::count-1);
-						fmt::print("{} requests in {}s\n", total_reqs, secs);          
-						fmt::print("Request/sec:  {}\n", static_cast<double>(total_reqs) / secs);
-            fmt::print("================================================\n\n");
-
-            report r;
-            r.set_client_id(id);
-            r.set_completes(total_reqs);
-            std::string packet;
-            r.SerializeToString(&packet);
-            conn->send_packet(packet); // Report final statistics
-
-            engine().add_oneshot_task_after(1s, [&, clients, conn] {
-//              clients->stop();
-              engine().stop();
-            });
-          });
-        });
-      });
-
-    });
+    auto load = new wan_load(dest, verbose);
+    auto worker = new cluster_worker<wan_load>(cluster_config{}, *load, id,
+        make_ipv4_address(server_addr), make_ipv4_address(local_addr));
+    worker->connect();
     engine().run();
-
-
-    delete clients;
   });
 	return 0;
 }
@@ -118,7 +118,7 @@ public:
           });
 
           conn->when_disconnect([] (const connptr& conn) {
-            conn->reconnect();
+            engine().reconnects().disconnected(conn);
           });
 
           conn->when_ready([http_conn] (const connptr& conn){
@@ -0,0 +1,67 @@
+// Echo or discard server on every reactor, a local target for the
+// generators:
+//
+//   echo_server --network-stack kernel -c 4 --port 10000
+//   echo_server --network-stack kernel -c 4 --port 10000 --sink --steer
+//
+// Each reactor listens on the port with a SO_REUSEPORT socket of its own
+// and serves the connections it accepts, see sharded_tcp_server.
+#include "application.h"
+#include "connection.h"
+#include "log.h"
+#include "reactor.h"
+#include "smp.h"
+#include "tcp_server.h"
+
+using namespace infgen;
+namespace bpo = boost::program_options;
+
+struct shard_stats {
+  uint64_t conns{0};
+  uint64_t bytes{0};
+};
+
+int main(int argc, char **argv) {
+  application app;
+  app.add_options()
+    ("addr", bpo::value<std::string>()->default_value("0.0.0.0"), "address to listen on")
+    ("port", bpo::value<uint16_t>()->default_value(10000), "port to listen on")
+    ("sink", bpo::bool_switch()->default_value(false), "discard what arrives instead of echoing it")
+    ("steer", bpo::bool_switch()->default_value(false),
+     "hand a connection to the reactor on the cpu that received its SYN");
+  app.run(argc, argv, [&app] {
+    auto &config = app.configuration();
+    auto addr = ipv4_addr(config["addr"].as<std::string>(), config["port"].as<uint16_t>());
+    bool sink = config["sink"].as<bool>();
+    bool steer = config["steer"].as<bool>();
+
+    auto server = sharded_tcp_server::listen(make_ipv4_address(addr), [sink](tcp_server &svr) {
+      auto stats = std::make_shared<shard_stats>();
+      svr.when_ready([stats](const connptr &) { stats->conns++; });
+      svr.when_recved([sink, stats](const connptr &c) {
+        auto &in = c->get_input();
+        stats->bytes += in.size();
+        if (!sink) {
+          c->send_packet(in);
+        }
+        in.consume(in.size());
+      });
+      svr.when_disconnect([stats](const connptr &) { stats->conns--; });
+      engine().add_periodic_task_after<infinite>(1s, [stats] {
+        if (stats->bytes) {
+          app_logger.info("reactor {}: {} connections, {:.2f} MB/s in", engine().cpu_id(),
+                          stats->conns, stats->bytes / 1e6);
+          stats->bytes = 0;
+        }
+      });
+    }, steer, [addr, sink] {
+      app_logger.info("{} server on {} from {} reactors", sink ? "sink" : "echo", addr, smp::count);
+    });
+    if (!server) {
+      app_logger.error("cannot listen on {}", addr);
+    }
+
+    engine().run();
+  });
+  return 0;
+}
@@ -5,7 +5,9 @@
 #include "smp.h"
 #include "distributor.h"
 #include "http/http_parser.h"
+#include "http/response_parser.h"
 
+#include <array>
 #include <chrono>
 #include <memory>
 #include <vector>
@@ -14,7 +16,8 @@ using namespace infgen;
 namespace bpo = boost::program_options;
 
 std::string request;
-unsigned req_length;
+// requests in flight per connection
+unsigned pipeline_depth = 1;
 
 
 class http_client {
@@ -23,6 +26,7 @@ private:
   unsigned conn_per_core_;
   uint64_t conn_finished_{0};
 	int think_time_;
+  unsigned think_sink_{0};
 
   ipv4_addr server_addr_;
   distributor<http_client>* container_;
@@ -49,34 +53,91 @@ private:
   }
 
   struct http_connection {
+    static constexpr unsigned max_depth = 64;
+
     http_connection(connptr c): flow(c) {}
     connptr flow;
     uint64_t nr_done {0};
-    system_clock::time_point send_ts;
     system_clock::time_point recv_ts;
     uint64_t acc_delay {0};
 
-    unsigned header_len;
-    unsigned file_len;
-    bool header_set;
+    http::response_parser parser;
+
+    // send timestamps of the requests in flight, oldest first; responses
+    // come back in request order, so each one pops its own timestamp
+    std::array<system_clock::time_point, max_depth> send_ts;
+    uint64_t ts_head {0};
+    uint64_t ts_tail {0};
+    // bytes [unsent_off, unsent_end) of batch_ still wait for the socket
+    size_t unsent_off {0};
+    size_t unsent_end {0};
 
-    bool request_sent;
 		std::string request_;
+    // request_ repeated pipeline_depth times, so any number of requests
+    // goes out as one write
+    std::string batch_;
+
+    unsigned in_flight() const { return ts_tail - ts_head; }
+
+    void set_request(const std::string& req) {
+      request_ = req;
+      batch_.clear();
+      for (unsigned i = 0; i < pipeline_depth; i++) {
+        batch_ += req;
+      }
+    }
+
     void do_req() {
-      //flow->send_packet("GET / HTTP/1.1\r\n"
-      //    "HOST: 192.168.2.2\r\n\r\n");
-      flow->send_packet(/*request*/request_);
-			request_sent = true;
-      send_ts = system_clock::now();
+      if (unsent_off < unsent_end) {
+        // the rest of the last batch goes first, see send_unsent()
+        return;
+      }
+      unsigned n = pipeline_depth - in_flight();
+      if (n == 0) {
+        return;
+      }
+      unsent_off = 0;
+      unsent_end = n * request_.size();
+      send_unsent();
+    }
+
+    // writes what the socket takes of the batch; a request is timed once
+    // its last byte is written, the rest follows when it is writable
+    void send_unsent() {
+      size_t done = unsent_off / request_.size();
+      unsent_off += flow->write_some(batch_.data() + unsent_off, unsent_end - unsent_off);
+      auto now = system_clock::now();
+      for (size_t i = done; i < unsent_off / request_.size(); i++) {
+        send_ts[ts_tail++ % max_depth] = now;
+      }
+    }
+
+    void on_writable() {
+      if (unsent_off < unsent_end) {
+        send_unsent();
+      }
+      // responses that came while the batch was cut short refill it now
+      do_req();
     }
 
     void complete_request() {
+      if (in_flight() == 0) {
+        app_logger.warn("unsolicited response on connection {}", flow->get_id());
+        return;
+      }
       nr_done++;
       recv_ts = system_clock::now();
-      auto delay = duration_cast<microseconds>(recv_ts - send_ts).count();
+      auto delay = duration_cast<microseconds>(recv_ts - send_ts[ts_head++ % max_depth]).count();
       acc_delay += delay;
     }
 
+    // requests in flight are lost with the connection
+    void reset_pipeline() {
+      ts_head = ts_tail = 0;
+      unsent_off = unsent_end = 0;
+      parser.reset();
+    }
+
     void finish() {
       flow->when_closed([this] {
         app_logger.trace("Test complete, connection {} closed", flow->get_id());
@@ -86,6 +147,8 @@ private:
   };
 
 public:
+  static constexpr unsigned max_pipeline_depth() { return http_connection::max_depth; }
+
   http_client(unsigned duration, unsigned concurrency, int think_time)
       : duration_(duration), conn_per_core_(concurrency / (smp::count-1)),
 				think_time_(think_time){
@@ -112,52 +175,62 @@ public:
     for (unsigned i = 0; i < conn_per_core_; i++) {
       auto conn = engine().connect(make_ipv4_address(server_addr));
       auto http_conn = std::make_shared<http_connection>(conn);
-			http_conn->request_ = std::string(req_length, '0');
-			http_conn->request_[5] = 0x01;
-			http_conn->request_[6] = 0x02;
-			http_conn->request_[7] = 0x01;
+			http_conn->set_request(request);
       
 			conns_.push_back(http_conn);
 
-      conn->when_recved([this, http_conn] (const connptr& conn) {
-        if (!http_conn->header_set) {
-        // parse header
-          std::string resp_str = conn->get_input().string();
-          //conn->get_input().consume(resp_str.size());
-          //fmt::print("response: {}\n", resp_str);
-          http_conn->header_set = true;
-        } else {
-          std::string content = conn->get_input().string();
-          //conn->get_input().consume(content.size());
-          //fmt::print("content: {}\n", content);
+      conn->on_data([http_conn, this] (const connptr& conn, recv_view& input) {
+        // a read may hold several responses, or only part of one
+        while (true) {
+          auto res = http_conn->parser.parse(input);
+          if (res == http::response_parser::result::incomplete) {
+            break;
+          }
+          if (res == http::response_parser::result::error) {
+            app_logger.error("malformed HTTP response on connection {}", conn->get_id());
+            conn->close();
+            return;
+          }
+
+          int code = http_conn->parser.status_code();
+          http_conn->parser.reset();
+          if (code >= 100 && code < 200) {
+            // interim response, the real one follows
+            continue;
+          }
+
+          // processing time (ns), kept observable so it is not optimized out
+          think_sink_ += Fibonacci_service(think_time_);
+
+          http_conn->complete_request();
         }
-      });
-
-      conn->on_message([http_conn, this](const connptr& conn, std::string& msg) {
-        conn->get_input().consume(msg.size());
-
-				// processing time (ns)
-				unsigned val = Fibonacci_service(think_time_);
-        if (msg.size()) {
-          msg[0] = static_cast<int>(val % 127);
-        }
-
-        http_conn->complete_request();
+        // refill the pipeline once for all responses of this read
         if (conn->get_state() == tcp_connection::state::connected) {
           http_conn->do_req();
         }
-          //conn->close();
       });
 
       conn->when_closed([conn] {
         conn->reconnect();
       });
 
-      conn->when_disconnect([this] (const connptr& conn) {
-        conn->reconnect();
+      conn->when_disconnect([http_conn, this] (const connptr& conn) {
+        // a response without a length ends with the connection
+        if (http_conn->in_flight() && http_conn->parser.finish_on_close()) {
+          http_conn->complete_request();
+        }
+        http_conn->reset_pipeline();
+        engine().reconnects().disconnected(conn);
+      });
+
+      conn->when_writable([http_conn] (const connptr& conn) {
+        http_conn->on_writable();
       });
 
       conn->when_ready([http_conn, this] (const connptr& conn){
+        auto& input = conn->get_input();
+        input.consume(input.size());
+        http_conn->reset_pipeline();
         http_conn->do_req();
       });
     }
@@ -195,7 +268,8 @@ public:
 int main(int argc, char **argv) {
   application app;
   app.add_options()
-		("length,l", bpo::value<unsigned>()->default_value(16), "length of message (> 8)")
+		("path,p", bpo::value<std::string>()->default_value("/"), "request path")
+		("depth,D", bpo::value<unsigned>()->default_value(1), "pipelined requests per connection")
     ("conn,c", bpo::value<unsigned>()->default_value(100), "total connections")
 		("think-time,t", bpo::value<int>()->default_value(0), "think time between requests (ns)")
     ("duration,d", bpo::value<unsigned>()->default_value(0), "duration of test in seconds");
@@ -205,18 +279,20 @@ int main(int argc, char **argv) {
     auto total_conn = config["conn"].as<unsigned>();
     auto duration = config["duration"].as<unsigned>();
 		auto think_time = config["think-time"].as<int>();
-		auto length = config["length"].as<unsigned>();
+		auto path = config["path"].as<std::string>();
+		auto depth = config["depth"].as<unsigned>();
 
     if (total_conn % (smp::count-1) != 0) {
       fmt::print("Error: conn needs to be n * cpu_nr \n");
       exit(-1);
     }
-	/* Payload with fixed length */
-		req_length = length;
-		request = std::string(length,'0'); //16, '0'
-    request[5] = 0x01;
-    request[6] = 0x02;
-    request[7] = 0x01;
+    if (depth == 0 || depth > http_client::max_pipeline_depth()) {
+      fmt::print("Error: depth needs to be within [1, {}]\n",
+          http_client::max_pipeline_depth());
+      exit(-1);
+    }
+		pipeline_depth = depth;
+		request = fmt::format("GET {} HTTP/1.1\r\nHost: {}\r\n\r\n", path, server);
 
     auto clients = new distributor<http_client>;
     clients->start(duration, total_conn, think_time);
@@ -0,0 +1,172 @@
+// Ping-pong over loopback against an in-process echo server, to compare
+// the kernel stack backends:
+//
+//   loopback_bench --network-stack kernel --device lo -c 1000 -d 10
+//   loopback_bench --network-stack uring --device lo -c 1000 -d 10
+//
+// The echo server runs on a thread of its own outside the engines; pin it
+// away from them with --server-cpu.
+#include "application.h"
+#include "connection.h"
+#include "distributor.h"
+#include "log.h"
+#include "reactor.h"
+#include "smp.h"
+
+#include <netinet/in.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+
+#include <memory>
+#include <thread>
+#include <vector>
+
+using namespace infgen;
+namespace bpo = boost::program_options;
+
+static void echo_server(uint16_t port, int cpu) {
+  if (cpu >= 0) {
+    pin_this_thread(cpu);
+  }
+  int lfd = ::socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+  int one = 1;
+  ::setsockopt(lfd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+  sockaddr_in sa{};
+  sa.sin_family = AF_INET;
+  sa.sin_port = htons(port);
+  sa.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  if (::bind(lfd, (sockaddr *)&sa, sizeof(sa)) != 0 || ::listen(lfd, 4096) != 0) {
+    app_logger.error("echo server cannot listen on port {}: {}", port, strerror(errno));
+  }
+  int ep = ::epoll_create1(0);
+  epoll_event ev{};
+  ev.events = EPOLLIN;
+  ev.data.fd = lfd;
+  ::epoll_ctl(ep, EPOLL_CTL_ADD, lfd, &ev);
+
+  std::vector<epoll_event> events(1024);
+  std::vector<char> buf(65536);
+  for (;;) {
+    int n = ::epoll_wait(ep, events.data(), events.size(), -1);
+    for (int i = 0; i < n; i++) {
+      int fd = events[i].data.fd;
+      if (fd == lfd) {
+        int cfd;
+        while ((cfd = ::accept4(lfd, nullptr, nullptr, SOCK_NONBLOCK)) >= 0) {
+          ev.data.fd = cfd;
+          ::epoll_ctl(ep, EPOLL_CTL_ADD, cfd, &ev);
+        }
+        continue;
+      }
+      auto r = ::read(fd, buf.data(), buf.size());
+      if (r <= 0) {
+        ::close(fd);
+      } else if (::write(fd, buf.data(), r) != r) {
+        ::close(fd);
+      }
+    }
+  }
+}
+
+class echo_loader {
+private:
+  unsigned conns_;
+  unsigned duration_;
+  std::string msg_;
+  std::vector<connptr> flows_;
+  uint64_t done_{0};
+  uint64_t cpu_us_{0};
+  distributor<echo_loader> *container_;
+
+  static uint64_t thread_cpu_us() {
+    rusage ru;
+    ::getrusage(RUSAGE_THREAD, &ru);
+    return (ru.ru_utime.tv_sec + ru.ru_stime.tv_sec) * 1000000ULL +
+           ru.ru_utime.tv_usec + ru.ru_stime.tv_usec;
+  }
+
+public:
+  echo_loader(unsigned conns, unsigned duration, unsigned size)
+      : conns_(conns), duration_(duration), msg_(size, 'x') {}
+
+  void set_container(distributor<echo_loader> *container) { container_ = container; }
+
+  void start(ipv4_addr server) {
+    auto size = msg_.size();
+    auto started = thread_cpu_us();
+    for (unsigned i = 0; i < conns_; i++) {
+      auto conn = engine().connect(make_ipv4_address(server));
+      conn->on_data([this, size](const connptr &c, recv_view &data) {
+        while (data.size() >= size) {
+          data.consume(size);
+          done_++;
+          c->send_packet(msg_);
+        }
+      });
+      conn->when_ready([this](const connptr &c) { c->send_packet(msg_); });
+      conn->when_disconnect([](const connptr &c) { engine().reconnects().disconnected(c); });
+      flows_.push_back(conn);
+    }
+    engine().add_oneshot_task_after(seconds(duration_), [this, started] {
+      cpu_us_ = thread_cpu_us() - started;
+      for (auto &c : flows_) {
+        if (c->get_state() == tcp_connection::state::connected) {
+          c->close();
+        }
+      }
+      container_->end_game(this);
+    });
+  }
+
+  uint64_t messages() { return done_; }
+  uint64_t cpu_us() { return cpu_us_; }
+  void stop() {}
+};
+
+int main(int argc, char **argv) {
+  application app;
+  app.add_options()
+    ("conn,c", bpo::value<unsigned>()->default_value(1000), "total connections")
+    ("duration,d", bpo::value<unsigned>()->default_value(10), "duration of test in seconds")
+    ("msg-size,s", bpo::value<unsigned>()->default_value(64), "bytes per message")
+    ("port", bpo::value<uint16_t>()->default_value(10000), "port of the echo server")
+    ("server-cpu", bpo::value<int>()->default_value(-1), "cpu of the echo server thread");
+  app.run(argc, argv, [&app] {
+    auto &config = app.configuration();
+    auto conns = config["conn"].as<unsigned>();
+    auto duration = config["duration"].as<unsigned>();
+    auto size = config["msg-size"].as<unsigned>();
+    auto port = config["port"].as<uint16_t>();
+    auto stack = config["network-stack"].as<std::string>();
+    unsigned loaders = smp::count > 1 ? smp::count - 1 : 1;
+
+    std::thread(echo_server, port, config["server-cpu"].as<int>()).detach();
+
+    auto clients = new distributor<echo_loader>;
+    clients->start(conns / loaders, duration, size);
+    fmt::print("{} connections over {} stack, {} bytes per message, {}s\n",
+               conns, stack, size, duration);
+    clients->invoke_on_all(&echo_loader::start, ipv4_addr("127.0.0.1", port));
+
+    adder msgs, cpu;
+    clients->when_done([clients, &msgs, &cpu] {
+      clients->map_reduce(msgs, &echo_loader::messages);
+      clients->map_reduce(cpu, &echo_loader::cpu_us);
+      engine().add_oneshot_task_after(1s, [clients] {
+        clients->stop();
+        engine().stop();
+      });
+    });
+
+    engine().run();
+
+    auto total = msgs.result();
+    fmt::print("=============== {} =========================\n", stack);
+    fmt::print("messages/sec:        {}\n", double(total) / duration);
+    fmt::print("engine cpu/message:  {:.2f} us\n", total ? double(cpu.result()) / total : 0.0);
+    fmt::print("=============== done ============================\n");
+    delete clients;
+  });
+  return 0;
+}
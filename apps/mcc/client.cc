@@ -2,6 +2,8 @@
 #include "connection.h"
 #include "reactor.h"
 #include "log.h"
+#include "control.h"
+#include "epoch_schedule.h"
 
 #include "smp.h"
 #include "distributor.h"
@@ -10,6 +12,7 @@
 #include <random>
 
 #include <time.h>
+#include <cinttypes>
 
 #define MAXRAND 100
 #define NUM_RTT 5000
@@ -31,9 +34,17 @@ private:
   unsigned wait_time_;
   unsigned duration_;
 	int think_time_; /// ns
+  // keeps the simulated think time from being optimized out
+  unsigned think_sink_{0};
 
+  // every flow opened, connected or not; the load is planned over all of
+  // them so a flow keeps its slot in the epoch across reconnects
   std::vector<connptr> conns_;
   std::vector<int> ref_;
+  ipv4_addr server_addr_;
+  epoch_schedule load_;
+  bool loading_{false};
+  system_clock::time_point load_tp_;
 
   //@ wuwenqing for fixed length of payload
 	unsigned req_length_;
@@ -42,6 +53,9 @@ private:
   std::string request_;
 	const char* req_ptr_;
 	const char* hrt_ptr_;
+  // everything behind the request counter is sent by reference on mTCP
+  static constexpr unsigned counter_len = 4;
+  int heartbeat_id_, request_id_;
 
   distributor<client>* container_;
 public :
@@ -62,8 +76,33 @@ private:
     stats.received = 0;
   }
 
+  // The counter goes out as a copy, the rest of the message by reference.
+  // A message that went out only in part leaves the stream misframed, the
+  // flow is closed and opened again.
+  bool send_message(unsigned j, const std::string& msg, int id) {
+    auto& conn = conns_[j];
+    size_t head = std::min<size_t>(msg.size(), counter_len);
+    size_t n = conn->write_some(msg.data(), head);
+    if (n == 0) {
+      // nothing of it is in the stream
+      return false;
+    }
+    if (n == head && (msg.size() == head ||
+                      conn->send_payload(id, head, msg.size() - head))) {
+      return true;
+    }
+    if (conn->get_state() == tcp_connection::state::connected) {
+      app_logger.warn("message cut short on connection {}, reconnecting", conn->get_id());
+      conn->close();
+      conn->reconnect();
+    }
+    return false;
+  }
+
   void send_request(unsigned j) {
-    conns_[j]->send_packet(/*request_data*/ request_);
+    if (!send_message(j, request_, request_id_)) {
+      return;
+    }
     stats_sec.request++;
     stats_sec.send++;
     stats_log.request++;
@@ -75,7 +114,9 @@ private:
   }
 
   void send_heartbeat(unsigned j) {
-    conns_[j]->send_packet(/*heartbeat_data*/ heartbeat_ );
+    if (!send_message(j, heartbeat_, heartbeat_id_)) {
+      return;
+    }
     stats_sec.send++;
     stats_log.send++;
 		
@@ -140,6 +181,8 @@ public:
   }
 
   void start(ipv4_addr server_addr) {
+    request_id_ = engine().register_payload(request_.data(), request_.size());
+    heartbeat_id_ = engine().register_payload(heartbeat_.data(), heartbeat_.size());
 
 	if (prio_grain_ == 1) {
 		// Grain of priority: flow
@@ -149,58 +192,13 @@ public:
 		std::mt19937 g(rd());
 		std::shuffle(ref_.begin(), ref_.end(), g);
 	}
-    auto block = nr_conns_ / setup_time_;
-    for (unsigned i = 0; i < setup_time_; i++) {
-      engine().add_oneshot_task_after(i * 1s, [=] {
-        for (unsigned j = 0; j < block; j++) {
-	  	  	//usleep(10);
-          	auto conn = engine().connect(make_ipv4_address(server_addr));
-					conn->req_cnt_ = 1;
-          	conn->when_ready([this] (const connptr& conn) {
-            stats_log.connected++;
-            stats_sec.connected++;
-            conns_.push_back(conn);
-            if (conns_.size() >= nr_conns_) {
-              app_logger.trace("all connections ready!");
-            }
-          });
-
-          	conn->when_recved([this] (const connptr& conn) {
-            stats_sec.received++;
-            stats_log.received++;
-            std::string s = conn->get_input().string();
-            conn->get_input().consume(s.size());
-            unsigned int idx = (conn->rtt) / 100000;
-            if (idx < NUM_RTT)
-              stats_log.rtts[idx]++;
-            else
-              stats_log.rtts[NUM_RTT]++;
-
-            //@ wuwenqing, simulate 'Think time' forxx ns
-						unsigned val = Fibonacci_service(think_time_); 
-						request_[9] = static_cast<int>(val % 127);
-          });
-
-          conn->when_closed([this] {
-            stats_sec.connected--;
-            stats_log.connected--;
-          });
-
-          conn->when_failed([this] (const connptr& conn) {
-            engine().add_oneshot_task_after(3s, [conn] {conn->reconnect(); });
-          });
-
-          conn->when_disconnect([this] (const connptr& conn) {
-            stats_sec.connected--;
-            stats_sec.retry++;
-
-            stats_log.connected--;
-            stats_log.retry++;
-            engine().add_oneshot_task_after(3s, [conn] {conn->reconnect(); });
-           });
-        } //for(...)
-      });
+    server_addr_ = server_addr;
+    // without --connect-rate the flows are spread evenly over the setup time
+    auto& connects = engine().connects();
+    if (!connects.paced()) {
+      connects.set_rate(double(nr_conns_) / setup_time_);
     }
+    open_connections();
     engine().add_oneshot_task_after(seconds(wait_time_ + setup_time_),
                                               [this] { do_req(); });
 
@@ -212,6 +210,72 @@ public:
     });
   }
 
+  /// Queue the flows missing to reach nr_conns_ on the engine's connect
+  /// scheduler.
+  void open_connections() {
+    engine().connects().cancel();
+    engine().connects().submit(nr_conns_ - std::min<size_t>(conns_.size(), nr_conns_), [this] {
+      // a retune may have moved the target in the meantime
+      if (conns_.size() < nr_conns_) {
+        open_connection();
+      }
+    }, [this] {
+      if (loading_) {
+        plan_load();
+      }
+    });
+  }
+
+  void open_connection() {
+    auto conn = engine().connect(make_ipv4_address(server_addr_));
+    conn->req_cnt_ = 1;
+    conns_.push_back(conn);
+    conn->when_ready([this] (const connptr& conn) {
+      stats_log.connected++;
+      stats_sec.connected++;
+      if (conns_.size() >= nr_conns_) {
+        app_logger.trace("all connections ready!");
+      }
+    });
+
+    conn->when_recved([this] (const connptr& conn) {
+      stats_sec.received++;
+      stats_log.received++;
+      std::string s = conn->get_input().string();
+      conn->get_input().consume(s.size());
+      unsigned int idx = (conn->rtt) / 100000;
+      if (idx < NUM_RTT)
+        stats_log.rtts[idx]++;
+      else
+        stats_log.rtts[NUM_RTT]++;
+
+      //@ wuwenqing, simulate 'Think time' forxx ns
+			// request_ is a registered payload and must not change, the
+			// result only has to stay observable
+			think_sink_ += Fibonacci_service(think_time_);
+    });
+
+    conn->when_closed([this] {
+      stats_sec.connected--;
+      stats_log.connected--;
+    });
+
+    conn->when_failed([this] (const connptr& conn) {
+      engine().reconnects().schedule(conn);
+    });
+
+    conn->when_disconnect([this] (const connptr& conn) {
+      stats_sec.connected--;
+      stats_log.connected--;
+      // an orderly close is churn, not a retry
+      if (!conn->closed_by_peer()) {
+        stats_sec.retry++;
+        stats_log.retry++;
+      }
+      engine().reconnects().disconnected(conn);
+    });
+  }
+
   void print_stats() {
     /*fmt::printf("[engine {}]\tconnected: {} \tretry: {}\tsend: {}\t"
                  "request: {}\treceived: {}\n", engine().cpu_id(),
@@ -225,48 +289,81 @@ public:
   }
 
   void do_req() {
+    loading_ = true;
+    load_tp_ = system_clock::now();
+    plan_load();
+  }
+
+  /// Change the offered load in place: flows are only opened or closed to
+  /// meet the new count, the send timers are re-planned on the same epoch
+  /// anchor.
+  void retune(unsigned epoch, unsigned burst, double ratio, unsigned conns) {
+    epoch_ = epoch;
+    burst_ = burst;
+    request_ratio_ = ratio;
+    nr_conns_ = conns;
+    if (prio_grain_ == 1 && ref_.size() != burst_) {
+      ref_.resize(burst_);
+      std::iota(ref_.begin(), ref_.end(), 0);
+    }
+
+    while (conns_.size() > nr_conns_) {
+      // a retune took the flow away
+      conns_.back()->retire();
+      conns_.pop_back();
+    }
+    // the new flows come up at the connect rate, the load is planned again
+    // once they are all open
+    open_connections();
+    if (loading_) {
+      plan_load();
+    }
+    app_logger.info("retuned: epoch {}ms, burst {}, ratio {}, {} flows", epoch_, burst_,
+                    request_ratio_, conns_.size());
+  }
+
+private:
+  void plan_load() {
     auto blocks = conns_.size() / burst_;
 	auto remainder = conns_.size() % burst_;
     //blocks = blocks <= 0 ? 1 : blocks;
     blocks = remainder > 0 ? (blocks+1) : blocks;
-    auto interval = epoch_ / blocks;
-	int thre = (double)MAXRAND * request_ratio_ * 1.5;
 
-	app_logger.info("interval: {}", interval);
+	app_logger.info("interval: {}", blocks ? epoch_ / blocks : 0);
 	app_logger.info("blocks: {}", blocks);
-    for (unsigned i = 0; i < blocks; i++) {
-      engine().add_periodic_task_at<infinite>(
-          system_clock::now() + i * milliseconds(interval), milliseconds(epoch_), [=] {
-		  			int type_cnt = 0;
-					int pri = -1;
-            for (unsigned j = i * burst_;
-                 j < (i + 1) * burst_ && j < conns_.size(); j++) {
-              if (conns_[j]->get_state() == tcp_connection::state::connected) {
-                clock_gettime(CLOCK_MONOTONIC, &conns_[j]->time_send);
-					if (prio_grain_ == 1) { // flow-level priority
-						//if (ref_[j % burst_] < static_cast<int>(burst_ * request_ratio_)) 
-						pri = (double)rand() / (RAND_MAX+1.0) * MAXRAND;
-    					//fmt::print("pri:{}\n", pri);
-						if ((pri < thre) && 
-							(type_cnt < static_cast<int>(burst_ * request_ratio_))){
-							type_cnt += 1;
-							send_request(j);
-						} else {
-							send_heartbeat(j);
-						}
-					} else { //packet-level priority
-						pri = rand() % MAXRAND;
-    					fmt::print("pri:{}\n", pri);
-						if ((pri < thre) && (type_cnt < static_cast<int>(burst_ * request_ratio_))) {
-							type_cnt += 1;
-							send_request(j);
-						} else {
-							send_heartbeat(j);
-						}
-					}
-              }
-            }
-          });
+    load_.plan(load_tp_, milliseconds(epoch_), blocks, [this] (unsigned i) { send_block(i); });
+  }
+
+  void send_block(unsigned i) {
+	int thre = (double)MAXRAND * request_ratio_ * 1.5;
+	int type_cnt = 0;
+	int pri = -1;
+    for (unsigned j = i * burst_;
+         j < (i + 1) * burst_ && j < conns_.size(); j++) {
+      if (conns_[j]->get_state() == tcp_connection::state::connected) {
+        clock_gettime(CLOCK_MONOTONIC, &conns_[j]->time_send);
+			if (prio_grain_ == 1) { // flow-level priority
+				//if (ref_[j % burst_] < static_cast<int>(burst_ * request_ratio_)) 
+				pri = (double)rand() / (RAND_MAX+1.0) * MAXRAND;
+				//fmt::print("pri:{}\n", pri);
+				if ((pri < thre) && 
+					(type_cnt < static_cast<int>(burst_ * request_ratio_))){
+					type_cnt += 1;
+					send_request(j);
+				} else {
+					send_heartbeat(j);
+				}
+			} else { //packet-level priority
+				pri = rand() % MAXRAND;
+				fmt::print("pri:{}\n", pri);
+				if ((pri < thre) && (type_cnt < static_cast<int>(burst_ * request_ratio_))) {
+					type_cnt += 1;
+					send_request(j);
+				} else {
+					send_heartbeat(j);
+				}
+			}
+      }
     }
   }
 };
@@ -287,7 +384,9 @@ int main(int argc, char **argv) {
     ("duration,d", bpo::value<unsigned>()->default_value(1000000), "duration of test")
     ("think-time,t", bpo::value<int>()->default_value(0), "think time between requests (ns)")
     ("request-ratio,r", bpo::value<double>()->default_value(1.0), "ratio of request packet")
-    ("log-duration", bpo::value<unsigned>()->default_value(10), "log duration between logs");
+    ("log-duration", bpo::value<unsigned>()->default_value(10), "log duration between logs")
+    ("control-port", bpo::value<unsigned>()->default_value(0),
+     "local port to re-tune epoch, burst, request ratio and flows at runtime (0 for none)");
 
   app.run(argc, argv, [&app] {
     auto &config = app.configuration();
@@ -315,6 +414,60 @@ int main(int argc, char **argv) {
         setup, wait, duration, think_time, ratio, length, prio_grain);
     loaders->invoke_on_all(&client::start, ipv4_addr(dest, 80));
 
+    // knobs take the same values as their command line options, e.g.
+    // "echo 'conn 200000' | nc 127.0.0.1 <control-port>"
+    auto control_port = config["control-port"].as<unsigned>();
+    if (control_port) {
+      struct knobs {
+        unsigned epoch, burst;
+        double ratio;
+        unsigned conn;
+      };
+      auto cur = new knobs{epoch, burst, ratio, conn};
+      auto cores = smp::count - 1;
+      auto apply = [=] {
+        loaders->invoke_on_all(&client::retune, unsigned(cur->epoch), unsigned(cur->burst / cores),
+                               double(cur->ratio), unsigned(cur->conn / cores));
+        return std::string();
+      };
+      auto ctl = new control_channel;
+      ctl->on("epoch", "send epoch(s)", [=] (const std::string& v) {
+        float e;
+        if (!control_channel::parse(v, e) || e * 1000 < 1) {
+          return std::string("epoch needs to be at least 1ms");
+        }
+        cur->epoch = static_cast<unsigned>(1000 * e);
+        return apply();
+      });
+      ctl->on("burst", "burst packets", [=] (const std::string& v) {
+        unsigned b;
+        if (!control_channel::parse(v, b) || b < cores) {
+          return fmt::format("burst needs to be at least {}", cores);
+        }
+        cur->burst = b;
+        return apply();
+      });
+      ctl->on("ratio", "ratio of request packet", [=] (const std::string& v) {
+        double r;
+        if (!control_channel::parse(v, r) || r < 0 || r > 1) {
+          return std::string("ratio needs to be in [0, 1]");
+        }
+        cur->ratio = r;
+        return apply();
+      });
+      ctl->on("conn", "number of flows", [=] (const std::string& v) {
+        unsigned c;
+        if (!control_channel::parse(v, c)) {
+          return std::string("conn needs to be a number");
+        }
+        cur->conn = c;
+        return apply();
+      });
+      if (!ctl->listen(control_port)) {
+        exit(-1);
+      }
+    }
+
     adder connected, send, request, received, retry;
     engine().add_periodic_task_at<infinite>(
         system_clock::now(), 1s, [&, loaders]() mutable {
@@ -326,7 +479,7 @@ int main(int argc, char **argv) {
           loaders->invoke_on_all(&client::print_stats);
 
           engine().add_oneshot_task_after(100ms, [&] () mutable {
-            fprintf(stderr, "[ALL]\t\tconnected: %u\tretry: %u\tsend: %u\trequest: %u\treceived: %u\n",
+            fprintf(stderr, "[ALL]\t\tconnected: %" PRIu64 "\tretry: %" PRIu64 "\tsend: %" PRIu64 "\trequest: %" PRIu64 "\treceived: %" PRIu64 "\n",
                        connected.result(), retry.result(), send.result(), request.result(),
                        received.result());
             connected.reset();
@@ -366,7 +519,7 @@ int main(int argc, char **argv) {
                 break;
             }
             fprintf(stderr, "Total RTTs : %d\n", total_rtt);
-            fprintf(stderr, "connected: %d\tsend: %d\t request: %d\t received: %d \t50th-RTT:%d\t 99th-RTT: %d\n",
+            fprintf(stderr, "connected: %" PRIu64 "\tsend: %" PRIu64 "\t request: %" PRIu64 "\t received: %" PRIu64 " \t50th-RTT:%d\t 99th-RTT: %d\n",
                       connected_log.result(), send_log.result(), request_log.result(),
                       received_log.result(), ptr_50, ptr);
 
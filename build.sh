@@ -35,6 +35,7 @@ cd proto
 protoc --cpp_out=. http.proto
 protoc --cpp_out=. mcc.proto
 protoc --cpp_out=. wan.proto
+protoc --cpp_out=. cluster.proto
 cd ..
 mkdir -p build/$BUILD_TYPE
 cd build/$BUILD_TYPE
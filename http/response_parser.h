@@ -0,0 +1,301 @@
+#pragma once
+
+#include "buffer.h"
+
+#include <cstdint>
+#include <cstring>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+namespace infgen {
+namespace http {
+
+/// Index of the first '\n' in p[from, len), or len if there is none.
+inline size_t find_lf(const char* p, size_t from, size_t len) noexcept {
+  size_t i = from;
+#if defined(__SSE2__)
+  const __m128i lf = _mm_set1_epi8('\n');
+  for (; i + 16 <= len; i += 16) {
+    __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + i));
+    unsigned mask = _mm_movemask_epi8(_mm_cmpeq_epi8(v, lf));
+    if (mask) {
+      return i + __builtin_ctz(mask);
+    }
+  }
+#endif
+  auto hit = static_cast<const char*>(std::memchr(p + i, '\n', len - i));
+  return hit ? hit - p : len;
+}
+
+/// Incremental HTTP/1.1 response parser working directly on a connection's
+/// input buffer, or on the received data in place.
+///
+/// parse() consumes every byte it is done with, including bodies, which are
+/// skipped without being copied. A header block stays in the buffer until it
+/// is complete; the parser remembers how far it has scanned, so a header
+/// arriving in many segments is still only scanned once. Responses are
+/// framed by Content-Length, chunked transfer coding or, failing both, by
+/// the connection closing (see finish_on_close()).
+class response_parser {
+ public:
+  enum class result { incomplete, done, error };
+
+  static constexpr size_t max_header_size = 64 * 1024;
+
+  response_parser() { reset(); }
+
+  /// Prepare for the next response on the same connection.
+  void reset() noexcept {
+    state_ = state::header;
+    scanned_ = 0;
+    status_code_ = 0;
+    remaining_ = 0;
+    body_bytes_ = 0;
+    chunked_ = false;
+    keep_alive_ = true;
+  }
+
+  /// in is a buffer or a recv_view (connection.h), anything with begin(),
+  /// size() and consume().
+  template <typename Input>
+  result parse(Input& in) {
+    while (true) {
+      switch (state_) {
+        case state::header: {
+          size_t end = find_header_end(in.begin(), in.size());
+          if (end == 0) {
+            return in.size() > max_header_size ? result::error
+                                               : result::incomplete;
+          }
+          if (!parse_header(in.begin(), end)) {
+            return result::error;
+          }
+          in.consume(end);
+          break;
+        }
+        case state::body:
+        case state::chunk_data: {
+          size_t n = std::min<uint64_t>(remaining_, in.size());
+          in.consume(n);
+          remaining_ -= n;
+          body_bytes_ += n;
+          if (remaining_ > 0) {
+            return result::incomplete;
+          }
+          if (state_ == state::body) {
+            state_ = state::done;
+            return result::done;
+          }
+          state_ = state::chunk_crlf;
+          break;
+        }
+        case state::until_close:
+          body_bytes_ += in.size();
+          in.consume(in.size());
+          return result::incomplete;
+        case state::chunk_size:
+        case state::chunk_crlf:
+        case state::trailer: {
+          // all three are a single line
+          size_t lf = find_lf(in.begin(), 0, in.size());
+          if (lf == in.size()) {
+            return in.size() > max_header_size ? result::error
+                                               : result::incomplete;
+          }
+          bool ok = parse_chunk_line(in.begin(), lf);
+          in.consume(lf + 1);
+          if (!ok) {
+            return result::error;
+          }
+          if (state_ == state::done) {
+            return result::done;
+          }
+          break;
+        }
+        case state::done:
+          return result::done;
+      }
+    }
+  }
+
+  /// A response without Content-Length or chunked coding ends when the
+  /// server closes the connection. Returns true if such a response was in
+  /// progress (and is now complete).
+  bool finish_on_close() noexcept {
+    if (state_ == state::until_close) {
+      state_ = state::done;
+      return true;
+    }
+    return false;
+  }
+
+  int status_code() const noexcept { return status_code_; }
+  bool chunked() const noexcept { return chunked_; }
+  bool keep_alive() const noexcept { return keep_alive_; }
+  uint64_t body_bytes() const noexcept { return body_bytes_; }
+
+ private:
+  enum class state {
+    header,
+    body,
+    until_close,
+    chunk_size,
+    chunk_data,
+    chunk_crlf,
+    trailer,
+    done
+  };
+
+  state state_;
+  size_t scanned_;
+  int status_code_;
+  uint64_t remaining_;
+  uint64_t body_bytes_;
+  bool chunked_;
+  bool keep_alive_;
+
+  /// Length of the header block including the empty line, or 0.
+  size_t find_header_end(const char* p, size_t len) noexcept {
+    size_t i = scanned_;
+    while ((i = find_lf(p, i, len)) < len) {
+      if ((i >= 1 && p[i - 1] == '\n') ||
+          (i >= 2 && p[i - 1] == '\r' && p[i - 2] == '\n')) {
+        scanned_ = 0;
+        return i + 1;
+      }
+      i++;
+    }
+    scanned_ = len;
+    return 0;
+  }
+
+  static bool name_is(const char* p, size_t len, const char* name) noexcept {
+    if (std::strlen(name) != len) {
+      return false;
+    }
+    for (size_t i = 0; i < len; i++) {
+      if ((p[i] | 0x20) != name[i]) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  static bool contains_token(const char* p, size_t len, const char* token) noexcept {
+    size_t n = std::strlen(token);
+    for (size_t i = 0; i + n <= len; i++) {
+      if (name_is(p + i, n, token)) {
+        return true;
+      }
+    }
+    return false;
+  }
+
+  static bool parse_uint(const char* p, size_t len, uint64_t& v, int base) noexcept {
+    size_t i = 0;
+    v = 0;
+    while (i < len && (p[i] == ' ' || p[i] == '\t')) i++;
+    size_t start = i;
+    for (; i < len; i++) {
+      int d;
+      char c = p[i];
+      if (c >= '0' && c <= '9') {
+        d = c - '0';
+      } else if (base == 16 && (c | 0x20) >= 'a' && (c | 0x20) <= 'f') {
+        d = (c | 0x20) - 'a' + 10;
+      } else {
+        break;
+      }
+      if (v > (UINT64_MAX - d) / base) {
+        return false;
+      }
+      v = v * base + d;
+    }
+    return i > start;
+  }
+
+  bool parse_header(const char* p, size_t len) noexcept {
+    size_t eol = find_lf(p, 0, len);
+
+    // status line: HTTP/1.x SSS reason
+    if (eol < 12 || std::memcmp(p, "HTTP/1.", 7) != 0 || p[8] != ' ') {
+      return false;
+    }
+    keep_alive_ = p[7] == '1';
+    uint64_t code;
+    if (!parse_uint(p + 9, 3, code, 10)) {
+      return false;
+    }
+    status_code_ = static_cast<int>(code);
+
+    bool has_length = false;
+    for (size_t pos = eol + 1; pos < len; pos = eol + 1) {
+      eol = find_lf(p, pos, len);
+      size_t line_end = (eol > pos && p[eol - 1] == '\r') ? eol - 1 : eol;
+      auto colon = static_cast<const char*>(std::memchr(p + pos, ':', line_end - pos));
+      if (!colon) {
+        continue;
+      }
+      size_t name_len = colon - (p + pos);
+      const char* value = colon + 1;
+      size_t value_len = p + line_end - value;
+
+      if (name_is(p + pos, name_len, "content-length")) {
+        if (!parse_uint(value, value_len, remaining_, 10)) {
+          return false;
+        }
+        has_length = true;
+      } else if (name_is(p + pos, name_len, "transfer-encoding")) {
+        chunked_ = contains_token(value, value_len, "chunked");
+      } else if (name_is(p + pos, name_len, "connection")) {
+        if (contains_token(value, value_len, "close")) {
+          keep_alive_ = false;
+        } else if (contains_token(value, value_len, "keep-alive")) {
+          keep_alive_ = true;
+        }
+      }
+    }
+
+    if ((status_code_ >= 100 && status_code_ < 200) || status_code_ == 204 ||
+        status_code_ == 304) {
+      // no body, whatever the headers say
+      remaining_ = 0;
+      state_ = state::body;
+    } else if (chunked_) {
+      state_ = state::chunk_size;
+    } else if (has_length) {
+      state_ = state::body;
+    } else {
+      state_ = state::until_close;
+    }
+    return true;
+  }
+
+  bool parse_chunk_line(const char* p, size_t lf) noexcept {
+    size_t line_len = (lf > 0 && p[lf - 1] == '\r') ? lf - 1 : lf;
+
+    switch (state_) {
+      case state::chunk_size:
+        if (!parse_uint(p, line_len, remaining_, 16)) {
+          return false;
+        }
+        state_ = remaining_ ? state::chunk_data : state::trailer;
+        return true;
+      case state::chunk_crlf:
+        state_ = state::chunk_size;
+        return line_len == 0;
+      case state::trailer:
+        if (line_len == 0) {
+          state_ = state::done;
+        }
+        return true;
+      default:
+        return false;
+    }
+  }
+};
+
+}  // namespace http
+}  // namespace infgen
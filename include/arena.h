@@ -0,0 +1,75 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <new>
+#include <string>
+
+namespace infgen {
+namespace memory {
+
+enum class page_size { normal, huge_2m, huge_1g };
+
+struct arena_config {
+  size_t size = size_t(256) << 20;  // bytes per core, 0 disables the arena
+  page_size pages = page_size::huge_2m;
+};
+
+/// Parses the --hugepages option: "2M", "1G" or "none".
+page_size parse_page_size(const std::string& s);
+
+/// Carves the calling thread's arena from pages on the NUMA node of `cpu`.
+/// Called by the reactor once its thread is pinned. Falls back to normal
+/// pages when no hugepages are reserved, and to malloc when even that fails
+/// or the arena runs out.
+bool configure(unsigned cpu, const arena_config& cfg);
+
+/// Sized allocation from the calling thread's arena. Blocks may be freed on
+/// any thread: a block of another core's arena goes back to its owner.
+void* allocate(size_t size);
+void deallocate(void* p, size_t size);
+
+struct arena_stats {
+  bool configured{false};
+  int node{-1};             // NUMA node the arena is bound to
+  size_t page_bytes{0};     // page size actually backing it
+  size_t reserved{0};       // bytes mapped
+  size_t used{0};           // bytes carved so far
+  uint64_t allocs{0};
+  uint64_t frees{0};
+  uint64_t remote_frees{0};     // freed by other threads
+  uint64_t fallback_allocs{0};  // served by malloc
+  uint64_t remote_pages{0};     // carved pages that are not on `node`
+  int64_t dtlb_misses{-1};      // dTLB load misses of this thread, -1 if
+  int64_t remote_accesses{-1};  // unavailable; loads served by another node
+};
+
+/// Counters of the calling thread's arena, sampled now.
+arena_stats stats();
+
+/// STL allocator over the calling thread's arena, e.g. for allocate_shared.
+template <typename T>
+struct allocator {
+  using value_type = T;
+
+  allocator() noexcept = default;
+  template <typename U>
+  allocator(const allocator<U>&) noexcept {}
+
+  T* allocate(size_t n) {
+    void* p = memory::allocate(n * sizeof(T));
+    if (!p) {
+      throw std::bad_alloc();
+    }
+    return static_cast<T*>(p);
+  }
+  void deallocate(T* p, size_t n) noexcept { memory::deallocate(p, n * sizeof(T)); }
+
+  template <typename U>
+  bool operator==(const allocator<U>&) const noexcept { return true; }
+  template <typename U>
+  bool operator!=(const allocator<U>&) const noexcept { return false; }
+};
+
+}  // namespace memory
+}  // namespace infgen
@@ -5,14 +5,16 @@
 #include <utility>
 #include <string>
 
+#include "arena.h"
+
 namespace infgen {
 
 class buffer {
  public:
   buffer() : buf_(NULL), b_(0), e_(0), cap_(0), exp_(2048) {}
-  ~buffer() { delete[] buf_; }
+  ~buffer() { memory::deallocate(buf_, cap_); }
   void clear() {
-    delete[] buf_;
+    memory::deallocate(buf_, cap_);
     buf_ = nullptr;
     cap_ = 0;
     b_ = e_ = 0;
@@ -73,7 +75,7 @@ class buffer {
 
   buffer &operator=(const buffer &b) {
     if (this == &b) return *this;
-    delete[] buf_;
+    memory::deallocate(buf_, cap_);
     buf_ = NULL;
     copy_from(b);
     return *this;
@@ -91,11 +93,11 @@ class buffer {
   }
   void expand(size_t len) {
     size_t ncap = std::max(exp_, std::max(2 * cap_, size() + len));
-    char *p = new char[ncap];
+    char *p = static_cast<char *>(memory::allocate(ncap));
     std::copy(begin(), end(), p);
     e_ -= b_;
     b_ = 0;
-    delete[] buf_;
+    memory::deallocate(buf_, cap_);
     buf_ = p;
     cap_ = ncap;
   }
@@ -103,7 +105,7 @@ class buffer {
   void copy_from(const buffer &b) {
     std::memcpy(this, &b, sizeof b);
     if (b.buf_) {
-      buf_ = new char[cap_];
+      buf_ = static_cast<char *>(memory::allocate(cap_));
       std::memcpy(data(), b.begin(), b.size());
     }
   }
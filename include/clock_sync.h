@@ -0,0 +1,70 @@
+#pragma once
+
+#include <array>
+#include <chrono>
+#include <cstdint>
+
+namespace infgen {
+
+using namespace std::chrono;
+
+/// Estimates the offset between the local wall clock and a peer's from
+/// NTP-style exchanges: the local side stamps a ping when sending (t0), the
+/// peer stamps it on receipt (t1) and when replying (t2), the local side
+/// stamps the reply on arrival (t3).
+///
+/// Queueing delay only ever adds to the round trip, so of the last few
+/// samples the one with the smallest round trip is trusted (NTP's clock
+/// filter); its error is bounded by half of that round trip.
+class clock_sync {
+ public:
+  static constexpr unsigned window = 8;
+  /// Samples before the estimate is trusted for a coordinated start.
+  static constexpr unsigned min_samples = window / 2;
+
+  static int64_t now_us() {
+    return duration_cast<microseconds>(system_clock::now().time_since_epoch()).count();
+  }
+
+  void add_sample(int64_t t0, int64_t t1, int64_t t2, int64_t t3) {
+    auto& s = samples_[nr_samples_++ % window];
+    s.rtt = (t3 - t0) - (t2 - t1);
+    s.offset = ((t1 - t0) + (t2 - t3)) / 2;
+    if (s.rtt < 0) {
+      s.rtt = 0;
+    }
+
+    unsigned n = nr_samples_ < window ? nr_samples_ : window;
+    best_ = samples_[0];
+    for (unsigned i = 1; i < n; i++) {
+      if (samples_[i].rtt < best_.rtt) {
+        best_ = samples_[i];
+      }
+    }
+  }
+
+  bool synced() const { return nr_samples_ > 0; }
+  bool settled() const { return nr_samples_ >= min_samples; }
+  uint64_t samples() const { return nr_samples_; }
+
+  /// Peer clock minus local clock.
+  int64_t offset_us() const { return best_.offset; }
+  int64_t rtt_us() const { return best_.rtt; }
+  int64_t error_us() const { return best_.rtt / 2; }
+
+  /// Local time at which the peer's clock reads peer_us.
+  system_clock::time_point to_local(int64_t peer_us) const {
+    return system_clock::time_point(microseconds(peer_us - best_.offset));
+  }
+
+ private:
+  struct sample {
+    int64_t offset{0};
+    int64_t rtt{0};
+  };
+  std::array<sample, window> samples_{};
+  sample best_;
+  uint64_t nr_samples_{0};
+};
+
+}  // namespace infgen
@@ -0,0 +1,273 @@
+#pragma once
+
+#include "clock_sync.h"
+#include "connection.h"
+#include "frame.h"
+#include "log.h"
+#include "tcp_server.h"
+#include "proto/cluster.pb.h"
+
+#include <google/protobuf/arena.h>
+
+#include <string>
+#include <vector>
+
+namespace infgen {
+
+extern logger cluster_logger;
+
+/// Fleet control for distributed loaders. A master hands a workload to a
+/// fixed set of workers and collects their statistics, one framed control
+/// connection (frame.h) per worker.
+///
+/// The harness does registration, failure detection through heartbeats,
+/// clock offset estimation (heartbeats double as clock_sync pings), the
+/// coordinated start on the master's timeline, splitting of the fleet-wide
+/// parameters per worker and re-tuning them mid-run. What gets loaded and
+/// measured is up to the workload plugged into cluster_master and
+/// cluster_worker below.
+struct cluster_config {
+  unsigned workers = 1;
+  uint16_t port = 2222;
+  milliseconds heartbeat = 1000ms;
+  /// A peer that missed this many heartbeats is taken for dead.
+  unsigned max_missed = 3;
+  /// The run starts this long after the last worker's clock settled.
+  milliseconds start_delay = 3000ms;
+  /// Period of the master's dashboard, 0 for none.
+  milliseconds dashboard = 0ms;
+};
+
+class cluster_master_base {
+ public:
+  struct member {
+    connptr con;
+    bool online = false;
+    unsigned cores = 0;
+    system_clock::time_point last_seen;
+    // the worker's estimate of our clock minus its own
+    int64_t clock_offset = 0;
+    uint32_t clock_error = 0;
+    // samples behind that estimate, the start waits until it settled
+    uint32_t clock_samples = 0;
+    bool commanded = false;
+
+    bool settled() const { return clock_samples >= clock_sync::min_samples; }
+  };
+
+  explicit cluster_master_base(const cluster_config& cfg);
+  virtual ~cluster_master_base() = default;
+  cluster_master_base(const cluster_master_base&) = delete;
+  void operator=(const cluster_master_base&) = delete;
+
+  /// Accept workers, the run starts once all of them have registered and
+  /// their clock offsets have settled.
+  bool listen();
+  /// Send the current parameters to every worker again, mid-run.
+  void retune();
+  /// Stop every worker, then the local engine.
+  void shutdown();
+
+  const cluster_config& config() const { return cfg_; }
+  unsigned online() const { return online_; }
+  bool running() const { return running_; }
+  const member& worker(unsigned id) const { return members_[id]; }
+
+  /// Calls r(f(id)) for every online worker, see adder and histogram.
+  template <typename Reducer, typename Func>
+  void reduce(Reducer& r, Func&& f) const {
+    for (unsigned id = 0; id < members_.size(); id++) {
+      if (members_[id].online) {
+        r(f(id));
+      }
+    }
+  }
+
+  /// Messages of the workload's statistics frames can be allocated here,
+  /// the arena is reset after each frame.
+  google::protobuf::Arena& arena() { return arena_; }
+
+ protected:
+  /// Serialize the parameters for worker id into out.
+  virtual void encode_params(unsigned id, std::string& out) = 0;
+  /// A workload frame from worker id; type is the workload's own.
+  virtual void on_stats(unsigned id, uint8_t type, const char* p, size_t len) = 0;
+  virtual void on_dashboard() {}
+
+ private:
+  void handle_frame(const connptr& con, uint8_t type, const char* p, size_t len);
+  void join(const connptr& con, const char* p, size_t len);
+  void leave(unsigned id);
+  void heartbeat(const connptr& con, const char* p, size_t len);
+  void try_start();
+  void send_command(unsigned id, cluster_frame type);
+  void check_liveness();
+  bool registered(const connptr& con) const;
+
+  static google::protobuf::ArenaOptions arena_options(std::vector<char>& block);
+
+  cluster_config cfg_;
+  svrptr svr_;
+  std::vector<member> members_;
+  unsigned online_ = 0;
+  bool running_ = false;
+  uint64_t start_us_ = 0;
+  uint32_t generation_ = 0;
+  int64_t recv_us_ = 0;
+
+  std::vector<char> arena_block_;
+  google::protobuf::Arena arena_;
+  std::string frame_buf_;
+  cluster_command cmd_;
+  cluster_heartbeat hb_;
+};
+
+class cluster_worker_base {
+ public:
+  cluster_worker_base(const cluster_config& cfg, unsigned id, socket_address master,
+                      socket_address local);
+  virtual ~cluster_worker_base() = default;
+  cluster_worker_base(const cluster_worker_base&) = delete;
+  void operator=(const cluster_worker_base&) = delete;
+
+  /// Register with the master, retrying until it is up.
+  void connect();
+
+  /// Send a workload frame to the master.
+  template <typename Message>
+  bool send(uint8_t type, const Message& msg) {
+    if (!con_ || con_->get_state() != tcp_connection::state::connected) {
+      return false;
+    }
+    encode_frame(frame_buf_, CLUSTER_APP + type, msg);
+    return con_->send_packet(frame_buf_);
+  }
+
+  unsigned id() const { return id_; }
+  unsigned workers() const { return workers_; }
+  /// Start of the run on the local clock.
+  system_clock::time_point start_time() const { return start_tp_; }
+  const clock_sync& clock() const { return clock_; }
+
+ protected:
+  virtual void on_start(const std::string& params) = 0;
+  virtual void on_retune(const std::string& params) = 0;
+  virtual void on_stop() = 0;
+
+ private:
+  void handle_frame(uint8_t type, const char* p, size_t len);
+  void send_heartbeat();
+  void check_master();
+  void lost(const char* why);
+
+  cluster_config cfg_;
+  unsigned id_;
+  unsigned workers_ = 0;
+  socket_address master_, local_;
+  connptr con_;
+  bool registered_ = false;
+  bool started_ = false;
+  bool stopped_ = false;
+  uint32_t generation_ = 0;
+  system_clock::time_point start_tp_;
+  system_clock::time_point last_seen_;
+  int64_t recv_us_ = 0;
+  clock_sync clock_;
+
+  std::string frame_buf_;
+  cluster_command cmd_;
+  cluster_heartbeat hb_;
+};
+
+/// Master side of a distributed loader. Workload provides:
+///
+///   using params = <protobuf message>;
+///   // parameters of worker id out of the fleet-wide ones
+///   void split(const params& fleet, unsigned id, unsigned workers, params& out);
+///   // a statistics frame sent by worker id with cluster_worker::send()
+///   void on_stats(cluster_master_base& c, unsigned id, uint8_t type,
+///                 const char* p, size_t len);
+///   // called every config().dashboard
+///   void dashboard(cluster_master_base& c);
+template <typename Workload>
+class cluster_master : public cluster_master_base {
+ public:
+  using params = typename Workload::params;
+
+  cluster_master(const cluster_config& cfg, Workload& w, const params& p)
+      : cluster_master_base(cfg), w_(w), params_(p) {}
+
+  const params& fleet_params() const { return params_; }
+
+  /// Re-tune the running fleet with new fleet-wide parameters.
+  void retune(const params& p) {
+    params_ = p;
+    cluster_master_base::retune();
+  }
+
+ protected:
+  void encode_params(unsigned id, std::string& out) override {
+    split_.Clear();
+    w_.split(params_, id, config().workers, split_);
+    split_.SerializeToString(&out);
+  }
+
+  void on_stats(unsigned id, uint8_t type, const char* p, size_t len) override {
+    w_.on_stats(*this, id, type, p, len);
+  }
+
+  void on_dashboard() override { w_.dashboard(*this); }
+
+ private:
+  Workload& w_;
+  params params_;
+  params split_;
+};
+
+/// Worker side of a distributed loader. Workload provides:
+///
+///   using params = <protobuf message>;
+///   // run p, starting at c.start_time()
+///   void start(cluster_worker_base& c, const params& p);
+///   // new parameters while running
+///   void retune(cluster_worker_base& c, const params& p);
+///   // told to stop, or the master is gone
+///   void stop();
+template <typename Workload>
+class cluster_worker : public cluster_worker_base {
+ public:
+  using params = typename Workload::params;
+
+  cluster_worker(const cluster_config& cfg, Workload& w, unsigned id, socket_address master,
+                 socket_address local = socket_address{})
+      : cluster_worker_base(cfg, id, master, local), w_(w) {}
+
+ protected:
+  void on_start(const std::string& s) override {
+    if (parse(s)) {
+      w_.start(*this, params_);
+    }
+  }
+
+  void on_retune(const std::string& s) override {
+    if (parse(s)) {
+      w_.retune(*this, params_);
+    }
+  }
+
+  void on_stop() override { w_.stop(); }
+
+ private:
+  bool parse(const std::string& s) {
+    if (!params_.ParseFromString(s)) {
+      cluster_logger.error("failed to parse workload parameters");
+      return false;
+    }
+    return true;
+  }
+
+  Workload& w_;
+  params params_;
+};
+
+}  // namespace infgen
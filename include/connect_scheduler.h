@@ -0,0 +1,110 @@
+#pragma once
+
+#include "histogram.h"
+
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <string>
+
+namespace infgen {
+
+using namespace std::chrono;
+
+/// Paces the connection setup of one reactor.
+///
+/// Connection openings are queued with submit() and released from a token
+/// bucket on every iteration of the event loop, so SYNs leave at a steady
+/// rate instead of in one burst per timer callback. The rate follows a ramp
+/// from start_rate to rate over ramp_time, counted from the first submit(),
+/// and no opening is released while max_half_open handshakes are still in
+/// flight.
+///
+/// Every handshake of the reactor, paced or not, reconnects included, is
+/// accounted for: setup latency, SYN retransmissions and failures.
+class connect_scheduler {
+ public:
+  enum class profile { constant, linear, exponential };
+
+  struct config {
+    double rate{0};              // connects/s once ramped up, 0: not paced
+    double start_rate{0};        // connects/s at the start of the ramp
+    microseconds ramp_time{0};
+    profile shape{profile::constant};
+    unsigned burst{32};          // depth of the bucket
+    unsigned max_half_open{0};   // 0: no limit
+  };
+
+  struct stats {
+    uint64_t attempts{0};        // handshakes started
+    uint64_t established{0};
+    uint64_t failed{0};          // refused, timed out or given up
+    uint64_t syn_retries{0};
+    histogram setup;             // connect() to established, in us
+
+    void reset() { *this = stats{}; }
+  };
+
+  static bool parse(const std::string& name, profile& p);
+
+  void configure(const config& c) { cfg_ = c; }
+  const config& get_config() const { return cfg_; }
+  bool paced() const { return cfg_.rate > 0; }
+  /// Pace at rate from now on, ramp included.
+  void set_rate(double rate) { cfg_.rate = rate; }
+
+  /// Calls open n times as the rate allows, then done (if any). open is
+  /// expected to start one connection; it may submit() but not cancel().
+  void submit(uint64_t n, std::function<void()> open, std::function<void()> done = {});
+  /// Drops the openings not released yet, done is not called.
+  void cancel() { jobs_.clear(); }
+  uint64_t queued() const;
+
+  /// Releases the openings due, called once per loop iteration.
+  bool poll();
+
+  /// Current target rate in connects/s, 0 when not paced.
+  double rate() const;
+  uint64_t half_open() const { return half_open_; }
+
+  /// Handshake accounting, see tcp_connection.
+  void handshake_started() {
+    half_open_++;
+    total_.attempts++;
+    interval_.attempts++;
+  }
+  void handshake_done(microseconds latency, bool ok, unsigned syn_retries);
+  void handshake_abandoned() {
+    if (half_open_) {
+      half_open_--;
+    }
+  }
+
+  const stats& total() const { return total_; }
+  /// Counters since the previous call.
+  stats take_interval() {
+    auto s = interval_;
+    interval_.reset();
+    return s;
+  }
+
+ private:
+  struct job {
+    uint64_t left;
+    std::function<void()> open;
+    std::function<void()> done;
+  };
+
+  config cfg_;
+  std::deque<job> jobs_;
+  double tokens_{0};
+  steady_clock::time_point start_{};
+  steady_clock::time_point last_{};
+  bool started_{false};
+
+  uint64_t half_open_{0};
+  stats total_, interval_;
+};
+
+} // namespace infgen
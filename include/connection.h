@@ -4,10 +4,38 @@
 #include "connector.h"
 #include "timer.h"
 
+#include <algorithm>
+
 namespace infgen {
+
+/// Received bytes presented in place, see tcp_connection::on_data(). The
+/// handler consumes what it is done with; the rest is presented again,
+/// followed by newer data, on the next call.
+class recv_view {
+ public:
+  recv_view(const char* p, size_t len) : p_(p), len_(len) {}
+
+  const char* begin() const { return p_ + consumed_; }
+  const char* end() const { return p_ + len_; }
+  size_t size() const { return len_ - consumed_; }
+  bool empty() const { return size() == 0; }
+
+  recv_view& consume(size_t n) {
+    consumed_ += std::min(n, size());
+    return *this;
+  }
+  size_t consumed() const { return consumed_; }
+
+ private:
+  const char* p_;
+  size_t len_;
+  size_t consumed_ = 0;
+};
+
 using connfunc = std::function<void(const connptr&)>;
 using callback_t = std::function<void()>;
 using msg_callback = std::function<void(const connptr&, std::string& msg)>;
+using data_callback = std::function<void(const connptr&, recv_view& data)>;
 
 class tcp_connection : public std::enable_shared_from_this<tcp_connection> {
  public:
@@ -24,9 +52,21 @@ class tcp_connection : public std::enable_shared_from_this<tcp_connection> {
   tcp_connection(const tcp_connection &) = default;
   tcp_connection &operator=(const tcp_connection &) = default;
 
-  virtual ~tcp_connection() {}
+  virtual ~tcp_connection() {
+    abandon_handshake();
+    abandon_reconnect();
+  }
   virtual state get_state() { return state_; }
-  virtual void set_state(state s) { state_ = s; }
+  virtual void set_state(state s) {
+    if (s == state::closed) {
+      abandon_handshake();
+      abandon_reconnect();
+    }
+    state_ = s;
+  }
+  /// The connection went down on an orderly close by the peer (EOF)
+  /// rather than an error.
+  bool closed_by_peer() const { return peer_closed_; }
   virtual uint64_t get_id() { return id_; }
   virtual void set_id(uint64_t id) { id_ = id; }
   virtual uint64_t get_fd() { return fd_; }
@@ -34,6 +74,17 @@ class tcp_connection : public std::enable_shared_from_this<tcp_connection> {
   virtual bool send_packet(const void *data, std::size_t len) = 0;
   virtual bool send_packet(const std::string &data) = 0;
   virtual bool send_packet(const buffer &buf) = 0;
+  /// Sends len bytes at off of a payload registered with
+  /// reactor::register_payload(). Where the stack supports it only a
+  /// reference is queued, the bytes are copied straight into the packets.
+  /// False unless all of it was queued; part of it may be in the stream,
+  /// so a framed protocol has to drop the connection.
+  virtual bool send_payload(int id, std::size_t off, std::size_t len) = 0;
+  /// Writes as much of len bytes as the stack takes now and returns how
+  /// many leading bytes are part of the stream; 0 on a broken connection.
+  /// After a short write when_writable fires once more fits, the rest is
+  /// left to the caller.
+  virtual size_t write_some(const void *data, std::size_t len) = 0;
   struct timespec time_send, time_recv;
   uint64_t rtt;
 
@@ -42,6 +93,14 @@ class tcp_connection : public std::enable_shared_from_this<tcp_connection> {
     on_recved_ = std::forward<Func>(func);
   }
 
+  /// Like when_recved, but the data is parsed where it lies: on mTCP this is
+  /// the stack's own receive buffer, nothing is copied into get_input().
+  /// Takes precedence over when_recved.
+  template <typename Func>
+  void on_data(Func &&func) {
+    on_data_ = std::forward<Func>(func);
+  }
+
   template <typename Func>
   void on_message(Func &&func) {
     on_msg_ = std::forward<Func>(func);
@@ -52,6 +111,11 @@ class tcp_connection : public std::enable_shared_from_this<tcp_connection> {
     on_connected_ = std::forward<Func>(func);
   }
 
+  template <typename Func>
+  void when_writable(Func &&func) {
+    on_writable_ = std::forward<Func>(func);
+  }
+
   template <typename Func>
   void when_failed(Func &&func) {
     on_failed_ = std::forward<Func>(func);
@@ -70,8 +134,25 @@ class tcp_connection : public std::enable_shared_from_this<tcp_connection> {
   virtual void handle_write(connptr con) = 0;
   virtual void handle_read(connptr con) = 0;
   virtual void close() = 0;
+  /// Closes the connection for good, whatever state it is in: a socket
+  /// still connecting is released too, and no callback fires afterwards.
+  void retire() {
+    on_connected_ = on_failed_ = on_recved_ = on_disconnect_ = on_writable_ = nullptr;
+    on_msg_ = nullptr;
+    on_data_ = nullptr;
+    on_closed_ = nullptr;
+    if (state_ != state::closed && state_ != state::disconnect) {
+      close();
+    } else {
+      set_state(state::closed);
+    }
+  }
   virtual void attach(int fd, socket_address local, socket_address peer) = 0;
   virtual void reconnect() = 0;
+  /// Handshake accounting of the reactor's connect_scheduler: connectors
+  /// start it after attach() for outbound connects only, the SO_ERROR
+  /// check ends it. Accepted connections never count.
+  void start_handshake();
 
   virtual uint64_t tx_bytes() { return stat_.data_in; }
   virtual uint64_t rx_bytes() { return stat_.data_out; }
@@ -106,15 +187,61 @@ class tcp_connection : public std::enable_shared_from_this<tcp_connection> {
     }
   };
 
+  void end_handshake(bool ok);
+  void abandon_handshake() {
+    if (handshaking_) {
+      forget_handshake();
+    }
+  }
+  /// Leaves the reactor's reconnect_manager, the connection is closed.
+  void abandon_reconnect() {
+    if (reconnect_attempts_) {
+      forget_reconnect();
+    }
+  }
+  /// SYNs the stack retransmitted for the handshake that just ended.
+  virtual unsigned syn_retries() { return 0; }
+
+  /// Hands what has been read into input_ to on_data or on_recved.
+  void deliver(const connptr& con) {
+    if (on_data_) {
+      recv_view data(input_.begin(), input_.size());
+      on_data_(con, data);
+      input_.consume(data.consumed());
+    } else if (on_recved_) {
+      on_recved_(con);
+    }
+  }
+
+  /// The socket took all that was queued and can take more.
+  void writable(const connptr& con) {
+    if (on_writable_) {
+      on_writable_(con);
+    }
+  }
+
   buffer input_, output_;
   conn_stat stat_;
-  connfunc on_connected_, on_failed_, on_recved_, on_disconnect_;
+  connfunc on_connected_, on_failed_, on_recved_, on_disconnect_, on_writable_;
   msg_callback on_msg_;
+  data_callback on_data_;
   callback_t on_closed_;
   state state_;
+  bool peer_closed_{false};
   uint64_t id_, fd_;
 
   socket_address local_, peer_;
+
+ private:
+  friend class reconnect_manager;
+  void forget_handshake();
+  void forget_reconnect();
+
+  uint32_t reconnect_attempts_{0};   // retries since the connection was lost
+  steady_clock::time_point reopen_tp_{};   // last reconnect after an orderly close
+
+  steady_clock::time_point connect_tp_;
+  bool handshaking_{false};
 };
 
 }  // namespace infgen
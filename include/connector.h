@@ -1,4 +1,5 @@
 #pragma once
+#include "dest_pool.h"
 #include "inet_addr.h"
 #include <memory>
 #include <functional>
@@ -19,6 +20,14 @@ public:
   virtual connptr connect(socket_address sa, socket_address local=socket_address{}) = 0;
   virtual void configure(boost::program_options::variables_map vm) = 0;
   virtual void reconnect(connptr con) = 0;
+
+  /// Destinations of connections opened without an address, set before
+  /// configure().
+  void set_destinations(destination_pool dests) { dests_ = std::move(dests); }
+  destination_pool& destinations() { return dests_; }
+
+protected:
+  destination_pool dests_;
 };
 
 } // namespace infgen
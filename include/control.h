@@ -0,0 +1,55 @@
+#pragma once
+
+#include "log.h"
+#include "tcp_server.h"
+
+#include <functional>
+#include <map>
+#include <sstream>
+#include <string>
+
+namespace infgen {
+
+/// Runtime control of a running loader. A client sends one command per
+/// line on a local TCP port:
+///
+///   <name> [value]
+///
+/// e.g. "epoch 500" or "conn 200000", and gets "ok" or "error: <why>" back
+/// for each. Handlers run on the core that called listen(). "help" lists
+/// the commands.
+class control_channel {
+ public:
+  /// Returns an empty string on success, the reason otherwise.
+  using handler = std::function<std::string(const std::string& value)>;
+
+  control_channel() = default;
+  control_channel(const control_channel&) = delete;
+  void operator=(const control_channel&) = delete;
+
+  void on(const std::string& name, const std::string& help, handler h) {
+    commands_[name] = command{help, std::move(h)};
+  }
+
+  /// Listen on 127.0.0.1:port.
+  bool listen(uint16_t port);
+
+  /// Parse the value of a command, for use in handlers.
+  template <typename T>
+  static bool parse(const std::string& s, T& v) {
+    std::istringstream is(s);
+    return static_cast<bool>(is >> v) && is.eof();
+  }
+
+ private:
+  std::string execute(const std::string& line);
+
+  struct command {
+    std::string help;
+    handler h;
+  };
+  std::map<std::string, command> commands_;
+  svrptr svr_;
+};
+
+}  // namespace infgen
@@ -0,0 +1,85 @@
+#pragma once
+
+#include "inet_addr.h"
+
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace infgen {
+
+/// The servers a reactor spreads its connections over, e.g. the VIPs of a
+/// cluster, each with a weight.
+///
+/// pick() draws a destination with probability weight / total in O(1)
+/// whatever the number of destinations, from an alias table (Vose) built
+/// once at configuration time. A pool belongs to one reactor, its counters
+/// are not synchronized.
+class destination_pool {
+ public:
+  struct destination {
+    socket_address addr;
+    unsigned weight{1};
+
+    uint64_t connects{0};
+    uint64_t reconnects{0};
+    uint64_t errors{0};    // connect() failed, e.g. source addresses ran out
+  };
+
+  /// Parses "ip[:port[:weight]],...", port and weight default to
+  /// default_port and 1. Throws std::invalid_argument on a malformed list.
+  static destination_pool parse(const std::string& s, uint16_t default_port);
+
+  /// Adds a destination, or sets the weight of one already in the pool.
+  void add(socket_address addr, unsigned weight);
+
+  /// Index of the next destination to connect to.
+  size_t pick() {
+    if (alias_.size() <= 1) {
+      return 0;
+    }
+    // xorshift64*, high half picks the column, low half the side
+    rng_ ^= rng_ >> 12;
+    rng_ ^= rng_ << 25;
+    rng_ ^= rng_ >> 27;
+    uint64_t r = rng_ * 0x2545f4914f6cdd1dULL;
+    size_t i = ((r >> 32) * alias_.size()) >> 32;
+    return uint32_t(r) < prob_[i] ? i : alias_[i];
+  }
+
+  /// Index of addr in the pool, -1 if it is not a destination.
+  int find(const socket_address& addr) const {
+    auto it = index_.find(key(addr));
+    return it == index_.end() ? -1 : int(it->second);
+  }
+
+  destination& operator[](size_t i) { return dests_[i]; }
+  const destination& operator[](size_t i) const { return dests_[i]; }
+  size_t size() const { return dests_.size(); }
+  bool empty() const { return dests_.empty(); }
+
+  std::vector<destination>::iterator begin() { return dests_.begin(); }
+  std::vector<destination>::iterator end() { return dests_.end(); }
+  std::vector<destination>::const_iterator begin() const { return dests_.begin(); }
+  std::vector<destination>::const_iterator end() const { return dests_.end(); }
+
+  /// Seeds pick(), e.g. with the reactor id so that reactors don't all
+  /// draw the same sequence.
+  void seed(uint64_t s) { rng_ = s * 0x9e3779b97f4a7c15ULL | 1; }
+
+ private:
+  static uint64_t key(const socket_address& addr) {
+    return uint64_t(addr.u.in.sin_addr.s_addr) << 16 | addr.u.in.sin_port;
+  }
+  void build();
+
+  std::vector<destination> dests_;
+  std::unordered_map<uint64_t, size_t> index_;
+  // column i is taken with probability prob_[i] / 2^32, otherwise alias_[i]
+  std::vector<uint32_t> prob_;
+  std::vector<uint32_t> alias_;
+  uint64_t rng_{0x9e3779b97f4a7c15ULL};
+};
+
+} // namespace infgen
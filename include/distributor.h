@@ -15,15 +15,15 @@ class no_sharded_instance_exception : std::exception {
 /// adding elements to the  accumulator
 class adder {
 private:
-  unsigned result_;
+  uint64_t result_;
 public:
-  adder(unsigned initial=0): result_(initial) {}
-  unsigned operator()(const unsigned& value) {
+  adder(uint64_t initial=0): result_(initial) {}
+  uint64_t operator()(const uint64_t& value) {
     result_ += value;
     return result_;
   }
 
-  unsigned result() { return result_; }
+  uint64_t result() { return result_; }
   void reset() { result_ = 0; }
 };
 
@@ -124,6 +124,21 @@ public:
     }
   }
 
+  /// Like above, for any @Reducer whose operator() takes the mapper's result,
+  /// e.g. a histogram merged from all loader cores.
+  template <typename Reducer, typename Ret, typename... Args>
+  inline void map_reduce(Reducer &r, Ret (Service::*mapper)(Args... args),
+        Args&& ...args) {
+    for (unsigned i = 1; i < instances_.size(); i++) {
+      smp::submit_to(i, [this, mapper, args...] {
+        auto inst = get_local_service();
+        return ((*inst).*mapper)(args...);
+      }, std::function<void(Ret)>([&r] (Ret partial) mutable {
+          r(partial);
+      }));
+    }
+  }
+
 
   const Service &local() const;
   Service &local();
@@ -0,0 +1,58 @@
+#pragma once
+
+#include "reactor.h"
+
+#include <functional>
+#include <vector>
+
+namespace infgen {
+
+/// Spreads blocks of work evenly over a repeating epoch: block i runs at
+/// anchor + i * epoch / blocks, then once every epoch.
+///
+/// plan() may be called again at any time, e.g. with a new epoch or number
+/// of blocks. The timers of the old plan are cancelled and every block
+/// resumes at its next slot of the new plan, counted from the same anchor,
+/// so loaders sharing an anchor stay aligned across re-plans.
+class epoch_schedule {
+ public:
+  using block_fn = std::function<void(unsigned block)>;
+
+  epoch_schedule() = default;
+  epoch_schedule(const epoch_schedule&) = delete;
+  void operator=(const epoch_schedule&) = delete;
+
+  void plan(system_clock::time_point anchor, milliseconds epoch, unsigned blocks, block_fn f) {
+    cancel();
+    if (blocks == 0 || epoch.count() <= 0) {
+      return;
+    }
+    fn_ = std::move(f);
+    auto now = system_clock::now();
+    auto interval = duration_cast<microseconds>(epoch) / blocks;
+    for (unsigned i = 0; i < blocks; i++) {
+      system_clock::time_point tp = anchor + i * interval;
+      if (tp < now) {
+        // skip the slots already past, rounding up
+        tp += ((now - tp) / epoch + 1) * epoch;
+      }
+      timers_.push_back(
+          engine().add_periodic_task_at<infinite>(tp, epoch, [this, i] { fn_(i); }));
+    }
+  }
+
+  void cancel() {
+    for (auto& id : timers_) {
+      engine().cancel_task(id);
+    }
+    timers_.clear();
+  }
+
+  unsigned blocks() const { return timers_.size(); }
+
+ private:
+  block_fn fn_;
+  std::vector<timer_id> timers_;
+};
+
+}  // namespace infgen
@@ -5,21 +5,65 @@
 
 #include <functional>
 #include <memory>
+#include <vector>
 
 namespace infgen {
 
+/// Kernel epoll backend.
+///
+/// Interest changes are not applied as they are requested: a poll_state
+/// whose interest changed is marked and the net change is applied with at
+/// most one epoll_ctl right before the next epoll_wait, so a callback that
+/// turns an event off and on again costs nothing.
+///
+/// With edge_triggered, fds whose owner drains them until EAGAIN (see
+/// pollable_fd::set_edge_triggered) are registered once for both
+/// directions with EPOLLET and never modified again; the backend remembers
+/// which edges arrived while nobody asked for them.
+///
+/// The event batch starts at 128 and doubles whenever epoll_wait fills it,
+/// up to max_events; it halves again after a long run of light polls.
 class epoll_backend : public backend {
+public:
+  struct config {
+    bool edge_triggered{false};
+    unsigned max_events{4096};
+  };
+
+  struct stats {
+    uint64_t waits{0};   // epoll_wait calls
+    uint64_t events{0};
+    uint64_t ctls{0};    // epoll_ctl calls
+  };
+
 private:
+  static constexpr unsigned min_events = 128;
+
   file_desc epollfd_;
+  config cfg_;
+  std::vector<epoll_event> events_;
+  unsigned light_polls_{0};
+  std::vector<poll_state *> dirty_;
+  stats stats_;
+
   void complete_epoll_event(poll_state &fd, int events, int event);
   void abort_fd();
+  void mark(poll_state &state);
+  void unmark(poll_state &state);
+  void flush();
+  void apply(poll_state &state);
+  void resize_batch(int nr);
 
 public:
   epoll_backend();
+  explicit epoll_backend(const config &cfg);
   virtual void update(poll_state &fd, int event) override;
   virtual bool poll(int timeout) override;
   virtual void forget(poll_state &) override;
   virtual ~epoll_backend() override {}
+
+  const stats &get_stats() const { return stats_; }
+  unsigned batch() const { return events_.size(); }
 };
 
 } // namespace infgen
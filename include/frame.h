@@ -0,0 +1,59 @@
+#pragma once
+
+#include "buffer.h"
+
+#include <cstdint>
+#include <string>
+
+namespace infgen {
+
+/// Length-prefixed framing for control channels that carry serialized
+/// messages over a byte stream.
+///
+///   | length (4 bytes, big endian) | type (1 byte) | payload |
+///
+/// length counts the type byte and the payload. A read may end in the middle
+/// of a frame or hold many of them; for_each_frame() only hands out complete
+/// frames and leaves a partial one in the buffer for the next read.
+constexpr size_t frame_header_len = 5;
+constexpr size_t max_frame_len = 16 << 20;
+
+/// Serialize msg into out as a single frame. out is resized, not
+/// reallocated, so a scratch string kept across calls makes encoding
+/// allocation-free once it has grown to the largest frame.
+template <typename Message>
+void encode_frame(std::string& out, uint8_t type, const Message& msg) {
+  size_t len = msg.ByteSizeLong();
+  size_t flen = len + 1;
+  out.resize(frame_header_len + len);
+  auto p = reinterpret_cast<uint8_t*>(&out[0]);
+  p[0] = (uint8_t)(flen >> 24);
+  p[1] = (uint8_t)(flen >> 16);
+  p[2] = (uint8_t)(flen >> 8);
+  p[3] = (uint8_t)flen;
+  p[4] = type;
+  msg.SerializeWithCachedSizesToArray(p + frame_header_len);
+}
+
+/// Call f(type, data, len) for every complete frame at the head of in, the
+/// payload is passed in place and consumed once f returns. Returns false on
+/// a malformed frame, the stream can't be resynchronized after that.
+template <typename Func>
+bool for_each_frame(buffer& in, Func&& f) {
+  while (in.size() >= frame_header_len) {
+    auto p = reinterpret_cast<const uint8_t*>(in.begin());
+    size_t flen = (size_t)p[0] << 24 | (size_t)p[1] << 16 | (size_t)p[2] << 8 | p[3];
+    if (flen == 0 || flen > max_frame_len) {
+      return false;
+    }
+    if (in.size() < flen + 4) {
+      // wait for the rest of the frame
+      break;
+    }
+    f(p[4], reinterpret_cast<const char*>(p + frame_header_len), flen - 1);
+    in.consume(flen + 4);
+  }
+  return true;
+}
+
+}  // namespace infgen
@@ -0,0 +1,107 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+
+namespace infgen {
+
+/// Latency histogram in microseconds with log-linear buckets: every power of
+/// two is split into four buckets, so a bucket is at most 25% wide. Values
+/// below 4us get a bucket each, anything beyond ~2^33us lands in the last
+/// bucket.
+///
+/// Implements the @Reducer concept (see adder), histograms of several cores
+/// or workers are merged by calling operator() on each of them.
+class histogram {
+ public:
+  static constexpr unsigned nr_buckets = 128;
+
+  static unsigned bucket_of(uint64_t us) noexcept {
+    if (us < 4) {
+      return us;
+    }
+    unsigned msb = 63 - __builtin_clzll(us);
+    unsigned idx = 4 * (msb - 1) + ((us >> (msb - 2)) & 3);
+    return idx < nr_buckets ? idx : nr_buckets - 1;
+  }
+
+  /// Smallest value falling into bucket idx.
+  static uint64_t lower_bound(unsigned idx) noexcept {
+    if (idx < 4) {
+      return idx;
+    }
+    return (uint64_t)(4 + idx % 4) << (idx / 4 - 1);
+  }
+
+  void record(uint64_t us) noexcept {
+    buckets_[bucket_of(us)]++;
+    count_++;
+    sum_ += us;
+    if (us > max_) {
+      max_ = us;
+    }
+  }
+
+  /// Add count samples to a bucket, used when decoding a histogram received
+  /// from somewhere else; sum and max are restored separately.
+  void add(unsigned idx, uint64_t count) noexcept {
+    if (idx < nr_buckets) {
+      buckets_[idx] += count;
+      count_ += count;
+    }
+  }
+
+  void add_sum(uint64_t sum, uint64_t max) noexcept {
+    sum_ += sum;
+    if (max > max_) {
+      max_ = max;
+    }
+  }
+
+  const histogram& operator()(const histogram& h) noexcept {
+    for (unsigned i = 0; i < nr_buckets; i++) {
+      buckets_[i] += h.buckets_[i];
+    }
+    count_ += h.count_;
+    add_sum(h.sum_, h.max_);
+    return *this;
+  }
+
+  const histogram& result() const noexcept { return *this; }
+
+  void reset() noexcept {
+    buckets_.fill(0);
+    count_ = sum_ = max_ = 0;
+  }
+
+  uint64_t bucket(unsigned idx) const noexcept { return buckets_[idx]; }
+  uint64_t count() const noexcept { return count_; }
+  uint64_t sum() const noexcept { return sum_; }
+  uint64_t max() const noexcept { return max_; }
+  uint64_t mean() const noexcept { return count_ ? sum_ / count_ : 0; }
+
+  /// Upper bound of the bucket holding the p-th percentile (0 < p <= 100).
+  uint64_t percentile(double p) const noexcept {
+    if (count_ == 0) {
+      return 0;
+    }
+    uint64_t rank = static_cast<uint64_t>(count_ * p / 100);
+    uint64_t seen = 0;
+    for (unsigned i = 0; i < nr_buckets; i++) {
+      seen += buckets_[i];
+      if (seen > rank || seen == count_) {
+        uint64_t upper = i + 1 < nr_buckets ? lower_bound(i + 1) - 1 : max_;
+        return upper < max_ ? upper : max_;
+      }
+    }
+    return max_;
+  }
+
+ private:
+  std::array<uint64_t, nr_buckets> buckets_{};
+  uint64_t count_{0};
+  uint64_t sum_{0};
+  uint64_t max_{0};
+};
+
+}  // namespace infgen
@@ -4,6 +4,11 @@
 #include "mepoll.h"
 #include "inet_addr.h"
 #include <time.h>
+
+#ifdef AES_GCM
+#include "ssl_layer.h"
+#endif
+
 namespace infgen {
 
 class mtcp_connection : public tcp_connection {
@@ -14,6 +19,8 @@ public:
   virtual bool send_packet(const void *data, std::size_t len) override;
   virtual bool send_packet(const std::string &data) override;
   virtual bool send_packet(const buffer &buf) override;
+  virtual bool send_payload(int id, std::size_t off, std::size_t len) override;
+  virtual size_t write_some(const void *data, std::size_t len) override;
 
   virtual void close() override;
   void handle_write(connptr con) override;
@@ -23,8 +30,20 @@ public:
 
 private:
   std::shared_ptr<pollable_fd> pfd_;
+#ifdef AES_GCM
+  // records are sealed into output_ and opened from cipher_in_ into input_;
+  // no more than max_sealed bytes wait there, the rest is a short write
+  static constexpr size_t max_sealed = 16 * ssl_layer::max_record;
+  std::unique_ptr<ssl_layer> ssl_;
+  buffer cipher_in_;
+  size_t flush();
+#endif
+  // bytes of the current mTCP receive buffer already presented to on_data
+  size_t presented_ = 0;
+  void read_in_place(connptr con);
   size_t send(const void *data, size_t len);
   void cleanup(connptr con);
   bool handle_handshake(connptr con);
+  unsigned syn_retries() override;
 };
 } // namespace infgen
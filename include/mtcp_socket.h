@@ -115,6 +115,16 @@ struct mtcp_socket {
     return r;
   }
 
+  // write of a payload registered with the stack, queued by reference
+  size_t write_payload(int payload, size_t off, size_t count) {
+    auto r = mtcp_write_payload(mctx, id, payload, off, count);
+    if (r == -1 && errno == EAGAIN) {
+      return 0;
+    }
+    throw_mtcp_error_on(r == -1, "mtcp write payload");
+    return r;
+  }
+
   std::optional<size_t> read(char *buf, size_t count) {
     auto r = mtcp_recv(mctx, id, buf, count, 0);
     if (r == -1 && errno == EAGAIN) {
@@ -124,6 +134,23 @@ struct mtcp_socket {
     return {size_t(r)};
   }
 
+  // zero-copy read: the bytes waiting in mTCP's receive buffer, valid until
+  // release(), which must come before the next read
+  std::optional<std::pair<const char *, size_t>> read_zc() {
+    char *buf = nullptr;
+    auto r = mtcp_recv_zc(mctx, id, &buf);
+    if (r == -1 && errno == EAGAIN) {
+      return {};
+    }
+    throw_mtcp_error_on(r == -1, "mtcp zero-copy read");
+    return std::make_pair(static_cast<const char *>(buf), size_t(r));
+  }
+
+  void release(size_t count) {
+    auto r = mtcp_recv_release(mctx, id, count);
+    throw_mtcp_error_on(r == -1, "mtcp release");
+  }
+
   void getsockname(int sockfd, struct sockaddr* addr) {
     socklen_t solen = sizeof(addr);
     auto r = mtcp_getsockname(mctx, sockfd, addr, &solen);
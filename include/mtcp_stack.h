@@ -1,6 +1,9 @@
 #pragma once
 #include "mtcp_api.h"
+#include "resource.h"
 #include <iostream>
+#include <string>
+#include <vector>
 
 namespace infgen {
 
@@ -15,17 +18,39 @@ public:
 
   unsigned cpu() { return cpu_id_; }
 
-  static void set_stack_cpus(unsigned n) {
+  /// Stack thread i runs on cpus[i], which must be ascending. False if the
+  /// highest cpu does not fit mTCP's core mask.
+  static bool set_stack_cpus(const std::vector<unsigned> &cpus) {
     mtcp_conf mcfg;
     mtcp_getconf(&mcfg);
-    mcfg.num_cores = n;
+    mcfg.num_cores = cpus.size();
+
+    // hex mask, lowest nibble last
+    std::vector<unsigned> nibbles(cpus.empty() ? 1 : cpus.back() / 4 + 1);
+    for (auto c : cpus) {
+      nibbles[c / 4] |= 1u << (c % 4);
+    }
+    std::string mask;
+    for (auto it = nibbles.rbegin(); it != nibbles.rend(); ++it) {
+      mask += "0123456789abcdef"[*it];
+    }
+    if (mask.size() >= MTCP_CORE_MASK_LEN) {
+      return false;
+    }
+    mask.copy(mcfg.core_mask, mask.size());
+    mcfg.core_mask[mask.size()] = '\0';
     mtcp_setconf(&mcfg);
+    return true;
   }
 
-  static void configure(boost::program_options::variables_map vm) {
-    auto nr_cpus = vm["smp"].as<unsigned>();
-    
-    set_stack_cpus(nr_cpus == 1? 1: nr_cpus-1);
+  static void configure(boost::program_options::variables_map vm,
+                        const resource::layout &layout) {
+    if (!set_stack_cpus(layout.stack)) {
+      std::cerr << "config error: stack cpu " << layout.stack.back()
+                << " is beyond mTCP's core mask ("
+                << (MTCP_CORE_MASK_LEN - 1) * 4 << " cpus)" << std::endl;
+      exit(-1);
+    }
 
     auto ret = mtcp_init("config/mtcp.conf");
     if (ret < 0) {
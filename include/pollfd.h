@@ -21,6 +21,12 @@ struct poll_state {
 
   int events_epoll = 0;
   int events_requested = 0;
+  // edges that arrived while not requested (edge-triggered epoll)
+  int events_ready = 0;
+  // position in the backend's list of pending changes, -1 if none
+  int dirty = -1;
+  // the owner reads and writes until EAGAIN on every event
+  bool edge = false;
 
   eventfunc pollin;
   eventfunc pollout;
@@ -50,6 +56,11 @@ public:
     state_->pollin = std::forward<Func>(func);
   }
 
+  /// Promises that every callback reads or writes until EAGAIN, which
+  /// lets an edge-triggered backend register the fd once and for all. Set
+  /// before attach_to_loop().
+  void set_edge_triggered(bool on) { state_->edge = on; }
+
   void enable_read() { update_state(EPOLLIN); }
   void enable_write() { update_state(EPOLLOUT); }
 
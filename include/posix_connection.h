@@ -13,6 +13,8 @@ public:
   virtual bool send_packet(const void *data, std::size_t len) override;
   virtual bool send_packet(const std::string &data) override;
   virtual bool send_packet(const buffer &buf) override;
+  virtual bool send_payload(int id, std::size_t off, std::size_t len) override;
+  virtual size_t write_some(const void *data, std::size_t len) override;
   void attach(int fd, socket_address local, socket_address peer);
   void reconnect() override;
   virtual void close() override;
@@ -22,7 +24,9 @@ public:
 private:
   std::shared_ptr<pollable_fd> pfd_;
   void cleanup(connptr con);
+  void flush(connptr con);
   size_t send(const void *data, size_t len);
   bool handle_handshake(connptr con);
+  unsigned syn_retries() override;
 };
 } // namespace infgen
@@ -30,7 +30,7 @@ public:
   virtual void reconnect(connptr conn) override;
   static uint64_t nr_conns_;
 
-private:
+protected:
   addr_pool addrs_;
   bool no_delay_;
   socket_address fetch_address();
@@ -0,0 +1,93 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <string>
+
+namespace infgen {
+
+using namespace std::chrono;
+
+/// Fleet-wide ramp: total units of load (e.g. connections) are brought up
+/// over duration, either one at a time at a constant rate (linear) or in
+/// equal steps (staircase).
+///
+/// Unit g of the fleet belongs to worker g % workers and, on that worker, to
+/// core (g / workers) % cores. Every shard walks its own units in order and
+/// starts each one at offset(g) from the common start time, so whatever the
+/// number of workers and cores, the sum over the fleet follows the ramp as
+/// if a single loader ran it.
+class ramp {
+ public:
+  enum class shape { linear, staircase };
+
+  ramp() = default;
+  ramp(shape s, uint64_t total, microseconds duration, unsigned steps = 1)
+      : shape_(s), total_(total), duration_(duration), steps_(steps ? steps : 1) {}
+
+  static bool parse(const std::string& name, shape& s) {
+    if (name == "linear") {
+      s = shape::linear;
+    } else if (name == "staircase") {
+      s = shape::staircase;
+    } else {
+      return false;
+    }
+    return true;
+  }
+
+  /// When unit g starts, relative to the start of the ramp.
+  microseconds offset(uint64_t g) const {
+    if (total_ == 0 || g >= total_) {
+      return duration_;
+    }
+    auto d = static_cast<unsigned __int128>(duration_.count());
+    if (shape_ == shape::linear) {
+      return microseconds(static_cast<int64_t>(d * g / total_));
+    }
+    uint64_t step = static_cast<unsigned __int128>(g) * steps_ / total_;
+    return microseconds(static_cast<int64_t>(d * step / steps_));
+  }
+
+  uint64_t total() const { return total_; }
+  microseconds duration() const { return duration_; }
+
+ private:
+  shape shape_{shape::staircase};
+  uint64_t total_{0};
+  microseconds duration_{0};
+  unsigned steps_{1};
+};
+
+/// Cursor over the units of one (worker, core) shard of a ramp.
+class ramp_shard {
+ public:
+  ramp_shard() = default;
+  ramp_shard(const ramp& r, unsigned worker, unsigned workers, unsigned core, unsigned cores)
+      : ramp_(r),
+        next_(worker + static_cast<uint64_t>(workers) * core),
+        stride_(static_cast<uint64_t>(workers) * cores) {}
+
+  bool done() const { return next_ >= ramp_.total(); }
+  /// Offset of the next unit of this shard from the start of the ramp.
+  microseconds due() const { return ramp_.offset(next_); }
+  uint64_t next() {
+    auto g = next_;
+    next_ += stride_;
+    return g;
+  }
+  /// Pass over n units, e.g. those already up under a previous ramp.
+  void skip(uint64_t n) { next_ += n * stride_; }
+
+  /// Number of units left in the shard.
+  uint64_t size() const {
+    return done() ? 0 : (ramp_.total() - next_ + stride_ - 1) / stride_;
+  }
+
+ private:
+  ramp ramp_;
+  uint64_t next_{0};
+  uint64_t stride_{1};
+};
+
+}  // namespace infgen
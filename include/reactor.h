@@ -5,9 +5,12 @@
 #include <queue>
 #include <thread>
 #include <atomic>
+#include <string_view>
 
+#include "connect_scheduler.h"
 #include "connection.h"
 #include "mtcp_stack.h"
+#include "reconnect_manager.h"
 #include "thread.h"
 #include "timer.h"
 //@wuwenqing
@@ -45,6 +48,8 @@ private:
   class epoll_pollfn;
   class mtcp_pollfn;
   class signal_pollfn;
+  class connect_pollfn;
+  class reconnect_pollfn;
 
   void register_poller(pollfn *p);
   void unregister_poller(pollfn *p);
@@ -104,30 +109,34 @@ public:
   bool mtcp_bind_;
 
 public:
-  /// Timer related APIs.
+  /// Timer related APIs. The returned id can be passed to cancel_task().
   template <int RepeatCount, typename Duration, typename Func>
-  void add_periodic_task_at(const system_clock::time_point &trigger_time,
-                            const Duration &peroid, Func &&f) {
-    tm_.schedule_at_with_repeat<RepeatCount>(trigger_time, peroid,
-                                             std::forward<Func>(f));
+  timer_id add_periodic_task_at(const system_clock::time_point &trigger_time,
+                                const Duration &peroid, Func &&f) {
+    return tm_.schedule_at_with_repeat<RepeatCount>(trigger_time, peroid,
+                                                    std::forward<Func>(f));
   }
 
   template <int RepeatCount, typename Duration, typename Func>
-  void add_periodic_task_after(const Duration &duration, Func &&f) {
-    tm_.schedule_after_with_repeat<RepeatCount>(duration,
-                                                std::forward<Func>(f));
+  timer_id add_periodic_task_after(const Duration &duration, Func &&f) {
+    return tm_.schedule_after_with_repeat<RepeatCount>(duration,
+                                                       std::forward<Func>(f));
   }
 
   template <typename Func>
-  void add_oneshot_task_at(const system_clock::time_point &trigger_time, Func &&f) {
-    tm_.schedule_at(trigger_time, std::forward<Func>(f));
+  timer_id add_oneshot_task_at(const system_clock::time_point &trigger_time, Func &&f) {
+    return tm_.schedule_at(trigger_time, std::forward<Func>(f));
   }
 
   template <typename Duration, typename Func>
-  void add_oneshot_task_after(const Duration &duration, Func &&f) {
-    tm_.schedule_after(duration, std::forward<Func>(f));
+  timer_id add_oneshot_task_after(const Duration &duration, Func &&f) {
+    return tm_.schedule_after(duration, std::forward<Func>(f));
   }
 
+  /// Stop a task from firing again, a task may cancel itself. Returns false
+  /// if it is not pending (anymore).
+  bool cancel_task(const timer_id &id) { return tm_.cancel(id); }
+
   /// mTCP Timer related APIs.
 
   template <typename Func>
@@ -138,6 +147,12 @@ public:
 
   /// Connection related APIs
   connptr connect(socket_address sa, socket_address local = socket_address{});
+  /// Connects to a destination of --servers drawn by weight.
+  connptr connect();
+  /// Paces connection setup, see --connect-rate.
+  connect_scheduler &connects() { return connects_; }
+  /// Retries lost connections with backoff, see --reconnect-base.
+  reconnect_manager &reconnects() { return reconnects_; }
   void reconnect(connptr conn);
 
   /// Event I/O related APIs
@@ -154,7 +169,21 @@ public:
 
   bool ready() { return ready_; }
 
+  /// Payloads sent over and over, e.g. request templates, are registered
+  /// once per engine and sent with tcp_connection::send_payload(). The
+  /// bytes must stay valid and unchanged while the engine runs.
+  int register_payload(const void *data, size_t len);
+  std::string_view payload(int id) const { return payloads_[id].data; }
+  /// The id mTCP knows the payload by, -1 if the stack copies it.
+  int stack_payload(int id) const { return payloads_[id].stack_id; }
+
 private:
+  struct registered_payload {
+    std::string_view data;
+    int stack_id;
+  };
+  std::vector<registered_payload> payloads_;
+
   bool stopping_ { false };
   bool ready_ { false };
   unsigned id_;
@@ -162,6 +191,8 @@ private:
   std::queue<std::unique_ptr<task>> task_queue_;
   std::unique_ptr<backend> backend_;
   std::unique_ptr<connector> connector_;
+  connect_scheduler connects_;
+  reconnect_manager reconnects_;
   std::optional<poller> epoll_poller_{};
   friend class smp;
 
@@ -177,7 +208,7 @@ private:
 
 public:
   mctx_t context() { return mctx_; }
-	mbedtls_gcm_context ssl_context() { return sctx_; }
+	mbedtls_gcm_context &ssl_context() { return sctx_; }
 
 public:
   void add_task(std::unique_ptr<task> &&t) { task_queue_.push(std::move(t)); }
@@ -0,0 +1,99 @@
+#pragma once
+
+#include "connector.h"
+#include "histogram.h"
+
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <vector>
+
+namespace infgen {
+
+using namespace std::chrono;
+
+/// Retries lost connections of one reactor.
+///
+/// The n-th retry of a connection waits base * 2^(n-1), capped at max, of
+/// which a jitter share is drawn at random, so connections dropped together
+/// come back spread out instead of in lockstep. Waiting connections sit in
+/// a timer wheel polled by the event loop, there is no timer per
+/// connection. Due retries are released at no more than rate per second.
+///
+/// An outage (a "storm") lasts from the first connection lost while all
+/// were up until every lost connection is established again or given up;
+/// its duration is the time to recover.
+class reconnect_manager {
+ public:
+  struct config {
+    milliseconds base{1000};
+    milliseconds max{30000};
+    double jitter{0.5};   // share of the delay that is random, 0..1
+    double rate{0};       // retries/s, 0: no cap
+  };
+
+  struct stats {
+    uint64_t scheduled{0};    // retries scheduled
+    uint64_t reopened{0};     // reconnects after an orderly close
+    uint64_t issued{0};       // retries and reopens started
+    uint64_t throttled{0};    // retries that waited for the rate cap
+    uint64_t recovered{0};    // connections established again
+    uint64_t dropped{0};      // closed while being retried
+    uint64_t storms{0};
+    uint64_t largest_storm{0};   // most connections down at once
+    histogram recovery;          // time to recover per storm, in ms
+  };
+
+  void configure(const config& c) { cfg_ = c; }
+
+  /// Reconnects conn after its backoff, unless it is closed by then.
+  bool schedule(const connptr& conn);
+
+  /// For disconnect handlers: an orderly close by the peer is ordinary
+  /// churn (keep-alive limits, responses delimited by EOF) and reconnects
+  /// on the next poll, an error is retried after the backoff. A connection
+  /// gets one such attempt per base interval; closed again sooner, or
+  /// refused, it backs off like any other.
+  bool disconnected(const connptr& conn);
+
+  /// Starts the retries due, called once per loop iteration.
+  bool poll();
+
+  /// Connections lost and not yet back.
+  uint64_t down() const { return down_; }
+  const stats& get_stats() const { return stats_; }
+
+  /// See tcp_connection.
+  void recovered(tcp_connection& c);
+  void dropped(tcp_connection& c);
+
+ private:
+  static constexpr unsigned nr_slots = 1024;
+  static constexpr milliseconds tick{10};
+
+  struct entry {
+    connptr conn;
+    uint32_t rounds;   // turns of the wheel left
+  };
+
+  milliseconds backoff(unsigned attempt);
+  void leave(tcp_connection& c);
+
+  config cfg_;
+  std::array<std::vector<entry>, nr_slots> wheel_;
+  unsigned cursor_{0};
+  uint64_t waiting_{0};
+  steady_clock::time_point tick_tp_{};
+  std::deque<connptr> due_;
+  double tokens_{0};
+  steady_clock::time_point last_{};
+  uint64_t rng_{0x9e3779b97f4a7c15ULL};
+
+  uint64_t down_{0};
+  steady_clock::time_point storm_tp_{};
+  uint64_t storm_peak_{0};
+  stats stats_;
+};
+
+} // namespace infgen
@@ -3,12 +3,16 @@
 #include <vector>
 #include <set>
 #include <optional>
+#include <string>
 
 namespace infgen {
 namespace resource {
 
 using cpuset = std::set<unsigned>;
 
+/// Parses a cpu list as used by /sys and --cpuset, e.g. "0-3,8,10-11".
+cpuset parse_cpuset(const std::string& s);
+
 struct configuration {
   std::optional<size_t> cpus;
   std::optional<cpuset> cpu_set;
@@ -16,14 +20,51 @@ struct configuration {
 
 struct cpu {
   unsigned cpu_id;
+  unsigned package{0};
+  unsigned core{0};   // core id within the package, shared by SMT siblings
+  int node{-1};       // NUMA node, -1 if unknown
 };
 
 struct resources {
   std::vector<cpu> cpus;
 };
 
+/// The online cpus of this machine, read from /sys, ascending.
+resources read_topology();
+
 resources allocate(configuration c);
 unsigned nr_processing_units();
 
+int node_of_cpu(unsigned cpu_id);
+/// NUMA node of a network device, -1 if unknown.
+int node_of_device(const std::string& dev);
+
+/// What needs a cpu.
+struct placement_request {
+  configuration conf;
+  unsigned reactors{1};
+  bool mtcp{false};        // reactors own an mTCP stack thread each, reactor 0
+                           // only distributes when there are several
+  bool io_thread{false};   // extra I/O thread (non-normal mTCP modes)
+  int nic_node{-1};
+};
+
+/// Where every thread of the process runs.
+struct layout {
+  std::vector<unsigned> app;    // thread of each reactor
+  std::vector<unsigned> stack;  // mTCP stack thread of each NIC queue, ascending
+  std::optional<unsigned> io;
+  int nic_node{-1};
+  bool shared{false};           // more threads than cpus
+};
+
+/// Places the stack thread of every NIC queue and its app thread on SMT
+/// siblings of one physical core, on the NIC's node first, then the I/O
+/// thread, the distributor and plain reactors one per physical core as
+/// long as there are free ones.
+layout place(const resources& topo, const placement_request& req);
+
+std::string describe(const layout& l, const resources& topo);
+
 } // namespace resource
 } // namespace infgen
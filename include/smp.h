@@ -5,6 +5,7 @@
 
 #include "reactor.h"
 #include "log.h"
+#include "resource.h"
 
 namespace infgen {
 
@@ -151,6 +152,7 @@ class smp {
   static std::vector<reactor *> reactors_;
   static std::thread::id tmain_;
   static std::atomic<unsigned> ready_engines_;
+  static resource::layout layout_;
   // use deque instead of vector to avoid memory relocation
   static std::deque<std::deque<smp_message_queue>> qs_;
 
@@ -160,11 +162,17 @@ public:
   static void cleanup();
   static void join_all();
   static bool main_thread() { return std::this_thread::get_id() == tmain_; }
+  /// The cpus chosen for every reactor, stack and I/O thread.
+  static const resource::layout &layout() { return layout_; }
   static bool ready() {
     auto engines = ready_engines_.load(std::memory_order_relaxed);
     return engines >= smp::count;
   }
 
+  /// Runs func on engine t, and the callback, if any, back on the caller.
+  /// When t is the calling engine both run inline, ahead of whatever other
+  /// engines queued to t before; only submissions from one engine to
+  /// another keep their order.
   template <typename Func> static void submit_to(unsigned t, Func &&func) {
     if (t == engine().cpu_id()) {
       func();
@@ -184,9 +192,20 @@ public:
   }
 
   template <typename Func>
-  static void submit_to(unsigned t, Func &&func, std::function<void(unsigned)>&& cb) {
+  static void submit_to(unsigned t, Func &&func, std::function<void(uint64_t)>&& cb) {
     if (t == engine().cpu_id()) {
-      func();
+      cb(func());
+    } else {
+      qs_[t][engine().cpu_id()].submit(std::forward<Func>(func), std::move(cb));
+    }
+  }
+
+  /// Same as above for results of any copyable type, the callback has to be
+  /// passed as a std::function so that T can be deduced.
+  template <typename Func, typename T>
+  static void submit_to(unsigned t, Func &&func, std::function<void(T)>&& cb) {
+    if (t == engine().cpu_id()) {
+      cb(func());
     } else {
       qs_[t][engine().cpu_id()].submit(std::forward<Func>(func), std::move(cb));
     }
@@ -1,35 +1,67 @@
 #pragma once
 
+#include "buffer.h"
 #include "gcm.h"
 
+#include <sys/uio.h>
+
+#include <array>
 #include <functional>
 #include <memory>
 #include <optional>
+#include <vector>
 
 namespace infgen {
 
+// AES-256-GCM record layer of one connection.
+//
+// Records look like TLS 1.3 application data:
+//   0x17 0x03 0x03 | length (2 bytes, BE) | ciphertext | 16-byte tag
+// where length covers ciphertext and tag, the 5-byte header is the
+// additional data and the nonce is the static IV XORed with a per-direction
+// record sequence number. Records may span many segments; the receive side
+// reassembles them from the byte stream.
+//
+// The key schedule is shared by all connections of a reactor and held by
+// reference; only the sequence numbers are per connection.
 class ssl_layer {
 public:
-	mbedtls_gcm_context sctx_;
+	static constexpr size_t header_len = 5;
+	static constexpr size_t tag_len = 16;
+	static constexpr size_t overhead = header_len + tag_len;
+	static constexpr size_t max_record = 16384;
 
-	ssl_layer() {}
-	ssl_layer(mbedtls_gcm_context sctx) : sctx_(sctx) {}
+	explicit ssl_layer(mbedtls_gcm_context &ctx) : ctx_(ctx) {}
 
-	ssl_layer(const ssl_layer &s) : sctx_(s.sctx_) {};
-	ssl_layer(ssl_layer &&s) : sctx_(s.sctx_) {
-		mbedtls_gcm_free(&s.sctx_);
-	}
-	
-	
-	void operator=(const ssl_layer&) = delete;
-	ssl_layer& operator=(const ssl_layer&&s) {
-		if (this != &s) {
-			sctx_ = s.sctx_;
-		}
-		return *this;
+	ssl_layer(const ssl_layer &) = delete;
+	ssl_layer &operator=(const ssl_layer &) = delete;
+
+	// Seal len bytes as one or more records appended to out. The cipher
+	// writes straight into out, no intermediate copy is made; several
+	// records go through seal_batch().
+	// Returns the number of bytes appended.
+	size_t seal(const void *data, size_t len, buffer &out);
+
+	// Seal every iovec as its own record(s) in one pass over the key
+	// stream, which is much cheaper than sealing small messages one by one.
+	size_t seal_batch(const struct iovec *iov, size_t n, buffer &out);
+
+	// Open all complete records at the head of in, appending plaintext to
+	// out and consuming them from in; a partial record is left in place.
+	// Returns the number of plaintext bytes, or nullopt if a record is
+	// malformed or fails authentication.
+	std::optional<size_t> open(buffer &in, buffer &out);
+
+	static size_t sealed_size(size_t len) {
+		return len + (len / max_record + (len % max_record != 0)) * overhead;
 	}
 
-	mbedtls_gcm_context context() const { return sctx_; }
+	// The most plaintext whose records fit in room bytes.
+	static size_t sealable(size_t room) {
+		size_t rest = room % (max_record + overhead);
+		return room / (max_record + overhead) * max_record +
+			(rest > overhead ? rest - overhead : 0);
+	}
 
 	static void ssl_init(mbedtls_gcm_context &ctx);
 
@@ -40,14 +72,23 @@ public:
 	static void ssl_destroy(mbedtls_gcm_context &ctx) {
 #ifdef AES_GCM
 		// Free gcm context
-		mbedtls_gcm_free(&ctx);	
+		mbedtls_gcm_free(&ctx);
 #endif
-	} 
+	}
+
+private:
+	using nonce_t = std::array<unsigned char, 12>;
 
-	static void ssl_encrypt(mbedtls_gcm_context ctx, const unsigned char *data, unsigned char* ciphertext, size_t len); 
+	static nonce_t make_nonce(uint64_t seq);
+	static void put_header(char *p, size_t len);
 
-	static std::optional<size_t> ssl_decrypt(mbedtls_gcm_context ctx, const unsigned char *data, unsigned char* plaintext, size_t len); 
+	mbedtls_gcm_context &ctx_;
+	uint64_t tx_seq_ = 0;
+	uint64_t rx_seq_ = 0;
 
+	// scratch space of seal_batch(), kept to avoid allocating per call
+	std::vector<mbedtls_gcm_batch_entry> batch_;
+	std::vector<nonce_t> nonces_;
 };
 
 }
@@ -3,6 +3,8 @@
 #include "posix_connection.h"
 #include "pollfd.h"
 
+#include <vector>
+
 namespace infgen {
 
 class tcp_server;
@@ -14,6 +16,10 @@ class tcp_server {
   tcp_server();
   ~tcp_server();
   bool bind(const socket_address& sa, bool reuse_port = false);
+  /// Serves on fd, a socket already listening on sa.
+  bool serve(file_desc fd, const socket_address& sa);
+  /// Stops listening, accepted connections are left alone.
+  void close();
   static svrptr create_tcp_server(const socket_address& sa,
                                   bool reuse_port = false);
   void when_arrived(const std::function<connptr()>& cb) { createcb_ = cb; }
@@ -27,6 +33,7 @@ class tcp_server {
 
   void on_message(const msg_callback& cb) { msgcb_ = cb; }
 
+  uint64_t accepted() const { return accepted_; }
 
  private:
   socket_address local_;
@@ -35,7 +42,50 @@ class tcp_server {
   std::function<connptr()> createcb_;
   connfunc readycb_, failedcb_, readcb_, disconnect_cb_;
   msg_callback msgcb_;
+  uint64_t accepted_{0};
 
   void accept();
 };
+
+class sharded_tcp_server;
+using sharded_svrptr = std::shared_ptr<sharded_tcp_server>;
+
+/// A tcp_server on every reactor, each with a listener of its own in one
+/// SO_REUSEPORT group: the kernel spreads the incoming connections over
+/// the listeners and a connection stays on the reactor that accepted it.
+///
+/// By default the kernel picks the listener by a hash of the 4-tuple. With
+/// steer, a classic BPF program picks the listener of the reactor running
+/// on the cpu that received the SYN instead, so that with RSS or RPS
+/// spreading flows over the reactors' cpus a connection is processed on
+/// one cpu from the NIC up. SYNs received elsewhere fall back to the hash.
+///
+/// Kernel stacks only (kernel, uring).
+class sharded_tcp_server : public std::enable_shared_from_this<sharded_tcp_server> {
+ public:
+  using setup_func = std::function<void(tcp_server&)>;
+
+  /// Listens on sa from all reactors. setup installs the callbacks of each
+  /// shard, on the shard's reactor, ready runs on the calling reactor once
+  /// all of them accept. Returns nullptr if the listeners cannot be set up.
+  static sharded_svrptr listen(const socket_address& sa, setup_func setup,
+                               bool steer = false,
+                               std::function<void()> ready = nullptr);
+
+  /// Stops listening on all reactors, done runs on the calling reactor
+  /// with the number of connections each of them accepted.
+  void close(std::function<void(std::vector<uint64_t>)> done = nullptr);
+
+  unsigned shards() const { return shards_.size(); }
+
+ private:
+  explicit sharded_tcp_server(const socket_address& sa) : local_(sa) {}
+  static bool steer_by_cpu(int fd);
+
+  socket_address local_;
+  // indexed by reactor, each one touched by its own reactor only
+  std::vector<svrptr> shards_;
+  std::vector<uint64_t> accepted_;
+  unsigned pending_{0};
+};
 }  // namespace infgen
@@ -29,7 +29,8 @@ public:
 
   void tick();
   size_t size();
-  bool cancel(timer_id id);
+  // Keep a timer from firing again, also from within its own callback.
+  bool cancel(const timer_id &id);
 
   microseconds latest_timeout() const;
 
@@ -78,6 +79,9 @@ private:
   };
 
   std::multimap<system_clock::time_point, timer> timers_;
+  // the timer being fired, it is out of timers_ while its callback runs
+  timer_id firing_;
+  bool firing_cancelled_{false};
   static uint64_t g_timer_id;
 };
 
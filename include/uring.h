@@ -0,0 +1,158 @@
+#pragma once
+
+#include "buffer.h"
+#include "inet_addr.h"
+#include "pollfd.h"
+#include "reactor.h"
+
+#include <linux/io_uring.h>
+
+#include <cstdint>
+#include <deque>
+#include <unordered_map>
+#include <vector>
+
+namespace infgen {
+
+/// Completions of a socket driven through the ring, see uring_backend.
+class uring_handler {
+public:
+  virtual ~uring_handler() {}
+  /// res is 0 or -errno.
+  virtual void on_connected(int res) = 0;
+  /// res bytes at data, 0 on EOF, -errno on error.
+  virtual void on_received(const char *data, int res) = 0;
+  /// res bytes sent (the backend resends short writes), -errno on error.
+  virtual void on_sent(int res) = 0;
+};
+
+/// io_uring backend of the kernel stack.
+///
+/// Sockets attached with attach() skip readiness altogether: connect() and
+/// send() queue requests, a multishot recv fills buffers the kernel picks
+/// from a provided buffer ring. Requests queued during a loop iteration are
+/// submitted together by poll(), with one io_uring_enter, which also picks
+/// up the completions. Plain pollable_fds (listeners, posix_connection) are
+/// served with oneshot poll requests through the backend interface.
+///
+/// Needs Linux 6.0 or later.
+class uring_backend : public backend {
+public:
+  struct config {
+    unsigned entries{4096};       // submission queue depth
+    unsigned buffers{4096};       // receive buffers, rounded up to a power of 2
+    unsigned buffer_size{4096};
+  };
+
+  struct stats {
+    uint64_t enters{0};          // io_uring_enter calls
+    uint64_t requests{0};
+    uint64_t completions{0};
+    uint64_t no_buffers{0};      // recvs stopped for want of a buffer
+  };
+
+  /// A socket known to the ring, it outlives its handler until the
+  /// requests in flight have completed.
+  struct sock;
+
+  explicit uring_backend(const config &cfg);
+  virtual ~uring_backend() override;
+
+  virtual bool poll(int timeout) override;
+  virtual void update(poll_state &state, int event) override;
+  virtual void forget(poll_state &state) override;
+
+  /// Takes over fd, h gets its completions until close().
+  sock *attach(int fd, uring_handler &h);
+  void connect(sock *s, const socket_address &peer);
+  /// Keeps receiving until EOF, an error or close().
+  void recv(sock *s);
+  /// Sends are issued one at a time and in order. data is copied unless
+  /// stable, i.e. valid and unchanged as long as the engine runs.
+  void send(sock *s, const void *data, size_t len, bool stable = false);
+  /// No more completions are handed out, what was passed to send() still
+  /// goes out. The fd is closed once the kernel is done with it, so its
+  /// number is not reused under a pending request.
+  void close(sock *s);
+
+  const stats &get_stats() const { return stats_; }
+
+private:
+  enum op : uint64_t {
+    op_cancel = 0,
+    op_poll_in,
+    op_poll_out,
+    op_connect,
+    op_recv,
+    op_send,
+  };
+  static constexpr uint64_t op_mask = 7;
+
+  io_uring_sqe *get_sqe();
+  void queue(sock *s, op o, io_uring_sqe *sqe);
+  void cancel(sock *s, op o);
+  void arm_poll(sock *s, op o);
+  void submit_send(sock *s);
+  int enter(unsigned to_submit, unsigned min_complete, int timeout);
+  unsigned reap();
+  void complete(sock *s, op o, int res, uint32_t flags);
+  void recycle(uint16_t bid);
+  sock *get_sock(int fd);
+  void put_sock(sock *s);
+
+  int ring_fd_{-1};
+  unsigned features_{0};
+
+  // submission queue
+  void *sq_ptr_{nullptr};
+  size_t sq_len_{0};
+  unsigned *sq_head_, *sq_tail_, *sq_mask_, *sq_flags_;
+  unsigned sq_entries_;
+  io_uring_sqe *sqes_{nullptr};
+  size_t sqes_len_{0};
+  unsigned sq_local_tail_{0};
+  unsigned to_submit_{0};
+
+  // completion queue
+  void *cq_ptr_{nullptr};
+  size_t cq_len_{0};
+  unsigned *cq_head_, *cq_tail_, *cq_mask_;
+  io_uring_cqe *cqes_;
+
+  // provided receive buffers
+  static constexpr uint16_t buffer_group = 0;
+  io_uring_buf_ring *buf_ring_{nullptr};
+  size_t buf_ring_len_{0};
+  char *buf_base_{nullptr};
+  size_t buf_len_{0};
+  unsigned nr_bufs_;
+  unsigned buf_size_;
+  uint16_t buf_tail_{0};
+
+  std::deque<sock> socks_;
+  std::vector<sock *> free_socks_;
+  std::unordered_map<poll_state *, sock *> polled_;
+  bool reaping_{false};
+  stats stats_;
+};
+
+struct uring_backend::sock {
+  int fd{-1};
+  bool owns_fd{false};
+  uring_handler *handler{nullptr};
+  poll_state *state{nullptr};
+  unsigned inflight{0};
+  unsigned armed{0};        // bit per op in flight
+  bool closing{false};
+
+  sockaddr_storage peer;
+  socklen_t peer_len{0};
+
+  // the kernel reads out_[sending], send() appends to the other one
+  buffer out_[2];
+  unsigned sending{0};
+  const char *send_ptr{nullptr};
+  size_t send_left{0};
+};
+
+} // namespace infgen
@@ -0,0 +1,38 @@
+#pragma once
+
+#include "connection.h"
+#include "inet_addr.h"
+#include "uring.h"
+
+namespace infgen {
+
+/// Client connection of the uring stack: connect, sends and receives are
+/// requests on the reactor's ring, there is no readiness step.
+class uring_connection : public tcp_connection, public uring_handler {
+public:
+  explicit uring_connection(uring_backend &ring);
+  ~uring_connection();
+  virtual bool send_packet(const void *data, std::size_t len) override;
+  virtual bool send_packet(const std::string &data) override;
+  virtual bool send_packet(const buffer &buf) override;
+  virtual bool send_payload(int id, std::size_t off, std::size_t len) override;
+  virtual size_t write_some(const void *data, std::size_t len) override;
+  /// Takes over fd, a socket bound to local, and starts connecting to peer.
+  void attach(int fd, socket_address local, socket_address peer) override;
+  void reconnect() override;
+  virtual void close() override;
+  // completions come through uring_handler
+  void handle_write(connptr con) override {}
+  void handle_read(connptr con) override {}
+
+  void on_connected(int res) override;
+  void on_received(const char *data, int res) override;
+  void on_sent(int res) override;
+
+private:
+  uring_backend &ring_;
+  uring_backend::sock *sock_{nullptr};
+  void cleanup(connptr con);
+  unsigned syn_retries() override;
+};
+} // namespace infgen
@@ -0,0 +1,21 @@
+#pragma once
+
+#include "posix_connector.h"
+#include "uring.h"
+
+namespace infgen {
+
+/// Connects through the reactor's ring: socket() and bind() are still
+/// plain calls, the connects of a loop iteration are submitted together.
+class uring_connector : public posix_connector {
+public:
+  explicit uring_connector(uring_backend &ring) : ring_(ring) {}
+  virtual connptr connect(socket_address sa, socket_address local) override;
+  virtual void reconnect(connptr conn) override;
+
+private:
+  uring_backend &ring_;
+  file_desc open_socket(socket_address peer, socket_address &local);
+};
+
+} // namespace infgen
@@ -17,6 +17,28 @@ struct addr_map
 	struct addr_entry *addrmap[MAX_PORT];
 };
 /*----------------------------------------------------------------------------*/
+/* The per-core (RSS) pool keeps one bit per (source address, port) pair.     */
+/* A set bit means that the pair hashes to this core and is free to use.      */
+/* Words are populated lazily, so RSS hashes are only computed for the part   */
+/* of the port space that is actually needed.                                 */
+/*----------------------------------------------------------------------------*/
+#define PORT_BITS		64
+#define WORDS_PER_ADDR		((MAX_PORT) / PORT_BITS)
+/*----------------------------------------------------------------------------*/
+/* Above the bitmap sit summary levels: bit i of level 0 is set while word i  */
+/* of the bitmap may hold a free port, bit i of level l + 1 while word i of   */
+/* level l is non-zero. The top level is a single word, so finding a free     */
+/* port takes one ctz per level, whatever the size of the pool.               */
+/* Freers set bits bottom up. Only the fetcher clears them, and it re-checks  */
+/* the level below after every clear, so a concurrent free is never hidden.   */
+/*----------------------------------------------------------------------------*/
+#define SUMMARY_LEVELS		4
+/*----------------------------------------------------------------------------*/
+/* Pools of several destinations hang off a fixed hash index, so connect and  */
+/* close find theirs in one bucket whatever the number of destinations.       */
+/*----------------------------------------------------------------------------*/
+#define AP_INDEX_BUCKETS	256		/* power of two */
+/*----------------------------------------------------------------------------*/
 struct addr_pool
 {
 	struct addr_entry *pool;		/* address pool */
@@ -32,6 +54,35 @@ struct addr_pool
 	pthread_mutex_t lock;
 	TAILQ_HEAD(, addr_entry) free_list;
 	TAILQ_HEAD(, addr_entry) used_list;
+
+	/* per-core RSS pool (lock-free, see FetchAddressPerCore()) */
+	int per_core;
+	int core;
+	int num_queues;
+	uint32_t daddr_h;
+	uint16_t dport_h;
+	uint8_t endian_check;
+
+	uint64_t *free_map;				/* one bit per (addr, port) */
+	int num_words;
+	int scan_word;					/* next word to populate */
+	int alloc_word;					/* allocation cursor */
+	uint64_t *summary[SUMMARY_LEVELS];
+	int summary_bits[SUMMARY_LEVELS];
+	int levels;
+
+	struct addr_pool *next;			/* next pool in the index bucket */
+	struct addr_pool *next_retired;	/* next pool in the retired list */
+};
+/*----------------------------------------------------------------------------*/
+/* The stack thread looks pools up while the application adds them, so a     */
+/* pool is published with a single store and one it replaces is only retired, */
+/* freed with the index.                                                      */
+/*----------------------------------------------------------------------------*/
+struct addr_pool_index
+{
+	struct addr_pool *bucket[AP_INDEX_BUCKETS];
+	struct addr_pool *retired;
 };
 /*----------------------------------------------------------------------------*/
 addr_pool_t 
@@ -106,102 +157,316 @@ CreateAddressPoolPerCore(int core, int num_queues,
 		in_addr_t saddr_base, int num_addr, in_addr_t daddr, in_port_t dport)
 {
 	struct addr_pool *ap;
-	int num_entry;
-	int i, j, cnt;
-	in_addr_t saddr;
-	uint32_t saddr_h, daddr_h;
-	uint16_t sport_h, dport_h;
-	int rss_core;
-	int flag;
-#if 0
-	uint8_t endian_check = (current_iomodule_func == &dpdk_module_func) ?
-		0 : 1;
-#else
-	uint8_t endian_check = FetchEndianType();	
-#endif
+	int num_entry, bits, words;
 
 	ap = (addr_pool_t)calloc(1, sizeof(struct addr_pool));
 	if (!ap)
 		return NULL;
 
-	/* initialize address pool */
-	num_entry = (num_addr * (MAX_PORT - MIN_PORT)) / num_queues;
-	ap->pool = (struct addr_entry *)calloc(num_entry, sizeof(struct addr_entry));
-	if (!ap->pool) {
+	/* the bitmap is zero-filled and only touched when a word gets 
+	   populated, so untouched parts of the port space cost no memory */
+	ap->num_words = num_addr * WORDS_PER_ADDR;
+	ap->free_map = (uint64_t *)calloc(ap->num_words, sizeof(uint64_t));
+	if (!ap->free_map) {
 		free(ap);
 		return NULL;
 	}
-	
-	/* initialize address map */
-	ap->mapper = (struct addr_map *)calloc(num_addr, sizeof(struct addr_map));
-	if (!ap->mapper) {
-		free(ap->pool);
-		free(ap);
-		return NULL;
+
+	ap->per_core = TRUE;
+	for (bits = ap->num_words; ; bits = words) {
+		if (ap->levels == SUMMARY_LEVELS) {
+			TRACE_ERROR("Too many source addresses for the address pool: %d\n", 
+					num_addr);
+			DestroyAddressPool(ap);
+			return NULL;
+		}
+		words = (bits + PORT_BITS - 1) / PORT_BITS;
+		ap->summary[ap->levels] = (uint64_t *)calloc(words, sizeof(uint64_t));
+		if (!ap->summary[ap->levels]) {
+			DestroyAddressPool(ap);
+			return NULL;
+		}
+		ap->summary_bits[ap->levels++] = bits;
+		if (words == 1)
+			break;
 	}
 
-	TAILQ_INIT(&ap->free_list);
-	TAILQ_INIT(&ap->used_list);
+	ap->core = core;
+	ap->num_queues = num_queues;
+	ap->addr_base = ntohl(saddr_base);
+	ap->num_addr = num_addr;
+	ap->daddr_h = ntohl(daddr);
+	ap->dport_h = ntohs(dport);
+#if 0
+	ap->endian_check = (current_iomodule_func == &dpdk_module_func) ?
+		0 : 1;
+#else
+	ap->endian_check = FetchEndianType();	
+#endif
 
-	if (pthread_mutex_init(&ap->lock, NULL)) {
-		free(ap->pool);
-		free(ap);
+	ap->scan_word = 0;
+	ap->alloc_word = 0;
+	ap->num_entry = 0;
+	ap->num_free = 0;
+	ap->num_used = 0;
+
+	/* the pool fills lazily; RSS spreads the pairs about evenly */
+	num_entry = (num_addr * (MAX_PORT - MIN_PORT)) / num_queues;
+	if (num_entry < CONFIG.max_concurrency) {
+		fprintf(stderr, "\033[31m[WARINING] CPU %d, num_queues %d, Available # addresses (~%d) is smaller than"
+				" the max concurrency (%d).\033[0m\n", 
+				core, num_queues, num_entry, CONFIG.max_concurrency);
+	}
+
+	return ap;
+}
+/*----------------------------------------------------------------------------*/
+static inline unsigned int
+IndexBucket(uint32_t daddr_h, uint16_t dport_h)
+{
+	uint32_t h = (daddr_h ^ ((uint32_t)dport_h << 16)) * 2654435761u;
+
+	return (h >> 24) & (AP_INDEX_BUCKETS - 1);
+}
+/*----------------------------------------------------------------------------*/
+addr_pool_t 
+FindAddressPool(addr_pool_index_t index, const struct sockaddr_in *daddr)
+{
+	uint32_t daddr_h = ntohl(daddr->sin_addr.s_addr);
+	uint16_t dport_h = ntohs(daddr->sin_port);
+	addr_pool_t ap;
+
+	if (!index)
 		return NULL;
+
+	for (ap = index->bucket[IndexBucket(daddr_h, dport_h)]; ap; ap = ap->next) {
+		if (ap->daddr_h == daddr_h && ap->dport_h == dport_h)
+			return ap;
 	}
 
-	pthread_mutex_lock(&ap->lock);
+	return NULL;
+}
+/*----------------------------------------------------------------------------*/
+addr_pool_index_t 
+AddAddressPool(addr_pool_index_t index, addr_pool_t ap)
+{
+	addr_pool_t *walk, old;
 
-	ap->addr_base = ntohl(saddr_base);
-	ap->num_addr = num_addr;
-	daddr_h = ntohl(daddr);
-	dport_h = ntohs(dport);
+	if (!index) {
+		index = (addr_pool_index_t)calloc(1, sizeof(struct addr_pool_index));
+		if (!index)
+			return NULL;
+	}
 
-	/* search address space to get RSS-friendly addresses */
-	cnt = 0;
-	flag = 0;
-	for (i = 0; i < num_addr; i++) {
-		saddr_h = ap->addr_base + i;
-		saddr = htonl(saddr_h);
-		for (j = MIN_PORT; j < MAX_PORT; j++) {
-			if (cnt >= num_entry)
-				break;
+	/* a destination has one pool, a new one replaces the old */
+	for (walk = &index->bucket[IndexBucket(ap->daddr_h, ap->dport_h)]; 
+			*walk; walk = &(*walk)->next) {
+		if ((*walk)->daddr_h == ap->daddr_h && (*walk)->dport_h == ap->dport_h) {
+			old = *walk;
+			ap->next = old->next;
+			__sync_synchronize();
+			*walk = ap;
+			/* a lookup may still stand on it */
+			old->next_retired = index->retired;
+			index->retired = old;
+			return index;
+		}
+	}
+	ap->next = NULL;
+	__sync_synchronize();
+	*walk = ap;
+
+	return index;
+}
+/*----------------------------------------------------------------------------*/
+void 
+RetireAddressPools(addr_pool_index_t index)
+{
+	addr_pool_t ap;
+	int i;
 
-			sport_h = j;
-			rss_core = GetRSSCPUCore(daddr_h, saddr_h, dport_h, sport_h, num_queues, endian_check);
-			if (rss_core != core)
-				continue;
+	if (!index)
+		return;
 
-			ap->pool[cnt].addr.sin_addr.s_addr = saddr;
-			ap->pool[cnt].addr.sin_port = htons(sport_h);
-			ap->mapper[i].addrmap[j] = &ap->pool[cnt];
-			TAILQ_INSERT_TAIL(&ap->free_list, &ap->pool[cnt], addr_link);
-			cnt++;
-			if (cnt > CONFIG.max_concurrency + 20000) {
-					flag = 1;
-					break;
-			}
+	for (i = 0; i < AP_INDEX_BUCKETS; i++) {
+		for (ap = index->bucket[i]; ap; ap = ap->next) {
+			ap->next_retired = index->retired;
+			index->retired = ap;
 		}
-		if (flag) break;
+		index->bucket[i] = NULL;
 	}
+}
+/*----------------------------------------------------------------------------*/
+void 
+DestroyAddressPools(addr_pool_index_t index)
+{
+	addr_pool_t ap, next;
+	int i;
 
-	ap->num_entry = cnt;
-	ap->num_free = cnt;
-	ap->num_used = 0;
-	//fprintf(stderr, "CPU %d: Created %d address entries.\n", core, cnt);
-	if (ap->num_entry < CONFIG.max_concurrency) {
-		fprintf(stderr, "\033[31m[WARINING] CPU %d, num_queues %d, Available # addresses (%d) is smaller than"
-				" the max concurrency (%d).\033[0m\n", 
-				core, num_queues, ap->num_entry, CONFIG.max_concurrency);
+	if (!index)
+		return;
+
+	for (i = 0; i < AP_INDEX_BUCKETS; i++) {
+		for (ap = index->bucket[i]; ap; ap = next) {
+			next = ap->next;
+			DestroyAddressPool(ap);
+		}
 	}
-	
-	pthread_mutex_unlock(&ap->lock);
+	for (ap = index->retired; ap; ap = next) {
+		next = ap->next_retired;
+		DestroyAddressPool(ap);
+	}
+	free(index);
+}
+/*----------------------------------------------------------------------------*/
+/* MarkWord()                                                                 */
+/* Word i of the level below l became non-zero: sets its bit in level l and  */
+/* up, as long as the word above was empty.                                   */
+/*----------------------------------------------------------------------------*/
+static inline void
+MarkWord(addr_pool_t ap, int l, int i)
+{
+	uint64_t mask, old;
 
-	return ap;
+	for (; l < ap->levels; l++, i /= PORT_BITS) {
+		mask = 1ULL << (i % PORT_BITS);
+		old = __sync_fetch_and_or(&ap->summary[l][i / PORT_BITS], mask);
+		if (old)
+			break;
+	}
+}
+/*----------------------------------------------------------------------------*/
+/* ClearWord()                                                                */
+/* Word i of the level below l was seen empty: clears its bit in level l and */
+/* up. Fetcher only.                                                          */
+/*----------------------------------------------------------------------------*/
+static void
+ClearWord(addr_pool_t ap, int l, int i)
+{
+	volatile uint64_t *below;
+
+	for (; l < ap->levels; l++, i /= PORT_BITS) {
+		below = l ? &ap->summary[l - 1][i] : &ap->free_map[i];
+		__sync_fetch_and_and(&ap->summary[l][i / PORT_BITS], 
+				~(1ULL << (i % PORT_BITS)));
+		if (*below) {
+			/* freed meanwhile */
+			MarkWord(ap, l, i);
+			return;
+		}
+		if (ap->summary[l][i / PORT_BITS])
+			return;
+	}
+}
+/*----------------------------------------------------------------------------*/
+/* NextWord()                                                                 */
+/* First bitmap word at or after from that may hold a free port, or -1.       */
+/* Climbs until a summary word has a bit at or after the position, then       */
+/* descends along the lowest set bits.                                        */
+/*----------------------------------------------------------------------------*/
+static int
+NextWord(addr_pool_t ap, int from)
+{
+	uint64_t bits;
+	int l, i;
+
+retry:
+	l = 0;
+	i = from;
+	for (;;) {
+		if (i >= ap->summary_bits[l])
+			return -1;
+		bits = ap->summary[l][i / PORT_BITS] & (~0ULL << (i % PORT_BITS));
+		if (bits)
+			break;
+		if (l == ap->levels - 1)
+			return -1;
+		i = i / PORT_BITS + 1;
+		l++;
+	}
+
+	i = (i & ~(PORT_BITS - 1)) + __builtin_ctzll(bits);
+	while (l > 0) {
+		bits = ap->summary[--l][i];
+		if (!bits) {
+			/* emptied since the bit above was read */
+			ClearWord(ap, l + 1, i);
+			goto retry;
+		}
+		i = i * PORT_BITS + __builtin_ctzll(bits);
+	}
+
+	return i;
+}
+/*----------------------------------------------------------------------------*/
+/* PopulateWord()                                                             */
+/* Computes the RSS queue of the 64 ports covered by the next unpopulated     */
+/* word and publishes the ones that belong to this core.                      */
+/* Only the fetching thread calls this, so scan_word needs no atomics.        */
+/*----------------------------------------------------------------------------*/
+static inline int
+PopulateWord(addr_pool_t ap)
+{
+	uint64_t bits = 0;
+	uint32_t saddr_h;
+	int w, i, port, cnt;
+
+	if (ap->scan_word >= ap->num_words)
+		return -1;
+
+	w = ap->scan_word;
+	saddr_h = ap->addr_base + w / WORDS_PER_ADDR;
+	port = (w % WORDS_PER_ADDR) * PORT_BITS;
+
+	cnt = 0;
+	for (i = 0; i < PORT_BITS; i++) {
+		if (port + i < MIN_PORT)
+			continue;
+		if (GetRSSCPUCore(ap->daddr_h, saddr_h, ap->dport_h, port + i, 
+					ap->num_queues, ap->endian_check) != ap->core)
+			continue;
+		bits |= (1ULL << i);
+		cnt++;
+	}
+
+	if (bits) {
+		__sync_fetch_and_or(&ap->free_map[w], bits);
+		__sync_fetch_and_add(&ap->num_free, cnt);
+		ap->num_entry += cnt;
+		MarkWord(ap, 0, w);
+	}
+	ap->scan_word++;
+
+	return w;
+}
+/*----------------------------------------------------------------------------*/
+/* TakeBit()                                                                  */
+/* Atomically claims the lowest free port in the given word.                  */
+/* Returns the bit index, or -1 if the word has no free port.                 */
+/*----------------------------------------------------------------------------*/
+static inline int
+TakeBit(addr_pool_t ap, int w)
+{
+	uint64_t bits, mask;
+	int bit;
+
+	bits = ap->free_map[w];
+	while (bits) {
+		bit = __builtin_ctzll(bits);
+		mask = 1ULL << bit;
+		if (__sync_bool_compare_and_swap(&ap->free_map[w], bits, bits & ~mask))
+			return bit;
+		bits = ap->free_map[w];
+	}
+
+	return -1;
 }
 /*----------------------------------------------------------------------------*/
 void
 DestroyAddressPool(addr_pool_t ap)
 {
+	int i;
+
 	if (!ap)
 		return;
 
@@ -215,7 +480,16 @@ DestroyAddressPool(addr_pool_t ap)
 		ap->mapper = NULL;
 	}
 
-	pthread_mutex_destroy(&ap->lock);
+	if (ap->free_map) {
+		free(ap->free_map);
+		ap->free_map = NULL;
+	}
+
+	for (i = 0; i < ap->levels; i++)
+		free(ap->summary[i]);
+
+	if (!ap->per_core)
+		pthread_mutex_destroy(&ap->lock);
 
 	free(ap);
 }
@@ -279,35 +553,83 @@ FetchAddress(addr_pool_t ap, int core, int num_queues,
 	return ret;
 }
 /*----------------------------------------------------------------------------*/
+/* FetchAddressPerCore()                                                      */
+/* Lock-free: there is a single fetcher per pool (the thread that owns the    */
+/* mtcp context), while FreeAddress() may run concurrently from any thread.   */
+/* Ports are handed out round robin from the allocation cursor through the    */
+/* summary levels. Freed ports are reused before new words are populated.     */
+/*----------------------------------------------------------------------------*/
 int 
 FetchAddressPerCore(addr_pool_t ap, int core, int num_queues,
 		    const struct sockaddr_in *daddr, struct sockaddr_in *saddr)
 {
-	struct addr_entry *walk;
-	int ret = -1;
+	int w, bit;
+	uint32_t port;
 
 	if (!ap || !daddr || !saddr)
 		return -1;
 
-	pthread_mutex_lock(&ap->lock);
-  
-	if (!TAILQ_FIRST(&ap->free_list)) {
-    fprintf(stderr, "\nError, FetchAddressPerCore(), empty address pool, free entry %d.\n", ap->num_free);
-  }	
 	/* we don't need to calculate RSSCPUCore if mtcp_init_rss is called */
-	walk = TAILQ_FIRST(&ap->free_list);
-	if (walk) {
-		*saddr = walk->addr;
-		TAILQ_REMOVE(&ap->free_list, walk, addr_link);
-		TAILQ_INSERT_TAIL(&ap->used_list, walk, addr_link);
-		ap->num_free--;
-		ap->num_used++;
-		ret = 0;
+	for (;;) {
+		w = NextWord(ap, ap->alloc_word);
+		if (w < 0 && ap->alloc_word > 0)
+			w = NextWord(ap, 0);
+		if (w < 0) {
+			if (PopulateWord(ap) < 0) {
+				fprintf(stderr, "\nError, FetchAddressPerCore(), empty address pool, "
+						"free entry %d.\n", ap->num_free);
+				return -1;
+			}
+			continue;
+		}
+		bit = TakeBit(ap, w);
+		if (ap->free_map[w] == 0)
+			ClearWord(ap, 0, w);
+		if (bit >= 0)
+			break;
 	}
-	
-	pthread_mutex_unlock(&ap->lock);
-	
-	return ret;
+
+	ap->alloc_word = w;
+	__sync_fetch_and_sub(&ap->num_free, 1);
+	__sync_fetch_and_add(&ap->num_used, 1);
+
+	port = (w % WORDS_PER_ADDR) * PORT_BITS + bit;
+	saddr->sin_addr.s_addr = htonl(ap->addr_base + w / WORDS_PER_ADDR);
+	saddr->sin_port = htons(port);
+
+	return 0;
+}
+/*----------------------------------------------------------------------------*/
+static int 
+FreeAddressPerCore(addr_pool_t ap, const struct sockaddr_in *addr)
+{
+	uint32_t addr_h = ntohl(addr->sin_addr.s_addr);
+	uint16_t port_h = ntohs(addr->sin_port);
+	int index = addr_h - ap->addr_base;
+	uint64_t mask, old;
+	int w;
+
+	if (index < 0 || index >= ap->num_addr || port_h < MIN_PORT)
+		return -1;
+
+	/* only what this pool handed out: a populated word, a port on this core */
+	w = index * WORDS_PER_ADDR + port_h / PORT_BITS;
+	if (w >= *(volatile int *)&ap->scan_word ||
+	    GetRSSCPUCore(ap->daddr_h, addr_h, ap->dport_h, port_h, 
+			  ap->num_queues, ap->endian_check) != ap->core)
+		return -1;
+
+	mask = 1ULL << (port_h % PORT_BITS);
+	old = __sync_fetch_and_or(&ap->free_map[w], mask);
+	if (old & mask)
+		return -1;
+	if (!old)
+		MarkWord(ap, 0, w);
+
+	__sync_fetch_and_add(&ap->num_free, 1);
+	__sync_fetch_and_sub(&ap->num_used, 1);
+
+	return 0;
 }
 /*----------------------------------------------------------------------------*/
 int 
@@ -319,6 +641,9 @@ FreeAddress(addr_pool_t ap, const struct sockaddr_in *addr)
 	if (!ap || !addr)
 		return -1;
 
+	if (ap->per_core)
+		return FreeAddressPerCore(ap, addr);
+
 	pthread_mutex_lock(&ap->lock);
 
 	if (ap->mapper) {
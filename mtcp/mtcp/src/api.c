@@ -65,6 +65,12 @@ GetSocketError(socket_map_t socket, void *optval, socklen_t *optlen)
 	tcp_stream *cur_stream;
 
 	if (!socket->stream) {
+		/* the stack thread could not create the stream of a connect */
+		if (socket->connect_err) {
+			*(int *)optval = socket->connect_err;
+			*optlen = sizeof(int);
+			return 0;
+		}
 		errno = EBADF;
 		return -1;
 	}
@@ -213,6 +219,40 @@ mtcp_getpeername(mctx_t mctx, int sockid, struct sockaddr *addr,
 	return 0;
 }
 /*----------------------------------------------------------------------------*/
+/* 
+ * The subset of TCP_INFO that mTCP tracks. There is no running total of 
+ * retransmissions: tcpi_total_retrans holds the most times one segment has 
+ * been sent again, right after the handshake that is the number of SYN 
+ * retries.
+ */
+static inline int 
+GetTCPInfo(socket_map_t socket, void *optval, socklen_t *optlen)
+{
+	tcp_stream *cur_stream;
+	struct tcp_info info;
+
+	if (!socket->stream) {
+		errno = EBADF;
+		return -1;
+	}
+	if (*optlen < sizeof(info)) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	cur_stream = socket->stream;
+	memset(&info, 0, sizeof(info));
+	info.tcpi_retransmits = cur_stream->sndvar->nrtx;
+	info.tcpi_total_retrans = cur_stream->sndvar->max_nrtx;
+	info.tcpi_snd_mss = cur_stream->sndvar->mss;
+	info.tcpi_snd_cwnd = cur_stream->sndvar->mss ? 
+		cur_stream->sndvar->cwnd / cur_stream->sndvar->mss : 0;
+	memcpy(optval, &info, sizeof(info));
+	*optlen = sizeof(info);
+
+	return 0;
+}
+/*----------------------------------------------------------------------------*/
 int 
 mtcp_getsockopt(mctx_t mctx, int sockid, int level, 
 		int optname, void *optval, socklen_t *optlen)
@@ -251,6 +291,12 @@ mtcp_getsockopt(mctx_t mctx, int sockid, int level,
 				return GetSocketError(socket, optval, optlen);
 			}
 		}
+	} else if (level == IPPROTO_TCP) {
+		if (optname == TCP_INFO) {
+			if (socket->socktype == MTCP_SOCK_STREAM) {
+				return GetTCPInfo(socket, optval, optlen);
+			}
+		}
 	}
 
 	errno = ENOSYS;
@@ -640,27 +686,13 @@ mtcp_accept(mctx_t mctx, int sockid, struct sockaddr *addr, socklen_t *addrlen)
 	return accepted->socket->id;
 }
 /*----------------------------------------------------------------------------*/
-int 
-mtcp_init_rss(mctx_t mctx, in_addr_t saddr_base, int num_addr, 
+static addr_pool_t 
+CreateRSSAddressPool(mctx_t mctx, in_addr_t saddr_base, int num_addr, 
 		in_addr_t daddr, in_addr_t dport)
 {
-	mtcp_manager_t mtcp;
 	addr_pool_t ap;
 	uint8_t is_external;
 
-	mtcp = GetMTCPManager(mctx);
-	if (!mtcp) {
-		errno = EACCES;
-		return -1;
-	}
-
-	if (mtcp->ap) {
-		TRACE_DBG("Destroying already exsiting address pool.\n"
-		          "Are you calling mtcp_init_rss() multiple times?\n");
-		DestroyAddressPool(mtcp->ap);
-		mtcp->ap = NULL;
-	}
-
 	if (saddr_base == INADDR_ANY) {
 		int nif_out, eidx;
 
@@ -670,7 +702,7 @@ mtcp_init_rss(mctx_t mctx, in_addr_t saddr_base, int num_addr,
 		if (nif_out < 0) {
 			errno = EINVAL;
 			TRACE_DBG("Could not determine nif idx!\n");
-			return -1;
+			return NULL;
 		}
 		eidx = CONFIG.nif_to_eidx[nif_out];
 		saddr_base = CONFIG.eths[eidx].ip_addr;
@@ -679,16 +711,96 @@ mtcp_init_rss(mctx_t mctx, in_addr_t saddr_base, int num_addr,
 	ap = CreateAddressPoolPerCore(mctx->cpu, num_cpus, 
 			saddr_base, num_addr, daddr, dport);
 	if (!ap) {
+		errno = ENOMEM;
+		return NULL;
+	}
+	UNUSED(is_external);
+
+	return ap;
+}
+/*----------------------------------------------------------------------------*/
+int 
+mtcp_init_rss(mctx_t mctx, in_addr_t saddr_base, int num_addr, 
+		in_addr_t daddr, in_addr_t dport)
+{
+	mtcp_manager_t mtcp;
+
+	mtcp = GetMTCPManager(mctx);
+	if (!mtcp) {
+		errno = EACCES;
+		return -1;
+	}
+
+	if (mtcp->ap) {
+		TRACE_DBG("Retiring already exsiting address pool.\n"
+		          "Are you calling mtcp_init_rss() multiple times?\n");
+		/* the stack thread may be looking one up, see addr_pool.c */
+		RetireAddressPools(mtcp->ap);
+	}
+
+	return mtcp_add_rss(mctx, saddr_base, num_addr, daddr, dport);
+}
+/*----------------------------------------------------------------------------*/
+int 
+mtcp_add_rss(mctx_t mctx, in_addr_t saddr_base, int num_addr, 
+		in_addr_t daddr, in_addr_t dport)
+{
+	mtcp_manager_t mtcp;
+	addr_pool_index_t index;
+	addr_pool_t ap;
+
+	mtcp = GetMTCPManager(mctx);
+	if (!mtcp) {
+		errno = EACCES;
+		return -1;
+	}
+
+	ap = CreateRSSAddressPool(mctx, saddr_base, num_addr, daddr, dport);
+	if (!ap)
+		return -1;
+
+	index = AddAddressPool(mtcp->ap, ap);
+	if (!index) {
+		DestroyAddressPool(ap);
 		errno = ENOMEM;
 		return -1;
 	}
+	mtcp->ap = index;
 
-	mtcp->ap = ap;
-	UNUSED(is_external);
-	
 	return 0;
 }
 /*----------------------------------------------------------------------------*/
+/* 
+ * Withdraws a connect request that the stack thread has not picked up yet and 
+ * returns TRUE. If the stack thread has already claimed it, waits until the 
+ * stream is attached to the socket (or has failed) and returns FALSE. The 
+ * socket cannot be given up before that, the stack thread still writes to 
+ * it; the claim only covers the stream creation, so the wait is short and 
+ * sleeps rather than spins.
+ */
+#define CONNECT_CANCEL_POLL_US		10
+static inline int 
+CancelConnectRequest(mtcp_manager_t mtcp, socket_map_t socket)
+{
+
+	if (__sync_bool_compare_and_swap(&socket->connect_req, 
+				CONNECT_PENDING, CONNECT_IDLE)) {
+		if (socket->connect_dyn_bound) {
+			if (FreeBoundAddress(mtcp, &socket->saddr, &socket->daddr) < 0) {
+				TRACE_ERROR("(NEVER HAPPEN) Failed to free address.\n");
+			}
+			socket->opts &= ~MTCP_ADDR_BIND;
+			socket->connect_dyn_bound = FALSE;
+		}
+		return TRUE;
+	}
+
+	while (socket->connect_req == CONNECT_CLAIMED) {
+		usleep(CONNECT_CANCEL_POLL_US);
+	}
+	return FALSE;
+}
+/*----------------------------------------------------------------------------*/
 int 
 mtcp_connect(mctx_t mctx, int sockid, 
 		const struct sockaddr *addr, socklen_t addrlen)
@@ -739,6 +851,11 @@ mtcp_connect(mctx_t mctx, int sockid,
 	}
 
 	socket = &mtcp->smap[sockid];
+	if (socket->connect_req != CONNECT_IDLE) {
+		TRACE_API("Socket %d: connect already requested!\n", sockid);
+		errno = EALREADY;
+		return -1;
+	}
 	if (socket->stream) {
 		TRACE_API("Socket %d: stream already exist!\n", sockid);
 		if (socket->stream->state >= TCP_ST_ESTABLISHED) {
@@ -768,8 +885,9 @@ mtcp_connect(mctx_t mctx, int sockid,
 			return -1;
 		}
 	} else {
-		if (mtcp->ap) {
-			ret = FetchAddressPerCore(mtcp->ap, 
+		addr_pool_t rss_ap = FindAddressPool(mtcp->ap, addr_in);
+		if (rss_ap) {
+			ret = FetchAddressPerCore(rss_ap, 
 						  mctx->cpu, num_queues, addr_in, &socket->saddr);
 		} else {
 			uint8_t is_external;
@@ -790,33 +908,29 @@ mtcp_connect(mctx_t mctx, int sockid,
 		is_dyn_bound = TRUE;
 	}
 
-	cur_stream = CreateTCPStream(mtcp, socket, socket->socktype, 
-			socket->saddr.sin_addr.s_addr, socket->saddr.sin_port, dip, dport);
-	if (!cur_stream) {
-		TRACE_ERROR("Socket %d: failed to create tcp_stream!\n", sockid);
-		errno = ENOMEM;
-		return -1;
-	}
-
-	if (is_dyn_bound)
-		cur_stream->is_bound_addr = TRUE;
-	cur_stream->sndvar->cwnd = 1;
-	cur_stream->sndvar->ssthresh = cur_stream->sndvar->mss * 10;
-
-	cur_stream->state = TCP_ST_SYN_SENT;
-	TRACE_STATE("Stream %d: TCP_ST_SYN_SENT\n", cur_stream->id);
+	/* 
+	 * the stream itself is created by the stack thread, which owns the 
+	 * flow pools and the flow table (see HandleConnectRequest())
+	 */
+	socket->daddr.sin_family = AF_INET;
+	socket->daddr.sin_addr.s_addr = dip;
+	socket->daddr.sin_port = dport;
+	socket->connect_dyn_bound = is_dyn_bound;
+	socket->connect_err = 0;
+	__sync_synchronize();
+	socket->connect_req = CONNECT_PENDING;
 
 	SQ_LOCK(&mtcp->ctx->connect_lock);
-	ret = StreamEnqueue(mtcp->connectq, cur_stream);
+	ret = SocketEnqueue(mtcp->connectq, socket);
 	SQ_UNLOCK(&mtcp->ctx->connect_lock);
 	mtcp->wakeup_flag = TRUE;
 	if (ret < 0) {
 		TRACE_ERROR("Socket %d: failed to enqueue to conenct queue!\n", sockid);
-		SQ_LOCK(&mtcp->ctx->destroyq_lock);
-		StreamEnqueue(mtcp->destroyq, cur_stream);
-		SQ_UNLOCK(&mtcp->ctx->destroyq_lock);
-		errno = EAGAIN;
-		return -1;
+		/* a stale entry of this socket may have picked the request up */
+		if (CancelConnectRequest(mtcp, socket)) {
+			errno = EAGAIN;
+			return -1;
+		}
 	}
 
 	/* if nonblocking socket, return EINPROGRESS */
@@ -825,6 +939,16 @@ mtcp_connect(mctx_t mctx, int sockid,
 		return -1;
 
 	} else {
+		while (socket->connect_req != CONNECT_IDLE) {
+			usleep(1000);
+		}
+		cur_stream = socket->stream;
+		if (!cur_stream) {
+			TRACE_ERROR("Socket %d: failed to create tcp_stream!\n", sockid);
+			errno = socket->connect_err ? socket->connect_err : ENOMEM;
+			return -1;
+		}
+
 		while (1) {
 			if (!cur_stream) {
 				TRACE_ERROR("STREAM DESTROYED\n");
@@ -861,6 +985,12 @@ CloseStreamSocket(mctx_t mctx, int sockid)
 		return -1;
 	}
 
+	/* a connect that never left the connect queue has nothing to close */
+	if (mtcp->smap[sockid].connect_req != CONNECT_IDLE && 
+	    CancelConnectRequest(mtcp, &mtcp->smap[sockid])) {
+		return 0;
+	}
+
 	cur_stream = mtcp->smap[sockid].stream;
 	if (!cur_stream) {
 		TRACE_API("Socket %d: stream does not exist.\n", sockid);
@@ -1038,6 +1168,12 @@ mtcp_abort(mctx_t mctx, int sockid)
 		return -1;
 	}
 
+	if (mtcp->smap[sockid].connect_req != CONNECT_IDLE && 
+	    CancelConnectRequest(mtcp, &mtcp->smap[sockid])) {
+		FreeSocket(mctx, sockid, FALSE);
+		return 0;
+	}
+
 	cur_stream = mtcp->smap[sockid].stream;
 	if (!cur_stream) {
 		TRACE_API("Stream %d: does not exist.\n", sockid);
@@ -1117,23 +1253,14 @@ PeekForUser(mtcp_manager_t mtcp, tcp_stream *cur_stream, char *buf, int len)
 	return copylen;
 }
 /*----------------------------------------------------------------------------*/
-static inline int
-CopyToUser(mtcp_manager_t mtcp, tcp_stream *cur_stream, char *buf, int len)
+static inline void
+RemoveFromRecvBuf(mtcp_manager_t mtcp, tcp_stream *cur_stream, int len)
 {
 	struct tcp_recv_vars *rcvvar = cur_stream->rcvvar;
-	uint32_t prev_rcv_wnd;
-	int copylen;
-
-	copylen = MIN(rcvvar->rcvbuf->merged_len, len);
-	if (copylen <= 0) {
-		errno = EAGAIN;
-		return -1;
-	}
 
-	prev_rcv_wnd = rcvvar->rcv_wnd;
-	/* Copy data to user buffer and remove it from receiving buffer */
-	memcpy(buf, rcvvar->rcvbuf->head, copylen);
-	RBRemove(mtcp->rbm_rcv, rcvvar->rcvbuf, copylen, AT_APP);
+	RBRemove(mtcp->rbm_rcv, rcvvar->rcvbuf, len, AT_APP);
+	/* an idle flow keeps no receive chunk */
+	RBReleaseData(mtcp->rbm_rcv, rcvvar->rcvbuf);
 	rcvvar->rcv_wnd = rcvvar->rcvbuf->size - rcvvar->rcvbuf->merged_len;
 
 	/* Advertise newly freed receive buffer */
@@ -1149,8 +1276,24 @@ CopyToUser(mtcp_manager_t mtcp, tcp_stream *cur_stream, char *buf, int len)
 			}
 		}
 	}
+}
+/*----------------------------------------------------------------------------*/
+static inline int
+CopyToUser(mtcp_manager_t mtcp, tcp_stream *cur_stream, char *buf, int len)
+{
+	struct tcp_recv_vars *rcvvar = cur_stream->rcvvar;
+	int copylen;
+
+	copylen = MIN(rcvvar->rcvbuf->merged_len, len);
+	if (copylen <= 0) {
+		errno = EAGAIN;
+		return -1;
+	}
+
+	/* Copy data to user buffer and remove it from receiving buffer */
+	memcpy(buf, rcvvar->rcvbuf->head, copylen);
+	RemoveFromRecvBuf(mtcp, cur_stream, copylen);
 
-	UNUSED(prev_rcv_wnd);
 	return copylen;
 }
 /*----------------------------------------------------------------------------*/
@@ -1288,6 +1431,149 @@ mtcp_recv(mctx_t mctx, int sockid, char *buf, size_t len, int flags)
     return ret;
 }
 /*----------------------------------------------------------------------------*/
+static inline tcp_stream *
+GetRecvStream(mtcp_manager_t mtcp, int sockid, socket_map_t *socket)
+{
+	tcp_stream *cur_stream;
+
+	if (sockid < 0 || sockid >= CONFIG.max_concurrency) {
+		TRACE_API("Socket id %d out of range.\n", sockid);
+		errno = EBADF;
+		return NULL;
+	}
+
+	*socket = &mtcp->smap[sockid];
+	if ((*socket)->socktype == MTCP_SOCK_UNUSED) {
+		TRACE_API("Invalid socket id: %d\n", sockid);
+		errno = EBADF;
+		return NULL;
+	}
+
+	if ((*socket)->socktype != MTCP_SOCK_STREAM) {
+		TRACE_API("Not an end socket. id: %d\n", sockid);
+		errno = ENOTSOCK;
+		return NULL;
+	}
+
+	/* stream should be in ESTABLISHED, FIN_WAIT_1, FIN_WAIT_2, CLOSE_WAIT */
+	cur_stream = (*socket)->stream;
+	if (!cur_stream || 
+	    !(cur_stream->state >= TCP_ST_ESTABLISHED && 
+	      cur_stream->state <= TCP_ST_CLOSE_WAIT)) {
+		errno = ENOTCONN;
+		return NULL;
+	}
+
+	return cur_stream;
+}
+/*----------------------------------------------------------------------------*/
+ssize_t
+mtcp_recv_zc(mctx_t mctx, int sockid, char **buf)
+{
+	mtcp_manager_t mtcp;
+	socket_map_t socket;
+	tcp_stream *cur_stream;
+	struct tcp_recv_vars *rcvvar;
+	int ret;
+
+	mtcp = GetMTCPManager(mctx);
+	if (!mtcp) {
+		return -1;
+	}
+
+	cur_stream = GetRecvStream(mtcp, sockid, &socket);
+	if (!cur_stream) {
+		return -1;
+	}
+	rcvvar = cur_stream->rcvvar;
+
+	/* if CLOSE_WAIT, return 0 if there is no payload */
+	if (cur_stream->state == TCP_ST_CLOSE_WAIT) {
+		if (!rcvvar->rcvbuf || rcvvar->rcvbuf->merged_len == 0)
+			return 0;
+	}
+
+	/* lending is non-blocking only, there is nothing to wait on */
+	if (!rcvvar->rcvbuf || rcvvar->rcvbuf->merged_len == 0) {
+		errno = EAGAIN;
+		return -1;
+	}
+
+	SBUF_LOCK(&rcvvar->read_lock);
+	if (rcvvar->rcvbuf->lent_len > 0) {
+		/* the previous loan was never released */
+		SBUF_UNLOCK(&rcvvar->read_lock);
+		errno = EBUSY;
+		return -1;
+	}
+	*buf = (char *)rcvvar->rcvbuf->head;
+	ret = rcvvar->rcvbuf->merged_len;
+	rcvvar->rcvbuf->lent_len = ret;
+	SBUF_UNLOCK(&rcvvar->read_lock);
+
+	return ret;
+}
+/*----------------------------------------------------------------------------*/
+int
+mtcp_recv_release(mctx_t mctx, int sockid, size_t len)
+{
+	mtcp_manager_t mtcp;
+	socket_map_t socket;
+	tcp_stream *cur_stream;
+	struct tcp_recv_vars *rcvvar;
+	int lent;
+	int event_remaining;
+
+	mtcp = GetMTCPManager(mctx);
+	if (!mtcp) {
+		return -1;
+	}
+
+	cur_stream = GetRecvStream(mtcp, sockid, &socket);
+	if (!cur_stream) {
+		return -1;
+	}
+	rcvvar = cur_stream->rcvvar;
+	if (!rcvvar->rcvbuf) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	SBUF_LOCK(&rcvvar->read_lock);
+	lent = rcvvar->rcvbuf->lent_len;
+	if (len > (size_t)lent) {
+		SBUF_UNLOCK(&rcvvar->read_lock);
+		errno = EINVAL;
+		return -1;
+	}
+	RBEndLoan(mtcp->rbm_rcv, rcvvar->rcvbuf);
+	if (len > 0)
+		RemoveFromRecvBuf(mtcp, cur_stream, len);
+
+	/* unlike mtcp_recv(), bytes left over are the ones the application
+	   could not use yet, so only new data is worth another EPOLLIN */
+	event_remaining = FALSE;
+	if (socket->epoll & MTCP_EPOLLIN) {
+		if (!(socket->epoll & MTCP_EPOLLET) && 
+		    rcvvar->rcvbuf->merged_len > lent - (int)len) {
+			event_remaining = TRUE;
+		}
+	}
+	/* if waiting for close, notify it if no remaining data */
+	if (cur_stream->state == TCP_ST_CLOSE_WAIT && 
+	    rcvvar->rcvbuf->merged_len == 0 && len > 0) {
+		event_remaining = TRUE;
+	}
+	SBUF_UNLOCK(&rcvvar->read_lock);
+
+	if (event_remaining && socket->epoll) {
+		AddEpollEvent(mtcp->ep, 
+			      USR_SHADOW_EVENT_QUEUE, socket, MTCP_EPOLLIN);
+	}
+
+	return 0;
+}
+/*----------------------------------------------------------------------------*/
 inline ssize_t
 mtcp_read(mctx_t mctx, int sockid, char *buf, size_t len)
 {
@@ -1446,10 +1732,19 @@ CopyFromUser(mtcp_manager_t mtcp, tcp_stream *cur_stream, const char *buf, int l
 			return -1;
 		}
 	}
+	if (SBAttachData(mtcp->rbm_snd, sndvar->sndbuf, sndlen) < 0) {
+		cur_stream->close_reason = TCP_NO_MEM;
+		errno = ENOMEM;
+		return -1;
+	}
 
 	ret = SBPut(mtcp->rbm_snd, sndvar->sndbuf, buf, sndlen);
-	assert(ret == sndlen);
 	sndvar->snd_wnd = sndvar->sndbuf->size - sndvar->sndbuf->len;
+	if (ret == SB_NO_PIECE) {
+		/* all pieces of the send buffer are taken */
+		errno = EAGAIN;
+		return -1;
+	}
 	if (ret <= 0) {
 		TRACE_ERROR("SBPut failed. reason: %d (sndlen: %u, len: %u\n", 
 				ret, sndlen, sndvar->sndbuf->len);
@@ -1462,46 +1757,71 @@ CopyFromUser(mtcp_manager_t mtcp, tcp_stream *cur_stream, const char *buf, int l
 				cur_stream->id, sndvar->snd_wnd);
 	}
 
+	assert(ret == sndlen);
+
 	return ret;
 }
 /*----------------------------------------------------------------------------*/
-ssize_t
-mtcp_write(mctx_t mctx, int sockid, const char *buf, size_t len)
+static inline int
+RefFromUser(mtcp_manager_t mtcp, tcp_stream *cur_stream, 
+		int payload, size_t off, int len)
 {
-	mtcp_manager_t mtcp;
-	socket_map_t socket;
-	tcp_stream *cur_stream;
-	struct tcp_send_vars *sndvar;
+	struct tcp_send_vars *sndvar = cur_stream->sndvar;
+	int sndlen;
 	int ret;
 
-	mtcp = GetMTCPManager(mctx);
-	if (!mtcp) {
+	sndlen = MIN((int)sndvar->snd_wnd, len);
+	if (sndlen <= 0) {
+		errno = EAGAIN;
 		return -1;
 	}
 
-	mtcp->nstat.write_called++;
-	if (sockid < 0 || sockid >= CONFIG.max_concurrency) {
-		TRACE_API("Socket id %d out of range.\n", sockid);
-		errno = EBADF;
-		return -1;
+	if (!sndvar->sndbuf) {
+		sndvar->sndbuf = SBInit(mtcp->rbm_snd, sndvar->iss + 1);
+		if (!sndvar->sndbuf) {
+			cur_stream->close_reason = TCP_NO_MEM;
+			errno = ENOMEM;
+			return -1;
+		}
 	}
 
-	socket = &mtcp->smap[sockid];
-	if (socket->socktype == MTCP_SOCK_UNUSED) {
-		TRACE_API("Invalid socket id: %d\n", sockid);
-		errno = EBADF;
+	/* only (payload, offset, length) is queued, the bytes are copied 
+	   once, into the outgoing packet */
+	ret = SBPutRef(mtcp->rbm_snd, sndvar->sndbuf, payload, off, sndlen);
+	if (ret < 0) {
 		return -1;
 	}
-
-	if (socket->socktype == MTCP_SOCK_PIPE) {
-		return PipeWrite(mctx, sockid, buf, len);
+	sndvar->snd_wnd = sndvar->sndbuf->size - sndvar->sndbuf->len;
+	if (ret == 0) {
+		/* all pieces of the send buffer are taken */
+		errno = EAGAIN;
+		return -1;
 	}
 
-	if (socket->socktype != MTCP_SOCK_STREAM) {
-		TRACE_API("Not an end socket. id: %d\n", sockid);
-		errno = ENOTSOCK;
+	return ret;
+}
+/*----------------------------------------------------------------------------*/
+int
+mtcp_register_payload(mctx_t mctx, const void *buf, size_t len)
+{
+	mtcp_manager_t mtcp;
+
+	mtcp = GetMTCPManager(mctx);
+	if (!mtcp) {
 		return -1;
 	}
+
+	return SBRegisterPayload(mtcp->rbm_snd, buf, len);
+}
+/*----------------------------------------------------------------------------*/
+/* writes len bytes of buf, or at off of registered payload if buf is NULL */
+static ssize_t
+WriteStream(mtcp_manager_t mtcp, socket_map_t socket, 
+		const char *buf, int payload, size_t off, size_t len)
+{
+	tcp_stream *cur_stream;
+	struct tcp_send_vars *sndvar;
+	int ret;
 	
 	cur_stream = socket->stream;
 	if (!cur_stream || 
@@ -1539,7 +1859,10 @@ mtcp_write(mctx_t mctx, int sockid, const char *buf, size_t len)
 	}
 #endif
 
-	ret = CopyFromUser(mtcp, cur_stream, buf, len);
+	if (buf)
+		ret = CopyFromUser(mtcp, cur_stream, buf, len);
+	else
+		ret = RefFromUser(mtcp, cur_stream, payload, off, len);
 
 	SBUF_UNLOCK(&sndvar->write_lock);
 
@@ -1574,13 +1897,79 @@ mtcp_write(mctx_t mctx, int sockid, const char *buf, size_t len)
 	}
 
 	TRACE_EPOLL("Core[%d] Stream %p Socket %d: ip %u sport %u mtcp_write() returning %d\n", 
-			mctx->cpu, cur_stream, cur_stream->id,
+			mtcp->ctx->cpu, cur_stream, cur_stream->id,
 			htonl(cur_stream->saddr)&0xff, 
 			htons(cur_stream->sport), 
 			ret);
 	return ret;
 }
 /*----------------------------------------------------------------------------*/
+ssize_t
+mtcp_write(mctx_t mctx, int sockid, const char *buf, size_t len)
+{
+	mtcp_manager_t mtcp;
+	socket_map_t socket;
+
+	mtcp = GetMTCPManager(mctx);
+	if (!mtcp) {
+		return -1;
+	}
+
+	mtcp->nstat.write_called++;
+	if (sockid < 0 || sockid >= CONFIG.max_concurrency) {
+		TRACE_API("Socket id %d out of range.\n", sockid);
+		errno = EBADF;
+		return -1;
+	}
+
+	socket = &mtcp->smap[sockid];
+	if (socket->socktype == MTCP_SOCK_UNUSED) {
+		TRACE_API("Invalid socket id: %d\n", sockid);
+		errno = EBADF;
+		return -1;
+	}
+
+	if (socket->socktype == MTCP_SOCK_PIPE) {
+		return PipeWrite(mctx, sockid, buf, len);
+	}
+
+	if (socket->socktype != MTCP_SOCK_STREAM) {
+		TRACE_API("Not an end socket. id: %d\n", sockid);
+		errno = ENOTSOCK;
+		return -1;
+	}
+
+	return WriteStream(mtcp, socket, buf, -1, 0, len);
+}
+/*----------------------------------------------------------------------------*/
+ssize_t
+mtcp_write_payload(mctx_t mctx, int sockid, int payload, size_t off, size_t len)
+{
+	mtcp_manager_t mtcp;
+	socket_map_t socket;
+
+	mtcp = GetMTCPManager(mctx);
+	if (!mtcp) {
+		return -1;
+	}
+
+	mtcp->nstat.write_called++;
+	if (sockid < 0 || sockid >= CONFIG.max_concurrency) {
+		TRACE_API("Socket id %d out of range.\n", sockid);
+		errno = EBADF;
+		return -1;
+	}
+
+	socket = &mtcp->smap[sockid];
+	if (socket->socktype != MTCP_SOCK_STREAM) {
+		TRACE_API("Not an end socket. id: %d\n", sockid);
+		errno = socket->socktype == MTCP_SOCK_UNUSED ? EBADF : ENOTSOCK;
+		return -1;
+	}
+
+	return WriteStream(mtcp, socket, NULL, payload, off, len);
+}
+/*----------------------------------------------------------------------------*/
 int
 mtcp_writev(mctx_t mctx, int sockid, const struct iovec *iov, int numIOV)
 {
@@ -615,6 +615,20 @@ ParseConfiguration(char *line)
 			TRACE_CONFIG("Send buffer size should be larger than 64.\n");
 			return -1;
 		}
+	} else if (strcmp(p, "small_buf") == 0) {
+		CONFIG.small_buf_size = mystrtol(q, 10);
+		if (CONFIG.small_buf_size != 0 &&
+		    (CONFIG.small_buf_size < 64 || CONFIG.small_buf_size % 4 != 0)) {
+			TRACE_CONFIG("Small buffer size should be 0 or a multiple "
+				     "of 4 larger than 64.\n");
+			return -1;
+		}
+	} else if (strcmp(p, "max_num_small_buffers") == 0) {
+		CONFIG.max_num_small_buffers = mystrtol(q, 10);
+		if (CONFIG.max_num_small_buffers < 0) {
+			TRACE_CONFIG("The maximum # small buffers should be larger than 0.\n");
+			return -1;
+		}
 	} else if (strcmp(p, "tcp_timeout") == 0) {
 		CONFIG.tcp_timeout = mystrtol(q, 10);
 		if (CONFIG.tcp_timeout > 0) {
@@ -711,6 +725,12 @@ LoadConfiguration(const char *fname)
 
 	fclose(fp);
 
+#ifndef DISABLE_DPDK
+	/* the application placed the stack threads itself */
+	if (CONFIG.core_mask[0])
+		mpz_set_str(CONFIG._cpumask, CONFIG.core_mask, 16);
+#endif
+
 	/* if rcvbuf is set but sndbuf is not, sndbuf = rcvbuf */
 	if (CONFIG.sndbuf_size == -1 && CONFIG.rcvbuf_size != -1)
 		CONFIG.sndbuf_size = CONFIG.rcvbuf_size;
@@ -720,6 +740,12 @@ LoadConfiguration(const char *fname)
 	/* if sndbuf & rcvbuf are not set, rcvbuf = sndbuf = 8192 */
 	if (CONFIG.rcvbuf_size == -1 && CONFIG.sndbuf_size == -1)
 		CONFIG.sndbuf_size = CONFIG.rcvbuf_size = 8192;
+	/* the small class only pays off below both buffer sizes */
+	if (CONFIG.small_buf_size >= CONFIG.rcvbuf_size ||
+	    CONFIG.small_buf_size >= CONFIG.sndbuf_size)
+		CONFIG.small_buf_size = 0;
+	if (CONFIG.max_num_small_buffers == 0)
+		CONFIG.max_num_small_buffers = CONFIG.max_num_buffers;
 	
 	return SetNetEnv(port_list, port_stat_list);
 	
@@ -747,6 +773,10 @@ PrintConfiguration()
 			CONFIG.max_num_buffers);
 	TRACE_CONFIG("Receive buffer size: %d\n", CONFIG.rcvbuf_size);
 	TRACE_CONFIG("Send buffer size: %d\n", CONFIG.sndbuf_size);
+	if (CONFIG.small_buf_size > 0) {
+		TRACE_CONFIG("Small buffer size: %d (%d per core)\n", 
+				CONFIG.small_buf_size, CONFIG.max_num_small_buffers);
+	}
 
 	if (CONFIG.tcp_timeout > 0) {
 		TRACE_CONFIG("TCP timeout seconds: %d\n", 
@@ -0,0 +1,241 @@
+/*----------------------------------------------------------------------------*/
+/* connect_bench: stream setup rate between an app thread and a stack thread  */
+/*                                                                            */
+/* Replays the allocation side of mtcp_connect() followed by the teardown of  */
+/* the stream, once per connection:                                           */
+/*   locked   - the app thread allocates the stream, its recv/send vars and   */
+/*              the flow table entry under a shared mutex and queues the      */
+/*              stream; the stack thread destroys it under the same mutex     */
+/*              (the old flow_pool_lock scheme)                               */
+/*   handover - the app thread only queues the socket on the connect queue    */
+/*              and the stack thread creates and destroys the stream without  */
+/*              any lock (HandleConnectRequest())                             */
+/*                                                                            */
+/* Run the two threads on different cores, e.g. with taskset -c 2,4.          */
+/*                                                                            */
+/* usage: connect_bench [num_connects]   (default: 10M)                       */
+/*----------------------------------------------------------------------------*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include <arpa/inet.h>
+
+#include "fhash.h"
+#include "memory_mgt.h"
+#include "tcp_stream_queue.h"
+
+#define NUM_SRC_ADDR		200
+#define BENCH_SERVER		"10.0.0.1"
+#define BENCH_PORT		80
+#define QUEUE_SIZE		(10*1024)	/* BACKLOG_SIZE */
+#define POOL_SIZE		(2 * QUEUE_SIZE)
+/*----------------------------------------------------------------------------*/
+struct bench
+{
+	int locked;
+	uint32_t num_connects;
+
+	mem_pool_t flow_pool;
+	mem_pool_t rv_pool;
+	mem_pool_t sv_pool;
+	struct hashtable *ht;
+	pthread_mutex_t flow_pool_lock;
+
+	stream_queue_t connectq;
+	struct socket_map *smap;
+
+	volatile uint32_t done;
+	uint32_t failed;
+};
+/*----------------------------------------------------------------------------*/
+static inline double
+NowSec()
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+/*----------------------------------------------------------------------------*/
+static tcp_stream *
+AllocStream(struct bench *b, struct socket_map *socket)
+{
+	tcp_stream *stream;
+
+	stream = MPAllocateChunk(b->flow_pool);
+	if (!stream)
+		return NULL;
+	memset(stream, 0, sizeof(tcp_stream));
+	stream->rcvvar = MPAllocateChunk(b->rv_pool);
+	stream->sndvar = MPAllocateChunk(b->sv_pool);
+	if (!stream->rcvvar || !stream->sndvar)
+		return NULL;
+	memset(stream->rcvvar, 0, sizeof(struct tcp_recv_vars));
+	memset(stream->sndvar, 0, sizeof(struct tcp_send_vars));
+
+	stream->saddr = socket->saddr.sin_addr.s_addr;
+	stream->sport = socket->saddr.sin_port;
+	stream->daddr = socket->daddr.sin_addr.s_addr;
+	stream->dport = socket->daddr.sin_port;
+	if (StreamHTInsert(b->ht, stream) < 0)
+		return NULL;
+
+	return stream;
+}
+/*----------------------------------------------------------------------------*/
+static void
+FreeStream(struct bench *b, tcp_stream *stream)
+{
+	StreamHTRemove(b->ht, stream);
+	MPFreeChunk(b->rv_pool, stream->rcvvar);
+	MPFreeChunk(b->sv_pool, stream->sndvar);
+	MPFreeChunk(b->flow_pool, stream);
+}
+/*----------------------------------------------------------------------------*/
+static void *
+StackThread(void *arg)
+{
+	struct bench *b = arg;
+	struct socket_map *socket;
+	tcp_stream *stream;
+
+	while (b->done < b->num_connects) {
+		if (b->locked) {
+			stream = StreamDequeue(b->connectq);
+			if (!stream)
+				continue;
+			pthread_mutex_lock(&b->flow_pool_lock);
+			FreeStream(b, stream);
+			pthread_mutex_unlock(&b->flow_pool_lock);
+		} else {
+			socket = SocketDequeue(b->connectq);
+			if (!socket)
+				continue;
+			if (__sync_bool_compare_and_swap(&socket->connect_req,
+						CONNECT_PENDING, CONNECT_CLAIMED)) {
+				stream = AllocStream(b, socket);
+				if (stream)
+					FreeStream(b, stream);
+				else
+					b->failed++;
+				__sync_synchronize();
+				socket->connect_req = CONNECT_IDLE;
+			} else {
+				b->failed++;
+			}
+		}
+		__sync_synchronize();
+		b->done++;
+	}
+
+	return NULL;
+}
+/*----------------------------------------------------------------------------*/
+static void
+SetSocket(struct socket_map *socket, uint32_t i, uint32_t daddr)
+{
+	socket->saddr.sin_addr.s_addr = htonl(0x0a010000 + i % NUM_SRC_ADDR);
+	socket->saddr.sin_port = htons(1025 + (i / NUM_SRC_ADDR) % 60000);
+	socket->daddr.sin_addr.s_addr = daddr;
+	socket->daddr.sin_port = htons(BENCH_PORT);
+}
+/*----------------------------------------------------------------------------*/
+static int
+RunBench(uint32_t num_connects, int locked)
+{
+	struct bench b;
+	pthread_t stack;
+	struct socket_map *socket;
+	tcp_stream *stream;
+	uint32_t daddr = inet_addr(BENCH_SERVER);
+	uint32_t i;
+	double start, elapsed;
+
+	memset(&b, 0, sizeof(b));
+	b.locked = locked;
+	b.num_connects = num_connects;
+	b.flow_pool = MPCreate(sizeof(tcp_stream),
+			(size_t)sizeof(tcp_stream) * POOL_SIZE);
+	b.rv_pool = MPCreate(sizeof(struct tcp_recv_vars),
+			(size_t)sizeof(struct tcp_recv_vars) * POOL_SIZE);
+	b.sv_pool = MPCreate(sizeof(struct tcp_send_vars),
+			(size_t)sizeof(struct tcp_send_vars) * POOL_SIZE);
+	b.ht = CreateHashtable(HashFlow, EqualFlow, NUM_BINS_FLOWS);
+	b.connectq = CreateStreamQueue(QUEUE_SIZE);
+	b.smap = calloc(QUEUE_SIZE, sizeof(struct socket_map));
+	if (!b.flow_pool || !b.rv_pool || !b.sv_pool ||
+			!b.ht || !b.connectq || !b.smap) {
+		fprintf(stderr, "Failed to allocate the bench state.\n");
+		return -1;
+	}
+	pthread_mutex_init(&b.flow_pool_lock, NULL);
+
+	if (pthread_create(&stack, NULL, StackThread, &b)) {
+		perror("pthread_create");
+		return -1;
+	}
+
+	start = NowSec();
+	for (i = 0; i < num_connects; i++) {
+		/* never more requests in flight than the connect queue holds */
+		while (i - b.done >= QUEUE_SIZE - 1)
+			;
+		socket = &b.smap[i % QUEUE_SIZE];
+		SetSocket(socket, i, daddr);
+
+		if (locked) {
+			pthread_mutex_lock(&b.flow_pool_lock);
+			stream = AllocStream(&b, socket);
+			pthread_mutex_unlock(&b.flow_pool_lock);
+			if (!stream) {
+				fprintf(stderr, "Failed to allocate stream %u.\n", i);
+				return -1;
+			}
+			StreamEnqueue(b.connectq, stream);
+		} else {
+			__sync_synchronize();
+			socket->connect_req = CONNECT_PENDING;
+			SocketEnqueue(b.connectq, socket);
+		}
+	}
+	pthread_join(stack, NULL);
+	elapsed = NowSec() - start;
+
+	printf("%-8s %9u connects: %7.2f Mconn/s, %6.1f ns/conn\n",
+			locked ? "locked" : "handover", num_connects,
+			num_connects / elapsed / 1e6, elapsed * 1e9 / num_connects);
+	if (b.failed) {
+		fprintf(stderr, "%u streams failed to allocate.\n", b.failed);
+		return -1;
+	}
+
+	pthread_mutex_destroy(&b.flow_pool_lock);
+	free(b.smap);
+	DestroyStreamQueue(b.connectq);
+	DestroyHashtable(b.ht);
+	MPDestroy(b.sv_pool);
+	MPDestroy(b.rv_pool);
+	MPDestroy(b.flow_pool);
+
+	return 0;
+}
+/*----------------------------------------------------------------------------*/
+int
+main(int argc, char **argv)
+{
+	uint32_t num_connects = 10000000;
+
+	if (argc > 1)
+		num_connects = strtoul(argv[1], NULL, 10);
+
+	if (RunBench(num_connects, TRUE) < 0)
+		return -1;
+	if (RunBench(num_connects, FALSE) < 0)
+		return -1;
+
+	return 0;
+}
+/*----------------------------------------------------------------------------*/
@@ -506,17 +506,68 @@ FlushEpollEvents(mtcp_manager_t mtcp, uint32_t cur_ts)
 	pthread_mutex_unlock(&ep->epoll_lock);
 }
 /*----------------------------------------------------------------------------*/
+/* 
+ * Creates the stream of an mtcp_connect() request on the stack thread, so 
+ * that stream objects are only ever allocated and freed by their owning core.
+ */
+static inline void 
+HandleConnectRequest(mtcp_manager_t mtcp, socket_map_t socket, uint32_t cur_ts)
+{
+	tcp_stream *stream;
+
+	/* cancelled by mtcp_close()/mtcp_abort(), or already served through 
+	   an earlier queue entry of the same (reused) socket */
+	if (!__sync_bool_compare_and_swap(&socket->connect_req, 
+				CONNECT_PENDING, CONNECT_CLAIMED)) {
+		return;
+	}
+
+	errno = 0;
+	stream = CreateTCPStream(mtcp, socket, socket->socktype, 
+			socket->saddr.sin_addr.s_addr, socket->saddr.sin_port, 
+			socket->daddr.sin_addr.s_addr, socket->daddr.sin_port);
+	if (!stream) {
+		TRACE_ERROR("Socket %d: failed to create tcp_stream!\n", socket->id);
+		/* reported by getsockopt(SO_ERROR) and a blocking mtcp_connect() */
+		socket->connect_err = errno ? errno : ENOMEM;
+		if (socket->connect_dyn_bound) {
+			if (FreeBoundAddress(mtcp, &socket->saddr, &socket->daddr) < 0) {
+				TRACE_ERROR("(NEVER HAPPEN) Failed to free address.\n");
+			}
+			socket->opts &= ~MTCP_ADDR_BIND;
+			socket->connect_dyn_bound = FALSE;
+		}
+		if (socket->epoll & MTCP_EPOLLERR) {
+			AddEpollEvent(mtcp->ep, MTCP_EVENT_QUEUE, socket, MTCP_EPOLLERR);
+		}
+	} else {
+		if (socket->connect_dyn_bound)
+			stream->is_bound_addr = TRUE;
+		stream->sndvar->cwnd = 1;
+		stream->sndvar->ssthresh = stream->sndvar->mss * 10;
+
+		stream->state = TCP_ST_SYN_SENT;
+		TRACE_STATE("Stream %d: TCP_ST_SYN_SENT\n", stream->id);
+
+		AddtoControlList(mtcp, stream, cur_ts);
+	}
+
+	__sync_synchronize();
+	socket->connect_req = CONNECT_IDLE;
+}
+/*----------------------------------------------------------------------------*/
 static inline void 
 HandleApplicationCalls(mtcp_manager_t mtcp, uint32_t cur_ts)
 {
 	tcp_stream *stream;
+	socket_map_t socket;
 	int cnt, max_cnt;
 	int handled, delayed;
 	int control, send, ack;
 
 	/* connect handling */
-	while ((stream = StreamDequeue(mtcp->connectq))) {
-		AddtoControlList(mtcp, stream, cur_ts);
+	while ((socket = SocketDequeue(mtcp->connectq))) {
+		HandleConnectRequest(mtcp, socket, cur_ts);
 	}
 
 	/* send queue handling */
@@ -727,15 +778,23 @@ DestroyRemainingFlows(mtcp_manager_t mtcp)
 {
 	struct hashtable *ht = mtcp->tcp_flow_table;
 	tcp_stream *walk;
-	int cnt, i;
+	int cnt;
 
 	cnt = 0;
 #if 0
 	thread_printf(mtcp, mtcp->log_fp, 
 			"CPU %d: Flushing remaining flows.\n", mtcp->ctx->cpu);
 #endif
-	for (i = 0; i < NUM_BINS; i++) {
-		TAILQ_FOREACH(walk, &ht->ht_table[i], rcvvar->he_link) {
+	/* removal may advance (and finish) a pending resize, so rescan 
+	   after every stream taken from the old table */
+	while (StreamHTCount(ht) > 0) {
+		struct flow_table *ft = ht->old.ctrl ? &ht->old : &ht->cur;
+		uint32_t i;
+
+		for (i = 0; i < (ft->mask + 1) * FT_GROUP_SIZE; i++) {
+			if (ft->ctrl[i] & 0x80)
+				continue;
+			walk = ft->slots[i].stream;
 #ifdef DUMP_STREAM
 			thread_printf(mtcp, mtcp->log_fp, 
 					"CPU %d: Destroying stream %d\n", mtcp->ctx->cpu, walk->id);
@@ -743,6 +802,8 @@ DestroyRemainingFlows(mtcp_manager_t mtcp)
 #endif
 			DestroyTCPStream(mtcp, walk);
 			cnt++;
+			if (ft == &ht->old)
+				break;
 		}
 	}
 
@@ -1001,13 +1062,15 @@ InitializeMTCPManager(struct mtcp_thread_context* ctx)
 		return NULL;
 	}	
 #endif
-	mtcp->rbm_snd = SBManagerCreate(mtcp, CONFIG.sndbuf_size, CONFIG.max_num_buffers);
+	mtcp->rbm_snd = SBManagerCreate(mtcp, CONFIG.sndbuf_size, CONFIG.max_num_buffers, 
+			CONFIG.small_buf_size, CONFIG.max_num_small_buffers);
 	if (!mtcp->rbm_snd) {
 		CTRACE_ERROR("Failed to create send ring buffer.\n");
 		return NULL;
 	}
 
-	mtcp->rbm_rcv = RBManagerCreate(mtcp, CONFIG.rcvbuf_size, CONFIG.max_num_buffers);
+	mtcp->rbm_rcv = RBManagerCreate(mtcp, CONFIG.rcvbuf_size, CONFIG.max_num_buffers, 
+			CONFIG.small_buf_size, CONFIG.max_num_small_buffers);
 	if (!mtcp->rbm_rcv) {
 		CTRACE_ERROR("Failed to create recv ring buffer.\n");
 		return NULL;
@@ -1152,11 +1215,6 @@ MTCPRunThread(void *arg)
 		exit(-1);
 	}
 
-	if (pthread_mutex_init(&ctx->flow_pool_lock, NULL)) {
-		perror("pthread_mutex_init of ctx->flow_pool_lock\n");
-		exit(-1);
-	}
-	
 	if (pthread_mutex_init(&ctx->socket_pool_lock, NULL)) {
 		perror("pthread_mutex_init of ctx->socket_pool_lock\n");
 		exit(-1);
@@ -1408,7 +1466,7 @@ mtcp_free_context(mctx_t mctx)
 	MPDestroy(mtcp->flow_pool);
 	
 	if (mtcp->ap) {
-		DestroyAddressPool(mtcp->ap);
+		DestroyAddressPools(mtcp->ap);
 		mtcp->ap = NULL;
 	}
 
@@ -1463,6 +1521,8 @@ mtcp_getconf(struct mtcp_conf *conf)
 	conf->tcp_timewait = CONFIG.tcp_timewait;
 	conf->tcp_timeout = CONFIG.tcp_timeout;
 
+	strncpy(conf->core_mask, CONFIG.core_mask, MTCP_CORE_MASK_LEN);
+
 	return 0;
 }
 /*----------------------------------------------------------------------------*/
@@ -1488,6 +1548,11 @@ mtcp_setconf(const struct mtcp_conf *conf)
 	if (conf->tcp_timeout > 0)
 		CONFIG.tcp_timeout = conf->tcp_timeout;
 
+	if (conf->core_mask[0]) {
+		strncpy(CONFIG.core_mask, conf->core_mask, MTCP_CORE_MASK_LEN);
+		CONFIG.core_mask[MTCP_CORE_MASK_LEN - 1] = '\0';
+	}
+
 	TRACE_CONFIG("Configuration updated by mtcp_setconf().\n");
 	//PrintConfiguration();
 
@@ -7,11 +7,257 @@
 #include <arpa/inet.h>
 #include <sys/queue.h>
 
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
 #include "debug.h"
 #include "fhash.h"
 
 #define IS_FLOW_TABLE(x)	(x == HashFlow)
 #define IS_LISTEN_TABLE(x)	(x == HashListener)
+
+#define FT_H1(hash)		((hash) >> 7)
+#define FT_H2(hash)		((uint8_t)((hash) & 0x7F))
+#define FT_SLOTS(ft)		(((ft)->mask + 1) * FT_GROUP_SIZE)
+/*----------------------------------------------------------------------------*/
+unsigned int
+HashFlow(const void *f)
+{
+	tcp_stream *flow = (tcp_stream *)f;
+	uint64_t h;
+
+	/* saddr, daddr, sport and dport are laid out contiguously in tcp_stream */
+	h = (((uint64_t)flow->saddr << 32) | flow->daddr) * 0x9E3779B97F4A7C15ULL;
+	h ^= (((uint64_t)flow->sport << 16) | flow->dport) * 0xC2B2AE3D27D4EB4FULL;
+	h ^= h >> 29;
+	h *= 0xBF58476D1CE4E5B9ULL;
+	h ^= h >> 32;
+
+	return (unsigned int)h;
+}
+/*----------------------------------------------------------------------------*/
+int
+EqualFlow(const void *f1, const void *f2)
+{
+	tcp_stream *flow1 = (tcp_stream *)f1;
+	tcp_stream *flow2 = (tcp_stream *)f2;
+
+	return (flow1->saddr == flow2->saddr && 
+			flow1->sport == flow2->sport &&
+			flow1->daddr == flow2->daddr &&
+			flow1->dport == flow2->dport);
+}
+/*----------------------------------------------------------------------------*/
+/* Group matching: bit i of the returned mask is set if slot i of the group   */
+/* satisfies the predicate.                                                   */
+/*----------------------------------------------------------------------------*/
+static inline uint32_t
+GroupMatch(const uint8_t *ctrl, uint8_t tag)
+{
+#ifdef __SSE2__
+	__m128i c = _mm_load_si128((const __m128i *)ctrl);
+	return _mm_movemask_epi8(_mm_cmpeq_epi8(c, _mm_set1_epi8((char)tag)));
+#else
+	uint32_t m = 0;
+	int i;
+	for (i = 0; i < FT_GROUP_SIZE; i++)
+		if (ctrl[i] == tag)
+			m |= (1U << i);
+	return m;
+#endif
+}
+/*----------------------------------------------------------------------------*/
+/* EMPTY and DELETED are the only control values with the high bit set */
+static inline uint32_t
+GroupMatchFree(const uint8_t *ctrl)
+{
+#ifdef __SSE2__
+	return _mm_movemask_epi8(_mm_load_si128((const __m128i *)ctrl));
+#else
+	uint32_t m = 0;
+	int i;
+	for (i = 0; i < FT_GROUP_SIZE; i++)
+		if (ctrl[i] & 0x80)
+			m |= (1U << i);
+	return m;
+#endif
+}
+/*----------------------------------------------------------------------------*/
+static int
+FTInit(struct flow_table *ft, uint32_t nslots)
+{
+	uint32_t groups = 1;
+
+	while (groups * FT_GROUP_SIZE < nslots)
+		groups <<= 1;
+
+	if (posix_memalign((void **)&ft->ctrl, FT_GROUP_SIZE, 
+				groups * FT_GROUP_SIZE)) {
+		ft->ctrl = NULL;
+		return -1;
+	}
+	/* slots are only read through a FULL control byte, so they may stay 
+	   untouched (and unbacked) until used */
+	ft->slots = calloc(groups * FT_GROUP_SIZE, sizeof(struct flow_slot));
+	if (!ft->slots) {
+		free(ft->ctrl);
+		ft->ctrl = NULL;
+		return -1;
+	}
+	memset(ft->ctrl, FT_CTRL_EMPTY, groups * FT_GROUP_SIZE);
+
+	ft->mask = groups - 1;
+	ft->size = 0;
+	ft->tombs = 0;
+
+	return 0;
+}
+/*----------------------------------------------------------------------------*/
+static void
+FTFree(struct flow_table *ft)
+{
+	free(ft->ctrl);
+	free(ft->slots);
+	memset(ft, 0, sizeof(*ft));
+}
+/*----------------------------------------------------------------------------*/
+/* FTFind()                                                                   */
+/* Returns the slot index holding a flow equal to key (or the stream pointer  */
+/* itself if by_ptr is set), -1 if absent.                                    */
+/*----------------------------------------------------------------------------*/
+static inline int
+FTFind(struct hashtable *ht, struct flow_table *ft, uint32_t hash, 
+		const void *key, int by_ptr)
+{
+	uint32_t g = FT_H1(hash) & ft->mask;
+	uint32_t step = 0;
+	uint32_t m;
+	int idx;
+
+	for (;;) {
+		const uint8_t *ctrl = ft->ctrl + g * FT_GROUP_SIZE;
+
+		m = GroupMatch(ctrl, FT_H2(hash));
+		while (m) {
+			idx = g * FT_GROUP_SIZE + __builtin_ctz(m);
+			if (ft->slots[idx].hash == hash) {
+				if (by_ptr ? ft->slots[idx].stream == key :
+						ht->eqfn(ft->slots[idx].stream, key))
+					return idx;
+			}
+			m &= m - 1;
+		}
+		if (GroupMatch(ctrl, FT_CTRL_EMPTY))
+			return -1;
+
+		/* triangular probing visits every group of a power-of-two table */
+		step++;
+		if (step > ft->mask)
+			return -1;
+		g = (g + step) & ft->mask;
+	}
+}
+/*----------------------------------------------------------------------------*/
+static inline void
+FTPut(struct flow_table *ft, uint32_t hash, tcp_stream *stream)
+{
+	uint32_t g = FT_H1(hash) & ft->mask;
+	uint32_t step = 0;
+	uint32_t m;
+	int idx;
+
+	for (;;) {
+		m = GroupMatchFree(ft->ctrl + g * FT_GROUP_SIZE);
+		if (m)
+			break;
+		step++;
+		g = (g + step) & ft->mask;
+	}
+
+	idx = g * FT_GROUP_SIZE + __builtin_ctz(m);
+	if (ft->ctrl[idx] == FT_CTRL_DELETED)
+		ft->tombs--;
+	ft->ctrl[idx] = FT_H2(hash);
+	ft->slots[idx].hash = hash;
+	ft->slots[idx].stream = stream;
+	ft->size++;
+}
+/*----------------------------------------------------------------------------*/
+static inline void
+FTErase(struct flow_table *ft, int idx)
+{
+	const uint8_t *group = ft->ctrl + (idx & ~(FT_GROUP_SIZE - 1));
+
+	/* probing stops at a group with an EMPTY slot, so if this group already 
+	   has one no probe sequence passes through it and the slot may become 
+	   EMPTY again; otherwise leave a tombstone */
+	if (GroupMatch(group, FT_CTRL_EMPTY)) {
+		ft->ctrl[idx] = FT_CTRL_EMPTY;
+	} else {
+		ft->ctrl[idx] = FT_CTRL_DELETED;
+		ft->tombs++;
+	}
+	ft->size--;
+}
+/*----------------------------------------------------------------------------*/
+/* MigrateStep()                                                              */
+/* Moves a few groups of the old table into the current one. Moved slots are  */
+/* left as tombstones so that lookups still walking the old table keep        */
+/* probing past them.                                                         */
+/*----------------------------------------------------------------------------*/
+static void
+MigrateStep(struct hashtable *ht)
+{
+	struct flow_table *old = &ht->old;
+	uint32_t end = ht->migrate_pos + FT_MIGRATE_GROUPS;
+	uint32_t i;
+
+	if (end > old->mask + 1)
+		end = old->mask + 1;
+
+	for (i = ht->migrate_pos * FT_GROUP_SIZE; i < end * FT_GROUP_SIZE; i++) {
+		if (old->ctrl[i] & 0x80)
+			continue;
+		FTPut(&ht->cur, old->slots[i].hash, old->slots[i].stream);
+		old->ctrl[i] = FT_CTRL_DELETED;
+		old->size--;
+	}
+	ht->migrate_pos = end;
+
+	if (ht->migrate_pos > old->mask)
+		FTFree(old);
+}
+/*----------------------------------------------------------------------------*/
+/* Starts a resize once live entries plus tombstones reach 7/8 of capacity.   */
+/* The table doubles unless most of the load is tombstones, in which case it  */
+/* is rebuilt at the same size. The move itself is spread over later calls.   */
+/*----------------------------------------------------------------------------*/
+static int
+MaybeGrow(struct hashtable *ht)
+{
+	struct flow_table *cur = &ht->cur;
+	uint32_t cap = FT_SLOTS(cur);
+	struct flow_table next;
+
+	if ((cur->size + cur->tombs + 1) * 8 <= cap * 7)
+		return 0;
+
+	/* never stack two resizes */
+	while (ht->old.ctrl)
+		MigrateStep(ht);
+
+	if (FTInit(&next, (cur->size * 2 < cap) ? cap : cap * 2) < 0) {
+		TRACE_ERROR("Failed to grow flow table (%u slots)!\n", cap);
+		return -1;
+	}
+
+	ht->old = *cur;
+	ht->cur = next;
+	ht->migrate_pos = 0;
+
+	return 0;
+}
 /*----------------------------------------------------------------------------*/
 struct hashtable * 
 CreateHashtable(unsigned int (*hashfn) (const void *), // key function
@@ -31,15 +277,11 @@ CreateHashtable(unsigned int (*hashfn) (const void *), // key function
 
 	/* creating bins */
 	if (IS_FLOW_TABLE(hashfn)) {
-		ht->ht_table = calloc(bins, sizeof(hash_bucket_head));
-		if (!ht->ht_table) {
+		if (FTInit(&ht->cur, bins) < 0) {
 			TRACE_ERROR("calloc: CreateHashtable bins!\n");
 			free(ht);
 			return 0;
 		}
-		/* init the tables */
-		for (i = 0; i < bins; i++)
-			TAILQ_INIT(&ht->ht_table[i]);
 	} else if (IS_LISTEN_TABLE(hashfn)) {
 		ht->lt_table = calloc(bins, sizeof(list_bucket_head));
 		if (!ht->lt_table) {
@@ -58,9 +300,11 @@ CreateHashtable(unsigned int (*hashfn) (const void *), // key function
 void
 DestroyHashtable(struct hashtable *ht)
 {
-	if (IS_FLOW_TABLE(ht->hashfn))
-		free(ht->ht_table);
-	else /* IS_LISTEN_TABLE(ht->hashfn) */
+	if (IS_FLOW_TABLE(ht->hashfn)) {
+		FTFree(&ht->cur);
+		if (ht->old.ctrl)
+			FTFree(&ht->old);
+	} else /* IS_LISTEN_TABLE(ht->hashfn) */
 		free(ht->lt_table);
 	free(ht);
 }
@@ -69,15 +313,16 @@ int
 StreamHTInsert(struct hashtable *ht, void *it)
 {
 	/* create an entry*/ 
-	int idx;
 	tcp_stream *item = (tcp_stream *)it;
 
 	assert(ht);
 
-	idx = ht->hashfn(item);
-	assert(idx >=0 && idx < NUM_BINS_FLOWS);
+	if (MaybeGrow(ht) < 0)
+		return -1;
+	if (ht->old.ctrl)
+		MigrateStep(ht);
 
-	TAILQ_INSERT_TAIL(&ht->ht_table[idx], item, rcvvar->he_link);
+	FTPut(&ht->cur, ht->hashfn(item), item);
 
 	item->ht_idx = TCP_AR_CNT;
 	
@@ -87,12 +332,21 @@ StreamHTInsert(struct hashtable *ht, void *it)
 void* 
 StreamHTRemove(struct hashtable *ht, void *it)
 {
-	hash_bucket_head *head;
 	tcp_stream *item = (tcp_stream *)it;
-	int idx = ht->hashfn(item);
+	uint32_t hash = ht->hashfn(item);
+	int idx;
 
-	head = &ht->ht_table[idx];
-	TAILQ_REMOVE(head, item, rcvvar->he_link);	
+	idx = FTFind(ht, &ht->cur, hash, item, TRUE);
+	if (idx >= 0) {
+		FTErase(&ht->cur, idx);
+	} else if (ht->old.ctrl) {
+		idx = FTFind(ht, &ht->old, hash, item, TRUE);
+		if (idx >= 0)
+			FTErase(&ht->old, idx);
+	}
+
+	if (ht->old.ctrl)
+		MigrateStep(ht);
 
 	return (item);
 }	
@@ -100,24 +354,32 @@ StreamHTRemove(struct hashtable *ht, void *it)
 void * 
 StreamHTSearch(struct hashtable *ht, const void *it)
 {
+	uint32_t hash = ht->hashfn(it);
 	int idx;
-	const tcp_stream *item = (const tcp_stream *)it;
-	tcp_stream *walk;
-	hash_bucket_head *head;
-
-	idx = ht->hashfn(item);
 
-	head = &ht->ht_table[ht->hashfn(item)];
-	TAILQ_FOREACH(walk, head, rcvvar->he_link) {
-		if (ht->eqfn(walk, item)) 
-			return walk;
+	if (__builtin_expect(ht->old.ctrl != NULL, 0)) {
+		MigrateStep(ht);
+		if (ht->old.ctrl) {
+			idx = FTFind(ht, &ht->old, hash, it, FALSE);
+			if (idx >= 0)
+				return ht->old.slots[idx].stream;
+		}
 	}
 
-	UNUSED(idx);
+	idx = FTFind(ht, &ht->cur, hash, it, FALSE);
+	if (idx >= 0)
+		return ht->cur.slots[idx].stream;
+
 	return NULL;
 }
 /*----------------------------------------------------------------------------*/
 unsigned int
+StreamHTCount(struct hashtable *ht)
+{
+	return ht->cur.size + (ht->old.ctrl ? ht->old.size : 0);
+}
+/*----------------------------------------------------------------------------*/
+unsigned int
 HashListener(const void *l)
 {
 	struct tcp_listener *listener = (struct tcp_listener *)l;
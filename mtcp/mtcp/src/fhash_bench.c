@@ -0,0 +1,142 @@
+/*----------------------------------------------------------------------------*/
+/* fhash_bench: flow table insert/lookup benchmark                            */
+/*                                                                            */
+/* Populates a flow table with client-side 4-tuples (many source addresses    */
+/* and ports towards one server) the way a connect-heavy load generator does, */
+/* then measures hit and miss lookups in random order.                        */
+/*                                                                            */
+/* usage: fhash_bench [num_flows ...]   (default: 1M 5M 10M)                  */
+/*----------------------------------------------------------------------------*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <time.h>
+#include <arpa/inet.h>
+
+#include "fhash.h"
+
+#define NUM_SRC_ADDR		200
+#define BENCH_SERVER		"10.0.0.1"
+#define BENCH_PORT		80
+/*----------------------------------------------------------------------------*/
+static inline double
+NowSec()
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+/*----------------------------------------------------------------------------*/
+static void
+SetTuple(tcp_stream *s, uint32_t i, uint32_t daddr)
+{
+	s->saddr = htonl(0x0a010000 + i % NUM_SRC_ADDR);
+	s->sport = htons(1025 + i / NUM_SRC_ADDR);
+	s->daddr = daddr;
+	s->dport = htons(BENCH_PORT);
+}
+/*----------------------------------------------------------------------------*/
+static int
+RunBench(uint32_t num_flows)
+{
+	struct hashtable *ht;
+	tcp_stream *streams, key;
+	uint32_t *order;
+	uint32_t daddr = inet_addr(BENCH_SERVER);
+	uint32_t i, j, tmp, found;
+	double start, elapsed;
+
+	streams = calloc(num_flows, sizeof(tcp_stream));
+	order = malloc(num_flows * sizeof(uint32_t));
+	ht = CreateHashtable(HashFlow, EqualFlow, NUM_BINS_FLOWS);
+	if (!streams || !order || !ht) {
+		fprintf(stderr, "Failed to allocate %u flows.\n", num_flows);
+		return -1;
+	}
+
+	for (i = 0; i < num_flows; i++) {
+		SetTuple(&streams[i], i, daddr);
+		order[i] = i;
+	}
+	srand(num_flows);
+	for (i = num_flows - 1; i > 0; i--) {
+		j = rand() % (i + 1);
+		tmp = order[i];
+		order[i] = order[j];
+		order[j] = tmp;
+	}
+
+	/* insert, including every incremental resize from the initial size */
+	start = NowSec();
+	for (i = 0; i < num_flows; i++)
+		StreamHTInsert(ht, &streams[i]);
+	elapsed = NowSec() - start;
+	printf("%9u flows: insert %7.2f ns/op", num_flows, elapsed * 1e9 / num_flows);
+
+	/* hits, through a stack key as in ProcessTCPPacket() */
+	found = 0;
+	start = NowSec();
+	for (i = 0; i < num_flows; i++) {
+		SetTuple(&key, order[i], daddr);
+		if (StreamHTSearch(ht, &key) == &streams[order[i]])
+			found++;
+	}
+	elapsed = NowSec() - start;
+	printf(", hit %7.2f ns/op", elapsed * 1e9 / num_flows);
+	if (found != num_flows) {
+		fprintf(stderr, "\nLookup failed: %u of %u flows found.\n",
+				found, num_flows);
+		return -1;
+	}
+
+	/* misses: same clients towards another server port */
+	found = 0;
+	start = NowSec();
+	for (i = 0; i < num_flows; i++) {
+		SetTuple(&key, order[i], daddr);
+		key.dport = htons(BENCH_PORT + 1);
+		if (StreamHTSearch(ht, &key))
+			found++;
+	}
+	elapsed = NowSec() - start;
+	printf(", miss %7.2f ns/op\n", elapsed * 1e9 / num_flows);
+	if (found) {
+		fprintf(stderr, "Lookup failed: %u false hits.\n", found);
+		return -1;
+	}
+
+	/* remove everything */
+	for (i = 0; i < num_flows; i++)
+		StreamHTRemove(ht, &streams[order[i]]);
+	if (StreamHTCount(ht) != 0) {
+		fprintf(stderr, "Remove failed: %u flows left.\n", StreamHTCount(ht));
+		return -1;
+	}
+
+	DestroyHashtable(ht);
+	free(order);
+	free(streams);
+
+	return 0;
+}
+/*----------------------------------------------------------------------------*/
+int
+main(int argc, char **argv)
+{
+	uint32_t defaults[] = {1000000, 5000000, 10000000};
+	int i;
+
+	if (argc > 1) {
+		for (i = 1; i < argc; i++)
+			if (RunBench(strtoul(argv[i], NULL, 10)) < 0)
+				return -1;
+	} else {
+		for (i = 0; i < sizeof(defaults) / sizeof(defaults[0]); i++)
+			if (RunBench(defaults[i]) < 0)
+				return -1;
+	}
+
+	return 0;
+}
+/*----------------------------------------------------------------------------*/
@@ -8,6 +8,7 @@
 #define MAX_PORT (65535 + 1)
 /*----------------------------------------------------------------------------*/
 typedef struct addr_pool *addr_pool_t;
+typedef struct addr_pool_index *addr_pool_index_t;
 /*----------------------------------------------------------------------------*/
 /* CreateAddressPool()                                                        */
 /* Create address pool for given address range.                               */
@@ -20,11 +21,33 @@ CreateAddressPool(in_addr_t addr_base, int num_addr);
 /* CreateAddressPoolPerCore()                                                 */
 /* Create address pool only for the given core number.                        */
 /* All addresses and port numbers should be in network order.                 */
+/* Entries are kept in a bitmap that is filled lazily with the ports whose    */
+/* RSS hash maps to the core; fetch/free on this pool never take a lock.      */
 /*----------------------------------------------------------------------------*/
 addr_pool_t 
 CreateAddressPoolPerCore(int core, int num_queues, 
 		in_addr_t saddr_base, int num_addr, in_addr_t daddr, in_port_t dport);
 /*----------------------------------------------------------------------------*/
+/* Per-core pools of several destinations are indexed by (daddr, dport).     */
+/* FindAddressPool() returns the pool of daddr in the index, or NULL.         */
+/* AddAddressPool() adds ap (replacing the pool of the same destination) and  */
+/* returns the index, created on first use; NULL if it cannot be allocated.   */
+/* RetireAddressPools() empties the index. Replaced and retired pools stay    */
+/* allocated for lookups in flight on the stack thread until                  */
+/* DestroyAddressPools() frees the index with all of its pools.               */
+/*----------------------------------------------------------------------------*/
+addr_pool_t 
+FindAddressPool(addr_pool_index_t index, const struct sockaddr_in *daddr);
+/*----------------------------------------------------------------------------*/
+addr_pool_index_t 
+AddAddressPool(addr_pool_index_t index, addr_pool_t ap);
+/*----------------------------------------------------------------------------*/
+void 
+RetireAddressPools(addr_pool_index_t index);
+/*----------------------------------------------------------------------------*/
+void 
+DestroyAddressPools(addr_pool_index_t index);
+/*----------------------------------------------------------------------------*/
 void
 DestroyAddressPool(addr_pool_t ap);
 /*----------------------------------------------------------------------------*/
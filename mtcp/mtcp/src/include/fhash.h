@@ -1,17 +1,38 @@
 #ifndef FHASH_H
 #define FHASH_H
 
+#include <stdint.h>
 #include <sys/queue.h>
 #include "tcp_stream.h"
 
-#define NUM_BINS_FLOWS 		(131072)     /* 132 K entries per thread*/
+#define NUM_BINS_FLOWS 		(131072)     /* initial flow slots per thread, grows on demand */
 #define NUM_BINS_LISTENERS	(1024)	     /* assuming that chaining won't happen excessively */
 #define TCP_AR_CNT 		(3)
 
-typedef struct hash_bucket_head {
-	tcp_stream *tqh_first;
-	tcp_stream **tqh_last;
-} hash_bucket_head;
+/*----------------------------------------------------------------------------*/
+/* The flow table is an open-addressing (Swiss-table style) hash table.       */
+/* Slots are probed in groups of FT_GROUP_SIZE; every slot has a one-byte     */
+/* control tag (7 bits of the hash, or EMPTY/DELETED) so that a whole group   */
+/* is matched with a single SIMD compare. The full hash is kept inline in the */
+/* slot, so neither resizing nor tag collisions touch the tcp_stream itself.  */
+/*----------------------------------------------------------------------------*/
+#define FT_GROUP_SIZE		16
+#define FT_CTRL_EMPTY		((uint8_t)0x80)
+#define FT_CTRL_DELETED		((uint8_t)0xFE)
+#define FT_MIGRATE_GROUPS	8	/* groups moved per operation while resizing */
+
+struct flow_slot {
+	uint32_t hash;
+	tcp_stream *stream;
+};
+
+struct flow_table {
+	uint8_t *ctrl;				/* one control byte per slot */
+	struct flow_slot *slots;
+	uint32_t mask;				/* number of groups - 1 */
+	uint32_t size;				/* live entries */
+	uint32_t tombs;				/* DELETED slots */
+};
 
 typedef struct list_bucket_head {
 	struct tcp_listener *tqh_first;
@@ -22,10 +43,13 @@ typedef struct list_bucket_head {
 struct hashtable {
 	uint32_t bins;
 
-	union {
-		hash_bucket_head *ht_table;
-		list_bucket_head *lt_table;
-	};
+	/* listener table */
+	list_bucket_head *lt_table;
+
+	/* flow table; old.ctrl != NULL while an incremental resize is running */
+	struct flow_table cur;
+	struct flow_table old;
+	uint32_t migrate_pos;			/* next group of old to move */
 
 	// functions
 	unsigned int (*hashfn) (const void *);
@@ -33,8 +57,8 @@ struct hashtable {
 };
 
 /*functions for hashtable*/
-struct hashtable *CreateHashtable(unsigned int (*hashfn) (const void *), 
-				  int (*eqfn) (const void *, 
+struct hashtable *CreateHashtable(unsigned int (*hashfn) (const void *),
+				  int (*eqfn) (const void *,
 					       const void *),
 				  int bins);
 void DestroyHashtable(struct hashtable *ht);
@@ -43,6 +67,7 @@ void DestroyHashtable(struct hashtable *ht);
 int StreamHTInsert(struct hashtable *ht, void *);
 void* StreamHTRemove(struct hashtable *ht, void *);
 void *StreamHTSearch(struct hashtable *ht, const void *);
+unsigned int StreamHTCount(struct hashtable *ht);
 unsigned int HashListener(const void *hbo_port_ptr);
 int EqualListener(const void *hbo_port_ptr1, const void *hbo_port_ptr2);
 int ListenerHTInsert(struct hashtable *ht, void *);
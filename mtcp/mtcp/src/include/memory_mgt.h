@@ -31,6 +31,10 @@ MPAllocateChunk(mem_pool_t mp);
 void
 MPFreeChunk(mem_pool_t mp, void *p);
 
+/* free one chunk from a thread other than the one allocating from mp */
+void
+MPFreeChunkRemote(mem_pool_t mp, void *p);
+
 /* destroy the memory pool */
 void
 MPDestroy(mem_pool_t mp);
@@ -157,10 +157,15 @@ struct mtcp_config
 #ifndef DISABLE_DPDK
 	mpz_t _cpumask;
 #endif
+	/* core mask set by mtcp_setconf(), overrides the config file */
+	char core_mask[MTCP_CORE_MASK_LEN];
 
 	int max_num_buffers;
 	int rcvbuf_size;
 	int sndbuf_size;
+	/* size class for short messages, 0 to always use full-size buffers */
+	int small_buf_size;
+	int max_num_small_buffers;
 	
 	int tcp_timewait;
 	int tcp_timeout;
@@ -218,7 +223,7 @@ struct mtcp_manager
 	socket_map_t smap;
 	TAILQ_HEAD (, socket_map) free_smap;
 
-	addr_pool_t ap;			/* address pool */
+	addr_pool_index_t ap;		/* RSS address pools, one per destination */
 
 	uint32_t g_id;			/* id space in a thread */
 	uint32_t flow_cnt;		/* number of concurrent flows */
@@ -237,7 +242,7 @@ struct mtcp_manager
 
 	struct hashtable *listeners;
 
-	stream_queue_t connectq;				/* streams need to connect */
+	stream_queue_t connectq;				/* sockets requesting connect */
 	stream_queue_t sendq;				/* streams need to send data */
 	stream_queue_t ackq;					/* streams need to send ack */
 
@@ -305,7 +310,6 @@ struct mtcp_thread_context
 
 	void *io_private_context;
 	pthread_mutex_t smap_lock;
-	pthread_mutex_t flow_pool_lock;
 	pthread_mutex_t socket_pool_lock;
 
 #if LOCK_STREAM_QUEUE
@@ -27,6 +27,8 @@ enum socket_type
 	MTCP_SOCK_PIPE, 
 };
 
+#define MTCP_CORE_MASK_LEN		64
+
 struct mtcp_conf
 {
 	int num_cores;
@@ -38,6 +40,10 @@ struct mtcp_conf
 
 	int tcp_timewait;
 	int tcp_timeout;
+
+	/* hex mask of the cores running the stack threads (DPDK only), thread i 
+	   on the i-th lowest core; "" keeps core_mask of the config file */
+	char core_mask[MTCP_CORE_MASK_LEN];
 };
 
 extern int use_extra_io;
@@ -106,6 +112,13 @@ int
 mtcp_init_rss(mctx_t mctx, in_addr_t saddr_base, int num_addr, 
 		in_addr_t daddr, in_addr_t dport);
 
+/* Like mtcp_init_rss(), but adds the pool of one more destination instead of 
+ * replacing the existing ones. mtcp_connect() takes the source address from 
+ * the pool of its destination. */
+int 
+mtcp_add_rss(mctx_t mctx, in_addr_t saddr_base, int num_addr, 
+		in_addr_t daddr, in_addr_t dport);
+
 int 
 mtcp_connect(mctx_t mctx, int sockid, 
 		const struct sockaddr *addr, socklen_t addrlen);
@@ -136,9 +149,50 @@ mtcp_recv(mctx_t mctx, int sockid, char *buf, size_t len, int flags);
 int
 mtcp_readv(mctx_t mctx, int sockid, const struct iovec *iov, int numIOV);
 
+/**
+ * Zero-copy receive: lends the application the in-order bytes waiting in
+ * the receive buffer instead of copying them out.
+ * @param [out] buf: start of the lent bytes
+ * @return number of bytes lent, 0 if the peer closed and nothing is left,
+ * -1 on error (EAGAIN if nothing is waiting)
+ *
+ * The bytes stay valid and in place until mtcp_recv_release(), which must
+ * come before the next read on the socket. Data arriving meanwhile is
+ * appended behind them and shows up on the next loan.
+ */
+ssize_t
+mtcp_recv_zc(mctx_t mctx, int sockid, char **buf);
+
+/**
+ * Ends the loan of mtcp_recv_zc(), removing the first len of the lent bytes
+ * from the receive buffer. The rest is lent again by the next
+ * mtcp_recv_zc().
+ * @return 0 on success, -1 on error
+ */
+int
+mtcp_recv_release(mctx_t mctx, int sockid, size_t len);
+
 ssize_t
 mtcp_write(mctx_t mctx, int sockid, const char *buf, size_t len);
 
+/**
+ * Registers an immutable payload with the calling core's stack, for 
+ * mtcp_write_payload(). The memory must stay valid and unchanged for as 
+ * long as the context exists.
+ * @return payload id, -1 on error
+ */
+int
+mtcp_register_payload(mctx_t mctx, const void *buf, size_t len);
+
+/**
+ * mtcp_write() of len bytes at off of a registered payload. Only a 
+ * reference is queued in the send buffer; the bytes are copied once, 
+ * into the outgoing packet.
+ * @return number of bytes queued, -1 on error
+ */
+ssize_t
+mtcp_write_payload(mctx_t mctx, int sockid, int payload, size_t off, size_t len);
+
 /* writev should work in atomic */
 int
 mtcp_writev(mctx_t mctx, int sockid, const struct iovec *iov, int numIOV);
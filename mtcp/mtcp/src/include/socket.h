@@ -11,6 +11,14 @@ enum socket_opts
 	MTCP_ADDR_BIND		= 0x02, 
 };
 /*----------------------------------------------------------------------------*/
+/* connect request handed from mtcp_connect() to the stack thread */
+enum connect_req_state
+{
+	CONNECT_IDLE		= 0, 
+	CONNECT_PENDING		= 1,	/* queued, may still be cancelled */
+	CONNECT_CLAIMED		= 2,	/* stack thread is creating the stream */
+};
+/*----------------------------------------------------------------------------*/
 struct socket_map
 {
 	int id;
@@ -18,6 +26,11 @@ struct socket_map
 	uint32_t opts;
 
 	struct sockaddr_in saddr;
+	struct sockaddr_in daddr;	/* peer of a pending connect request */
+
+	volatile uint8_t connect_req;
+	uint8_t connect_dyn_bound;
+	int connect_err;		/* errno of a connect request that failed */
 
 	union {
 		struct tcp_stream *stream;
@@ -18,6 +18,8 @@
 #include <stdint.h>
 #include <sys/types.h>
 
+#define RB_GROWN_DRAINS		16	/* drains that fit a small chunk before 
+					   a grown buffer tries one again */
 /*----------------------------------------------------------------------------*/
 enum rb_caller
 {
@@ -48,12 +50,21 @@ struct tcp_ring_buffer
 	uint64_t cum_len;		/* cummulatively merged length */
 	int last_len;			/* currently saved data length */
 	int size;				/* total ring buffer size */
+	int alloc_size;			/* size of the attached chunk, 0 if none */
+	int peak;				/* most bytes pending since the attach */
+	uint8_t grown;			/* drains left on full chunks after 
+							   outgrowing a small one */
 	
 	/* TCP payload features */
 	uint32_t head_seq;
 	uint32_t init_seq;
 
 	struct fragment_ctx* fctx;
+
+	int lent_len;			/* bytes lent to the application, see mtcp_recv_zc() */
+	u_char* lent_data;		/* chunk the loan points into once RBPut had 
+					   to move the bytes, freed by RBEndLoan() */
+	int lent_alloc;			/* size of lent_data */
 };
 /*----------------------------------------------------------------------------*/
 uint32_t RBGetCurnum(rb_manager_t rbm);
@@ -61,10 +72,15 @@ void RBPrintInfo(struct tcp_ring_buffer* buff);
 void RBPrintStr(struct tcp_ring_buffer* buff);
 void RBPrintHex(struct tcp_ring_buffer* buff);
 /*----------------------------------------------------------------------------*/
-rb_manager_t RBManagerCreate(mtcp_manager_t mtcp, size_t chunk_size, uint32_t cnum);
+rb_manager_t RBManagerCreate(mtcp_manager_t mtcp, size_t chunk_size, uint32_t cnum, 
+		size_t small_size, uint32_t small_cnum);
 /*----------------------------------------------------------------------------*/
 struct tcp_ring_buffer* RBInit(rb_manager_t rbm,  uint32_t init_seq);
 void RBFree(rb_manager_t rbm, struct tcp_ring_buffer* buff);
+/* give the chunk of a drained buffer back to the pool (application thread) */
+void RBReleaseData(rb_manager_t rbm, struct tcp_ring_buffer* buff);
+/* end a loan of mtcp_recv_zc() (application thread) */
+void RBEndLoan(rb_manager_t rbm, struct tcp_ring_buffer* buff);
 uint32_t RBIsDanger(rb_manager_t rbm);
 /*----------------------------------------------------------------------------*/
 /* data manupulation functions */
@@ -7,6 +7,23 @@
 /*----------------------------------------------------------------------------*/
 typedef struct sb_manager* sb_manager_t;
 typedef struct mtcp_manager* mtcp_manager_t;
+#define SB_MAX_PAYLOADS		1024	/* registered payloads per core */
+#define SB_MIN_PIECES		4	/* the piece ring starts this small */
+#define SB_MAX_PIECES		128	/* payload pieces queued per stream */
+#define SB_GROWN_DRAINS		16	/* drains that fit a small chunk before 
+					   a grown buffer tries one again */
+#define SB_COPIED		0xFFFF	/* piece id of bytes copied into data */
+#define SB_NO_PIECE		-3	/* SBPut: every piece is taken, retry once 
+					   acked data frees some */
+/*----------------------------------------------------------------------------*/
+/* A run of the send buffer: len bytes at off of registered payload id, or 
+   the next len copied bytes in data if id is SB_COPIED */
+struct sb_piece
+{
+	uint16_t id;
+	uint32_t off;
+	uint32_t len;
+};
 /*----------------------------------------------------------------------------*/
 struct tcp_send_buffer
 {
@@ -18,16 +35,29 @@ struct tcp_send_buffer
 	uint32_t len;
 	uint64_t cum_len;
 	uint32_t size;
+	uint32_t alloc_size;	/* size of the attached chunk, 0 if none */
+	uint32_t peak;		/* most copied bytes pending since the attach */
+	uint8_t grown;		/* drains left on full chunks after 
+				   outgrowing a small one */
 
 	uint32_t head_seq;
 	uint32_t init_seq;
+
+	/* while payload references are queued, the bytes from head_seq on are 
+	   described by pieces (a ring) and data only holds the copied ones; 
+	   the ring grows on demand and goes with the chunk once drained */
+	struct sb_piece *pieces;
+	uint16_t piece_head;
+	uint16_t piece_cnt;
+	uint16_t piece_cap;
 };
 /*----------------------------------------------------------------------------*/
 uint32_t 
 SBGetCurnum(sb_manager_t sbm);
 /*----------------------------------------------------------------------------*/
 sb_manager_t 
-SBManagerCreate(mtcp_manager_t mtcp, size_t chunk_size, uint32_t cnum);
+SBManagerCreate(mtcp_manager_t mtcp, size_t chunk_size, uint32_t cnum, 
+		size_t small_size, uint32_t small_cnum);
 /*----------------------------------------------------------------------------*/
 struct tcp_send_buffer *
 SBInit(sb_manager_t sbm, uint32_t init_seq);
@@ -41,5 +71,29 @@ SBPut(sb_manager_t sbm, struct tcp_send_buffer *buf, const void *data, size_t le
 size_t 
 SBRemove(sb_manager_t sbm, struct tcp_send_buffer *buf, size_t len);
 /*----------------------------------------------------------------------------*/
+/* registers an immutable payload, returns its id or -1 */
+int
+SBRegisterPayload(sb_manager_t sbm, const void *data, size_t len);
+/*----------------------------------------------------------------------------*/
+/* queues len bytes at off of payload id by reference, returns bytes queued */
+int
+SBPutRef(sb_manager_t sbm, struct tcp_send_buffer *buf, 
+		int id, size_t off, size_t len);
+/*----------------------------------------------------------------------------*/
+/* copies len buffered bytes starting off bytes after head_seq to dst */
+void
+SBCopy(sb_manager_t sbm, struct tcp_send_buffer *buf, 
+		uint32_t off, uint8_t *dst, uint32_t len);
+/*----------------------------------------------------------------------------*/
+/* makes room for need more copied bytes, attaching a chunk of the 
+   smallest size class that fits or moving to a full one */
+int
+SBAttachData(sb_manager_t sbm, struct tcp_send_buffer *buf, size_t need);
+/*----------------------------------------------------------------------------*/
+/* gives the chunk and the piece ring of a drained buffer back 
+   (mtcp thread) */
+void
+SBReleaseData(sb_manager_t sbm, struct tcp_send_buffer *buf);
+/*----------------------------------------------------------------------------*/
 
 #endif /* TCP_SEND_BUFFER_H */
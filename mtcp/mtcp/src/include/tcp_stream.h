@@ -71,8 +71,6 @@ struct tcp_recv_vars
 	pthread_mutex_t read_lock;
 #endif
 
-	TAILQ_ENTRY(tcp_stream) he_link;	/* hash table entry link */
-
 #if BLOCKING_SUPPORT
 	TAILQ_ENTRY(tcp_stream) rcv_br_link;
 	pthread_cond_t read_cond;
@@ -226,6 +224,12 @@ CreateTCPStream(mtcp_manager_t mtcp, socket_map_t socket, int type,
 void
 DestroyTCPStream(mtcp_manager_t mtcp, tcp_stream *stream);
 
+/* give a dynamically bound source address back to the address pool of 
+   its destination */
+int
+FreeBoundAddress(mtcp_manager_t mtcp, const struct sockaddr_in *addr, 
+		const struct sockaddr_in *daddr);
+
 void 
 DumpStream(mtcp_manager_t mtcp, tcp_stream *stream);
 
@@ -34,6 +34,7 @@
 #endif /* LOCK_STREAM_QUEUE */
 
 /*---------------------------------------------------------------------------*/
+struct socket_map;
 typedef struct stream_queue* stream_queue_t;
 /*---------------------------------------------------------------------------*/
 typedef struct stream_queue_int
@@ -71,6 +72,13 @@ StreamEnqueue(stream_queue_t sq, struct tcp_stream *stream);
 struct tcp_stream *
 StreamDequeue(stream_queue_t sq);
 /*---------------------------------------------------------------------------*/
+/* the same queue carrying sockets (connect requests) instead of streams */
+int 
+SocketEnqueue(stream_queue_t sq, struct socket_map *socket);
+/*---------------------------------------------------------------------------*/
+struct socket_map *
+SocketDequeue(stream_queue_t sq);
+/*---------------------------------------------------------------------------*/
 int 
 StreamQueueIsEmpty(stream_queue_t sq);
 /*---------------------------------------------------------------------------*/
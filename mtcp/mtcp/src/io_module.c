@@ -255,7 +255,7 @@ SetNetEnv(char *dev_name_list, char *port_stat_list)
 #ifndef DISABLE_DPDK
 		int cpu = CONFIG.num_cores;
 		mpz_t _cpumask;
-		char cpumaskbuf[32] = "";
+		char cpumaskbuf[MTCP_CORE_MASK_LEN + 1] = "";
 		char mem_channels[8] = "";
 		char socket_mem_str[32] = "";
 		// int i;
@@ -270,9 +270,9 @@ SetNetEnv(char *dev_name_list, char *port_stat_list)
 			for (ret = 0; ret < cpu; ret++)
 				mpz_setbit(_cpumask, ret);
 			
-			gmp_sprintf(cpumaskbuf, "%ZX", _cpumask);
+			gmp_snprintf(cpumaskbuf, sizeof(cpumaskbuf), "%ZX", _cpumask);
 		} else
-			gmp_sprintf(cpumaskbuf, "%ZX", CONFIG._cpumask);
+			gmp_snprintf(cpumaskbuf, sizeof(cpumaskbuf), "%ZX", CONFIG._cpumask);
 		
 		mpz_clear(_cpumask);
 
@@ -289,13 +289,17 @@ SetNetEnv(char *dev_name_list, char *port_stat_list)
 		/* get socket memory threshold (in MB) */
 		socket_mem = 
 			RTE_ALIGN_CEIL((unsigned long)ceil((CONFIG.num_cores *
-							    (CONFIG.rcvbuf_size +
-							     CONFIG.sndbuf_size +
-							     sizeof(struct tcp_stream) +
-							     sizeof(struct tcp_recv_vars) +
-							     sizeof(struct tcp_send_vars) +
-							     sizeof(struct fragment_ctx)) *
-							    CONFIG.max_concurrency)/RTE_SOCKET_MEM_SHIFT),
+							    ((sizeof(struct tcp_stream) +
+							      sizeof(struct tcp_recv_vars) +
+							      sizeof(struct tcp_send_vars) +
+							      sizeof(struct fragment_ctx)) *
+							     (uint64_t)CONFIG.max_concurrency +
+							     /* buffers are only held by busy flows */
+							     (uint64_t)(CONFIG.rcvbuf_size +
+									CONFIG.sndbuf_size) *
+							     CONFIG.max_num_buffers +
+							     (uint64_t)CONFIG.small_buf_size * 2 *
+							     CONFIG.max_num_small_buffers))/RTE_SOCKET_MEM_SHIFT),
 				       RTE_CACHE_LINE_SIZE);
 		
 		/* initialize the rte env, what a waste of implementation effort! */
@@ -545,7 +549,7 @@ SetNetEnv(char *dev_name_list, char *port_stat_list)
 #ifdef ENABLE_ONVM
 		int cpu = CONFIG.num_cores;
 		mpz_t cpumask;
-		char cpumaskbuf[32];
+		char cpumaskbuf[MTCP_CORE_MASK_LEN + 1];
 		char mem_channels[8];
 		char service[6];
 		char instance[6];
@@ -556,7 +560,7 @@ SetNetEnv(char *dev_name_list, char *port_stat_list)
 		/* get the cpu mask */
 		for (ret = 0; ret < cpu; ret++)
 			mpz_setbit(cpumask, ret);
-		gmp_sprintf(cpumaskbuf, "%ZX", cpumask);
+		gmp_snprintf(cpumaskbuf, sizeof(cpumaskbuf), "%ZX", cpumask);
 
 		mpz_clear(cpumask);
 				
@@ -25,6 +25,7 @@ typedef struct mem_pool
 	int mp_total_chunks;       /* number of total free chunks */
 	int mp_chunk_size;        /* chunk size in bytes */
 	int mp_type;
+	mem_chunk_t volatile mp_deferred; /* chunks freed by other threads */
 	
 } mem_pool;
 /*----------------------------------------------------------------------------*/
@@ -77,11 +78,28 @@ MPCreate(int chunk_size, size_t total_size)
 	return mp;
 }
 /*----------------------------------------------------------------------------*/
+static inline void
+ReclaimDeferredChunks(mem_pool_t mp)
+{
+	mem_chunk_t p, next;
+
+	p = __sync_lock_test_and_set(&mp->mp_deferred, NULL);
+	while (p) {
+		next = p->mc_next;
+		MPFreeChunk(mp, p);
+		p = next;
+	}
+}
+/*----------------------------------------------------------------------------*/
 void *
 MPAllocateChunk(mem_pool_t mp)
 {
-	mem_chunk_t p = mp->mp_freeptr;
-	
+	mem_chunk_t p;
+
+	if (mp->mp_deferred)
+		ReclaimDeferredChunks(mp);
+
+	p = mp->mp_freeptr;
 	if (mp->mp_free_chunks == 0) 
 		return (NULL);
 	assert(p->mc_free_chunks > 0 && p->mc_free_chunks <= p->mc_free_chunks);
@@ -119,6 +137,21 @@ MPFreeChunk(mem_pool_t mp, void *p)
 }
 /*----------------------------------------------------------------------------*/
 void
+MPFreeChunkRemote(mem_pool_t mp, void *p)
+{
+	mem_chunk_t mcp = (mem_chunk_t)p;
+	mem_chunk_t head;
+
+	assert(((u_char *)p - mp->mp_startptr) % mp->mp_chunk_size == 0);
+
+	/* the owner moves these to its free list on its next allocation */
+	do {
+		head = mp->mp_deferred;
+		mcp->mc_next = head;
+	} while (!__sync_bool_compare_and_swap(&mp->mp_deferred, head, mcp));
+}
+/*----------------------------------------------------------------------------*/
+void
 MPDestroy(mem_pool_t mp)
 {
 	free(mp->mp_startptr);
@@ -197,6 +230,13 @@ MPFreeChunk(mem_pool_t mp, void *p)
 }
 /*----------------------------------------------------------------------------*/
 void
+MPFreeChunkRemote(mem_pool_t mp, void *p)
+{
+	/* rte_mempool is multi-producer safe */
+	rte_mempool_put(mp, p);
+}
+/*----------------------------------------------------------------------------*/
+void
 MPDestroy(mem_pool_t mp)
 {
 #if RTE_VERSION < RTE_VERSION_NUM(16, 7, 0, 0)
@@ -42,12 +42,16 @@ AllocateSocket(mctx_t mctx, int socktype, int need_lock)
 	socket->stream = NULL;
 	socket->epoll = 0;
 	socket->events = 0;
+	socket->connect_req = CONNECT_IDLE;
+	socket->connect_dyn_bound = FALSE;
+	socket->connect_err = 0;
 
 	/* 
 	 * reset a few fields (needed for client socket) 
 	 * addr = INADDR_ANY, port = INPORT_ANY
 	 */
 	memset(&socket->saddr, 0, sizeof(struct sockaddr_in));
+	memset(&socket->daddr, 0, sizeof(struct sockaddr_in));
 	memset(&socket->ep_data, 0, sizeof(mtcp_epoll_data_t));
 
 	return socket;
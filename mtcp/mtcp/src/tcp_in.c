@@ -509,6 +509,8 @@ ProcessACK(mtcp_manager_t mtcp, tcp_stream *cur_stream, uint32_t cur_ts,
 			assert(0);
 		}
 		ret = SBRemove(mtcp->rbm_snd, sndvar->sndbuf, rmlen);
+		/* an idle flow keeps no send chunk */
+		SBReleaseData(mtcp->rbm_snd, sndvar->sndbuf);
 		sndvar->snd_una = ack_seq;
 		snd_wnd_prev = sndvar->snd_wnd;
 		sndvar->snd_wnd = sndvar->sndbuf->size - sndvar->sndbuf->len;
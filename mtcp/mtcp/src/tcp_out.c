@@ -314,7 +314,14 @@ SendTCPPacket(struct mtcp_manager *mtcp, tcp_stream *cur_stream,
 	tcph->doff = (TCP_HEADER_LEN + optlen) >> 2;
 	// copy payload if exist
 	if (payloadlen > 0) {
-		memcpy((uint8_t *)tcph + TCP_HEADER_LEN + optlen, payload, payloadlen);
+		if (payload) {
+			memcpy((uint8_t *)tcph + TCP_HEADER_LEN + optlen, payload, payloadlen);
+		} else {
+			/* gather registered payloads straight from the send buffer */
+			SBCopy(mtcp->rbm_snd, cur_stream->sndvar->sndbuf, 
+					cur_stream->snd_nxt - cur_stream->sndvar->sndbuf->head_seq, 
+					(uint8_t *)tcph + TCP_HEADER_LEN + optlen, payloadlen);
+		}
 		mtcp->nstat.payload_out++;
 #if defined(NETSTAT) && defined(ENABLELRO)
 		mtcp->nstat.tx_gdptbytes += payloadlen;
@@ -485,7 +492,11 @@ FlushTCPSendingBuffer(mtcp_manager_t mtcp, tcp_stream *cur_stream, uint32_t cur_
 	
 	while (1) {
 		seq = cur_stream->snd_nxt;
-		data = sndvar->sndbuf->head + (seq - sndvar->sndbuf->head_seq);
+		/* with payload references queued, SendTCPPacket() gathers them */
+		if (sndvar->sndbuf->piece_cnt > 0)
+			data = NULL;
+		else
+			data = sndvar->sndbuf->head + (seq - sndvar->sndbuf->head_seq);
 		len = sndvar->sndbuf->len - (seq - sndvar->sndbuf->head_seq);
 		
 		/* sanity check */
@@ -24,10 +24,12 @@
 struct rb_manager
 {
 	size_t chunk_size;
+	size_t small_size;
 	uint32_t cur_num;
 	uint32_t cnum;
 
 	mem_pool_t mp;
+	mem_pool_t mp_small;
 	mem_pool_t frag_mp;
 
 	rb_frag_queue_t free_fragq;		/* free fragment queue (for app thread) */
@@ -75,7 +77,8 @@ RBPrintHex(struct tcp_ring_buffer* buff)
 }
 /*----------------------------------------------------------------------------*/
 rb_manager_t
-RBManagerCreate(mtcp_manager_t mtcp, size_t chunk_size, uint32_t cnum)
+RBManagerCreate(mtcp_manager_t mtcp, size_t chunk_size, uint32_t cnum, 
+		size_t small_size, uint32_t small_cnum)
 {
 	rb_manager_t rbm = (rb_manager_t) calloc(1, sizeof(rb_manager));
 
@@ -113,11 +116,32 @@ RBManagerCreate(mtcp_manager_t mtcp, size_t chunk_size, uint32_t cnum)
 		return NULL;
 	}
 
+	if (small_size > 0 && small_size < chunk_size) {
+		rbm->small_size = small_size;
+#if ! defined(DISABLE_DPDK) && ! defined(ENABLE_ONVM)
+		sprintf(pool_name, "rbm_small_pool_%u", mtcp->ctx->cpu);
+		rbm->mp_small = (mem_pool_t)MPCreate(pool_name, small_size, 
+						     (uint64_t)small_size * small_cnum);
+#else
+		rbm->mp_small = (mem_pool_t)MPCreate(small_size, 
+						     (uint64_t)small_size * small_cnum);
+#endif
+		if (!rbm->mp_small) {
+			TRACE_ERROR("Failed to allocate mp_small pool.\n");
+			MPDestroy(rbm->mp);
+			MPDestroy(rbm->frag_mp);
+			free(rbm);
+			return NULL;
+		}
+	}
+
 	rbm->free_fragq = CreateRBFragQueue(cnum);
 	if (!rbm->free_fragq) {
 		TRACE_ERROR("Failed to create free fragment queue.\n");
 		MPDestroy(rbm->mp);
 		MPDestroy(rbm->frag_mp);
+		if (rbm->mp_small)
+			MPDestroy(rbm->mp_small);
 		free(rbm);
 		return NULL;
 	}
@@ -126,6 +150,8 @@ RBManagerCreate(mtcp_manager_t mtcp, size_t chunk_size, uint32_t cnum)
 		TRACE_ERROR("Failed to create internal free fragment queue.\n");
 		MPDestroy(rbm->mp);
 		MPDestroy(rbm->frag_mp);
+		if (rbm->mp_small)
+			MPDestroy(rbm->mp_small);
 		DestroyRBFragQueue(rbm->free_fragq);
 		free(rbm);
 		return NULL;
@@ -201,17 +227,8 @@ RBInit(rb_manager_t rbm, uint32_t init_seq)
 		return NULL;
 	}
 
-	buff->data = MPAllocateChunk(rbm->mp);
-	if(!buff->data){
-		perror("rb_init MPAllocateChunk");
-		free(buff);
-		return NULL;
-	}
-
-	//memset(buff->data, 0, rbm->chunk_size);
-
+	/* the chunk is attached by RBPut() on the first payload */
 	buff->size = rbm->chunk_size;
-	buff->head = buff->data;
 	buff->head_seq = init_seq;
 	buff->init_seq = init_seq;
 	
@@ -230,7 +247,12 @@ RBFree(rb_manager_t rbm, struct tcp_ring_buffer* buff)
 	}
 	
 	if (buff->data) {
-		MPFreeChunk(rbm->mp, buff->data);
+		MPFreeChunk(buff->alloc_size == rbm->chunk_size ? 
+			    rbm->mp : rbm->mp_small, buff->data);
+	}
+	if (buff->lent_data) {
+		MPFreeChunk(buff->lent_alloc == rbm->chunk_size ? 
+			    rbm->mp : rbm->mp_small, buff->lent_data);
 	}
 	
 	rbm->cur_num--;
@@ -238,6 +260,93 @@ RBFree(rb_manager_t rbm, struct tcp_ring_buffer* buff)
 	free(buff);
 }
 /*----------------------------------------------------------------------------*/
+static inline int
+AttachData(rb_manager_t rbm, struct tcp_ring_buffer* buff, int need)
+{
+	/* this function should be called only in mtcp thread */
+	u_char *data;
+	int small = rbm->mp_small && !buff->grown && need <= rbm->small_size;
+
+	data = MPAllocateChunk(small ? rbm->mp_small : rbm->mp);
+	if (!data)
+		return -1;
+
+	if (buff->data) {
+		/* outgrown: move the pending bytes over to a full chunk */
+		memcpy(data, buff->head, buff->last_len);
+		MPFreeChunk(rbm->mp_small, buff->data);
+		buff->tail_offset -= buff->head_offset;
+		buff->head_offset = 0;
+		buff->grown = RB_GROWN_DRAINS;
+	}
+	buff->data = data;
+	buff->head = data + buff->head_offset;
+	buff->alloc_size = small ? rbm->small_size : rbm->chunk_size;
+
+	return 0;
+}
+/*----------------------------------------------------------------------------*/
+static inline int
+RelocateLent(rb_manager_t rbm, struct tcp_ring_buffer* buff, int need)
+{
+	/* this function should be called only in mtcp thread */
+	u_char *data;
+	int full = !rbm->mp_small || buff->alloc_size == rbm->chunk_size || 
+		   buff->alloc_size < need;
+
+	/* the pending bytes move to a fresh chunk, the old one stays as it is
+	   for the application until the loan ends */
+	data = MPAllocateChunk(full ? rbm->mp : rbm->mp_small);
+	if (!data)
+		return -1;
+
+	memcpy(data, buff->head, buff->last_len);
+	if (full && buff->alloc_size < rbm->chunk_size)
+		buff->grown = RB_GROWN_DRAINS;
+	buff->lent_data = buff->data;
+	buff->lent_alloc = buff->alloc_size;
+	buff->tail_offset -= buff->head_offset;
+	buff->head_offset = 0;
+	buff->data = buff->head = data;
+	buff->alloc_size = full ? rbm->chunk_size : rbm->small_size;
+
+	return 0;
+}
+/*----------------------------------------------------------------------------*/
+void
+RBEndLoan(rb_manager_t rbm, struct tcp_ring_buffer* buff)
+{
+	/* this function should be called only in application thread */
+	buff->lent_len = 0;
+	if (buff->lent_data) {
+		MPFreeChunkRemote(buff->lent_alloc == rbm->chunk_size ? 
+				  rbm->mp : rbm->mp_small, buff->lent_data);
+		buff->lent_data = NULL;
+		buff->lent_alloc = 0;
+	}
+}
+/*----------------------------------------------------------------------------*/
+void
+RBReleaseData(rb_manager_t rbm, struct tcp_ring_buffer* buff)
+{
+	/* this function should be called only in application thread */
+	if (!buff->data || buff->last_len > 0 || buff->fctx || buff->lent_len > 0)
+		return;
+
+	/* a grown flow goes back to small chunks once its bursts fit again */
+	if (buff->peak > rbm->small_size)
+		buff->grown = RB_GROWN_DRAINS;
+	else if (buff->grown)
+		buff->grown--;
+	buff->peak = 0;
+
+	MPFreeChunkRemote(buff->alloc_size == rbm->chunk_size ? 
+			  rbm->mp : rbm->mp_small, buff->data);
+	buff->data = buff->head = NULL;
+	buff->head_offset = buff->tail_offset = 0;
+	buff->alloc_size = 0;
+}
+/*----------------------------------------------------------------------------*/
 #define MAXSEQ               ((uint32_t)(0xFFFFFFFF))
 /*----------------------------------------------------------------------------*/
 static inline uint32_t
@@ -307,13 +416,35 @@ RBPut(rb_manager_t rbm, struct tcp_ring_buffer* buff,
 		TRACE_ERROR("full rcvbuf @buff %p!\n", buff);
 		return -2;
 	}
+
+	// attach a chunk on the first byte, or a full one if the small
+	// chunk is outgrown
+	if (!buff->data || buff->alloc_size < end_off) {
+		// lent bytes must stay where the application sees them
+		if (buff->lent_len > 0 && !buff->lent_data) {
+			if (RelocateLent(rbm, buff, end_off) < 0) {
+				TRACE_ERROR("rcvbuf chunks depleted @buff %p!\n", buff);
+				return -2;
+			}
+		} else if (AttachData(rbm, buff, end_off) < 0) {
+			TRACE_ERROR("rcvbuf chunks depleted @buff %p!\n", buff);
+			return -2;
+		}
+	}
 	
 	// if buffer is at tail, move the data to the first of head
-	if (buff->size <= (buff->head_offset + end_off)) {
-		memmove(buff->data, buff->head, buff->last_len);
-		buff->tail_offset -= buff->head_offset;
-		buff->head_offset = 0;
-		buff->head = buff->data;
+	if (buff->alloc_size <= (buff->head_offset + end_off)) {
+		if (buff->lent_len > 0 && !buff->lent_data) {
+			if (RelocateLent(rbm, buff, end_off) < 0) {
+				TRACE_ERROR("rcvbuf chunks depleted @buff %p!\n", buff);
+				return -2;
+			}
+		} else {
+			memmove(buff->data, buff->head, buff->last_len);
+			buff->tail_offset -= buff->head_offset;
+			buff->head_offset = 0;
+			buff->head = buff->data;
+		}
 	}
 #ifdef ENABLELRO
 	// copy data to buffer
@@ -325,6 +456,8 @@ RBPut(rb_manager_t rbm, struct tcp_ring_buffer* buff,
 	if (buff->tail_offset < buff->head_offset + end_off) 
 		buff->tail_offset = buff->head_offset + end_off;
 	buff->last_len = buff->tail_offset - buff->head_offset;
+	if (buff->last_len > buff->peak)
+		buff->peak = buff->last_len;
 
 	// create fragmentation context blocks
 	new_ctx = AllocateFragmentContext(rbm);
@@ -1,4 +1,5 @@
 #include <string.h>
+#include <errno.h>
 
 #include "memory_mgt.h"
 #include "debug.h"
@@ -8,15 +9,26 @@
 #define MAX(a, b) ((a)>(b)?(a):(b))
 #define MIN(a, b) ((a)<(b)?(a):(b))
 
+/*----------------------------------------------------------------------------*/
+struct sb_payload
+{
+	const uint8_t *data;
+	uint32_t len;
+};
 /*----------------------------------------------------------------------------*/
 struct sb_manager
 {
 	size_t chunk_size;
+	size_t small_size;
 	uint32_t cur_num;
 	uint32_t cnum;
 	mem_pool_t mp;
+	mem_pool_t mp_small;
 	sb_queue_t freeq;
 
+	struct sb_payload *payloads;
+	uint16_t payload_num;
+
 } sb_manager;
 /*----------------------------------------------------------------------------*/
 uint32_t 
@@ -26,7 +38,8 @@ SBGetCurnum(sb_manager_t sbm)
 }
 /*----------------------------------------------------------------------------*/
 sb_manager_t 
-SBManagerCreate(mtcp_manager_t mtcp, size_t chunk_size, uint32_t cnum)
+SBManagerCreate(mtcp_manager_t mtcp, size_t chunk_size, uint32_t cnum, 
+		size_t small_size, uint32_t small_cnum)
 {
 	sb_manager_t sbm = (sb_manager_t)calloc(1, sizeof(sb_manager));
 	if (!sbm) {
@@ -49,10 +62,42 @@ SBManagerCreate(mtcp_manager_t mtcp, size_t chunk_size, uint32_t cnum)
 		return NULL;
 	}
 
+	if (small_size > 0 && small_size < chunk_size) {
+		sbm->small_size = small_size;
+#if !defined(DISABLE_DPDK) && !defined(ENABLE_ONVM)
+		sprintf(pool_name, "sbm_small_pool_%d", mtcp->ctx->cpu);
+		sbm->mp_small = (mem_pool_t)MPCreate(pool_name, small_size, 
+						     (uint64_t)small_size * small_cnum);
+#else
+		sbm->mp_small = (mem_pool_t)MPCreate(small_size, 
+						     (uint64_t)small_size * small_cnum);
+#endif
+		if (!sbm->mp_small) {
+			TRACE_ERROR("Failed to create small mem pool for sb.\n");
+			MPDestroy(sbm->mp);
+			free(sbm);
+			return NULL;
+		}
+	}
+
 	sbm->freeq = CreateSBQueue(cnum);
 	if (!sbm->freeq) {
 		TRACE_ERROR("Failed to create free buffer queue.\n");
 		MPDestroy(sbm->mp);
+		if (sbm->mp_small)
+			MPDestroy(sbm->mp_small);
+		free(sbm);
+		return NULL;
+	}
+
+	sbm->payloads = (struct sb_payload *)
+			calloc(SB_MAX_PAYLOADS, sizeof(struct sb_payload));
+	if (!sbm->payloads) {
+		TRACE_ERROR("Failed to allocate payload table.\n");
+		DestroySBQueue(sbm->freeq);
+		MPDestroy(sbm->mp);
+		if (sbm->mp_small)
+			MPDestroy(sbm->mp_small);
 		free(sbm);
 		return NULL;
 	}
@@ -73,16 +118,19 @@ SBInit(sb_manager_t sbm, uint32_t init_seq)
 			perror("malloc() for buf");
 			return NULL;
 		}
-		buf->data = MPAllocateChunk(sbm->mp);
-		if (!buf->data) {
-			TRACE_ERROR("Failed to fetch memory chunk for data.\n");
-			free(buf);
-			return NULL;
-		}
+		/* the chunk is attached on the first copied byte, a stream 
+		   only sending registered payloads never needs one */
+		buf->data = NULL;
+		buf->alloc_size = 0;
+		buf->pieces = NULL;
+		buf->piece_cap = 0;
 		sbm->cur_num++;
 	}
 
 	buf->head = buf->data;
+	buf->peak = 0;
+	buf->grown = 0;
+	buf->piece_head = buf->piece_cnt = 0;
 
 	buf->head_off = buf->tail_off = 0;
 	buf->len = buf->cum_len = 0;
@@ -101,9 +149,11 @@ SBFreeInternal(sb_manager_t sbm, struct tcp_send_buffer *buf)
 		return;
 
 	if (buf->data) {
-		MPFreeChunk(sbm->mp, buf->data);
+		MPFreeChunk(buf->alloc_size == sbm->chunk_size ? 
+			    sbm->mp : sbm->mp_small, buf->data);
 		buf->data = NULL;
 	}
+	free(buf->pieces);
 
 	sbm->cur_num--;
 	free(buf);
@@ -119,10 +169,127 @@ SBFree(sb_manager_t sbm, struct tcp_send_buffer *buf)
 	SBEnqueue(sbm->freeq, buf);
 }
 /*----------------------------------------------------------------------------*/
+int
+SBAttachData(sb_manager_t sbm, struct tcp_send_buffer *buf, size_t need)
+{
+	/* this function should be called only in application thread */
+	unsigned char *data;
+	uint32_t copied = buf->tail_off - buf->head_off;
+	int small;
+
+	need = MIN(need + copied, buf->size);
+	if (buf->data && buf->alloc_size >= need)
+		return 0;
+
+	small = sbm->mp_small && !buf->grown && need <= sbm->small_size;
+	data = MPAllocateChunk(small ? sbm->mp_small : sbm->mp);
+	if (!data) {
+		TRACE_ERROR("Failed to fetch memory chunk for data.\n");
+		return -1;
+	}
+
+	if (buf->data) {
+		/* outgrown: move the copied bytes over to a full chunk */
+		memcpy(data, buf->head, copied);
+		MPFreeChunk(sbm->mp_small, buf->data);
+		buf->grown = SB_GROWN_DRAINS;
+	}
+	buf->data = buf->head = data;
+	buf->head_off = 0;
+	buf->tail_off = copied;
+	buf->alloc_size = small ? sbm->small_size : sbm->chunk_size;
+
+	return 0;
+}
+/*----------------------------------------------------------------------------*/
+void
+SBReleaseData(sb_manager_t sbm, struct tcp_send_buffer *buf)
+{
+	/* this function should be called only in mtcp thread */
+	if (buf->len > 0)
+		return;
+
+	if (buf->pieces) {
+		free(buf->pieces);
+		buf->pieces = NULL;
+		buf->piece_head = buf->piece_cap = 0;
+	}
+
+	if (!buf->data)
+		return;
+
+	/* a grown flow goes back to small chunks once its bursts fit again */
+	if (buf->peak > sbm->small_size)
+		buf->grown = SB_GROWN_DRAINS;
+	else if (buf->grown)
+		buf->grown--;
+	buf->peak = 0;
+
+	MPFreeChunkRemote(buf->alloc_size == sbm->chunk_size ? 
+			  sbm->mp : sbm->mp_small, buf->data);
+	buf->data = buf->head = NULL;
+	buf->head_off = buf->tail_off = 0;
+	buf->alloc_size = 0;
+}
+/*----------------------------------------------------------------------------*/
+static int
+GrowPieces(struct tcp_send_buffer *buf)
+{
+	struct sb_piece *pieces;
+	uint16_t cap;
+	int i;
+
+	if (buf->piece_cap == SB_MAX_PIECES)
+		return -1;
+
+	cap = buf->piece_cap ? buf->piece_cap * 2 : SB_MIN_PIECES;
+	pieces = (struct sb_piece *)malloc(cap * sizeof(struct sb_piece));
+	if (!pieces)
+		return -1;
+
+	/* unwrap the ring */
+	for (i = 0; i < buf->piece_cnt; i++)
+		pieces[i] = buf->pieces[(buf->piece_head + i) % buf->piece_cap];
+	free(buf->pieces);
+	buf->pieces = pieces;
+	buf->piece_head = 0;
+	buf->piece_cap = cap;
+
+	return 0;
+}
+/*----------------------------------------------------------------------------*/
+static inline int
+AppendPiece(struct tcp_send_buffer *buf, uint16_t id, uint32_t off, uint32_t len)
+{
+	struct sb_piece *piece;
+
+	/* extend the last piece if the bytes follow on */
+	if (buf->piece_cnt > 0) {
+		piece = &buf->pieces[(buf->piece_head + buf->piece_cnt - 1) % buf->piece_cap];
+		if (piece->id == id && 
+				(id == SB_COPIED || piece->off + piece->len == off)) {
+			piece->len += len;
+			return 0;
+		}
+	}
+
+	if (buf->piece_cnt == buf->piece_cap && GrowPieces(buf) < 0)
+		return -1;
+
+	piece = &buf->pieces[(buf->piece_head + buf->piece_cnt) % buf->piece_cap];
+	piece->id = id;
+	piece->off = off;
+	piece->len = len;
+	buf->piece_cnt++;
+
+	return 0;
+}
+/*----------------------------------------------------------------------------*/
 size_t 
 SBPut(sb_manager_t sbm, struct tcp_send_buffer *buf, const void *data, size_t len)
 {
 	size_t to_put;
+	uint32_t copied;
 
 	if (len <= 0)
 		return 0;
@@ -133,24 +300,55 @@ SBPut(sb_manager_t sbm, struct tcp_send_buffer *buf, const void *data, size_t le
 		return -2;
 	}
 
-	if (buf->tail_off + to_put < buf->size) {
+	/* behind payload references, the bytes go into a piece of their own */
+	if (buf->piece_cnt > 0 && AppendPiece(buf, SB_COPIED, 0, to_put) < 0)
+		return SB_NO_PIECE;
+
+	copied = buf->tail_off - buf->head_off;
+	if (buf->tail_off + to_put < buf->alloc_size) {
 		/* if the data fit into the buffer, copy it */
 		memcpy(buf->data + buf->tail_off, data, to_put);
 		buf->tail_off += to_put;
 	} else {
 		/* if buffer overflows, move the existing payload and merge */
-		memmove(buf->data, buf->head, buf->len);
+		memmove(buf->data, buf->head, copied);
 		buf->head = buf->data;
 		buf->head_off = 0;
-		memcpy(buf->head + buf->len, data, to_put);
-		buf->tail_off = buf->len + to_put;
+		memcpy(buf->head + copied, data, to_put);
+		buf->tail_off = copied + to_put;
 	}
 	buf->len += to_put;
 	buf->cum_len += to_put;
+	buf->peak = MAX(buf->peak, buf->tail_off - buf->head_off);
 
 	return to_put;
 }
 /*----------------------------------------------------------------------------*/
+static inline void
+RemovePieces(struct tcp_send_buffer *buf, uint32_t len)
+{
+	struct sb_piece *piece;
+	uint32_t n;
+
+	while (len > 0) {
+		piece = &buf->pieces[buf->piece_head];
+		n = MIN(len, piece->len);
+		if (piece->id == SB_COPIED) {
+			buf->head_off += n;
+			buf->head = buf->data + buf->head_off;
+		} else {
+			piece->off += n;
+		}
+		piece->len -= n;
+		len -= n;
+
+		if (piece->len == 0) {
+			buf->piece_head = (buf->piece_head + 1) % buf->piece_cap;
+			buf->piece_cnt--;
+		}
+	}
+}
+/*----------------------------------------------------------------------------*/
 size_t 
 SBRemove(sb_manager_t sbm, struct tcp_send_buffer *buf, size_t len)
 {
@@ -164,8 +362,12 @@ SBRemove(sb_manager_t sbm, struct tcp_send_buffer *buf, size_t len)
 		return -2;
 	}
 
-	buf->head_off += to_remove;
-	buf->head = buf->data + buf->head_off;
+	if (buf->piece_cnt > 0) {
+		RemovePieces(buf, to_remove);
+	} else {
+		buf->head_off += to_remove;
+		buf->head = buf->data + buf->head_off;
+	}
 	buf->head_seq += to_remove;
 	buf->len -= to_remove;
 
@@ -178,3 +380,94 @@ SBRemove(sb_manager_t sbm, struct tcp_send_buffer *buf, size_t len)
 	return to_remove;
 }
 /*---------------------------------------------------------------------------*/
+int
+SBRegisterPayload(sb_manager_t sbm, const void *data, size_t len)
+{
+	if (!data || len == 0 || len > UINT32_MAX) {
+		errno = EINVAL;
+		return -1;
+	}
+	if (sbm->payload_num >= SB_MAX_PAYLOADS) {
+		TRACE_ERROR("No more than %d payloads can be registered.\n", 
+				SB_MAX_PAYLOADS);
+		errno = ENOSPC;
+		return -1;
+	}
+
+	sbm->payloads[sbm->payload_num].data = (const uint8_t *)data;
+	sbm->payloads[sbm->payload_num].len = len;
+
+	return sbm->payload_num++;
+}
+/*----------------------------------------------------------------------------*/
+int
+SBPutRef(sb_manager_t sbm, struct tcp_send_buffer *buf, 
+		int id, size_t off, size_t len)
+{
+	struct sb_payload *payload;
+	size_t to_put;
+
+	if (id < 0 || id >= sbm->payload_num) {
+		errno = EINVAL;
+		return -1;
+	}
+	payload = &sbm->payloads[id];
+	if (off > payload->len || len > payload->len - off) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	to_put = MIN(len, buf->size - buf->len);
+	if (to_put <= 0)
+		return 0;
+
+	/* bytes copied so far go first */
+	if (buf->piece_cnt == 0 && buf->len > 0 &&
+	    AppendPiece(buf, SB_COPIED, 0, buf->len) < 0)
+		return 0;
+
+	if (AppendPiece(buf, id, off, to_put) < 0)
+		return 0;
+	buf->len += to_put;
+	buf->cum_len += to_put;
+
+	return to_put;
+}
+/*----------------------------------------------------------------------------*/
+void
+SBCopy(sb_manager_t sbm, struct tcp_send_buffer *buf, 
+		uint32_t off, uint8_t *dst, uint32_t len)
+{
+	struct sb_piece *piece;
+	const uint8_t *src;
+	uint32_t copied = 0;
+	uint32_t n;
+	int i, idx;
+
+	if (buf->piece_cnt == 0) {
+		memcpy(dst, buf->head + off, len);
+		return;
+	}
+
+	/* copied bytes are consecutive in data, whichever pieces lie between */
+	for (i = 0; i < buf->piece_cnt && len > 0; i++) {
+		idx = (buf->piece_head + i) % buf->piece_cap;
+		piece = &buf->pieces[idx];
+		if (off >= piece->len) {
+			off -= piece->len;
+		} else {
+			n = MIN(len, piece->len - off);
+			if (piece->id == SB_COPIED)
+				src = buf->head + copied + off;
+			else
+				src = sbm->payloads[piece->id].data + piece->off + off;
+			memcpy(dst, src, n);
+			dst += n;
+			len -= n;
+			off = 0;
+		}
+		if (piece->id == SB_COPIED)
+			copied += piece->len;
+	}
+}
+/*---------------------------------------------------------------------------*/
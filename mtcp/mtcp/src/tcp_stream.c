@@ -52,55 +52,6 @@ InitializeTCPStreamManager()
 	next_seed = time(NULL);
 }
 /*---------------------------------------------------------------------------*/
-unsigned int
-HashFlow(const void *f)
-{
-	tcp_stream *flow = (tcp_stream *)f;
-#if 0
-	unsigned long hash = 5381;
-	int c;
-	int index;
-
-	char *str = (char *)&flow->saddr;
-	index = 0;
-
-	while ((c = *str++) && index++ < 12) {
-		if (index == 8) {
-			str = (char *)&flow->sport;
-		}
-		hash = ((hash << 5) + hash) + c;
-	}
-
-	return hash & (NUM_BINS_FLOWS - 1);
-#else
-	unsigned int hash, i;
-	char *key = (char *)&flow->saddr;
-
-	for (hash = i = 0; i < 12; ++i) {
-		hash += key[i];
-		hash += (hash << 10);
-		hash ^= (hash >> 6);
-	}
-	hash += (hash << 3);
-	hash ^= (hash >> 11);
-	hash += (hash << 15);
-
-	return hash & (NUM_BINS_FLOWS - 1);
-#endif
-}
-/*---------------------------------------------------------------------------*/
-int
-EqualFlow(const void *f1, const void *f2)
-{
-	tcp_stream *flow1 = (tcp_stream *)f1;
-	tcp_stream *flow2 = (tcp_stream *)f2;
-
-	return (flow1->saddr == flow2->saddr && 
-			flow1->sport == flow2->sport &&
-			flow1->daddr == flow2->daddr &&
-			flow1->dport == flow2->dport);
-}
-/*---------------------------------------------------------------------------*/
 inline void 
 RaiseReadEvent(mtcp_manager_t mtcp, tcp_stream *stream)
 {
@@ -213,15 +164,15 @@ CreateTCPStream(mtcp_manager_t mtcp, socket_map_t socket, int type,
 	uint8_t is_external;
 	uint8_t *sa;
 	uint8_t *da;
-	
-	pthread_mutex_lock(&mtcp->ctx->flow_pool_lock);
 
+	/* only the stack thread creates and destroys streams, so neither the 
+	   pools nor the flow table need a lock (see HandleConnectRequest()) */
 	stream = (tcp_stream *)MPAllocateChunk(mtcp->flow_pool);
 	if (!stream) {
 		TRACE_ERROR("Cannot allocate memory for the stream. "
 				"CONFIG.max_concurrency: %d, concurrent: %u\n", 
 				CONFIG.max_concurrency, mtcp->flow_cnt);
-		pthread_mutex_unlock(&mtcp->ctx->flow_pool_lock);
+		errno = ENOMEM;
 		return NULL;
 	}
 	memset(stream, 0, sizeof(tcp_stream));
@@ -229,14 +180,14 @@ CreateTCPStream(mtcp_manager_t mtcp, socket_map_t socket, int type,
 	stream->rcvvar = (struct tcp_recv_vars *)MPAllocateChunk(mtcp->rv_pool);
 	if (!stream->rcvvar) {
 		MPFreeChunk(mtcp->flow_pool, stream);
-		pthread_mutex_unlock(&mtcp->ctx->flow_pool_lock);
+		errno = ENOMEM;
 		return NULL;
 	}
 	stream->sndvar = (struct tcp_send_vars *)MPAllocateChunk(mtcp->sv_pool);
 	if (!stream->sndvar) {
 		MPFreeChunk(mtcp->rv_pool, stream->rcvvar);
 		MPFreeChunk(mtcp->flow_pool, stream);
-		pthread_mutex_unlock(&mtcp->ctx->flow_pool_lock);
+		errno = ENOMEM;
 		return NULL;
 	}
 	memset(stream->rcvvar, 0, sizeof(struct tcp_recv_vars));
@@ -252,15 +203,16 @@ CreateTCPStream(mtcp_manager_t mtcp, socket_map_t socket, int type,
 	if (ret < 0) {
 		TRACE_ERROR("Stream %d: "
 				"Failed to insert the stream into hash table.\n", stream->id);
+		MPFreeChunk(mtcp->sv_pool, stream->sndvar);
+		MPFreeChunk(mtcp->rv_pool, stream->rcvvar);
 		MPFreeChunk(mtcp->flow_pool, stream);
-		pthread_mutex_unlock(&mtcp->ctx->flow_pool_lock);
+		/* the 4-tuple is taken by another stream */
+		errno = EADDRNOTAVAIL;
 		return NULL;
 	}
 	stream->on_hash_table = TRUE;
 	mtcp->flow_cnt++;
 
-	pthread_mutex_unlock(&mtcp->ctx->flow_pool_lock);
-
 	if (socket) {
 		stream->socket = socket;
 		socket->stream = stream;
@@ -344,10 +296,36 @@ CreateTCPStream(mtcp_manager_t mtcp, socket_map_t socket, int type,
 	return stream;
 }
 /*---------------------------------------------------------------------------*/
+int
+FreeBoundAddress(mtcp_manager_t mtcp, const struct sockaddr_in *addr, 
+		const struct sockaddr_in *daddr)
+{
+	addr_pool_t rss_ap;
+	int ret;
+
+	rss_ap = FindAddressPool(mtcp->ap, daddr);
+	if (rss_ap) {
+		ret = FreeAddress(rss_ap, addr);
+	} else {
+		uint8_t is_external;
+		int nif = GetOutputInterface(addr->sin_addr.s_addr, &is_external);
+		if (nif < 0) {
+			TRACE_ERROR("nif is negative!\n");
+			ret = -1;
+		} else {
+			int eidx = CONFIG.nif_to_eidx[nif];
+			ret = FreeAddress(ap[eidx], addr);
+		}
+		UNUSED(is_external);
+	}
+
+	return ret;
+}
+/*---------------------------------------------------------------------------*/
 void
 DestroyTCPStream(mtcp_manager_t mtcp, tcp_stream *stream)
 {
-	struct sockaddr_in addr;
+	struct sockaddr_in addr, daddr;
 	int bound_addr = FALSE;
 	uint8_t *sa, *da;
 	int ret;
@@ -434,6 +412,8 @@ DestroyTCPStream(mtcp_manager_t mtcp, tcp_stream *stream)
 		bound_addr = TRUE;
 		addr.sin_addr.s_addr = stream->saddr;
 		addr.sin_port = stream->sport;
+		daddr.sin_addr.s_addr = stream->daddr;
+		daddr.sin_port = stream->dport;
 	}
 
 	RemoveFromControlList(mtcp, stream);
@@ -488,8 +468,6 @@ DestroyTCPStream(mtcp_manager_t mtcp, tcp_stream *stream)
 		stream->rcvvar->rcvbuf = NULL;
 	}
 
-	pthread_mutex_lock(&mtcp->ctx->flow_pool_lock);
-
 	/* remove from flow hash table */
 	StreamHTRemove(mtcp->tcp_flow_table, stream);
 	stream->on_hash_table = FALSE;
@@ -499,29 +477,14 @@ DestroyTCPStream(mtcp_manager_t mtcp, tcp_stream *stream)
 	MPFreeChunk(mtcp->rv_pool, stream->rcvvar);
 	MPFreeChunk(mtcp->sv_pool, stream->sndvar);
 	MPFreeChunk(mtcp->flow_pool, stream);
-	pthread_mutex_unlock(&mtcp->ctx->flow_pool_lock);
 
 	if (bound_addr) {
-		if (mtcp->ap) {
-			ret = FreeAddress(mtcp->ap, &addr);
-		} else {
-			uint8_t is_external;
-			int nif = GetOutputInterface(addr.sin_addr.s_addr, &is_external);
-			if (nif < 0) {
-				TRACE_ERROR("nif is negative!\n");
-				ret = -1;
-			} else {
-			        int eidx = CONFIG.nif_to_eidx[nif];
-				ret = FreeAddress(ap[eidx], &addr);
-			}
-			UNUSED(is_external);
-		}
+		ret = FreeBoundAddress(mtcp, &addr, &daddr);
 		if (ret < 0) {
 			TRACE_ERROR("(NEVER HAPPEN) Failed to free address.\n");
 		}
 	}
 
-
 #ifdef NETSTAT
 #if NETSTAT_PERTHREAD
 	TRACE_STREAM("Destroyed. Remaining flows: %u\n", mtcp->flow_cnt);
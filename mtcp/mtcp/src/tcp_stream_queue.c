@@ -38,7 +38,7 @@ struct stream_queue
 	volatile index_type _head;
 	volatile index_type _tail;
 
-	struct tcp_stream * volatile * _q;
+	void * volatile * _q;
 };
 /*----------------------------------------------------------------------------*/
 stream_queue_int * 
@@ -137,9 +137,9 @@ StreamQueueIsEmpty(stream_queue_t sq)
 }
 /*---------------------------------------------------------------------------*/
 static inline void 
-StreamMemoryBarrier(tcp_stream * volatile stream, volatile index_type index)
+StreamMemoryBarrier(void * volatile item, volatile index_type index)
 {
-	__asm__ volatile("" : : "m" (stream), "m" (index));
+	__asm__ volatile("" : : "m" (item), "m" (index));
 }
 /*---------------------------------------------------------------------------*/
 stream_queue_t 
@@ -151,7 +151,7 @@ CreateStreamQueue(int capacity)
 	if (!sq)
 		return NULL;
 
-	sq->_q = (tcp_stream **)calloc(capacity + 1, sizeof(tcp_stream *));
+	sq->_q = (void **)calloc(capacity + 1, sizeof(void *));
 	if (!sq->_q) {
 		free(sq);
 		return NULL;
@@ -177,15 +177,15 @@ DestroyStreamQueue(stream_queue_t sq)
 	free(sq);
 }
 /*---------------------------------------------------------------------------*/
-int 
-StreamEnqueue(stream_queue_t sq, tcp_stream *stream)
+static inline int 
+QueuePush(stream_queue_t sq, void *item)
 {
 	index_type h = sq->_head;
 	index_type t = sq->_tail;
 	index_type nt = NextIndex(sq, t);
 
 	if (nt != h) {
-		sq->_q[t] = stream;
+		sq->_q[t] = item;
 		StreamMemoryBarrier(sq->_q[t], sq->_tail);
 		sq->_tail = nt;
 		return 0;
@@ -195,20 +195,44 @@ StreamEnqueue(stream_queue_t sq, tcp_stream *stream)
 	return -1;
 }
 /*---------------------------------------------------------------------------*/
-tcp_stream *
-StreamDequeue(stream_queue_t sq)
+static inline void *
+QueuePop(stream_queue_t sq)
 {
 	index_type h = sq->_head;
 	index_type t = sq->_tail;
 
 	if (h != t) {
-		tcp_stream *stream = sq->_q[h];
+		void *item = sq->_q[h];
 		StreamMemoryBarrier(sq->_q[h], sq->_head);
 		sq->_head = NextIndex(sq, h);
-		assert(stream);
-		return stream;
+		assert(item);
+		return item;
 	}
 
 	return NULL;
 }
 /*---------------------------------------------------------------------------*/
+int 
+StreamEnqueue(stream_queue_t sq, tcp_stream *stream)
+{
+	return QueuePush(sq, stream);
+}
+/*---------------------------------------------------------------------------*/
+tcp_stream *
+StreamDequeue(stream_queue_t sq)
+{
+	return (tcp_stream *)QueuePop(sq);
+}
+/*---------------------------------------------------------------------------*/
+int 
+SocketEnqueue(stream_queue_t sq, struct socket_map *socket)
+{
+	return QueuePush(sq, socket);
+}
+/*---------------------------------------------------------------------------*/
+struct socket_map *
+SocketDequeue(stream_queue_t sq)
+{
+	return (struct socket_map *)QueuePop(sq);
+}
+/*---------------------------------------------------------------------------*/
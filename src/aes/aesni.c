@@ -0,0 +1,593 @@
+/*
+ *  AES-NI support functions
+ *
+ *  Copyright (C) 2006-2015, ARM Limited, All Rights Reserved
+ *  SPDX-License-Identifier: Apache-2.0
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License"); you may
+ *  not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *  http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ *  WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ *  This file is part of mbed TLS (https://tls.mbed.org)
+ */
+
+/*
+ * [AES-WP] http://software.intel.com/en-us/articles/intel-advanced-encryption-standard-aes-instructions-set
+ * [CLMUL-WP] http://software.intel.com/en-us/articles/intel-carry-less-multiplication-instruction-and-its-usage-for-computing-the-gcm-mode/
+ *
+ * Unlike upstream mbed TLS this version uses compiler intrinsics. Every
+ * function is compiled for the AES/PCLMUL targets individually, so the
+ * library still builds and runs on CPUs without them: callers check
+ * mbedtls_aesni_has_support() and fall back to the portable code.
+ */
+
+#if !defined(MBEDTLS_CONFIG_FILE)
+#include "config.h"
+#else
+#include MBEDTLS_CONFIG_FILE
+#endif
+
+#if defined(MBEDTLS_AESNI_C)
+
+#include "aesni.h"
+
+#include <string.h>
+
+#if defined(MBEDTLS_HAVE_X86_64)
+
+#include <cpuid.h>
+#include <immintrin.h>
+
+#define AESNI_TARGET __attribute__((target("aes,pclmul,sse4.1")))
+
+/*
+ * AES-NI support detection routine
+ */
+int mbedtls_aesni_has_support( unsigned int what )
+{
+    static int done = 0;
+    static unsigned int c = 0;
+
+    if( ! done )
+    {
+        unsigned int a, b, d;
+
+        if( __get_cpuid( 1, &a, &b, &c, &d ) == 0 )
+            c = 0;
+        done = 1;
+    }
+
+    return( ( c & what ) != 0 );
+}
+
+/*
+ * AES-NI AES-ECB block en(de)cryption
+ */
+AESNI_TARGET
+int mbedtls_aesni_crypt_ecb( mbedtls_aes_context *ctx,
+                     int mode,
+                     const unsigned char input[16],
+                     unsigned char output[16] )
+{
+    const __m128i *rk = (const __m128i *) ctx->rk;
+    __m128i b = _mm_loadu_si128( (const __m128i *) input );
+    int i;
+
+    b = _mm_xor_si128( b, _mm_loadu_si128( rk ) );
+
+    if( mode == MBEDTLS_AES_ENCRYPT )
+    {
+        for( i = 1; i < ctx->nr; i++ )
+            b = _mm_aesenc_si128( b, _mm_loadu_si128( rk + i ) );
+        b = _mm_aesenclast_si128( b, _mm_loadu_si128( rk + ctx->nr ) );
+    }
+    else
+    {
+        for( i = 1; i < ctx->nr; i++ )
+            b = _mm_aesdec_si128( b, _mm_loadu_si128( rk + i ) );
+        b = _mm_aesdeclast_si128( b, _mm_loadu_si128( rk + ctx->nr ) );
+    }
+
+    _mm_storeu_si128( (__m128i *) output, b );
+
+    return( 0 );
+}
+
+/*
+ * Encrypt four blocks with interleaved rounds
+ */
+AESNI_TARGET
+static inline void aesni_enc4( const __m128i *rk, int nr, __m128i b[4] )
+{
+    __m128i k = rk[0];
+    int i;
+
+    b[0] = _mm_xor_si128( b[0], k );
+    b[1] = _mm_xor_si128( b[1], k );
+    b[2] = _mm_xor_si128( b[2], k );
+    b[3] = _mm_xor_si128( b[3], k );
+
+    for( i = 1; i < nr; i++ )
+    {
+        k = rk[i];
+        b[0] = _mm_aesenc_si128( b[0], k );
+        b[1] = _mm_aesenc_si128( b[1], k );
+        b[2] = _mm_aesenc_si128( b[2], k );
+        b[3] = _mm_aesenc_si128( b[3], k );
+    }
+
+    k = rk[nr];
+    b[0] = _mm_aesenclast_si128( b[0], k );
+    b[1] = _mm_aesenclast_si128( b[1], k );
+    b[2] = _mm_aesenclast_si128( b[2], k );
+    b[3] = _mm_aesenclast_si128( b[3], k );
+}
+
+AESNI_TARGET
+static inline __m128i aesni_enc1( const __m128i *rk, int nr, __m128i b )
+{
+    int i;
+
+    b = _mm_xor_si128( b, rk[0] );
+    for( i = 1; i < nr; i++ )
+        b = _mm_aesenc_si128( b, rk[i] );
+
+    return( _mm_aesenclast_si128( b, rk[nr] ) );
+}
+
+AESNI_TARGET
+static inline void aesni_load_keys( const mbedtls_aes_context *ctx,
+                                    __m128i rk[15] )
+{
+    int i;
+
+    for( i = 0; i <= ctx->nr; i++ )
+        rk[i] = _mm_loadu_si128( (const __m128i *) ctx->rk + i );
+}
+
+AESNI_TARGET
+void mbedtls_aesni_encrypt_blocks( const mbedtls_aes_context *ctx,
+                     size_t nblocks,
+                     const unsigned char *input,
+                     unsigned char *output )
+{
+    const __m128i *in = (const __m128i *) input;
+    __m128i *out = (__m128i *) output;
+    __m128i rk[15], b[4];
+    size_t i;
+
+    aesni_load_keys( ctx, rk );
+
+    for( ; nblocks >= 4; nblocks -= 4, in += 4, out += 4 )
+    {
+        for( i = 0; i < 4; i++ )
+            b[i] = _mm_loadu_si128( in + i );
+        aesni_enc4( rk, ctx->nr, b );
+        for( i = 0; i < 4; i++ )
+            _mm_storeu_si128( out + i, b[i] );
+    }
+
+    for( ; nblocks > 0; nblocks--, in++, out++ )
+        _mm_storeu_si128( out, aesni_enc1( rk, ctx->nr, _mm_loadu_si128( in ) ) );
+}
+
+/*
+ * GF(2^128) multiplication of byte-reflected operands, see [CLMUL-WP]
+ * algorithms 1 (Karatsuba-free schoolbook product), 4 (shift) and 5
+ * (reduction modulo x^128 + x^7 + x^2 + x + 1).
+ */
+AESNI_TARGET
+static inline __m128i aesni_gfmul( __m128i a, __m128i b )
+{
+    __m128i t2, t3, t4, t5, t6, t7, t8, t9;
+
+    t3 = _mm_clmulepi64_si128( a, b, 0x00 );
+    t4 = _mm_clmulepi64_si128( a, b, 0x10 );
+    t5 = _mm_clmulepi64_si128( a, b, 0x01 );
+    t6 = _mm_clmulepi64_si128( a, b, 0x11 );
+
+    t4 = _mm_xor_si128( t4, t5 );
+    t5 = _mm_slli_si128( t4, 8 );
+    t4 = _mm_srli_si128( t4, 8 );
+    t3 = _mm_xor_si128( t3, t5 );
+    t6 = _mm_xor_si128( t6, t4 );
+
+    /* shift the 256-bit product left by one bit */
+    t7 = _mm_srli_epi32( t3, 31 );
+    t8 = _mm_srli_epi32( t6, 31 );
+    t3 = _mm_slli_epi32( t3, 1 );
+    t6 = _mm_slli_epi32( t6, 1 );
+    t9 = _mm_srli_si128( t7, 12 );
+    t8 = _mm_slli_si128( t8, 4 );
+    t7 = _mm_slli_si128( t7, 4 );
+    t3 = _mm_or_si128( t3, t7 );
+    t6 = _mm_or_si128( t6, t8 );
+    t6 = _mm_or_si128( t6, t9 );
+
+    /* reduce */
+    t7 = _mm_slli_epi32( t3, 31 );
+    t8 = _mm_slli_epi32( t3, 30 );
+    t9 = _mm_slli_epi32( t3, 25 );
+    t7 = _mm_xor_si128( t7, t8 );
+    t7 = _mm_xor_si128( t7, t9 );
+    t8 = _mm_srli_si128( t7, 4 );
+    t7 = _mm_slli_si128( t7, 12 );
+    t3 = _mm_xor_si128( t3, t7 );
+
+    t2 = _mm_srli_epi32( t3, 1 );
+    t4 = _mm_srli_epi32( t3, 2 );
+    t5 = _mm_srli_epi32( t3, 7 );
+    t2 = _mm_xor_si128( t2, t4 );
+    t2 = _mm_xor_si128( t2, t5 );
+    t2 = _mm_xor_si128( t2, t8 );
+    t3 = _mm_xor_si128( t3, t2 );
+
+    return( _mm_xor_si128( t6, t3 ) );
+}
+
+#define AESNI_BSWAP_MASK \
+    _mm_set_epi8( 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15 )
+
+/*
+ * GCM multiplication: c = a times b in GF(2^128)
+ */
+AESNI_TARGET
+void mbedtls_aesni_gcm_mult( unsigned char c[16],
+                     const unsigned char a[16],
+                     const unsigned char b[16] )
+{
+    const __m128i bswap = AESNI_BSWAP_MASK;
+    __m128i x = _mm_shuffle_epi8( _mm_loadu_si128( (const __m128i *) a ), bswap );
+    __m128i y = _mm_shuffle_epi8( _mm_loadu_si128( (const __m128i *) b ), bswap );
+
+    _mm_storeu_si128( (__m128i *) c, _mm_shuffle_epi8( aesni_gfmul( x, y ), bswap ) );
+}
+
+/*
+ * Counter block with the low 32 bits (big endian) set to ctr
+ */
+AESNI_TARGET
+static inline __m128i aesni_ctr_block( __m128i base, uint32_t ctr )
+{
+    return( _mm_insert_epi32( base, (int) __builtin_bswap32( ctr ), 3 ) );
+}
+
+/*
+ * Fused CTR encryption and GHASH over whole blocks
+ */
+AESNI_TARGET
+void mbedtls_aesni_gcm_crypt( const mbedtls_aes_context *ctx,
+                     const unsigned char h[16],
+                     unsigned char y[16],
+                     unsigned char buf[16],
+                     int decrypt,
+                     size_t nblocks,
+                     const unsigned char *input,
+                     unsigned char *output )
+{
+    const __m128i bswap = AESNI_BSWAP_MASK;
+    const __m128i *in = (const __m128i *) input;
+    __m128i *out = (__m128i *) output;
+    __m128i rk[15], b[4], c[4];
+    __m128i base, H, H2, H3, H4, X;
+    uint32_t ctr;
+    size_t i;
+
+    aesni_load_keys( ctx, rk );
+
+    base = _mm_loadu_si128( (const __m128i *) y );
+    ctr = __builtin_bswap32( (uint32_t) _mm_extract_epi32( base, 3 ) );
+    H = _mm_shuffle_epi8( _mm_loadu_si128( (const __m128i *) h ), bswap );
+    X = _mm_shuffle_epi8( _mm_loadu_si128( (const __m128i *) buf ), bswap );
+
+    if( nblocks >= 4 )
+    {
+        H2 = aesni_gfmul( H, H );
+        H3 = aesni_gfmul( H2, H );
+        H4 = aesni_gfmul( H2, H2 );
+    }
+
+    for( ; nblocks >= 4; nblocks -= 4, in += 4, out += 4 )
+    {
+        for( i = 0; i < 4; i++ )
+            b[i] = aesni_ctr_block( base, ++ctr );
+        aesni_enc4( rk, ctx->nr, b );
+
+        /* load all input before storing, so that in-place works */
+        for( i = 0; i < 4; i++ )
+            c[i] = _mm_loadu_si128( in + i );
+        for( i = 0; i < 4; i++ )
+        {
+            b[i] = _mm_xor_si128( b[i], c[i] );
+            _mm_storeu_si128( out + i, b[i] );
+        }
+
+        /* aggregated GHASH: the four products are independent */
+        for( i = 0; i < 4; i++ )
+            c[i] = _mm_shuffle_epi8( decrypt ? c[i] : b[i], bswap );
+        X = _mm_xor_si128(
+                _mm_xor_si128( aesni_gfmul( _mm_xor_si128( X, c[0] ), H4 ),
+                               aesni_gfmul( c[1], H3 ) ),
+                _mm_xor_si128( aesni_gfmul( c[2], H2 ),
+                               aesni_gfmul( c[3], H ) ) );
+    }
+
+    for( ; nblocks > 0; nblocks--, in++, out++ )
+    {
+        __m128i p = _mm_loadu_si128( in );
+        __m128i e = _mm_xor_si128( aesni_enc1( rk, ctx->nr,
+                                               aesni_ctr_block( base, ++ctr ) ), p );
+
+        _mm_storeu_si128( out, e );
+        X = aesni_gfmul( _mm_xor_si128( X, _mm_shuffle_epi8( decrypt ? p : e, bswap ) ), H );
+    }
+
+    _mm_storeu_si128( (__m128i *) y, aesni_ctr_block( base, ctr ) );
+    _mm_storeu_si128( (__m128i *) buf, _mm_shuffle_epi8( X, bswap ) );
+}
+
+#define AESNI_GCM_LANES 4
+
+/*
+ * Where a lane of mbedtls_aesni_gcm_crypt_lanes() stands
+ */
+typedef struct {
+    const unsigned char *add, *in, *ks;
+    unsigned char *out;
+    size_t add_left, left;
+    int final;          /* the length block is next */
+}
+aesni_lane_pos;
+
+AESNI_TARGET
+static inline __m128i aesni_load_partial( const unsigned char *p, size_t len )
+{
+    unsigned char b[16] = { 0 };
+
+    if( len >= 16 )
+        return( _mm_loadu_si128( (const __m128i *) p ) );
+    memcpy( b, p, len );
+    return( _mm_loadu_si128( (const __m128i *) b ) );
+}
+
+/*
+ * Next GHASH input block of a lane, en/decrypting its data on the way;
+ * 0 once the lane has nothing left but its tag
+ */
+AESNI_TARGET
+static int aesni_lane_next( aesni_lane_pos *pos, const mbedtls_aesni_gcm_lane *l,
+                            int decrypt, __m128i *block )
+{
+    size_t use_len;
+
+    if( pos->add_left > 0 )
+    {
+        use_len = ( pos->add_left < 16 ) ? pos->add_left : 16;
+        *block = aesni_load_partial( pos->add, use_len );
+        pos->add += use_len;
+        pos->add_left -= use_len;
+        return( 1 );
+    }
+
+    if( pos->left > 0 )
+    {
+        unsigned char t[16];
+        __m128i c, e;
+
+        use_len = ( pos->left < 16 ) ? pos->left : 16;
+        c = aesni_load_partial( pos->in, use_len );
+        e = _mm_xor_si128( c, _mm_loadu_si128( (const __m128i *) pos->ks ) );
+        if( use_len == 16 )
+            _mm_storeu_si128( (__m128i *) pos->out, e );
+        else
+        {
+            /* the hashed ciphertext is zero padded */
+            _mm_storeu_si128( (__m128i *) t, e );
+            memcpy( pos->out, t, use_len );
+            e = aesni_load_partial( t, use_len );
+        }
+        *block = decrypt ? c : e;
+        pos->in += use_len;
+        pos->out += use_len;
+        pos->ks += 16;
+        pos->left -= use_len;
+        return( 1 );
+    }
+
+    if( pos->final )
+    {
+        *block = _mm_set_epi64x( (long long) __builtin_bswap64( (uint64_t) l->length * 8 ),
+                                 (long long) __builtin_bswap64( (uint64_t) l->add_len * 8 ) );
+        pos->final = 0;
+        return( 1 );
+    }
+
+    return( 0 );
+}
+
+/*
+ * GCM over messages with a precomputed key stream, four at a time
+ */
+AESNI_TARGET
+void mbedtls_aesni_gcm_crypt_lanes( const unsigned char h[16],
+                     int decrypt,
+                     const mbedtls_aesni_gcm_lane *lanes,
+                     size_t n )
+{
+    const __m128i bswap = AESNI_BSWAP_MASK;
+    const __m128i H = _mm_shuffle_epi8( _mm_loadu_si128( (const __m128i *) h ), bswap );
+    aesni_lane_pos pos[AESNI_GCM_LANES];
+    __m128i X[AESNI_GCM_LANES], b[AESNI_GCM_LANES];
+    int live[AESNI_GCM_LANES];
+    size_t first, i, k;
+    int more;
+
+    for( first = 0; first < n; first += k )
+    {
+        k = ( n - first < AESNI_GCM_LANES ) ? n - first : AESNI_GCM_LANES;
+
+        for( i = 0; i < k; i++ )
+        {
+            const mbedtls_aesni_gcm_lane *l = &lanes[first + i];
+
+            pos[i].add = l->add;
+            pos[i].add_left = l->add_len;
+            pos[i].in = l->input;
+            pos[i].out = l->output;
+            pos[i].left = l->length;
+            pos[i].ks = l->ks + 16;
+            pos[i].final = 1;
+            X[i] = _mm_setzero_si128();
+        }
+
+        do
+        {
+            more = 0;
+            for( i = 0; i < k; i++ )
+            {
+                live[i] = aesni_lane_next( &pos[i], &lanes[first + i], decrypt, &b[i] );
+                more |= live[i];
+            }
+            /* independent products, the multipliers pipeline them */
+            for( i = 0; i < k; i++ )
+                if( live[i] )
+                    X[i] = aesni_gfmul( _mm_xor_si128( X[i], _mm_shuffle_epi8( b[i], bswap ) ), H );
+        }
+        while( more );
+
+        for( i = 0; i < k; i++ )
+        {
+            const mbedtls_aesni_gcm_lane *l = &lanes[first + i];
+
+            _mm_storeu_si128( (__m128i *) l->tag,
+                              _mm_xor_si128( _mm_loadu_si128( (const __m128i *) l->ks ),
+                                             _mm_shuffle_epi8( X[i], bswap ) ) );
+        }
+    }
+}
+
+/*
+ * Compute decryption round keys from encryption round keys
+ */
+AESNI_TARGET
+void mbedtls_aesni_inverse_key( unsigned char *invkey,
+                        const unsigned char *fwdkey, int nr )
+{
+    __m128i *ik = (__m128i *) invkey;
+    const __m128i *fk = (const __m128i *) fwdkey + nr;
+
+    _mm_storeu_si128( ik, _mm_loadu_si128( fk ) );
+
+    for( --fk, ++ik; fk > (const __m128i *) fwdkey; --fk, ++ik )
+        _mm_storeu_si128( ik, _mm_aesimc_si128( _mm_loadu_si128( fk ) ) );
+
+    _mm_storeu_si128( ik, _mm_loadu_si128( fk ) );
+}
+
+/*
+ * Key expansion, 128-bit case, see [AES-WP] figure 24
+ */
+AESNI_TARGET
+static inline __m128i aesni_expand128( __m128i key, __m128i assist )
+{
+    assist = _mm_shuffle_epi32( assist, 0xff );
+    key = _mm_xor_si128( key, _mm_slli_si128( key, 4 ) );
+    key = _mm_xor_si128( key, _mm_slli_si128( key, 4 ) );
+    key = _mm_xor_si128( key, _mm_slli_si128( key, 4 ) );
+
+    return( _mm_xor_si128( key, assist ) );
+}
+
+/*
+ * Second half of a 256-bit round: like the 128-bit case but uses the
+ * SubWord() result without rotation, see [AES-WP] figure 26
+ */
+AESNI_TARGET
+static inline __m128i aesni_expand256b( __m128i key, __m128i assist )
+{
+    assist = _mm_shuffle_epi32( assist, 0xaa );
+    key = _mm_xor_si128( key, _mm_slli_si128( key, 4 ) );
+    key = _mm_xor_si128( key, _mm_slli_si128( key, 4 ) );
+    key = _mm_xor_si128( key, _mm_slli_si128( key, 4 ) );
+
+    return( _mm_xor_si128( key, assist ) );
+}
+
+#define AESNI_EXPAND128( i, rcon ) \
+    rk[i] = aesni_expand128( rk[i - 1], _mm_aeskeygenassist_si128( rk[i - 1], rcon ) )
+
+#define AESNI_EXPAND256( i, rcon ) \
+    rk[i] = aesni_expand128( rk[i - 2], _mm_aeskeygenassist_si128( rk[i - 1], rcon ) ); \
+    if( i + 1 < 15 ) \
+        rk[i + 1] = aesni_expand256b( rk[i - 1], _mm_aeskeygenassist_si128( rk[i], 0 ) )
+
+AESNI_TARGET
+static void aesni_setkey_enc_128( __m128i *out, const unsigned char *key )
+{
+    __m128i rk[11];
+    int i;
+
+    rk[0] = _mm_loadu_si128( (const __m128i *) key );
+    AESNI_EXPAND128( 1, 0x01 );
+    AESNI_EXPAND128( 2, 0x02 );
+    AESNI_EXPAND128( 3, 0x04 );
+    AESNI_EXPAND128( 4, 0x08 );
+    AESNI_EXPAND128( 5, 0x10 );
+    AESNI_EXPAND128( 6, 0x20 );
+    AESNI_EXPAND128( 7, 0x40 );
+    AESNI_EXPAND128( 8, 0x80 );
+    AESNI_EXPAND128( 9, 0x1B );
+    AESNI_EXPAND128( 10, 0x36 );
+
+    for( i = 0; i < 11; i++ )
+        _mm_storeu_si128( out + i, rk[i] );
+}
+
+AESNI_TARGET
+static void aesni_setkey_enc_256( __m128i *out, const unsigned char *key )
+{
+    __m128i rk[15];
+    int i;
+
+    rk[0] = _mm_loadu_si128( (const __m128i *) key );
+    rk[1] = _mm_loadu_si128( (const __m128i *) key + 1 );
+    AESNI_EXPAND256( 2, 0x01 );
+    AESNI_EXPAND256( 4, 0x02 );
+    AESNI_EXPAND256( 6, 0x04 );
+    AESNI_EXPAND256( 8, 0x08 );
+    AESNI_EXPAND256( 10, 0x10 );
+    AESNI_EXPAND256( 12, 0x20 );
+    AESNI_EXPAND256( 14, 0x40 );
+
+    for( i = 0; i < 15; i++ )
+        _mm_storeu_si128( out + i, rk[i] );
+}
+
+/*
+ * Key expansion, wrapper
+ */
+int mbedtls_aesni_setkey_enc( unsigned char *rk,
+                      const unsigned char *key,
+                      size_t bits )
+{
+    switch( bits )
+    {
+        case 128: aesni_setkey_enc_128( (__m128i *) rk, key ); break;
+        case 256: aesni_setkey_enc_256( (__m128i *) rk, key ); break;
+        default : return( MBEDTLS_ERR_AES_INVALID_KEY_LENGTH );
+    }
+
+    return( 0 );
+}
+
+#endif /* MBEDTLS_HAVE_X86_64 */
+
+#endif /* MBEDTLS_AESNI_C */
@@ -3,3 +3,6 @@
 #define MBEDTLS_CIPHER_C
 #define MBEDTLS_AES_C
 #define MBEDTLS_SELF_TEST
+#if defined(__GNUC__) && ( defined(__amd64__) || defined(__x86_64__) )
+#define MBEDTLS_AESNI_C
+#endif
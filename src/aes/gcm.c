@@ -45,6 +45,7 @@
 
 #if defined(MBEDTLS_AESNI_C)
 #include "aesni.h"
+#include "cipher_internal.h"
 #endif
 
 #if defined(MBEDTLS_SELF_TEST) && defined(MBEDTLS_AES_C)
@@ -213,6 +214,10 @@ static const uint64_t last4[16] =
  * Sets output to x times H using the precomputed tables.
  * x and output are seen as elements of GF(2^128) as in [MGV].
  */
+#if defined(MBEDTLS_AESNI_C) && defined(MBEDTLS_HAVE_X86_64)
+static void gcm_get_h( const mbedtls_gcm_context *ctx, unsigned char h[16] );
+#endif
+
 static void gcm_mult( mbedtls_gcm_context *ctx, const unsigned char x[16],
                       unsigned char output[16] )
 {
@@ -224,11 +229,7 @@ static void gcm_mult( mbedtls_gcm_context *ctx, const unsigned char x[16],
     if( mbedtls_aesni_has_support( MBEDTLS_AESNI_CLMUL ) ) {
         unsigned char h[16];
 
-        PUT_UINT32_BE( ctx->HH[8] >> 32, h,  0 );
-        PUT_UINT32_BE( ctx->HH[8],       h,  4 );
-        PUT_UINT32_BE( ctx->HL[8] >> 32, h,  8 );
-        PUT_UINT32_BE( ctx->HL[8],       h, 12 );
-
+        gcm_get_h( ctx, h );
         mbedtls_aesni_gcm_mult( output, x, h );
         return;
     }
@@ -269,6 +270,32 @@ static void gcm_mult( mbedtls_gcm_context *ctx, const unsigned char x[16],
     PUT_UINT32_BE( zl, output, 12 );
 }
 
+#if defined(MBEDTLS_AESNI_C) && defined(MBEDTLS_HAVE_X86_64)
+/*
+ * AES key schedule for the fused AES-NI/CLMUL kernels, or NULL if they
+ * cannot be used for this context
+ */
+static const mbedtls_aes_context *gcm_aesni_ctx( const mbedtls_gcm_context *ctx )
+{
+    if( ctx->cipher_ctx.cipher_info->base->cipher != MBEDTLS_CIPHER_ID_AES ||
+        ! mbedtls_aesni_has_support( MBEDTLS_AESNI_AES ) ||
+        ! mbedtls_aesni_has_support( MBEDTLS_AESNI_CLMUL ) )
+    {
+        return( NULL );
+    }
+
+    return( (const mbedtls_aes_context *) ctx->cipher_ctx.cipher_ctx );
+}
+
+static void gcm_get_h( const mbedtls_gcm_context *ctx, unsigned char h[16] )
+{
+    PUT_UINT32_BE( ctx->HH[8] >> 32, h,  0 );
+    PUT_UINT32_BE( ctx->HH[8],       h,  4 );
+    PUT_UINT32_BE( ctx->HL[8] >> 32, h,  8 );
+    PUT_UINT32_BE( ctx->HL[8],       h, 12 );
+}
+#endif /* MBEDTLS_AESNI_C && MBEDTLS_HAVE_X86_64 */
+
 int mbedtls_gcm_starts( mbedtls_gcm_context *ctx,
                 int mode,
                 const unsigned char *iv,
@@ -363,6 +390,9 @@ int mbedtls_gcm_update( mbedtls_gcm_context *ctx,
     const unsigned char *p;
     unsigned char *out_p = output;
     size_t use_len, olen = 0;
+#if defined(MBEDTLS_AESNI_C) && defined(MBEDTLS_HAVE_X86_64)
+    const mbedtls_aes_context *aes;
+#endif
 
     if( output > input && (size_t) ( output - input ) < length )
         return( MBEDTLS_ERR_GCM_BAD_INPUT );
@@ -378,6 +408,25 @@ int mbedtls_gcm_update( mbedtls_gcm_context *ctx,
     ctx->len += length;
 
     p = input;
+
+#if defined(MBEDTLS_AESNI_C) && defined(MBEDTLS_HAVE_X86_64)
+    /* whole blocks: pipelined CTR and GHASH without the cipher layer */
+    if( length >= 16 && ( aes = gcm_aesni_ctx( ctx ) ) != NULL )
+    {
+        unsigned char h[16];
+        size_t nblocks = length / 16;
+
+        gcm_get_h( ctx, h );
+        mbedtls_aesni_gcm_crypt( aes, h, ctx->y, ctx->buf,
+                                 ctx->mode == MBEDTLS_GCM_DECRYPT,
+                                 nblocks, p, out_p );
+
+        length -= nblocks * 16;
+        p += nblocks * 16;
+        out_p += nblocks * 16;
+    }
+#endif /* MBEDTLS_AESNI_C && MBEDTLS_HAVE_X86_64 */
+
     while( length > 0 )
     {
         use_len = ( length < 16 ) ? length : 16;
@@ -491,6 +540,100 @@ int mbedtls_gcm_crypt_and_tag( mbedtls_gcm_context *ctx,
     return( 0 );
 }
 
+#if defined(MBEDTLS_AESNI_C) && defined(MBEDTLS_HAVE_X86_64)
+#define GCM_BATCH_BLOCKS    256     /* key stream blocks per ECB pass */
+#endif /* MBEDTLS_AESNI_C && MBEDTLS_HAVE_X86_64 */
+
+int mbedtls_gcm_crypt_and_tag_batch( mbedtls_gcm_context *ctx,
+                       int mode,
+                       mbedtls_gcm_batch_entry *entries,
+                       size_t count )
+{
+    int ret;
+    size_t n = 0;
+
+#if defined(MBEDTLS_AESNI_C) && defined(MBEDTLS_HAVE_X86_64)
+    const mbedtls_aes_context *aes = gcm_aesni_ctx( ctx );
+
+    if( aes != NULL )
+    {
+        unsigned char ks[GCM_BATCH_BLOCKS * 16];
+        /* every message takes two key stream blocks at least */
+        mbedtls_aesni_gcm_lane lanes[GCM_BATCH_BLOCKS / 2];
+        unsigned char h[16];
+
+        gcm_get_h( ctx, h );
+
+        while( n < count )
+        {
+            size_t first = n, used = 0, i, nb;
+            unsigned char *y = ks;
+            uint32_t ctr;
+
+            /* lay out the counter blocks of as many messages as fit */
+            for( ; n < count; n++ )
+            {
+                nb = 1 + ( entries[n].length + 15 ) / 16;
+                if( used + nb > GCM_BATCH_BLOCKS )
+                    break;
+
+                for( ctr = 1; ctr <= nb; ctr++, y += 16 )
+                {
+                    memcpy( y, entries[n].iv, 12 );
+                    PUT_UINT32_BE( ctr, y, 12 );
+                }
+                used += nb;
+            }
+
+            /* a message longer than the whole key stream buffer */
+            if( n == first )
+            {
+                mbedtls_gcm_batch_entry *e = &entries[n++];
+
+                if( ( ret = mbedtls_gcm_crypt_and_tag( ctx, mode, e->length,
+                                e->iv, 12, e->add, e->add_len,
+                                e->input, e->output, 16, e->tag ) ) != 0 )
+                    return( ret );
+                continue;
+            }
+
+            mbedtls_aesni_encrypt_blocks( aes, used, ks, ks );
+
+            for( i = first, y = ks; i < n; i++ )
+            {
+                mbedtls_gcm_batch_entry *e = &entries[i];
+                mbedtls_aesni_gcm_lane *l = &lanes[i - first];
+
+                l->add = e->add;
+                l->add_len = e->add_len;
+                l->input = e->input;
+                l->output = e->output;
+                l->length = e->length;
+                l->ks = y;
+                l->tag = e->tag;
+                y += 16 * ( 1 + ( e->length + 15 ) / 16 );
+            }
+            mbedtls_aesni_gcm_crypt_lanes( h, mode == MBEDTLS_GCM_DECRYPT,
+                                           lanes, n - first );
+        }
+
+        return( 0 );
+    }
+#endif /* MBEDTLS_AESNI_C && MBEDTLS_HAVE_X86_64 */
+
+    for( ; n < count; n++ )
+    {
+        mbedtls_gcm_batch_entry *e = &entries[n];
+
+        if( ( ret = mbedtls_gcm_crypt_and_tag( ctx, mode, e->length,
+                        e->iv, 12, e->add, e->add_len,
+                        e->input, e->output, 16, e->tag ) ) != 0 )
+            return( ret );
+    }
+
+    return( 0 );
+}
+
 int mbedtls_gcm_auth_decrypt( mbedtls_gcm_context *ctx,
                       size_t length,
                       const unsigned char *iv,
@@ -111,6 +111,45 @@ int mbedtls_gcm_crypt_and_tag( mbedtls_gcm_context *ctx,
                        size_t tag_len,
                        unsigned char *tag );
 
+/**
+ * \brief           One message of a mbedtls_gcm_crypt_and_tag_batch() call
+ */
+typedef struct {
+    const unsigned char *iv;    /*!< 12-byte initialization vector */
+    const unsigned char *add;   /*!< additional data */
+    size_t add_len;             /*!< length of additional data */
+    const unsigned char *input; /*!< input data */
+    unsigned char *output;      /*!< output data (may be equal to input) */
+    size_t length;              /*!< length of the input data */
+    unsigned char *tag;         /*!< 16-byte tag (written on encryption,
+                                     computed over the input on decryption) */
+}
+mbedtls_gcm_batch_entry;
+
+/**
+ * \brief           GCM en/decryption of many independent messages under one
+ *                  key. With AES-NI the counter blocks of all messages are
+ *                  encrypted in a single pipelined pass, which pays off for
+ *                  many short messages (heartbeats, small requests).
+ *                  Without it this is equivalent to calling
+ *                  mbedtls_gcm_crypt_and_tag() on every entry.
+ *
+ * \note            Tags are always 16 bytes and IVs always 12 bytes.
+ *                  No tag verification is done on decryption: compare
+ *                  entries[i].tag with the received tag.
+ *
+ * \param ctx       GCM context
+ * \param mode      MBEDTLS_GCM_ENCRYPT or MBEDTLS_GCM_DECRYPT
+ * \param entries   messages to process
+ * \param count     number of entries
+ *
+ * \return          0 if successful
+ */
+int mbedtls_gcm_crypt_and_tag_batch( mbedtls_gcm_context *ctx,
+                       int mode,
+                       mbedtls_gcm_batch_entry *entries,
+                       size_t count );
+
 /**
  * \brief           GCM buffer authenticated decryption using a block cipher
  *
@@ -0,0 +1,307 @@
+#include "arena.h"
+#include "log.h"
+#include "resource.h"
+
+#include <array>
+#include <atomic>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+#include <linux/mman.h>
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+namespace infgen {
+namespace memory {
+
+logger mem_logger("memory");
+
+namespace {
+
+// size classes are powers of two from 16 bytes to 64K, bigger blocks
+// (and every block once the arena is used up) come from malloc
+constexpr unsigned min_shift = 4;
+constexpr unsigned max_shift = 16;
+constexpr unsigned nr_classes = max_shift - min_shift + 1;
+constexpr unsigned max_arenas = 256;
+
+// <numaif.h> values, kept here to avoid depending on libnuma
+constexpr int mpol_bind = 2;
+constexpr unsigned mpol_mf_move = 1 << 1;
+
+struct chunk {
+  chunk* next;
+};
+
+inline unsigned size_class(size_t size) {
+  size_t s = size < (size_t(1) << min_shift) ? (size_t(1) << min_shift) : size;
+  return (64 - __builtin_clzll(s - 1)) - min_shift;
+}
+
+inline size_t align_up(size_t v, size_t a) { return (v + a - 1) & ~(a - 1); }
+
+int open_counter(uint32_t type, uint64_t config) {
+  perf_event_attr attr;
+  std::memset(&attr, 0, sizeof(attr));
+  attr.size = sizeof(attr);
+  attr.type = type;
+  attr.config = config;
+  attr.exclude_kernel = 1;
+  attr.exclude_hv = 1;
+  // this thread, on whichever cpu it runs
+  int fd = ::syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+  if (fd >= 0) {
+    ::ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+    ::ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+  }
+  return fd;
+}
+
+int64_t read_counter(int fd) {
+  uint64_t v;
+  if (fd < 0 || ::read(fd, &v, sizeof(v)) != sizeof(v)) {
+    return -1;
+  }
+  return v;
+}
+
+constexpr uint64_t cache_read_miss(uint64_t cache) {
+  return cache | (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+         (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+}
+
+class arena {
+ public:
+  bool map(int node, const arena_config& cfg) {
+    node_ = node;
+    page_ = cfg.pages == page_size::huge_1g ? (size_t(1) << 30)
+          : cfg.pages == page_size::huge_2m ? (size_t(2) << 20)
+          : size_t(::sysconf(_SC_PAGESIZE));
+    size_ = align_up(cfg.size, page_);
+
+    void* p = MAP_FAILED;
+    if (cfg.pages != page_size::normal) {
+      int huge = cfg.pages == page_size::huge_1g ? MAP_HUGE_1GB : MAP_HUGE_2MB;
+      p = ::mmap(nullptr, size_, PROT_READ | PROT_WRITE,
+                 MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB | huge, -1, 0);
+      if (p == MAP_FAILED) {
+        mem_logger.warn("no {} hugepages for a {} MB arena ({}), using normal pages",
+                        cfg.pages == page_size::huge_1g ? "1G" : "2M",
+                        size_ >> 20, strerror(errno));
+        page_ = ::sysconf(_SC_PAGESIZE);
+        size_ = align_up(cfg.size, page_);
+      }
+    }
+    if (p == MAP_FAILED) {
+      p = ::mmap(nullptr, size_, PROT_READ | PROT_WRITE,
+                 MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+      if (p == MAP_FAILED) {
+        mem_logger.error("failed to map a {} MB arena: {}", size_ >> 20, strerror(errno));
+        return false;
+      }
+      // let THP back it where it can
+      ::madvise(p, size_, MADV_HUGEPAGE);
+    }
+    base_ = static_cast<char*>(p);
+
+    // pages are faulted in on first use, bind them before that happens
+    if (node_ >= 0) {
+      std::vector<unsigned long> mask(node_ / (8 * sizeof(unsigned long)) + 1);
+      mask[node_ / (8 * sizeof(unsigned long))] |= 1UL << (node_ % (8 * sizeof(unsigned long)));
+      if (::syscall(SYS_mbind, base_, size_, mpol_bind, mask.data(),
+                    mask.size() * 8 * sizeof(unsigned long) + 1, mpol_mf_move) != 0) {
+        mem_logger.warn("failed to bind the arena to node {}: {}", node_, strerror(errno));
+      }
+    }
+
+    dtlb_fd_ = open_counter(PERF_TYPE_HW_CACHE, cache_read_miss(PERF_COUNT_HW_CACHE_DTLB));
+    node_fd_ = open_counter(PERF_TYPE_HW_CACHE, cache_read_miss(PERF_COUNT_HW_CACHE_NODE));
+    return true;
+  }
+
+  bool owns(const void* p) const {
+    return p >= base_ && p < base_ + size_;
+  }
+
+  void* allocate(size_t size) {
+    allocs_++;
+    unsigned c = size_class(size);
+    if (c >= nr_classes) {
+      fallback_allocs_++;
+      return std::malloc(size);
+    }
+    if (!free_[c] && remote_[c].load(std::memory_order_relaxed)) {
+      // only the owner takes from the remote list and it takes all of it
+      free_[c] = remote_[c].exchange(nullptr, std::memory_order_acquire);
+    }
+    if (auto* ch = free_[c]) {
+      free_[c] = ch->next;
+      return ch;
+    }
+
+    size_t bytes = size_t(1) << (c + min_shift);
+    size_t at = align_up(top_, bytes < 64 ? bytes : 64);
+    if (at + bytes > size_) {
+      fallback_allocs_++;
+      return std::malloc(size);
+    }
+    top_ = at + bytes;
+    return base_ + at;
+  }
+
+  void deallocate(void* p, size_t size) {
+    frees_++;
+    auto* ch = static_cast<chunk*>(p);
+    unsigned c = size_class(size);
+    ch->next = free_[c];
+    free_[c] = ch;
+  }
+
+  void deallocate_remote(void* p, size_t size) {
+    remote_frees_.fetch_add(1, std::memory_order_relaxed);
+    auto* ch = static_cast<chunk*>(p);
+    auto& head = remote_[size_class(size)];
+    ch->next = head.load(std::memory_order_relaxed);
+    while (!head.compare_exchange_weak(ch->next, ch, std::memory_order_release,
+                                       std::memory_order_relaxed)) {
+    }
+  }
+
+  arena_stats stats() const {
+    arena_stats s;
+    s.configured = true;
+    s.node = node_;
+    s.page_bytes = page_;
+    s.reserved = size_;
+    s.used = top_;
+    s.allocs = allocs_;
+    s.frees = frees_;
+    s.remote_frees = remote_frees_.load(std::memory_order_relaxed);
+    s.fallback_allocs = fallback_allocs_;
+    s.dtlb_misses = read_counter(dtlb_fd_);
+    s.remote_accesses = read_counter(node_fd_);
+
+    // ask the kernel where the carved pages actually are
+    if (node_ >= 0 && top_ > 0) {
+      size_t n = align_up(top_, page_) / page_;
+      std::vector<void*> pages(n);
+      std::vector<int> status(n);
+      for (size_t i = 0; i < n; i++) {
+        pages[i] = base_ + i * page_;
+      }
+      if (::syscall(SYS_move_pages, 0, n, pages.data(), nullptr, status.data(), 0) == 0) {
+        for (auto st : status) {
+          if (st >= 0 && st != node_) {
+            s.remote_pages++;
+          }
+        }
+      }
+    }
+    return s;
+  }
+
+ private:
+  char* base_{nullptr};
+  size_t size_{0};
+  size_t top_{0};
+  size_t page_{0};
+  int node_{-1};
+  std::array<chunk*, nr_classes> free_{};
+  std::array<std::atomic<chunk*>, nr_classes> remote_{};
+
+  uint64_t allocs_{0};
+  uint64_t frees_{0};
+  std::atomic<uint64_t> remote_frees_{0};
+  uint64_t fallback_allocs_{0};
+  int dtlb_fd_{-1};
+  int node_fd_{-1};
+};
+
+// arenas live as long as the process: blocks may outlive their thread
+std::array<std::atomic<arena*>, max_arenas> arenas{};
+std::atomic<unsigned> nr_arenas{0};
+__thread arena* local_arena;
+
+arena* owner_of(const void* p) {
+  unsigned n = nr_arenas.load(std::memory_order_acquire);
+  for (unsigned i = 0; i < n && i < max_arenas; i++) {
+    auto* a = arenas[i].load(std::memory_order_acquire);
+    if (a && a->owns(p)) {
+      return a;
+    }
+  }
+  return nullptr;
+}
+
+}  // namespace
+
+page_size parse_page_size(const std::string& s) {
+  if (s == "1G" || s == "1g") {
+    return page_size::huge_1g;
+  } else if (s == "none" || s == "4K" || s == "4k") {
+    return page_size::normal;
+  }
+  return page_size::huge_2m;
+}
+
+bool configure(unsigned cpu, const arena_config& cfg) {
+  if (local_arena || cfg.size == 0) {
+    return local_arena != nullptr;
+  }
+  unsigned slot = nr_arenas.fetch_add(1, std::memory_order_acq_rel);
+  if (slot >= max_arenas) {
+    mem_logger.error("more than {} arenas, core {} uses malloc", max_arenas, cpu);
+    return false;
+  }
+
+  int node = resource::node_of_cpu(cpu);
+  auto* a = new arena();
+  if (!a->map(node, cfg)) {
+    delete a;
+    return false;
+  }
+  arenas[slot].store(a, std::memory_order_release);
+  local_arena = a;
+
+  auto s = a->stats();
+  mem_logger.info("core {}: {} MB arena on node {} with {} pages", cpu,
+                  s.reserved >> 20, node,
+                  s.page_bytes >= (size_t(1) << 30) ? "1G"
+                  : s.page_bytes >= (size_t(2) << 20) ? "2M" : "normal");
+  return true;
+}
+
+void* allocate(size_t size) {
+  if (local_arena) {
+    return local_arena->allocate(size);
+  }
+  return std::malloc(size);
+}
+
+void deallocate(void* p, size_t size) {
+  if (!p) {
+    return;
+  }
+  if (local_arena && local_arena->owns(p)) {
+    local_arena->deallocate(p, size);
+  } else if (auto* a = owner_of(p)) {
+    a->deallocate_remote(p, size);
+  } else {
+    std::free(p);
+  }
+}
+
+arena_stats stats() {
+  if (!local_arena) {
+    return arena_stats{};
+  }
+  return local_arena->stats();
+}
+
+}  // namespace memory
+}  // namespace infgen
@@ -0,0 +1,360 @@
+#include "cluster.h"
+#include "reactor.h"
+#include "smp.h"
+
+namespace infgen {
+
+logger cluster_logger("cluster");
+
+// control messages are small, the block only has to hold one of them
+// (or one statistics message of the workload) at a time
+static constexpr size_t arena_block_size = 64 * 1024;
+
+google::protobuf::ArenaOptions cluster_master_base::arena_options(std::vector<char>& block) {
+  block.resize(arena_block_size);
+  google::protobuf::ArenaOptions opts;
+  opts.initial_block = block.data();
+  opts.initial_block_size = block.size();
+  return opts;
+}
+
+cluster_master_base::cluster_master_base(const cluster_config& cfg)
+    : cfg_(cfg),
+      members_(cfg.workers),
+      arena_(arena_options(arena_block_)) {}
+
+bool cluster_master_base::listen() {
+  ipv4_addr addr("0.0.0.0", cfg_.port);
+  svr_ = tcp_server::create_tcp_server(make_ipv4_address(addr));
+  if (svr_ == nullptr) {
+    cluster_logger.error("failed to listen on port {}", cfg_.port);
+    return false;
+  }
+
+  // frames are parsed straight from the input buffer: a read may hold any
+  // number of them, a partial one waits for the next read
+  svr_->when_recved([this](const connptr& con) {
+    recv_us_ = clock_sync::now_us();
+    bool ok = for_each_frame(con->get_input(), [&](uint8_t type, const char* p, size_t len) {
+      handle_frame(con, type, p, len);
+      arena_.Reset();
+    });
+    if (!ok) {
+      cluster_logger.error("malformed frame from connection {}, closing", con->get_id());
+      if (registered(con)) {
+        leave(con->get_id());
+      }
+      con->close();
+    }
+  });
+
+  svr_->when_disconnect([this](const connptr& con) {
+    if (registered(con)) {
+      leave(con->get_id());
+    }
+  });
+
+  engine().add_periodic_task_after<infinite>(cfg_.heartbeat, [this] { check_liveness(); });
+  if (cfg_.dashboard.count() > 0) {
+    engine().add_periodic_task_after<infinite>(cfg_.dashboard, [this] { on_dashboard(); });
+  }
+  cluster_logger.info("waiting for {} workers on port {}", cfg_.workers, cfg_.port);
+  return true;
+}
+
+bool cluster_master_base::registered(const connptr& con) const {
+  auto id = con->get_id();
+  return id < members_.size() && members_[id].con == con;
+}
+
+void cluster_master_base::handle_frame(const connptr& con, uint8_t type, const char* p,
+                                       size_t len) {
+  switch (type) {
+    case CLUSTER_HELLO:
+      join(con, p, len);
+      break;
+    case CLUSTER_HEARTBEAT:
+      heartbeat(con, p, len);
+      break;
+    default:
+      if (type < CLUSTER_APP || !registered(con)) {
+        cluster_logger.error("unexpected frame type {} from connection {}", type, con->get_id());
+        break;
+      }
+      on_stats(con->get_id(), type - CLUSTER_APP, p, len);
+      break;
+  }
+}
+
+void cluster_master_base::join(const connptr& con, const char* p, size_t len) {
+  auto hello = google::protobuf::Arena::CreateMessage<cluster_hello>(&arena_);
+  if (!hello->ParseFromArray(p, len) || hello->worker_id() >= cfg_.workers) {
+    cluster_logger.error("bad registration from connection {}", con->get_id());
+    return;
+  }
+  auto id = hello->worker_id();
+  auto& m = members_[id];
+  if (m.online) {
+    cluster_logger.error("worker {} is online already", id);
+    return;
+  }
+
+  con->set_id(id);
+  m.con = con;
+  m.online = true;
+  m.cores = hello->cores();
+  m.last_seen = system_clock::now();
+  online_++;
+  cluster_logger.info("worker {} online, {} cores ({}/{})", id, m.cores, online_, cfg_.workers);
+  // the start command waits for its clock samples, see try_start()
+}
+
+void cluster_master_base::try_start() {
+  if (running_) {
+    // a worker coming back joins the run in progress
+    for (unsigned i = 0; i < members_.size(); i++) {
+      auto& m = members_[i];
+      if (m.online && m.settled() && !m.commanded) {
+        send_command(i, CLUSTER_COMMAND);
+      }
+    }
+    return;
+  }
+  if (online_ < cfg_.workers) {
+    return;
+  }
+  for (auto& m : members_) {
+    if (!m.settled()) {
+      return;
+    }
+  }
+  cluster_logger.info("all workers ready and clocks settled, distributing workloads");
+  running_ = true;
+  start_us_ = clock_sync::now_us() + duration_cast<microseconds>(cfg_.start_delay).count();
+  for (unsigned i = 0; i < members_.size(); i++) {
+    send_command(i, CLUSTER_COMMAND);
+  }
+}
+
+void cluster_master_base::leave(unsigned id) {
+  auto& m = members_[id];
+  cluster_logger.info("worker {} offline", id);
+  m = member{};
+  online_--;
+}
+
+void cluster_master_base::heartbeat(const connptr& con, const char* p, size_t len) {
+  if (!hb_.ParseFromArray(p, len) || !registered(con)) {
+    cluster_logger.error("bad heartbeat from connection {}", con->get_id());
+    return;
+  }
+  auto& m = members_[con->get_id()];
+  m.last_seen = system_clock::now();
+  m.clock_offset = hb_.clock_offset_us();
+  m.clock_error = hb_.clock_error_us();
+  bool settled = m.settled();
+  m.clock_samples = hb_.clock_samples();
+
+  // answer right away, queueing here would count as network delay
+  hb_.set_t1(recv_us_);
+  hb_.set_t2(clock_sync::now_us());
+  encode_frame(frame_buf_, CLUSTER_HEARTBEAT, hb_);
+  con->send_packet(frame_buf_);
+
+  if (!settled && m.settled()) {
+    try_start();
+  }
+}
+
+void cluster_master_base::send_command(unsigned id, cluster_frame type) {
+  auto& m = members_[id];
+  if (!m.online) {
+    return;
+  }
+  cmd_.Clear();
+  cmd_.set_worker_id(id);
+  cmd_.set_workers(cfg_.workers);
+  cmd_.set_start_us(start_us_);
+  cmd_.set_generation(generation_);
+  encode_params(id, *cmd_.mutable_params());
+  encode_frame(frame_buf_, type, cmd_);
+  m.con->send_packet(frame_buf_);
+  if (type == CLUSTER_COMMAND) {
+    m.commanded = true;
+  }
+}
+
+void cluster_master_base::retune() {
+  if (!running_) {
+    // the new parameters go out with the start command
+    return;
+  }
+  generation_++;
+  cluster_logger.info("re-tuning {} workers, generation {}", online_, generation_);
+  for (unsigned id = 0; id < members_.size(); id++) {
+    // the others get the new parameters with their start command
+    if (!members_[id].commanded) {
+      continue;
+    }
+    send_command(id, CLUSTER_RETUNE);
+  }
+}
+
+void cluster_master_base::shutdown() {
+  cmd_.Clear();
+  encode_frame(frame_buf_, CLUSTER_STOP, cmd_);
+  for (auto& m : members_) {
+    if (m.online) {
+      m.con->send_packet(frame_buf_);
+    }
+  }
+  engine().add_oneshot_task_after(100ms, [] { engine().stop(); });
+}
+
+void cluster_master_base::check_liveness() {
+  auto deadline = system_clock::now() - cfg_.heartbeat * cfg_.max_missed;
+  for (unsigned id = 0; id < members_.size(); id++) {
+    auto& m = members_[id];
+    if (m.online && m.last_seen < deadline) {
+      cluster_logger.warn("worker {} missed {} heartbeats", id, cfg_.max_missed);
+      auto con = m.con;
+      leave(id);
+      con->close();
+    }
+  }
+}
+
+cluster_worker_base::cluster_worker_base(const cluster_config& cfg, unsigned id,
+                                         socket_address master, socket_address local)
+    : cfg_(cfg), id_(id), master_(master), local_(local) {}
+
+void cluster_worker_base::connect() {
+  con_ = engine().connect(master_, local_);
+
+  con_->when_ready([this](const connptr& con) {
+    cluster_logger.info("connected to master");
+    cluster_hello hello;
+    hello.set_worker_id(id_);
+    hello.set_cores(smp::count - 1);
+    encode_frame(frame_buf_, CLUSTER_HELLO, hello);
+    con->send_packet(frame_buf_);
+    registered_ = true;
+    last_seen_ = system_clock::now();
+
+    // a quick burst fills the clock filter, regular heartbeats track drift
+    // afterwards; every heartbeat tells the master how many samples the
+    // estimate rests on, it holds the start command back until it settled
+    engine().add_periodic_task_after<clock_sync::window>(20ms, [this] { send_heartbeat(); });
+    engine().add_periodic_task_after<infinite>(cfg_.heartbeat, [this] {
+      send_heartbeat();
+      check_master();
+    });
+  });
+
+  con_->when_recved([this](const connptr& con) {
+    recv_us_ = clock_sync::now_us();
+    bool ok = for_each_frame(con->get_input(), [this](uint8_t type, const char* p, size_t len) {
+      handle_frame(type, p, len);
+    });
+    if (!ok) {
+      con->close();
+      lost("malformed frame from master");
+    }
+  });
+
+  con_->when_failed([this](const connptr& con) {
+    if (registered_) {
+      lost("connection to master failed");
+      return;
+    }
+    cluster_logger.warn("master not reachable, retrying");
+    engine().add_oneshot_task_after(1s, [con] { con->reconnect(); });
+  });
+
+  con_->when_disconnect([this](const connptr& con) { lost("master disconnected"); });
+}
+
+void cluster_worker_base::handle_frame(uint8_t type, const char* p, size_t len) {
+  last_seen_ = system_clock::now();
+  switch (type) {
+    case CLUSTER_HEARTBEAT:
+      if (hb_.ParseFromArray(p, len)) {
+        clock_.add_sample(hb_.t0(), hb_.t1(), hb_.t2(), recv_us_);
+      }
+      break;
+    case CLUSTER_COMMAND:
+      if (!cmd_.ParseFromArray(p, len)) {
+        cluster_logger.error("failed to parse command");
+        break;
+      }
+      if (started_) {
+        cluster_logger.warn("already running, command ignored");
+        break;
+      }
+      started_ = true;
+      workers_ = cmd_.workers();
+      generation_ = cmd_.generation();
+      if (clock_.synced()) {
+        start_tp_ = clock_.to_local(cmd_.start_us());
+        cluster_logger.info("clock offset to master {}us (+/- {}us)", clock_.offset_us(),
+                            clock_.error_us());
+      } else {
+        cluster_logger.warn("no clock sample from master yet, trusting the local clock");
+        start_tp_ = system_clock::time_point(microseconds(cmd_.start_us()));
+      }
+      on_start(cmd_.params());
+      break;
+    case CLUSTER_RETUNE:
+      if (!cmd_.ParseFromArray(p, len)) {
+        cluster_logger.error("failed to parse command");
+        break;
+      }
+      if (!started_ || cmd_.generation() <= generation_) {
+        break;
+      }
+      generation_ = cmd_.generation();
+      cluster_logger.info("re-tuned, generation {}", generation_);
+      on_retune(cmd_.params());
+      break;
+    case CLUSTER_STOP:
+      cluster_logger.info("stopped by master");
+      stopped_ = true;
+      on_stop();
+      break;
+    default:
+      cluster_logger.error("unexpected frame type {} from master", type);
+      break;
+  }
+}
+
+void cluster_worker_base::send_heartbeat() {
+  if (stopped_ || con_->get_state() != tcp_connection::state::connected) {
+    return;
+  }
+  hb_.Clear();
+  hb_.set_worker_id(id_);
+  hb_.set_t0(clock_sync::now_us());
+  hb_.set_clock_offset_us(clock_.offset_us());
+  hb_.set_clock_error_us(clock_.error_us());
+  hb_.set_clock_samples(clock_.samples());
+  encode_frame(frame_buf_, CLUSTER_HEARTBEAT, hb_);
+  con_->send_packet(frame_buf_);
+}
+
+void cluster_worker_base::check_master() {
+  if (!stopped_ && system_clock::now() - last_seen_ > cfg_.heartbeat * cfg_.max_missed) {
+    con_->close();
+    lost("master missed heartbeats");
+  }
+}
+
+void cluster_worker_base::lost(const char* why) {
+  if (stopped_) {
+    return;
+  }
+  stopped_ = true;
+  cluster_logger.error("{}, stopping", why);
+  on_stop();
+}
+
+}  // namespace infgen
@@ -0,0 +1,119 @@
+#include "connect_scheduler.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace infgen {
+
+bool connect_scheduler::parse(const std::string& name, profile& p) {
+  if (name == "constant") {
+    p = profile::constant;
+  } else if (name == "linear") {
+    p = profile::linear;
+  } else if (name == "exponential") {
+    p = profile::exponential;
+  } else {
+    return false;
+  }
+  return true;
+}
+
+void connect_scheduler::submit(uint64_t n, std::function<void()> open,
+                               std::function<void()> done) {
+  if (!started_) {
+    started_ = true;
+    start_ = last_ = steady_clock::now();
+  }
+  if (n == 0) {
+    if (done) {
+      done();
+    }
+    return;
+  }
+  jobs_.push_back(job{n, std::move(open), std::move(done)});
+}
+
+uint64_t connect_scheduler::queued() const {
+  uint64_t n = 0;
+  for (auto& j : jobs_) {
+    n += j.left;
+  }
+  return n;
+}
+
+double connect_scheduler::rate() const {
+  if (!paced()) {
+    return 0;
+  }
+  auto t = steady_clock::now() - start_;
+  if (!started_ || cfg_.shape == profile::constant || cfg_.ramp_time.count() <= 0 ||
+      t >= cfg_.ramp_time) {
+    return cfg_.rate;
+  }
+  double x = duration<double>(t) / duration<double>(cfg_.ramp_time);
+  if (cfg_.shape == profile::linear) {
+    return cfg_.start_rate + (cfg_.rate - cfg_.start_rate) * x;
+  }
+  // the rate grows by the same factor every equal slice of the ramp
+  double from = std::max(cfg_.start_rate, std::min(1.0, cfg_.rate));
+  return from * std::pow(cfg_.rate / from, x);
+}
+
+bool connect_scheduler::poll() {
+  if (jobs_.empty()) {
+    return false;
+  }
+  auto now = steady_clock::now();
+  uint64_t budget;
+  if (paced()) {
+    tokens_ += rate() * duration<double>(now - last_).count();
+    tokens_ = std::min(tokens_, double(std::max(cfg_.burst, 1u)));
+    budget = uint64_t(tokens_);
+  } else {
+    budget = UINT64_MAX;
+  }
+  last_ = now;
+  if (cfg_.max_half_open) {
+    budget = std::min(budget, cfg_.max_half_open > half_open_
+                                  ? uint64_t(cfg_.max_half_open - half_open_) : 0);
+  }
+
+  uint64_t released = 0;
+  while (released < budget && !jobs_.empty()) {
+    auto& j = jobs_.front();
+    j.left--;
+    released++;
+    // open may submit more, which leaves references into the deque valid
+    if (j.left == 0) {
+      auto fin = std::move(j);
+      jobs_.pop_front();
+      fin.open();
+      if (fin.done) {
+        fin.done();
+      }
+    } else {
+      j.open();
+    }
+  }
+  if (paced()) {
+    tokens_ -= released;
+  }
+  return released > 0;
+}
+
+void connect_scheduler::handshake_done(microseconds latency, bool ok, unsigned syn_retries) {
+  if (half_open_) {
+    half_open_--;
+  }
+  for (auto* s : {&total_, &interval_}) {
+    s->syn_retries += syn_retries;
+    if (ok) {
+      s->established++;
+      s->setup.record(latency.count() > 0 ? latency.count() : 0);
+    } else {
+      s->failed++;
+    }
+  }
+}
+
+} // namespace infgen
@@ -0,0 +1,72 @@
+#include "control.h"
+
+#include <algorithm>
+
+namespace infgen {
+
+extern logger net_logger;
+
+// a line longer than this is not a command
+static constexpr size_t max_line = 1024;
+
+bool control_channel::listen(uint16_t port) {
+  ipv4_addr addr("127.0.0.1", port);
+  svr_ = tcp_server::create_tcp_server(make_ipv4_address(addr));
+  if (svr_ == nullptr) {
+    net_logger.error("failed to listen on control port {}", port);
+    return false;
+  }
+
+  svr_->when_recved([this](const connptr& con) {
+    auto& in = con->get_input();
+    std::string reply;
+    for (;;) {
+      auto eol = std::find(in.begin(), in.end(), '\n');
+      if (eol == in.end()) {
+        break;
+      }
+      std::string line(in.begin(), eol);
+      in.consume(eol - in.begin() + 1);
+      reply += execute(line);
+    }
+    if (in.size() > max_line) {
+      in.consume(in.size());
+      reply += "error: line too long\n";
+    }
+    if (!reply.empty()) {
+      con->send_packet(reply);
+    }
+  });
+
+  net_logger.info("control channel on 127.0.0.1:{}", port);
+  return true;
+}
+
+std::string control_channel::execute(const std::string& line) {
+  std::istringstream is(line);
+  std::string name, value;
+  is >> name >> value;
+  if (name.empty()) {
+    return "";
+  }
+  if (name == "help") {
+    std::string out;
+    for (auto& c : commands_) {
+      out += c.first + "\t" + c.second.help + "\n";
+    }
+    return out + "ok\n";
+  }
+
+  auto it = commands_.find(name);
+  if (it == commands_.end()) {
+    return "error: unknown command " + name + "\n";
+  }
+  auto err = it->second.h(value);
+  if (!err.empty()) {
+    return "error: " + err + "\n";
+  }
+  net_logger.info("control: {} {}", name, value);
+  return "ok\n";
+}
+
+}  // namespace infgen
@@ -0,0 +1,115 @@
+#include "dest_pool.h"
+
+#include <cstdlib>
+#include <limits>
+#include <stdexcept>
+
+#include <arpa/inet.h>
+
+namespace infgen {
+
+destination_pool destination_pool::parse(const std::string& s, uint16_t default_port) {
+  destination_pool pool;
+  size_t pos = 0;
+  while (pos < s.size()) {
+    auto end = s.find(',', pos);
+    if (end == std::string::npos) {
+      end = s.size();
+    }
+    auto item = s.substr(pos, end - pos);
+    pos = end + 1;
+    if (item.empty()) {
+      continue;
+    }
+
+    auto c1 = item.find(':');
+    auto ip = item.substr(0, c1);
+    unsigned long port = default_port;
+    unsigned long weight = 1;
+    char* stop = nullptr;
+    if (c1 != std::string::npos) {
+      auto c2 = item.find(':', c1 + 1);
+      port = std::strtoul(item.c_str() + c1 + 1, &stop, 10);
+      if (stop != item.c_str() + (c2 == std::string::npos ? item.size() : c2)) {
+        throw std::invalid_argument("bad destination: " + item);
+      }
+      if (c2 != std::string::npos) {
+        weight = std::strtoul(item.c_str() + c2 + 1, &stop, 10);
+        if (*stop != '\0') {
+          throw std::invalid_argument("bad destination: " + item);
+        }
+      }
+    }
+    in_addr a;
+    if (::inet_pton(AF_INET, ip.c_str(), &a) != 1 || port == 0 || port > 65535 ||
+        weight == 0 || weight > std::numeric_limits<uint32_t>::max()) {
+      throw std::invalid_argument("bad destination: " + item);
+    }
+    pool.add(make_ipv4_address(ipv4_addr(ip, port)), weight);
+  }
+  if (pool.empty()) {
+    throw std::invalid_argument("no destination in: " + s);
+  }
+  return pool;
+}
+
+void destination_pool::add(socket_address addr, unsigned weight) {
+  auto it = index_.find(key(addr));
+  if (it != index_.end()) {
+    dests_[it->second].weight = weight;
+  } else {
+    index_.emplace(key(addr), dests_.size());
+    destination d;
+    d.addr = addr;
+    d.weight = weight;
+    dests_.push_back(d);
+  }
+  build();
+}
+
+void destination_pool::build() {
+  size_t n = dests_.size();
+  prob_.assign(n, 0);
+  alias_.assign(n, 0);
+
+  // in units of total / n, a column holds exactly one unit
+  uint64_t total = 0;
+  for (auto& d : dests_) {
+    total += d.weight;
+  }
+  std::vector<uint64_t> scaled(n);
+  std::vector<uint32_t> small, large;
+  for (size_t i = 0; i < n; i++) {
+    scaled[i] = uint64_t(dests_[i].weight) * n;
+    (scaled[i] < total ? small : large).push_back(i);
+  }
+  auto set_prob = [&](size_t i) {
+    auto p = (static_cast<unsigned __int128>(scaled[i]) << 32) / total;
+    prob_[i] = p > std::numeric_limits<uint32_t>::max()
+                   ? std::numeric_limits<uint32_t>::max() : uint32_t(p);
+  };
+  while (!small.empty() && !large.empty()) {
+    auto s = small.back();
+    small.pop_back();
+    auto l = large.back();
+    set_prob(s);
+    alias_[s] = l;
+    // l fills the rest of column s
+    scaled[l] -= total - scaled[s];
+    if (scaled[l] < total) {
+      large.pop_back();
+      small.push_back(l);
+    }
+  }
+  // what is left holds one unit each, up to rounding
+  for (auto i : large) {
+    prob_[i] = std::numeric_limits<uint32_t>::max();
+    alias_[i] = i;
+  }
+  for (auto i : small) {
+    prob_[i] = std::numeric_limits<uint32_t>::max();
+    alias_[i] = i;
+  }
+}
+
+} // namespace infgen
@@ -8,53 +8,148 @@ using namespace net;
 
 extern logger epoll_logger;
 
-epoll_backend::epoll_backend()
-    : epollfd_(file_desc::epoll_create(EPOLL_CLOEXEC)) {}
+constexpr unsigned epoll_backend::min_events;
+
+epoll_backend::epoll_backend() : epoll_backend(config{}) {}
+
+epoll_backend::epoll_backend(const config &cfg)
+    : epollfd_(file_desc::epoll_create(EPOLL_CLOEXEC)), cfg_(cfg),
+      events_(min_events) {
+  cfg_.max_events = std::max(cfg_.max_events, min_events);
+}
 
 bool epoll_backend::poll(int timeout) {
-  std::array<epoll_event, 128> events;
-  int nr = ::epoll_wait(epollfd_.get(), events.data(), events.size(), timeout);
+  flush();
+  int nr = ::epoll_wait(epollfd_.get(), events_.data(), events_.size(), timeout);
+  stats_.waits++;
   if (nr == -1 && errno == EINTR) {
     return false;
   }
   assert(nr != -1);
+  stats_.events += nr;
   for (int i = 0; i < nr; ++i) {
-    auto &ev = events[i];
+    auto &ev = events_[i];
     auto state = reinterpret_cast<poll_state *>(ev.data.ptr);
     auto events = ev.events & (EPOLLIN | EPOLLOUT);
+
+    if (state->events_epoll & EPOLLET) {
+      // an edge is reported once, errors are left to the next read or write
+      if (ev.events & (EPOLLERR | EPOLLHUP)) {
+        events = EPOLLIN | EPOLLOUT;
+      }
+      state->events_ready |= events;
+      auto fire = state->events_ready & state->events_requested;
+      // the owner drains the fd, the next edge comes from the kernel
+      state->events_ready &= ~fire;
+      epoll_logger.debug("edge events: {}, requested: {}, fire: {}", events,
+                         state->events_requested, fire);
+      complete_epoll_event(*state, fire, EPOLLOUT);
+      complete_epoll_event(*state, fire, EPOLLIN);
+      continue;
+    }
+
     auto events_to_remove = events & ~state->events_requested;
 
     epoll_logger.debug("events: {}, requested: {}, remove: {}", events,
                      state->events_requested, events_to_remove);
 
-    complete_epoll_event(*state, events, EPOLLOUT);
-    complete_epoll_event(*state, events, EPOLLIN);
-
     if (events_to_remove) {
+      // dropped with the next flush unless asked for again until then
       epoll_logger.trace("remove events {} for fd {}", events_to_remove,
                        state->pollid);
-      state->events_epoll &= ~events_to_remove;
-      ev.events = state->events_epoll;
-      auto op = ev.events ? EPOLL_CTL_MOD : EPOLL_CTL_DEL;
-      ::epoll_ctl(epollfd_.get(), op, state->pollid, &ev);
+      mark(*state);
     }
+
+    complete_epoll_event(*state, events, EPOLLOUT);
+    complete_epoll_event(*state, events, EPOLLIN);
   }
+  resize_batch(nr);
   return nr;
 }
 
+void epoll_backend::resize_batch(int nr) {
+  unsigned size = events_.size();
+  if (unsigned(nr) == size && size < cfg_.max_events) {
+    events_.resize(std::min(size * 2, cfg_.max_events));
+    light_polls_ = 0;
+  } else if (nr > 0 && unsigned(nr) < size / 4 && size > min_events) {
+    if (++light_polls_ >= 1024) {
+      events_.resize(size / 2);
+      light_polls_ = 0;
+    }
+  } else if (nr > 0) {
+    light_polls_ = 0;
+  }
+}
+
 void epoll_backend::update(poll_state &state, int event) {
   state.events_requested |= event;
-  if (!(state.events_epoll & event)) {
+  if (state.events_epoll & EPOLLET) {
+    // registered for good, only an edge that came unasked is handed out
+    if (state.events_ready & event) {
+      mark(state);
+    }
+  } else if ((state.events_epoll & event) != event) {
     epoll_logger.trace("update event {} for fd {}", event, state.pollid);
-    auto ctl = state.events_epoll ? EPOLL_CTL_MOD : EPOLL_CTL_ADD;
-    state.events_epoll |= event;
-    ::epoll_event ev;
-    ev.events = state.events_epoll;
-    ev.data.ptr = &state;
-    int r = ::epoll_ctl(epollfd_.get(), ctl, state.pollid, &ev);
-    epoll_logger.fatalif(r != 0, "epoll_ctl failed, {}: {}", errno, strerror(errno));
-    engine().start_epoll();
+    mark(state);
+  }
+  engine().start_epoll();
+}
+
+void epoll_backend::mark(poll_state &state) {
+  if (state.dirty < 0) {
+    state.dirty = dirty_.size();
+    dirty_.push_back(&state);
+  }
+}
+
+void epoll_backend::unmark(poll_state &state) {
+  if (state.dirty >= 0) {
+    auto last = dirty_.back();
+    dirty_[state.dirty] = last;
+    last->dirty = state.dirty;
+    dirty_.pop_back();
+    state.dirty = -1;
+  }
+}
+
+void epoll_backend::flush() {
+  // apply() may run callbacks, which mark and forget other fds
+  while (!dirty_.empty()) {
+    auto state = dirty_.back();
+    dirty_.pop_back();
+    state->dirty = -1;
+    apply(*state);
+  }
+}
+
+void epoll_backend::apply(poll_state &state) {
+  ::epoll_event ev;
+  ev.data.ptr = &state;
+  if (state.events_epoll & EPOLLET) {
+    auto fire = state.events_ready & state.events_requested;
+    state.events_ready &= ~fire;
+    complete_epoll_event(state, fire, EPOLLOUT);
+    complete_epoll_event(state, fire, EPOLLIN);
+    return;
+  }
+
+  int ctl;
+  if (cfg_.edge_triggered && state.edge && !state.events_epoll) {
+    ctl = EPOLL_CTL_ADD;
+    state.events_epoll = EPOLLIN | EPOLLOUT | EPOLLET;
+  } else {
+    int target = state.events_requested & (EPOLLIN | EPOLLOUT);
+    if (target == state.events_epoll) {
+      return;
+    }
+    ctl = !state.events_epoll ? EPOLL_CTL_ADD : target ? EPOLL_CTL_MOD : EPOLL_CTL_DEL;
+    state.events_epoll = target;
   }
+  ev.events = state.events_epoll;
+  int r = ::epoll_ctl(epollfd_.get(), ctl, state.pollid, &ev);
+  stats_.ctls++;
+  epoll_logger.fatalif(r != 0, "epoll_ctl failed, {}: {}", errno, strerror(errno));
 }
 
 void epoll_backend::complete_epoll_event(poll_state &state, int events, int event) {
@@ -73,8 +168,11 @@ void epoll_backend::complete_epoll_event(poll_state &state, int events, int even
 }
 
 void epoll_backend::forget(poll_state &state) {
+  unmark(state);
   if (state.events_epoll) {
     ::epoll_ctl(epollfd_.get(), EPOLL_CTL_DEL, state.pollid, nullptr);
+    stats_.ctls++;
+    state.events_epoll = 0;
   }
 }
 } // namespace infgen
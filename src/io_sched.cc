@@ -107,7 +107,8 @@ void io_scheduler::io_loop() {
     if (smp::count > 1) {
       for (unsigned i = 0; i < nr_queue_; i++) {
         create_burst_thread([this, i] {
-          pin_this_thread(i);
+          // next to the stack thread of the queue it bursts
+          pin_this_thread(smp::layout().stack[i == 0 ? 0 : i - 1]);
           while (!stop_) {
             burst_loop(i);
           }
@@ -115,7 +116,7 @@ void io_scheduler::io_loop() {
       }
     } else {
       create_burst_thread([this] {
-        pin_this_thread(0);
+        pin_this_thread(smp::layout().stack[0]);
         while(!stop_) {
           burst_loop(0);
         }
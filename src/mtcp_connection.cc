@@ -3,9 +3,8 @@
 #include "mtcp_connection.h"
 #include "reactor.h"
 
-#ifdef AES_GCM
-#include "ssl_layer.h"
-#endif
+#include <algorithm>
+#include <netinet/tcp.h>
 
 namespace infgen {
 
@@ -24,10 +23,18 @@ mtcp_connection::~mtcp_connection() {
 
 void mtcp_connection::attach(int sockid, socket_address local, socket_address peer) {
   state_ = state::connecting;
+  peer_closed_ = false;
   fd_ = sockid;
   local_ = local;
   peer_ = peer;
   req_cnt_ = 0; 
+  presented_ = 0;
+
+#ifdef AES_GCM
+  ssl_ = std::make_unique<ssl_layer>(engine().ssl_context());
+  cipher_in_.clear();
+  output_.clear();
+#endif
 
   mtcp_socket sock(sockid, engine().context());
   pfd_ = std::make_shared<pollable_fd>(sock);
@@ -45,33 +52,76 @@ void mtcp_connection::close() {
     net_logger.trace("multiple close detected! please check your code");
     return;
   }
-	if (state_ == state::connected) {
-		state_ = state::closed;
-		pfd_->detach_from_loop();
-		pfd_->close_socket();
-		pfd_ = nullptr;
-		if (on_closed_) {
-			on_closed_();
-		}
-	}
+  abandon_handshake();
+  abandon_reconnect();
+  state_ = state::closed;
+  // a socket still connecting is released as well
+  if (pfd_) {
+    pfd_->detach_from_loop();
+    pfd_->close_socket();
+    pfd_ = nullptr;
+  }
+  if (on_closed_) {
+    on_closed_();
+  }
 }
 
-size_t mtcp_connection::send(const void *data, size_t len) {
-  if (len == 0) {
+#ifdef AES_GCM
+size_t mtcp_connection::flush() {
+  size_t nwrite = 0;
+  if (output_.empty()) {
     return 0;
   }
-  size_t nwrite = 0;
-#ifdef AES_GCM
   try {
-		char ciphertext[1500]; // buffer
+    nwrite = pfd_->get_mtcp_socket().write(output_.begin(), output_.size());
+    if (nwrite > 0) {
+      stat_.collect(OUT, nwrite);
+      net_logger.trace("Socket {} send {} bytes", pfd_->get_id(), nwrite);
+      output_.consume(nwrite);
+    }
+    if (!output_.empty()) {
+      // sealed records cannot be dropped, finish them once writable
+      net_logger.trace("Send buffer full! {} bytes pending", output_.size());
+      pfd_->enable_write();
+    } else {
+      pfd_->enable_read();
+    }
+  } catch (std::system_error &e) {
+    net_logger.warn("Send data error: {} Socket id: {}", e.what(), pfd_->get_id());
+    state_ = state::disconnect;
+  }
+  return nwrite;
+}
 
-		ssl_layer::ssl_encrypt(engine().ssl_context(), (const unsigned char *)data, (unsigned char*)ciphertext, len);
-		len += 21; // Additianal + ciphertext + tag
-    nwrite = pfd_->get_mtcp_socket().write((const char*)ciphertext, len);
+size_t mtcp_connection::send(const void *data, size_t len) {
+  if (len == 0) {
+    return 0;
+  }
+  // records left over by the socket go first, what does not fit behind
+  // them is left to the caller
+  flush();
+  if (state_ == state::disconnect) {
+    return 0;
+  }
+  len = std::min(len, ssl_layer::sealable(max_sealed - std::min(output_.size(), max_sealed)));
+  if (len == 0) {
+    // flush() waits for the socket to drain
+    return 0;
+  }
+  // seal straight into the output buffer; the records are part of the
+  // stream from now on, so all of len counts as sent
+  ssl_->seal(data, len, output_);
+  flush();
+  return state_ == state::disconnect ? 0 : len;
+}
 #else
+size_t mtcp_connection::send(const void *data, size_t len) {
+  if (len == 0) {
+    return 0;
+  }
+  size_t nwrite = 0;
   try {
     nwrite = pfd_->get_mtcp_socket().write((const char *)data, len);
-#endif
     if (nwrite > 0) {
       stat_.collect(OUT, nwrite);
       net_logger.trace("Socket {} send {} bytes", pfd_->get_id(), nwrite);
@@ -80,8 +130,10 @@ size_t mtcp_connection::send(const void *data, size_t len) {
       }
     } else if (nwrite == 0) {
       net_logger.trace("Send buffer full! Unable to send data");
-      //output_.append((const char*)data, len);
-      //pfd_->enable_write();
+    }
+    if (nwrite < len) {
+      // when_writable tells the caller once the rest fits
+      pfd_->enable_write();
     }
 
   } catch (std::system_error &e) {
@@ -90,6 +142,7 @@ size_t mtcp_connection::send(const void *data, size_t len) {
   }
   return nwrite;
 }
+#endif
 
 bool mtcp_connection::send_packet(const void *data, std::size_t len) {
   if (state_ != state::connected) {
@@ -105,15 +158,71 @@ bool mtcp_connection::send_packet(const void *data, std::size_t len) {
   if (bytes < len) {
     return false;
   }
+#ifndef AES_GCM
   pfd_->enable_read();
+#endif
   return true;
 }
 
+size_t mtcp_connection::write_some(const void *data, std::size_t len) {
+  if (state_ != state::connected) {
+    return 0;
+  }
+  size_t bytes = send(data, len);
+#ifndef AES_GCM
+  if (bytes > 0) {
+    pfd_->enable_read();
+  }
+#endif
+  return bytes;
+}
+
+bool mtcp_connection::send_payload(int id, std::size_t off, std::size_t len) {
+#ifndef AES_GCM
+  int ref = engine().stack_payload(id);
+  if (ref >= 0) {
+    if (state_ != state::connected) {
+      net_logger.error("trying to send packet via broken connection!");
+      return false;
+    }
+    if (len == 0) {
+      return true;
+    }
+    size_t nwrite = 0;
+    try {
+      nwrite = pfd_->get_mtcp_socket().write_payload(ref, off, len);
+      stat_.collect(OUT, nwrite);
+      net_logger.trace("Socket {} queued {} bytes of payload {}", pfd_->get_id(), nwrite, id);
+    } catch (std::system_error &e) {
+      net_logger.warn("Send data error: {} Socket id: {}", e.what(), pfd_->get_id());
+      state_ = state::disconnect;
+    }
+    if (nwrite < len) {
+      // the first nwrite bytes are in the stream, the caller resyncs it
+      net_logger.trace("Socket {} payload {} cut short, {} of {} bytes queued",
+                       pfd_->get_id(), id, nwrite, len);
+      return false;
+    }
+    pfd_->enable_read();
+    return true;
+  }
+#endif
+  // sealed records are built from a copy anyway
+  return send_packet(engine().payload(id).data() + off, len);
+}
+
 bool mtcp_connection::send_packet(const std::string &data) {
   return send_packet(data.data(), data.size());
 }
 
 bool mtcp_connection::send_packet(const buffer &buf) {
+#ifdef AES_GCM
+  // output_ already holds sealed records
+  if (&buf == &output_) {
+    flush();
+    return output_.empty();
+  }
+#endif
   return send_packet(buf.begin(), buf.size());
 }
 
@@ -126,8 +235,8 @@ void mtcp_connection::reconnect() {
 void mtcp_connection::handle_write(connptr con) {
   if (state_ == state::connecting) {
     handle_handshake(con);
-  } else {
-    send_packet(output_);
+  } else if (send_packet(output_)) {
+    writable(con);
   }
 }
 
@@ -138,6 +247,7 @@ bool mtcp_connection::handle_handshake(connptr con) {
   mtcp_socket sock = pfd_->get_mtcp_socket();
   auto err = sock.getsockopt<int>(SOL_SOCKET, SO_ERROR);
   if (err != 0) {
+    end_handshake(false);
     con->set_state(state::failed);
 	net_logger.error("Socket {} connect failed, errno: {}.\n",
 						sock.get(), errno);
@@ -146,6 +256,7 @@ bool mtcp_connection::handle_handshake(connptr con) {
     }
     return false;
   } else {
+    end_handshake(true);
     con->set_state(state::connected);
     if (on_connected_) {
       net_logger.trace("Socket {} connected!", fd_);
@@ -155,6 +266,15 @@ bool mtcp_connection::handle_handshake(connptr con) {
   }
 }
 
+unsigned mtcp_connection::syn_retries() {
+  tcp_info info;
+  socklen_t len = sizeof(info);
+  if (mtcp_getsockopt(engine().context(), fd_, IPPROTO_TCP, TCP_INFO, &info, &len) != 0) {
+    return 0;
+  }
+  return info.tcpi_total_retrans;
+}
+
 void mtcp_connection::handle_read(connptr con) {
   if (state_ == state::connecting && handle_handshake(con)) {
     return;
@@ -166,28 +286,20 @@ void mtcp_connection::handle_read(connptr con) {
   net_logger.trace("Socket {} in state {} handle read event",
       sock.get(), (int)get_state());
 
+#ifndef AES_GCM
+  if (on_data_) {
+    read_in_place(con);
+    return;
+  }
+#endif
+
   while (state_ == state::connected) {
     input_.make_room();
     try {
-			std::optional<int> ret; 
+      std::optional<int> ret;
 #ifdef AES_GCM
-			char data_read[1500];
-			auto data_len = sock.read(data_read, 1500);
-			if (data_len.has_value()) {
-					int len_tmp = data_len.value();
-					if (len_tmp == 0) {
-				    // connection closed by peer
-          	state_ = state::disconnect;
-          	cleanup(con);
-          	break;	
-					} else if (len_tmp < 21) {
-						net_logger.error("Socket {} in state {}, read data with unexpected length {}.",
-										sock.get(), (int)get_state(), len_tmp);
-					} 
-					ret = ssl_layer::ssl_decrypt(engine().ssl_context(), (const unsigned char*)(data_read + 5), (unsigned char*)input_.end(), len_tmp - 21);
-			} else {
-			 	ret = std::nullopt;
-			}
+      cipher_in_.make_room();
+      ret = sock.read(cipher_in_.end(), cipher_in_.space());
 #else
       ret = sock.read(input_.end(), input_.space());
 #endif
@@ -197,6 +309,7 @@ void mtcp_connection::handle_read(connptr con) {
 					//net_logger.error("Socket {} in state {}, can not read any data.",
 					//			sock.get(), (int)get_state());
           state_ = state::disconnect;
+          peer_closed_ = true;
           cleanup(con);
           break;
         } else {
@@ -204,8 +317,18 @@ void mtcp_connection::handle_read(connptr con) {
           auto nread = ret.value();
           net_logger.trace("socket {} read {} bytes", sock.get(), nread);
           stat_.collect(IN, nread);
+#ifdef AES_GCM
+          cipher_in_.add_size(nread);
+          if (!ssl_->open(cipher_in_, input_)) {
+            net_logger.error("Socket {} received a malformed or forged record", sock.get());
+            state_ = state::disconnect;
+            cleanup(con);
+            break;
+          }
+#else
           input_.add_size(nread);
-          if (on_recved_) on_recved_(con);
+#endif
+          deliver(con);
         }
       } else if (on_msg_ && input_.size()) {
         std::string msg = input_.string();
@@ -228,6 +351,51 @@ void mtcp_connection::handle_read(connptr con) {
 }
 
 
+#ifndef AES_GCM
+void mtcp_connection::read_in_place(connptr con) {
+  mtcp_socket sock = pfd_->get_mtcp_socket();
+  while (state_ == state::connected) {
+    try {
+      auto lent = sock.read_zc();
+      if (!lent.has_value()) {
+        pfd_->enable_read();
+        break;
+      }
+      auto [data, len] = lent.value();
+      if (len == 0) {
+        // connection closed by peer
+        state_ = state::disconnect;
+        peer_closed_ = true;
+        cleanup(con);
+        break;
+      }
+      pfd_->enable_read();
+      if (len == presented_) {
+        // nothing new behind what the handler left last time
+        sock.release(0);
+        break;
+      }
+      net_logger.trace("socket {} read {} bytes in place", sock.get(), len - presented_);
+      stat_.collect(IN, len - presented_);
+
+      recv_view view(data, len);
+      on_data_(con, view);
+      if (state_ != state::connected) {
+        // closed by the handler, the receive buffer is gone
+        break;
+      }
+      sock.release(view.consumed());
+      presented_ = len - view.consumed();
+    } catch (std::system_error& e) {
+      net_logger.trace("Read error on socket {}: {}", sock.get(), e.what());
+      state_ = state::disconnect;
+      cleanup(con);
+      break;
+    }
+  }
+}
+#endif
+
 void mtcp_connection::cleanup(connptr con) {
   net_logger.info("mTCP socket {} closed by peer", pfd_->get_id());
 
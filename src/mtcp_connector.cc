@@ -1,3 +1,4 @@
+#include "arena.h"
 #include "log.h"
 #include "mtcp_connection.h"
 #include "mtcp_connector.h"
@@ -7,14 +8,26 @@ namespace infgen {
 extern logger net_logger;
 
 connptr mtcp_connector::connect(socket_address sa, socket_address lo) {
+  int dest = dests_.find(sa);
   mtcp_socket sock = mtcp_socket::socket(sa.u.in.sin_family, SOCK_STREAM, 0);
   sock.set_nonblock();
   sockaddr_in local_sa;
   sock.getsockname(sock.get(), (sockaddr*)&local_sa);
   auto local = socket_address(local_sa);
-  auto con = std::make_shared<mtcp_connection>();
+  auto con = std::allocate_shared<mtcp_connection>(memory::allocator<mtcp_connection>());
   con->attach(sock.get(), local, sa);
-  sock.connect(sa.u.sa, sizeof(sa.u.sas));
+  con->start_handshake();
+  try {
+    sock.connect(sa.u.sa, sizeof(sa.u.sas));
+  } catch (std::system_error& e) {
+    if (dest >= 0) {
+      dests_[dest].errors++;
+    }
+    throw;
+  }
+  if (dest >= 0) {
+    dests_[dest].connects++;
+  }
 
   net_logger.trace("{} - {} connecting...", local, sa);
 
@@ -23,10 +36,10 @@ connptr mtcp_connector::connect(socket_address sa, socket_address lo) {
 
 void mtcp_connector::configure(boost::program_options::variables_map vm) {
   int ip_range = vm["ips"].as<int>();
-  std::string server_ip = vm["dest"].as<std::string>();
-  net_logger.trace("create address pool for ip {}", server_ip);
-  auto sa = make_ipv4_address(ipv4_addr(server_ip, 80));
-  generate_addrs(ip_range, sa);
+  for (auto& d : dests_) {
+    net_logger.trace("create address pool for {} (weight {})", ipv4_addr(d.addr), d.weight);
+    generate_addrs(ip_range, d.addr);
+  }
 }
 
 void mtcp_connector::generate_addrs(int range, socket_address addr) {
@@ -34,15 +47,30 @@ void mtcp_connector::generate_addrs(int range, socket_address addr) {
   in_addr_t daddr = addr.u.in.sin_addr.s_addr;
   in_addr_t saddr = INADDR_ANY;
 
-  mtcp_init_rss(engine().context(), saddr, range, daddr, dport);
+  // one RSS-aware source pool per destination, connect picks it by address
+  if (mtcp_add_rss(engine().context(), saddr, range, daddr, dport) < 0) {
+    net_logger.error("failed to create the address pool for {}: {}",
+                     ipv4_addr(addr), strerror(errno));
+  }
 }
 
 void mtcp_connector::reconnect(connptr old_conn) {
   socket_address sa = old_conn->get_peer();
 
+  int dest = dests_.find(sa);
   mtcp_socket sock = mtcp_socket::socket(sa.u.in.sin_family, SOCK_STREAM, 0);
   sock.set_nonblock();
-  sock.connect(sa.u.sa, sizeof(sa.u.sas));
+  try {
+    sock.connect(sa.u.sa, sizeof(sa.u.sas));
+  } catch (std::system_error& e) {
+    if (dest >= 0) {
+      dests_[dest].errors++;
+    }
+    throw;
+  }
+  if (dest >= 0) {
+    dests_[dest].reconnects++;
+  }
 
   sockaddr_in local_sa;
   sock.getsockname(sock.get(), (sockaddr*)&local_sa);
@@ -51,6 +79,7 @@ void mtcp_connector::reconnect(connptr old_conn) {
   net_logger.trace("{} - {} connecting...", local, sa);
 
   old_conn->attach(sock.get(), local, sa);
+  old_conn->start_handshake();
 }
 
 } // namespace infgen
@@ -12,6 +12,7 @@ void poll_state::replace(int id) {
   pollid = id;
   events_requested = 0;
   events_epoll = 0;
+  events_ready = 0;
 }
 
 pollable_fd::~pollable_fd() {
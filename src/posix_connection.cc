@@ -3,6 +3,8 @@
 #include "posix_connection.h"
 #include "reactor.h"
 
+#include <netinet/tcp.h>
+
 namespace infgen {
 
 extern logger net_logger;
@@ -22,6 +24,7 @@ posix_connection::~posix_connection() {
 
 void posix_connection::attach(int fd, socket_address local, socket_address peer) {
   state_ = state::connecting;
+  peer_closed_ = false;
   fd_ = fd;
   local_ = local;
   peer_ = peer;
@@ -36,6 +39,8 @@ void posix_connection::attach(int fd, socket_address local, socket_address peer)
   auto con = shared_from_this();
   pfd_->when_writable([=] { con->handle_write(con); });
   pfd_->when_readable([=] { con->handle_read(con); });
+  // reads and writes go on until EAGAIN
+  pfd_->set_edge_triggered(true);
   pfd_->attach_to_loop();
 }
 
@@ -49,6 +54,8 @@ void posix_connection::close() {
     net_logger.info("multiple close op detected! please check your code");
     return;
   }
+  abandon_handshake();
+  abandon_reconnect();
   state_ = state::closed;
   pfd_->detach_from_loop();
   pfd_->close_fd();
@@ -62,7 +69,29 @@ void posix_connection::handle_write(connptr con) {
   if (state_ == state::connecting) {
     handle_handshake(con);
   } else if (state_ == state::connected){
-    send_packet(output_);
+    flush(con);
+    if (state_ == state::connected && output_.empty()) {
+      writable(con);
+    }
+  }
+}
+
+void posix_connection::flush(connptr con) {
+  file_desc fd = pfd_->get_file_desc();
+  try {
+    while (!output_.empty()) {
+      auto nwrite = fd.write(output_.begin(), output_.size());
+      if (nwrite == 0) {
+        pfd_->enable_write();
+        return;
+      }
+      stat_.collect(OUT, nwrite);
+      output_.consume(nwrite);
+    }
+  } catch (std::system_error &e) {
+    net_logger.trace("send data error: {}", e.what());
+    state_ = state::disconnect;
+    cleanup(con);
   }
 }
 
@@ -72,12 +101,14 @@ bool posix_connection::handle_handshake(connptr con) {
   }
   auto err = pfd_->get_file_desc().getsockopt<int>(SOL_SOCKET, SO_ERROR);
   if (err != 0) {
+    end_handshake(false);
     con->set_state(state::failed);
     if (on_failed_) {
       on_failed_(con);
     }
     return false;
   } else {
+    end_handshake(true);
     con->set_state(state::connected);
     if (on_connected_) {
       net_logger.trace("fd {} connected!", fd_);
@@ -87,8 +118,23 @@ bool posix_connection::handle_handshake(connptr con) {
   }
 }
 
+unsigned posix_connection::syn_retries() {
+  // nothing but SYNs has been sent yet
+  tcp_info info;
+  socklen_t len = sizeof(info);
+  if (::getsockopt(fd_, IPPROTO_TCP, TCP_INFO, &info, &len) != 0) {
+    return 0;
+  }
+  return info.tcpi_total_retrans;
+}
+
 void posix_connection::handle_read(connptr con) {
-  if (state_ == state::connecting && handle_handshake(con)) {
+  // data that came with the handshake is read right away, an edge is
+  // not reported twice
+  if (state_ == state::connecting && !handle_handshake(con)) {
+    return;
+  }
+  if (state_ != state::connected) {
     return;
   }
   file_desc fd = pfd_->get_file_desc();
@@ -99,6 +145,7 @@ void posix_connection::handle_read(connptr con) {
       if (ret.has_value()) {
         if (ret.value() == 0) {
           state_ = state::disconnect;
+          peer_closed_ = true;
           cleanup(con);
           break;
         // received data
@@ -110,7 +157,7 @@ void posix_connection::handle_read(connptr con) {
           stat_.collect(IN, nread);
           input_.add_size(nread);
 
-          if (on_recved_) on_recved_(con);
+          deliver(con);
         }
       // EAGAIN triggered
       } else if (on_msg_ && input_.size()){
@@ -134,6 +181,11 @@ size_t posix_connection::send(const void *data, size_t len) {
   if (len == 0) {
     return 0;
   }
+  if (!output_.empty()) {
+    // queued behind what waits for EPOLLOUT
+    output_.append((const char*)data, len);
+    return len;
+  }
   size_t nwrite = 0;
   file_desc fd = pfd_->get_file_desc();
   try {
@@ -141,12 +193,10 @@ size_t posix_connection::send(const void *data, size_t len) {
     if (nwrite > 0) {
       stat_.collect(OUT, nwrite);
       net_logger.trace("fd {} send {} bytes", fd.get(), nwrite);
-      if (nwrite < len) {
-        net_logger.trace("Failed to send all data");
-      }
-    } else if (nwrite == 0) {
-      net_logger.trace("send buffer full");
-      output_.append((const char*)data, len);
+    }
+    if (nwrite < len) {
+      net_logger.trace("send buffer full, {} bytes wait for EPOLLOUT", len - nwrite);
+      output_.append((const char*)data + nwrite, len - nwrite);
       pfd_->enable_write();
     }
   } catch (std::system_error &e) {
@@ -154,8 +204,9 @@ size_t posix_connection::send(const void *data, size_t len) {
     state_ = state::disconnect;
     auto con = shared_from_this();
     cleanup(con);
+    return 0;
   }
-  return nwrite;
+  return len;
 }
 
 bool posix_connection::send_packet(const void *data, std::size_t len) {
@@ -180,6 +231,15 @@ bool posix_connection::send_packet(const buffer &buf) {
   return send_packet(buf.begin(), buf.size());
 }
 
+bool posix_connection::send_payload(int id, std::size_t off, std::size_t len) {
+  return send_packet(engine().payload(id).data() + off, len);
+}
+
+size_t posix_connection::write_some(const void *data, std::size_t len) {
+  // the unwritten rest waits in output_, so all of len is taken
+  return state_ == state::connected ? send(data, len) : 0;
+}
+
 void posix_connection::reconnect() {
   net_logger.trace("conn {} reconnecting", get_id());
   auto conn = shared_from_this();
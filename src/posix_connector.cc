@@ -1,3 +1,4 @@
+#include "arena.h"
 #include "log.h"
 #include "posix_connection.h"
 #include "posix_connector.h"
@@ -57,8 +58,9 @@ connptr posix_connector::connect(socket_address sa, socket_address lo) {
     engine().stop();
   }
 
-  auto con = std::make_shared<posix_connection>();
+  auto con = std::allocate_shared<posix_connection>(memory::allocator<posix_connection>());
   con->attach(fd.get(), local, sa);
+  con->start_handshake();
   return con;
 }
 
@@ -85,6 +87,7 @@ bind:
   net_logger.trace("connecting {} from {}", peer, local);
   fd.connect(peer.u.sa, sizeof(peer.u.sas));
   old_conn->attach(fd.get(), local, peer);
+  old_conn->start_handshake();
 }
 
 
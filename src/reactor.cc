@@ -1,3 +1,4 @@
+#include "arena.h"
 #include "epoll.h"
 #include "posix_connector.h"
 #include "mtcp_connector.h"
@@ -8,6 +9,8 @@
 #include "io_sched.h"
 #include "task.h"
 #include "resource.h"
+#include "uring_connector.h"
+#include <algorithm>
 #include <array>
 #include <chrono>
 #include <signal.h>
@@ -78,10 +81,43 @@ connptr reactor::connect(socket_address sa, socket_address local) {
   return conn;
 }
 
+connptr reactor::connect() {
+  auto& dests = connector_->destinations();
+  return connect(dests[dests.pick()].addr);
+}
+
 void reactor::reconnect(connptr conn) {
   connector_->reconnect(conn);
 }
 
+void tcp_connection::start_handshake() {
+  abandon_handshake();
+  handshaking_ = true;
+  connect_tp_ = steady_clock::now();
+  engine().connects().handshake_started();
+}
+
+void tcp_connection::end_handshake(bool ok) {
+  if (!handshaking_) {
+    return;
+  }
+  handshaking_ = false;
+  auto latency = duration_cast<microseconds>(steady_clock::now() - connect_tp_);
+  engine().connects().handshake_done(latency, ok, syn_retries());
+  if (ok && reconnect_attempts_) {
+    engine().reconnects().recovered(*this);
+  }
+}
+
+void tcp_connection::forget_handshake() {
+  handshaking_ = false;
+  engine().connects().handshake_abandoned();
+}
+
+void tcp_connection::forget_reconnect() {
+  engine().reconnects().dropped(*this);
+}
+
 class reactor::poller::registration_task : public task {
 private:
   poller *p_;
@@ -110,6 +146,19 @@ void reactor::register_queue(io_queue *q) {
   watchdog->add_queue(q);
 }
 
+int reactor::register_payload(const void *data, size_t len) {
+  int stack_id = -1;
+  if (mctx_) {
+    stack_id = mtcp_register_payload(mctx_, data, len);
+    if (stack_id < 0) {
+      net_logger.warn("mTCP cannot reference payload {}, it will be copied: {}",
+                      payloads_.size(), strerror(errno));
+    }
+  }
+  payloads_.push_back({std::string_view(static_cast<const char *>(data), len), stack_id});
+  return payloads_.size() - 1;
+}
+
 reactor::poller::poller(poller &&x)
     : pollfn_(std::move(x.pollfn_)), registration_task_(x.registration_task_) {
   if (pollfn_ && registration_task_) {
@@ -174,6 +223,22 @@ public:
   virtual bool poll() final override { return r_.poll_io(); }
 };
 
+class reactor::connect_pollfn final : public reactor::pollfn {
+  reactor &r_;
+
+public:
+  connect_pollfn(reactor &r) : r_(r) {}
+  virtual bool poll() final override { return r_.connects_.poll(); }
+};
+
+class reactor::reconnect_pollfn final : public reactor::pollfn {
+  reactor &r_;
+
+public:
+  reconnect_pollfn(reactor &r) : r_(r) {}
+  virtual bool poll() final override { return r_.reconnects_.poll(); }
+};
+
 class reactor::signal_pollfn final : public reactor::pollfn {
   reactor &r_;
 
@@ -211,6 +276,21 @@ void reactor::run() {
   }
 
   poller signal_poller = poller(std::make_unique<signal_pollfn>(*this));
+  poller connect_poller = poller(std::make_unique<connect_pollfn>(*this));
+  poller reconnect_poller = poller(std::make_unique<reconnect_pollfn>(*this));
+
+  // setup rate and latency of the last second, while connections come up
+  add_periodic_task_after<infinite>(1s, [this] {
+    auto s = connects_.take_interval();
+    if (s.attempts == 0 && s.established == 0 && s.failed == 0) {
+      return;
+    }
+    net_logger.info("engine {} connects: {}/s, {} established, {} failed, {} SYN retries, "
+                    "{} half-open, {} queued, setup p50 {} p99 {} max {} us",
+                    id_, s.attempts, s.established, s.failed, s.syn_retries,
+                    connects_.half_open(), connects_.queued(), s.setup.percentile(50),
+                    s.setup.percentile(99), s.setup.max());
+  });
 
   if (id_ == 0)  {
     signals_.handle_signal_once(SIGINT, [this] {
@@ -274,6 +354,54 @@ void reactor::run() {
     mtcp_destroy_context(mctx_);
   }
 
+  if (connector_ && connector_->destinations().size() > 1) {
+    for (auto& d : connector_->destinations()) {
+      net_logger.info("engine {} destination {} (weight {}): {} connects, "
+                      "{} reconnects, {} errors",
+                      id_, ipv4_addr(d.addr), d.weight, d.connects, d.reconnects, d.errors);
+    }
+  }
+
+  auto& cs = connects_.total();
+  if (cs.attempts) {
+    net_logger.info("engine {} handshakes: {} started, {} established, {} failed, "
+                    "{} SYN retries, setup p50 {} p90 {} p99 {} max {} us",
+                    id_, cs.attempts, cs.established, cs.failed, cs.syn_retries,
+                    cs.setup.percentile(50), cs.setup.percentile(90),
+                    cs.setup.percentile(99), cs.setup.max());
+  }
+
+  auto& rs = reconnects_.get_stats();
+  if (rs.scheduled || rs.reopened) {
+    net_logger.info("engine {} reconnects: {} scheduled, {} reopened, {} started "
+                    "({} rate-limited), {} recovered, {} dropped, {} still down; {} outages, "
+                    "up to {} connections down, recovered in p50 {} p99 {} max {} ms",
+                    id_, rs.scheduled, rs.reopened, rs.issued, rs.throttled, rs.recovered, rs.dropped,
+                    reconnects_.down(), rs.storms, rs.largest_storm,
+                    rs.recovery.percentile(50), rs.recovery.percentile(99), rs.recovery.max());
+  }
+
+  if (auto ep = dynamic_cast<epoll_backend*>(backend_.get())) {
+    auto& es = ep->get_stats();
+    net_logger.info("engine {} epoll: {} events in {} waits, {} epoll_ctl, batch of {}",
+                    id_, es.events, es.waits, es.ctls, ep->batch());
+  } else if (auto ring = dynamic_cast<uring_backend*>(backend_.get())) {
+    auto& us = ring->get_stats();
+    net_logger.info("engine {} io_uring: {} requests in {} enters, {} completions, "
+                    "{} recvs out of buffers",
+                    id_, us.requests, us.enters, us.completions, us.no_buffers);
+  }
+
+  auto ms = memory::stats();
+  if (ms.configured) {
+    net_logger.info("engine {} arena: node {}, {}/{} MB used, {} allocs, {} frees "
+                    "({} remote), {} malloc fallbacks, {} off-node pages, "
+                    "{} dTLB misses, {} remote-node loads",
+                    id_, ms.node, ms.used >> 20, ms.reserved >> 20, ms.allocs,
+                    ms.frees, ms.remote_frees, ms.fallback_allocs, ms.remote_pages,
+                    ms.dtlb_misses, ms.remote_accesses);
+  }
+
   if (id_ == 0) {
     net_logger.info("\033[32mengine {} stopped, waiting for workers\033[0m\n", id_);
     smp::join_all();
@@ -302,44 +430,105 @@ void reactor::configure(boost::program_options::variables_map configuration) {
 	ssl_layer::ssl_init(sctx_);
 #endif
 
-  if (network_stack_ == "kernel") {
-    pin_this_thread(id_);
+  memory::arena_config arena_cfg;
+  arena_cfg.size = configuration["arena-size"].as<size_t>() << 20;
+  arena_cfg.pages = memory::parse_page_size(configuration["hugepages"].as<std::string>());
+
+  // --servers takes precedence over the single --dest
+  destination_pool dests;
+  if (configuration.count("servers")) {
+    try {
+      dests = destination_pool::parse(configuration["servers"].as<std::string>(), 80);
+    } catch (std::invalid_argument& e) {
+      net_logger.error("config error: {}", e.what());
+      exit(-1);
+    }
+  } else {
+    dests.add(make_ipv4_address(ipv4_addr(configuration["dest"].as<std::string>(), 80)), 1);
+  }
+  dests.seed(id_ + 1);
+
+  // rates and limits are given for the whole process, every loading
+  // reactor takes its share
+  connect_scheduler::config pacing;
+  unsigned loaders = smp::count > 1 ? smp::count - 1 : 1;
+  pacing.rate = configuration["connect-rate"].as<double>() / loaders;
+  pacing.start_rate = configuration["connect-start-rate"].as<double>() / loaders;
+  pacing.ramp_time = duration_cast<microseconds>(
+      duration<double>(configuration["connect-ramp-time"].as<double>()));
+  if (!connect_scheduler::parse(configuration["connect-ramp"].as<std::string>(), pacing.shape)) {
+    net_logger.error("config error: unknown connect ramp {}",
+                     configuration["connect-ramp"].as<std::string>());
+    exit(-1);
+  }
+  pacing.burst = configuration["connect-burst"].as<unsigned>();
+  auto half_open = configuration["max-half-open"].as<unsigned>();
+  pacing.max_half_open = half_open ? std::max(half_open / loaders, 1u) : 0;
+  connects_.configure(pacing);
+
+  reconnect_manager::config retry;
+  retry.base = milliseconds(configuration["reconnect-base"].as<unsigned>());
+  retry.max = milliseconds(configuration["reconnect-max"].as<unsigned>());
+  retry.jitter = configuration["reconnect-jitter"].as<double>();
+  retry.rate = configuration["reconnect-rate"].as<double>() / loaders;
+  reconnects_.configure(retry);
+
+  auto& layout = smp::layout();
+  if (network_stack_ == "kernel" || network_stack_ == "uring") {
+    pin_this_thread(layout.app[id_]);
+    memory::configure(layout.app[id_], arena_cfg);
     if (!configuration.count("device")) {
       net_logger.error("config error: a network device must be assigned"
                        "when using kernel stack!\n");
       exit(-1);
     }
     mctx_ = nullptr;
-    connector_ = std::make_unique<posix_connector>();
-    backend_ = std::make_unique<epoll_backend>();
+    if (network_stack_ == "uring") {
+      uring_backend::config ring_cfg;
+      ring_cfg.entries = configuration["uring-entries"].as<unsigned>();
+      ring_cfg.buffers = configuration["uring-buffers"].as<unsigned>();
+      ring_cfg.buffer_size = configuration["uring-buffer-size"].as<unsigned>();
+      auto ring = std::make_unique<uring_backend>(ring_cfg);
+      connector_ = std::make_unique<uring_connector>(*ring);
+      backend_ = std::move(ring);
+    } else {
+      epoll_backend::config epoll_cfg;
+      epoll_cfg.edge_triggered = configuration["epoll-edge-triggered"].as<bool>();
+      epoll_cfg.max_events = configuration["epoll-max-events"].as<unsigned>();
+      connector_ = std::make_unique<posix_connector>();
+      backend_ = std::make_unique<epoll_backend>(epoll_cfg);
+    }
+    connector_->set_destinations(dests);
     connector_->configure(configuration);
   } else if (network_stack_ == "mtcp") {
     if (smp::count > 1 && id_ == 0) {
     // distributor thread in multi-threaded environment
-      pin_this_thread( 2 * (smp::count-1));
+      pin_this_thread(layout.app[0]);
+      memory::configure(layout.app[0], arena_cfg);
       mctx_ = nullptr;
       connector_ = std::make_unique<posix_connector>();
       backend_ = std::make_unique<epoll_backend>();
+      connector_->set_destinations(dests);
       connector_->configure(configuration);
     } else {
-      unsigned core = (id_ == 0 ? 0 : id_ - 1);
+      // the NIC queue this reactor's stack thread serves
+      unsigned queue = (id_ == 0 ? 0 : id_ - 1);
       stack_ = std::make_unique<mtcp_stack>();
-      stack_->create_stack_thread(core);
-      //stack_->create_stack_thread(core * 2);
+      stack_->create_stack_thread(queue);
       mctx_ = stack_->context();
-      net_logger.info("Stack thread {} started on core {}", id_, core);
+      net_logger.info("Stack thread {} started on core {}", id_, layout.stack[queue]);
 
       if (mode_ != "normal") {
         io_queue_ = std::make_unique<io_queue>();
       } else {
         io_queue_ = nullptr;
       }
-      // pin app thread to the same physical core
-      //pin_this_thread(core + resource::nr_processing_units() / 2);
-      pin_this_thread(core + smp::count-1);
-      //pin_this_thread(core * 2 + 1);
+      // the app thread runs on the SMT sibling of the stack thread
+      pin_this_thread(layout.app[id_]);
+      memory::configure(layout.app[id_], arena_cfg);
       connector_ = std::make_unique<mtcp_connector>();
       backend_ = std::make_unique<mtcp_epoll_backend>();
+      connector_->set_destinations(dests);
       connector_->configure(configuration);
     }
 
@@ -362,12 +551,50 @@ reactor::get_options_description() {
   bpo::options_description opts("Net options");
   opts.add_options()
     ("network-stack", bpo::value<std::string>()->default_value("kernel"),
-                      "select network stack (default: kernel stack")
+                      "select network stack: kernel, uring (kernel stack driven "
+                      "by io_uring) or mtcp (default: kernel stack")
     ("device", bpo::value<std::string>(),
      "select which network device to use (only avaiable when using kernel stack)")
     ("ips", bpo::value<int>()->default_value(200), "number of ips when using mtcp stack")
     ("no-delay", bpo::value<bool>()->default_value(false), "forbid tcp naggle")
-    ("dest", bpo::value<std::string>()->default_value("192.168.1.1"), "destination ip");
+    ("dest", bpo::value<std::string>()->default_value("192.168.1.1"), "destination ip")
+    ("servers", bpo::value<std::string>(),
+     "weighted destinations ip[:port[:weight]],... (port 80 and weight 1 by default), "
+     "used by connect() without an address instead of --dest")
+    ("connect-rate", bpo::value<double>()->default_value(0),
+     "connection attempts per second over all engines (0: as fast as the app asks)")
+    ("connect-ramp", bpo::value<std::string>()->default_value("constant"),
+     "how the connect rate is reached: constant, linear or exponential")
+    ("connect-start-rate", bpo::value<double>()->default_value(0),
+     "connect rate at the start of the ramp")
+    ("connect-ramp-time", bpo::value<double>()->default_value(0),
+     "seconds until the connect rate is reached")
+    ("connect-burst", bpo::value<unsigned>()->default_value(32),
+     "connection attempts an engine may start at once when paced")
+    ("max-half-open", bpo::value<unsigned>()->default_value(0),
+     "handshakes in flight over all engines (0: no limit)")
+    ("reconnect-base", bpo::value<unsigned>()->default_value(1000),
+     "delay before the first retry of a lost connection in ms, doubled per retry")
+    ("reconnect-max", bpo::value<unsigned>()->default_value(30000),
+     "longest delay between retries in ms")
+    ("reconnect-jitter", bpo::value<double>()->default_value(0.5),
+     "share of the retry delay that is random (0-1)")
+    ("reconnect-rate", bpo::value<double>()->default_value(0),
+     "retries per second over all engines (0: no limit)")
+    ("arena-size", bpo::value<size_t>()->default_value(256),
+     "per-core memory arena for connections and buffers in MB (0: use malloc)")
+    ("hugepages", bpo::value<std::string>()->default_value("2M"),
+     "pages backing the arenas: 2M, 1G or none")
+    ("epoll-edge-triggered", bpo::value<bool>()->default_value(false),
+     "register connections once with EPOLLET and drain them on every edge (kernel stack)")
+    ("epoll-max-events", bpo::value<unsigned>()->default_value(4096),
+     "largest batch the event array grows to (kernel stack)")
+    ("uring-entries", bpo::value<unsigned>()->default_value(4096),
+     "io_uring submission queue depth per engine (uring stack)")
+    ("uring-buffers", bpo::value<unsigned>()->default_value(4096),
+     "receive buffers shared by the connections of an engine (uring stack)")
+    ("uring-buffer-size", bpo::value<unsigned>()->default_value(4096),
+     "size of a receive buffer in bytes (uring stack)");
   return opts;
 }
 
@@ -0,0 +1,153 @@
+#include "reconnect_manager.h"
+#include "connection.h"
+#include "log.h"
+
+#include <algorithm>
+
+namespace infgen {
+
+extern logger net_logger;
+
+constexpr milliseconds reconnect_manager::tick;
+
+milliseconds reconnect_manager::backoff(unsigned attempt) {
+  auto cap = std::max(cfg_.max, cfg_.base);
+  auto d = cfg_.base;
+  for (unsigned i = 1; i < attempt && d < cap; i++) {
+    d *= 2;
+  }
+  d = std::min(d, cap);
+
+  rng_ ^= rng_ >> 12;
+  rng_ ^= rng_ << 25;
+  rng_ ^= rng_ >> 27;
+  double r = double((rng_ * 0x2545f4914f6cdd1dULL) >> 11) / double(1ULL << 53);
+  double jitter = std::clamp(cfg_.jitter, 0.0, 1.0);
+  return milliseconds(int64_t(d.count() * (1 - jitter + jitter * r)));
+}
+
+bool reconnect_manager::schedule(const connptr& conn) {
+  if (conn->get_state() == tcp_connection::state::closed) {
+    return false;
+  }
+  auto now = steady_clock::now();
+  if (waiting_ == 0) {
+    // the wheel stood still, it turns from now on
+    tick_tp_ = now;
+  }
+  if (conn->reconnect_attempts_++ == 0) {
+    if (down_++ == 0) {
+      storm_tp_ = now;
+      storm_peak_ = 0;
+      stats_.storms++;
+    }
+    storm_peak_ = std::max(storm_peak_, down_);
+    stats_.largest_storm = std::max(stats_.largest_storm, down_);
+  }
+  stats_.scheduled++;
+
+  uint64_t ticks = std::max<int64_t>(backoff(conn->reconnect_attempts_) / tick, 1);
+  wheel_[(cursor_ + ticks) % nr_slots].push_back(entry{conn, uint32_t((ticks - 1) / nr_slots)});
+  waiting_++;
+  return true;
+}
+
+bool reconnect_manager::disconnected(const connptr& conn) {
+  auto now = steady_clock::now();
+  // one immediate attempt per close; a peer that closes again within base,
+  // or refuses the attempt, is retried after the backoff like an error
+  if (!conn->closed_by_peer() || conn->reconnect_attempts_ ||
+      now - conn->reopen_tp_ < cfg_.base) {
+    return schedule(conn);
+  }
+  if (conn->get_state() == tcp_connection::state::closed) {
+    return false;
+  }
+  conn->reopen_tp_ = now;
+  stats_.reopened++;
+  // through due_, so a herd of closes, e.g. a server restart, stays under
+  // the rate cap
+  due_.push_back(conn);
+  return true;
+}
+
+bool reconnect_manager::poll() {
+  if (waiting_ == 0 && due_.empty()) {
+    return false;
+  }
+  auto now = steady_clock::now();
+  size_t fresh = 0;
+  while (waiting_ && tick_tp_ + tick <= now) {
+    tick_tp_ += tick;
+    cursor_ = (cursor_ + 1) % nr_slots;
+    auto& slot = wheel_[cursor_];
+    size_t kept = 0;
+    for (auto& e : slot) {
+      if (e.rounds) {
+        e.rounds--;
+        slot[kept++] = std::move(e);
+      } else {
+        due_.push_back(std::move(e.conn));
+        waiting_--;
+        fresh++;
+      }
+    }
+    slot.resize(kept);
+  }
+
+  uint64_t budget = UINT64_MAX;
+  if (cfg_.rate > 0) {
+    tokens_ = std::min(tokens_ + cfg_.rate * duration<double>(now - last_).count(),
+                       std::max(cfg_.rate / 100, 1.0));
+    budget = uint64_t(tokens_);
+  }
+  last_ = now;
+
+  uint64_t issued = 0;
+  while (!due_.empty() && issued < budget) {
+    auto conn = std::move(due_.front());
+    due_.pop_front();
+    // retired while waiting
+    if (conn->get_state() == tcp_connection::state::closed) {
+      dropped(*conn);
+      continue;
+    }
+    conn->reconnect();
+    issued++;
+  }
+  if (cfg_.rate > 0) {
+    tokens_ -= issued;
+    stats_.throttled += std::min(fresh, due_.size());
+  }
+  stats_.issued += issued;
+  return issued > 0;
+}
+
+void reconnect_manager::recovered(tcp_connection& c) {
+  if (c.reconnect_attempts_) {
+    stats_.recovered++;
+    leave(c);
+  }
+}
+
+void reconnect_manager::dropped(tcp_connection& c) {
+  if (c.reconnect_attempts_) {
+    stats_.dropped++;
+    leave(c);
+  }
+}
+
+void reconnect_manager::leave(tcp_connection& c) {
+  auto attempts = c.reconnect_attempts_;
+  c.reconnect_attempts_ = 0;
+  if (down_ && --down_ == 0) {
+    auto ms = duration_cast<milliseconds>(steady_clock::now() - storm_tp_);
+    stats_.recovery.record(ms.count());
+    if (storm_peak_ > 1) {
+      net_logger.info("{} lost connections back after {} ms, the last one after {} retries",
+                      storm_peak_, ms.count(), attempts);
+    }
+  }
+}
+
+} // namespace infgen
@@ -1,20 +1,305 @@
 #include "resource.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <map>
+#include <stdexcept>
+
+#include <dirent.h>
 #include <unistd.h>
 
+#include <fmt/format.h>
+
 namespace infgen {
 
 namespace resource {
 
+namespace {
+
+bool read_line(const std::string& path, std::string& out) {
+  std::ifstream ifs(path);
+  return ifs && std::getline(ifs, out);
+}
+
+unsigned read_uint(const std::string& path, unsigned dflt) {
+  std::string s;
+  if (!read_line(path, s) || s.empty()) {
+    return dflt;
+  }
+  return std::strtoul(s.c_str(), nullptr, 10);
+}
+
+std::string format_cpus(const std::vector<unsigned>& ids) {
+  std::vector<unsigned> v(ids);
+  std::sort(v.begin(), v.end());
+  std::string s;
+  for (size_t i = 0; i < v.size();) {
+    size_t j = i;
+    while (j + 1 < v.size() && v[j + 1] == v[j] + 1) {
+      j++;
+    }
+    s += (s.empty() ? "" : ",") +
+         (j == i ? fmt::format("{}", v[i]) : fmt::format("{}-{}", v[i], v[j]));
+    i = j + 1;
+  }
+  return s;
+}
+
+} // namespace
+
+cpuset parse_cpuset(const std::string& s) {
+  cpuset set;
+  size_t pos = 0;
+  while (pos < s.size()) {
+    auto end = s.find(',', pos);
+    if (end == std::string::npos) {
+      end = s.size();
+    }
+    auto item = s.substr(pos, end - pos);
+    pos = end + 1;
+    if (item.empty()) {
+      continue;
+    }
+    auto dash = item.find('-');
+    char* stop;
+    unsigned first = std::strtoul(item.c_str(), &stop, 10);
+    unsigned last = first;
+    if (dash != std::string::npos) {
+      last = std::strtoul(item.c_str() + dash + 1, &stop, 10);
+    }
+    if (*stop != '\0' || last < first) {
+      throw std::invalid_argument("bad cpu list: " + s);
+    }
+    for (unsigned c = first; c <= last; c++) {
+      set.insert(c);
+    }
+  }
+  return set;
+}
+
+int node_of_cpu(unsigned cpu_id) {
+  auto path = fmt::format("/sys/devices/system/cpu/cpu{}", cpu_id);
+  DIR* dir = ::opendir(path.c_str());
+  if (!dir) {
+    return -1;
+  }
+  int node = -1;
+  while (auto* e = ::readdir(dir)) {
+    if (std::strncmp(e->d_name, "node", 4) == 0) {
+      node = std::atoi(e->d_name + 4);
+      break;
+    }
+  }
+  ::closedir(dir);
+  return node;
+}
+
+int node_of_device(const std::string& dev) {
+  std::string s;
+  if (!read_line(fmt::format("/sys/class/net/{}/device/numa_node", dev), s)) {
+    return -1;
+  }
+  return std::atoi(s.c_str());
+}
+
+resources read_topology() {
+  resources ret;
+  std::string online;
+  cpuset ids;
+  if (read_line("/sys/devices/system/cpu/online", online)) {
+    ids = parse_cpuset(online);
+  } else {
+    for (unsigned i = 0; i < nr_processing_units(); i++) {
+      ids.insert(i);
+    }
+  }
+  for (auto id : ids) {
+    auto dir = fmt::format("/sys/devices/system/cpu/cpu{}/topology/", id);
+    cpu c{id};
+    c.package = read_uint(dir + "physical_package_id", 0);
+    // without topology information every cpu is its own core
+    c.core = read_uint(dir + "core_id", id);
+    c.node = node_of_cpu(id);
+    ret.cpus.push_back(c);
+  }
+  return ret;
+}
+
 resources allocate(configuration c) {
+  auto topo = read_topology();
   resources ret;
-  auto cpuset_procs = c.cpu_set ? c.cpu_set->size() : nr_processing_units();
-  auto procs = c.cpus.value_or(cpuset_procs);
-  ret.cpus.reserve(procs);
-  for (unsigned i = 0; i < procs; i++) {
-    ret.cpus.push_back(cpu{i});
+  for (auto& cpu : topo.cpus) {
+    if (!c.cpu_set || c.cpu_set->count(cpu.cpu_id)) {
+      ret.cpus.push_back(cpu);
+    }
+  }
+  if (c.cpus && *c.cpus < ret.cpus.size()) {
+    ret.cpus.resize(*c.cpus);
   }
   return ret;
 }
+
 unsigned nr_processing_units() { return ::sysconf(_SC_NPROCESSORS_ONLN); }
+
+layout place(const resources& topo, const placement_request& req) {
+  layout l;
+  l.nic_node = req.nic_node;
+
+  // physical cores of the allowed cpus, the NIC's node first
+  std::map<std::pair<unsigned, unsigned>, std::vector<const cpu*>> by_core;
+  for (auto& c : topo.cpus) {
+    if (!req.conf.cpu_set || req.conf.cpu_set->count(c.cpu_id)) {
+      by_core[{c.package, c.core}].push_back(&c);
+    }
+  }
+  if (by_core.empty()) {
+    throw std::runtime_error("no usable cpu in the cpuset");
+  }
+  std::vector<std::vector<const cpu*>> cores;
+  for (auto& kv : by_core) {
+    cores.push_back(kv.second);
+  }
+  auto local = [&](const std::vector<const cpu*>& core) {
+    return req.nic_node < 0 || core[0]->node == req.nic_node;
+  };
+  std::stable_sort(cores.begin(), cores.end(), [&](auto& a, auto& b) {
+    if (local(a) != local(b)) {
+      return local(a);
+    }
+    if (a[0]->node != b[0]->node) {
+      return a[0]->node < b[0]->node;
+    }
+    return a[0]->cpu_id < b[0]->cpu_id;
+  });
+
+  std::map<unsigned, bool> used;
+  size_t shared_next = 0;
+  auto take_core = [&]() -> const std::vector<const cpu*>* {
+    for (auto& core : cores) {
+      if (std::none_of(core.begin(), core.end(), [&](auto c) { return used[c->cpu_id]; })) {
+        for (auto c : core) {
+          used[c->cpu_id] = true;
+        }
+        return &core;
+      }
+    }
+    return nullptr;
+  };
+  auto take_free = [&]() -> std::optional<unsigned> {
+    // stay on the NIC's node, there an idle physical core before the
+    // sibling of a busy one
+    for (int pass = 0; pass < 4; pass++) {
+      for (auto& core : cores) {
+        bool idle = std::none_of(core.begin(), core.end(), [&](auto c) { return used[c->cpu_id]; });
+        if ((pass < 2 && !local(core)) || (pass % 2 == 0 && !idle)) {
+          continue;
+        }
+        for (auto c : core) {
+          if (!used[c->cpu_id]) {
+            used[c->cpu_id] = true;
+            return c->cpu_id;
+          }
+        }
+      }
+    }
+    return std::nullopt;
+  };
+  auto take_cpu = [&]() -> unsigned {
+    if (auto c = take_free()) {
+      return *c;
+    }
+    l.shared = true;
+    auto& core = cores[shared_next++ % cores.size()];
+    return core[0]->cpu_id;
+  };
+
+  // a stack thread and its app thread share a physical core
+  unsigned nr_stacks = req.mtcp ? (req.reactors > 1 ? req.reactors - 1 : 1) : 0;
+  std::vector<std::pair<unsigned, unsigned>> pairs;
+  for (unsigned i = 0; i < nr_stacks; i++) {
+    unsigned stack, app;
+    if (auto core = take_core()) {
+      stack = (*core)[0]->cpu_id;
+      if (core->size() > 1) {
+        app = (*core)[1]->cpu_id;
+        // siblings beyond the second stay free for others
+        for (size_t k = 2; k < core->size(); k++) {
+          used[(*core)[k]->cpu_id] = false;
+        }
+      } else {
+        app = take_cpu();
+      }
+    } else if (auto c = take_free()) {
+      stack = *c;
+      app = take_cpu();
+    } else {
+      throw std::runtime_error(fmt::format("{} stack threads need as many cpus", nr_stacks));
+    }
+    pairs.push_back({stack, app});
+  }
+  // mTCP runs stack thread i on the i-th lowest core of its mask
+  std::sort(pairs.begin(), pairs.end());
+  for (auto& p : pairs) {
+    l.stack.push_back(p.first);
+  }
+
+  if (req.io_thread) {
+    l.io = take_cpu();
+  }
+
+  l.app.resize(req.reactors);
+  if (req.mtcp) {
+    if (req.reactors > 1) {
+      l.app[0] = take_cpu();
+      for (unsigned i = 1; i < req.reactors; i++) {
+        l.app[i] = pairs[i - 1].second;
+      }
+    } else {
+      l.app[0] = pairs[0].second;
+    }
+  } else {
+    for (unsigned i = 0; i < req.reactors; i++) {
+      l.app[i] = take_cpu();
+    }
+  }
+  return l;
+}
+
+std::string describe(const layout& l, const resources& topo) {
+  auto info = [&](unsigned id) {
+    for (auto& c : topo.cpus) {
+      if (c.cpu_id == id) {
+        return fmt::format("cpu {} (node {}, core {}/{})", id, c.node, c.package, c.core);
+      }
+    }
+    return fmt::format("cpu {}", id);
+  };
+
+  std::vector<unsigned> all;
+  for (auto& c : topo.cpus) {
+    all.push_back(c.cpu_id);
+  }
+  std::string s = fmt::format("cpu layout, NIC on node {}, online cpus {}{}",
+                              l.nic_node, format_cpus(all),
+                              l.shared ? ", OVERSUBSCRIBED" : "");
+  for (unsigned i = 0; i < l.app.size(); i++) {
+    s += fmt::format("\n  reactor {}: {}", i, info(l.app[i]));
+    if (!l.stack.empty()) {
+      if (l.app.size() > 1 && i == 0) {
+        s += " [distributor]";
+      } else {
+        unsigned q = i == 0 ? 0 : i - 1;
+        s += fmt::format(", stack thread of queue {}: {}", q, info(l.stack[q]));
+      }
+    }
+  }
+  if (l.io) {
+    s += fmt::format("\n  I/O thread: {}", info(*l.io));
+  }
+  return s;
+}
+
 } // namespace resource
 } // namespace infgen
@@ -100,6 +100,7 @@ std::vector<reactor *> smp::reactors_;
 std::thread::id smp::tmain_;
 std::deque<std::deque<smp_message_queue>> smp::qs_;
 std::atomic<unsigned> smp::ready_engines_(1);
+resource::layout smp::layout_;
 unsigned smp::count = 1;
 
 boost::program_options::options_description smp::get_options_description() {
@@ -108,6 +109,8 @@ boost::program_options::options_description smp::get_options_description() {
   opts.add_options()
     ("smp", bpo::value<unsigned>()->default_value(1), "number of threads (default: one per CPU)")
     ("mode", bpo::value<std::string>()->default_value("normal"), "I/O mode")
+    ("cpuset", bpo::value<std::string>(),
+     "cpus to run on, e.g. 0-7,16-23 (default: all online cpus)")
   ;
   return opts;
 }
@@ -129,20 +132,40 @@ void smp::configure(boost::program_options::variables_map configuration) {
     for (unsigned j = 0; j < smp::count; j++)
       smp::qs_[i].emplace_back(reactors_[i], reactors_[j]);
   }
-  // use extra I/O scheduler when using mtcp stack
+
   auto stack = configuration["network-stack"].as<std::string>();
+  auto mode = configuration["mode"].as<std::string>();
+  resource::placement_request req;
+  req.reactors = smp::count;
+  req.mtcp = stack == "mtcp";
+  req.io_thread = req.mtcp && mode != "normal";
+  resource::resources topo;
+  try {
+    if (configuration.count("cpuset")) {
+      req.conf.cpu_set = resource::parse_cpuset(configuration["cpuset"].as<std::string>());
+    }
+    if (configuration.count("device")) {
+      req.nic_node = resource::node_of_device(configuration["device"].as<std::string>());
+    }
+    topo = resource::read_topology();
+    layout_ = resource::place(topo, req);
+  } catch (std::exception& e) {
+    smp_logger.error("config error: {}", e.what());
+    exit(-1);
+  }
+  smp_logger.info("{}", resource::describe(layout_, topo));
+
+  // use extra I/O scheduler when using mtcp stack
   if (stack == "mtcp") {
     // must initialize mtcp before starting any I/O threads!!!
-    mtcp_stack::configure(configuration);
-    auto mode = configuration["mode"].as<std::string>();
+    mtcp_stack::configure(configuration, layout_);
     if (mode != "normal") {
       // extra I/O thread
       use_extra_io = 1;
       watchdog = new io_scheduler(mode, smp::count);
       watchdog->configure(configuration);
       smp::create_thread([] {
-        // pin I/O thread to the first cpu core after the stack thread
-        pin(smp::count);
+        pin(*layout_.io);
         watchdog->run();
       });
     }
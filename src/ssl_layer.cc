@@ -1,5 +1,6 @@
 #include "ssl_layer.h"
 
+#include <algorithm>
 #include <cstring>
 #include <cstdlib>
 
@@ -7,13 +8,13 @@ namespace infgen {
 
 mbedtls_cipher_id_t cipher = MBEDTLS_CIPHER_ID_AES;
 
-const unsigned char key[32] = { 
+const unsigned char key[32] = {
 		0xad,0xc2,0x5f,0x83,0x19,0xb1,0xe2,0xaf,0x11,0x08,0x2c,0x3a,0x2e,0x89,0xe8,0xdf,0xed,0xfc,0x4b,0x55,0xba,0x07,0x11,0x85,0x10,0x87,0xcc,0xbe,0xa6,0x0e,0x30,0xe9};
 
-const unsigned char initial_value[12] = { 
+const unsigned char initial_value[12] = {
     0x18,0x63,0xd4,0x71,0x12,0x1a,0x74,0x65,0x5a,0x2e,0x2b,0x54};
 
-const unsigned char additional[] = {0x17,0x03,0x03,0x03,0x63};
+const unsigned char record_type[] = {0x17,0x03,0x03};
 
 
 void ssl_layer::ssl_init(mbedtls_gcm_context &ctx) {
@@ -23,36 +24,117 @@ void ssl_layer::ssl_init(mbedtls_gcm_context &ctx) {
 #endif
 }
 
-void ssl_layer::ssl_encrypt(mbedtls_gcm_context ctx, const unsigned char *data, unsigned char* ciphertext, size_t len) {
-#ifdef AES_GCM
-	unsigned char tag[16];
-	ciphertext[0] = 0x17;
-	ciphertext[1] = 0x03;
-	ciphertext[2] = 0x03;
-	ciphertext[3] = 0x03;
-	ciphertext[4] = 0x63;
-
-	mbedtls_gcm_crypt_and_tag(&ctx, MBEDTLS_GCM_ENCRYPT, len, initial_value, sizeof(initial_value)/*12*/, additional, sizeof(additional)/*5*/, data/*input*/, (ciphertext + 5)/*output*/, sizeof(tag)/*16*/, tag);
-
-	memcpy(ciphertext + 5 + len, tag, 16); //Additianal + ciphertext + tag
-#else
-	/// TODO: Add support for dynamic encryption
-#endif
+ssl_layer::nonce_t ssl_layer::make_nonce(uint64_t seq) {
+	nonce_t nonce;
+	std::memcpy(nonce.data(), initial_value, nonce.size());
+	// sequence number is left-padded to the IV length, as in TLS 1.3
+	for (int i = 0; i < 8; i++) {
+		nonce[4 + i] ^= (unsigned char)(seq >> (56 - 8 * i));
+	}
+	return nonce;
 }
 
-std::optional<size_t> ssl_layer::ssl_decrypt(mbedtls_gcm_context ctx, const unsigned char *data, unsigned char* plaintext, size_t len) {
-#ifdef AES_GCM
-	unsigned char tag[16];
-
-	mbedtls_gcm_crypt_and_tag(&ctx, MBEDTLS_GCM_DECRYPT, len, initial_value, sizeof(initial_value)/*12*/, additional, sizeof(additional)/*5*/, data/*input*/, plaintext/*output*/, sizeof(tag)/*16*/, tag);
-		
-	return {size_t(len)};
-#else
-		/// TODO: Add support for dynamic decryption
-	return {};
-#endif
+void ssl_layer::put_header(char *p, size_t len) {
+	size_t rlen = len + tag_len;
+	std::memcpy(p, record_type, sizeof(record_type));
+	p[3] = (char)(rlen >> 8);
+	p[4] = (char)rlen;
 }
 
+size_t ssl_layer::seal(const void *data, size_t len, buffer &out) {
+	if (len > max_record) {
+		// the batch kernel interleaves the records' GHASH
+		struct iovec iov = {const_cast<void *>(data), len};
+		return seal_batch(&iov, 1, out);
+	}
+
+	auto p = static_cast<const unsigned char *>(data);
+	size_t total = sealed_size(len);
+	char *rec = out.alloc_room(total);
+
+	while (len > 0) {
+		size_t n = std::min(len, max_record);
+		auto nonce = make_nonce(tx_seq_++);
+		auto c = (unsigned char *)rec + header_len;
+
+		put_header(rec, n);
+		mbedtls_gcm_crypt_and_tag(&ctx_, MBEDTLS_GCM_ENCRYPT, n, nonce.data(), nonce.size(),
+				(const unsigned char *)rec, header_len, p, c, tag_len, c + n);
+
+		rec += n + overhead;
+		p += n;
+		len -= n;
+	}
+	return total;
 }
 
+size_t ssl_layer::seal_batch(const struct iovec *iov, size_t n, buffer &out) {
+	size_t total = 0, records = 0;
+	for (size_t i = 0; i < n; i++) {
+		total += sealed_size(iov[i].iov_len);
+		records += (iov[i].iov_len + max_record - 1) / max_record;
+	}
+
+	// the nonces must not move once the entries point to them
+	nonces_.resize(records);
+	batch_.clear();
+
+	char *rec = out.alloc_room(total);
+	for (size_t i = 0; i < n; i++) {
+		auto p = static_cast<const unsigned char *>(iov[i].iov_base);
+		size_t len = iov[i].iov_len;
+
+		while (len > 0) {
+			size_t rlen = std::min(len, max_record);
+			auto &nonce = nonces_[batch_.size()];
+			auto c = (unsigned char *)rec + header_len;
+
+			nonce = make_nonce(tx_seq_++);
+			put_header(rec, rlen);
+			batch_.push_back({nonce.data(), (const unsigned char *)rec, header_len,
+					p, c, rlen, c + rlen});
+
+			rec += rlen + overhead;
+			p += rlen;
+			len -= rlen;
+		}
+	}
+
+	mbedtls_gcm_crypt_and_tag_batch(&ctx_, MBEDTLS_GCM_ENCRYPT, batch_.data(), batch_.size());
+	return total;
+}
+
+std::optional<size_t> ssl_layer::open(buffer &in, buffer &out) {
+	size_t total = 0;
+
+	while (in.size() >= header_len) {
+		auto h = (const unsigned char *)in.begin();
+		size_t rlen = (size_t)h[3] << 8 | h[4];
+
+		if (std::memcmp(h, record_type, sizeof(record_type)) != 0 ||
+				rlen < tag_len || rlen > max_record + tag_len) {
+			return std::nullopt;
+		}
+		if (in.size() < header_len + rlen) {
+			// wait for the rest of the record
+			break;
+		}
+
+		size_t len = rlen - tag_len;
+		auto nonce = make_nonce(rx_seq_);
+		auto c = h + header_len;
+		auto plain = (unsigned char *)out.make_room(len);
+
+		if (mbedtls_gcm_auth_decrypt(&ctx_, len, nonce.data(), nonce.size(), h, header_len,
+					c + len, tag_len, c, plain) != 0) {
+			return std::nullopt;
+		}
+		rx_seq_++;
+		out.add_size(len);
+		in.consume(header_len + rlen);
+		total += len;
+	}
+	return total;
+}
 
+}
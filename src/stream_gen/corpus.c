@@ -0,0 +1,217 @@
+/*
+Copyright (c) Wenqing Wu  <wuwenqing@ict.ac.cn>. All rights reserved.
+See the file COPYING for license details.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "include/corpus.h"
+#include "include/stream_gen.h"
+
+#define ALIGN_UP(x) (((x) + CORPUS_ALIGN - 1) & ~((uint64_t)CORPUS_ALIGN - 1))
+
+/* Description	: write all streams held in hash table into a corpus file
+ * Return 		: number of streams written; -1, if failed
+ * */
+int
+corpus_compile(const char *path)
+{
+    int i;
+    int cnt = 0;
+    int err;
+    int size = nids_params.n_tcp_streams;
+    uint64_t off = 0;
+    uint64_t nb_seg = 0;
+    static const uint8_t pad[CORPUS_ALIGN];
+    char tmp_path[256];
+    struct corpus_header hdr;
+    struct corpus_entry *entry;
+    struct buf_node *buf_entry;
+    FILE *fp;
+
+    for (i = 0; i < size; i++) {
+        list_for_each_entry(buf_entry, &hash_buf.buf_list[i], list) {
+            cnt++;
+        }
+    }
+
+    entry = (struct corpus_entry *)calloc(cnt ? cnt : 1, sizeof(struct corpus_entry));
+    if (entry == NULL) {
+        fprintf(stderr, "Allocate memory for corpus index failed.\n");
+        return -1;
+    }
+
+    cnt = 0;
+    for (i = 0; i < size; i++) {
+        list_for_each_entry(buf_entry, &hash_buf.buf_list[i], list) {
+            entry[cnt].off = off;
+            entry[cnt].len = buf_entry->len;
+            entry[cnt].saddr = buf_entry->tup.saddr;
+            entry[cnt].daddr = buf_entry->tup.daddr;
+            entry[cnt].sport = buf_entry->tup.source;
+            entry[cnt].dport = buf_entry->tup.dest;
+            entry[cnt].start_us = buf_entry->start_us;
+            entry[cnt].seg = nb_seg;
+            entry[cnt].nb_seg = buf_entry->nb_seg;
+            nb_seg += buf_entry->nb_seg;
+            off = ALIGN_UP(off + buf_entry->len);
+            cnt++;
+        }
+    }
+
+    memset(&hdr, 0, sizeof(hdr));
+    memcpy(hdr.magic, CORPUS_MAGIC, sizeof(hdr.magic));
+    hdr.version = CORPUS_VERSION;
+    hdr.nb_stream = cnt;
+    hdr.seg_off = sizeof(hdr) + sizeof(struct corpus_entry) * cnt;
+    hdr.nb_seg = nb_seg;
+    hdr.data_off = ALIGN_UP(hdr.seg_off + sizeof(struct seg_info) * nb_seg);
+    hdr.data_len = off;
+
+    /* write to a temporary file first, a reader never sees a partial corpus */
+    snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", path);
+    fp = fopen(tmp_path, "wb");
+    if (fp == NULL) {
+        perror("fopen");
+        free(entry);
+        return -1;
+    }
+
+    fwrite(&hdr, sizeof(hdr), 1, fp);
+    fwrite(entry, sizeof(struct corpus_entry), cnt, fp);
+    for (i = 0; i < size; i++) {
+        list_for_each_entry(buf_entry, &hash_buf.buf_list[i], list) {
+            fwrite(buf_entry->segs, sizeof(struct seg_info), buf_entry->nb_seg, fp);
+        }
+    }
+    fwrite(pad, 1, hdr.data_off - hdr.seg_off - sizeof(struct seg_info) * nb_seg, fp);
+
+    cnt = 0;
+    for (i = 0; i < size; i++) {
+        list_for_each_entry(buf_entry, &hash_buf.buf_list[i], list) {
+            fwrite(buf_entry->tot_buf, 1, buf_entry->len, fp);
+            fwrite(pad, 1, ALIGN_UP(buf_entry->len) - buf_entry->len, fp);
+            cnt++;
+        }
+    }
+    free(entry);
+
+    err = ferror(fp);
+    if (fclose(fp) != 0 || err || rename(tmp_path, path) != 0) {
+        fprintf(stderr, "Failed to write corpus file %s.\n", path);
+        unlink(tmp_path);
+        return -1;
+    }
+
+    return cnt;
+}
+
+/* Description	: map a corpus file read-only and check its layout
+ * Return 		: 0, if succeed; -1, if failed
+ * */
+int
+corpus_open(struct corpus *c, const char *path)
+{
+    int fd;
+    uint32_t i;
+    struct stat st;
+    const struct corpus_header *hdr;
+
+    memset(c, 0, sizeof(*c));
+
+    fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        perror("open");
+        return -1;
+    }
+    if (fstat(fd, &st) < 0 || (size_t)st.st_size < sizeof(struct corpus_header)) {
+        fprintf(stderr, "Invalid corpus file %s.\n", path);
+        close(fd);
+        return -1;
+    }
+
+    /* pages are shared by every sending thread (and every process replaying
+     * the same corpus) */
+    c->map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED | MAP_POPULATE, fd, 0);
+    close(fd);
+    if (c->map == MAP_FAILED) {
+        perror("mmap");
+        c->map = NULL;
+        return -1;
+    }
+    c->map_len = st.st_size;
+    madvise(c->map, c->map_len, MADV_WILLNEED);
+
+    hdr = (const struct corpus_header *)c->map;
+    if (memcmp(hdr->magic, CORPUS_MAGIC, sizeof(hdr->magic)) != 0
+        || hdr->version != CORPUS_VERSION
+        || hdr->seg_off < sizeof(*hdr) + sizeof(struct corpus_entry) * (uint64_t)hdr->nb_stream
+        || hdr->nb_seg > c->map_len / sizeof(struct seg_info)
+        || hdr->data_off < hdr->seg_off + sizeof(struct seg_info) * hdr->nb_seg
+        || hdr->data_off > c->map_len
+        || hdr->data_len > c->map_len - hdr->data_off) {
+        fprintf(stderr, "Corrupted or incompatible corpus file %s.\n", path);
+        corpus_close(c);
+        return -1;
+    }
+
+    c->hdr = hdr;
+    c->entry = (const struct corpus_entry *)(hdr + 1);
+    c->seg = (const struct seg_info *)((const uint8_t *)c->map + hdr->seg_off);
+    c->data = (const uint8_t *)c->map + hdr->data_off;
+
+    for (i = 0; i < hdr->nb_stream; i++) {
+        if (c->entry[i].off > hdr->data_len
+            || c->entry[i].len > hdr->data_len - c->entry[i].off
+            || c->entry[i].seg > hdr->nb_seg
+            || c->entry[i].nb_seg > hdr->nb_seg - c->entry[i].seg) {
+            fprintf(stderr, "Corrupted corpus file %s, stream %u out of range.\n", path, i);
+            corpus_close(c);
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+/* Description	: put streams of a mapped corpus into hash table,
+ * 				  stream data is referenced, not copied
+ * Return 		: number of streams loaded
+ * */
+int
+corpus_load(struct corpus *c)
+{
+    uint32_t i;
+    struct tuple4 tup;
+    struct buf_node *node;
+
+    for (i = 0; i < c->hdr->nb_stream; i++) {
+        const struct corpus_entry *e = &c->entry[i];
+
+        tup.saddr = e->saddr;
+        tup.daddr = e->daddr;
+        tup.source = e->sport;
+        tup.dest = e->dport;
+        node = link_stream_data(tup, c->data + e->off, e->len);
+        node->segs = (struct seg_info *)(c->seg + e->seg);
+        node->nb_seg = e->nb_seg;
+        node->start_us = e->start_us;
+    }
+
+    return c->hdr->nb_stream;
+}
+
+/* unmap corpus file */
+void
+corpus_close(struct corpus *c)
+{
+    if (c->map) {
+        munmap(c->map, c->map_len);
+    }
+    memset(c, 0, sizeof(*c));
+}
@@ -19,6 +19,7 @@ See the file COPYING for license details.
 #include "libnids-1.24/src/nids.h"
 
 #include "include/stream_gen.h"
+#include "include/corpus.h"
 
 #include <inttypes.h>
 #include <rte_eal.h>
@@ -63,6 +64,13 @@ uint16_t	dst_port;
 bool 		get_dst_from_file = false;
 char		dst_addr_file[20];
 int 		frag_rate = 100;
+double		replay_speed = 0;
+uint16_t	tx_gap = 10;
+bool		hw_cksum = false;
+bool		tx_multi_seg = false;
+static char		*corpus_out = NULL;		// corpus file to compile the pcap into
+static char		*corpus_in = NULL;		// corpus file to replay from
+static struct corpus	corpus;
 
 #define S_TO_TSC(t) rte_get_tsc_hz() * (t)
 /* delay for 't' seconds */
@@ -102,6 +110,23 @@ print_final_stat(void)
 	printf("----------- Statistics from application ----------\n");
     printf("   TX-packets:\t\t\t%"PRIu64"\n", tx_total);
     printf("   TX-dropped:\t\t\t%"PRIu64"\n", drop_total);
+    if (replay_speed > 0) {
+        uint64_t nb_seg = 0, err_sum = 0, err_max = 0, late = 0;
+        double tsc_per_us = (double)rte_get_tsc_hz() / US_PER_S;
+
+        for (i = 0; i < nb_snd_thread; ++i) {
+            nb_seg += th_info[i].rstats.nb_seg;
+            err_sum += th_info[i].rstats.err_sum;
+            late += th_info[i].rstats.late;
+            if (th_info[i].rstats.err_max > err_max)
+                err_max = th_info[i].rstats.err_max;
+        }
+        printf("------------ Replay timing (x%g) ------------------\n", replay_speed);
+        printf("   Segments:\t\t\t%"PRIu64"\n", nb_seg);
+        printf("   Avg-error(us):\t\t%.2f\n", nb_seg ? err_sum / tsc_per_us / nb_seg : 0);
+        printf("   Max-error(us):\t\t%.2f\n", err_max / tsc_per_us);
+        printf("   Late(>%dus):\t\t%"PRIu64"\n", WHEEL_TICK_US, late);
+    }
     printf("-------------- Statistics from NICs --------------\n");
     printf("   TX-packets:\t\t\t%"PRIu64"\n", stats_end.opackets - stats_start.opackets);
     printf("   TX-bytes:\t\t\t%"PRIu64"\n", stats_end.obytes - stats_start.obytes);
@@ -152,10 +177,16 @@ print_usage(const char * prgname)
         "\t-h HELP: Display usage infomation\n"
         "\t-i PCAP FILE:\n"
         "\t\tInput packets which contains network trace\n"
+        "\t-w CORPUS FILE:\n"
+        "\t\tCompile streams of the pcap file (-i) into a corpus file and exit\n"
+        "\t-p CORPUS FILE:\n"
+        "\t\tReplay streams from a corpus file instead of a pcap file\n"
         "\t-o INTERFACE:\n"
         "\t\tInterface used for sending packets\n"
         "\t\t(e.g. 1 for port1 with DPDK, default 0)\n"
         "\t-c CONCURRENCY: concurrency of sending streams.(default 10)\n"
+        "\t-s SPEED:\n"
+        "\t\tReplay with captured timing and segments, SPEED times as fast (e.g. 1, 0.5, 10)\n"
         "\t-t THREADS:\n"
         "\t\tNumber of sending threads (default 1, maximum 8)\n"
         "\t-l LENGTH of PAYLOAD: \n"
@@ -164,6 +195,8 @@ print_usage(const char * prgname)
 		"\t\tTime interval for displaying statistics information.(default 2 for 2s)\n"
         "\t-b BURST: \n"
         "\t\tTransmiting burst while sending with DPDK (default 1, maximum 128)\n"
+        "\t-g GAP: \n"
+        "\t\tInterval between two bursts in us (default 10, 0 for line rate)\n"
 		"\t-d DEST_PORT: \n"
 		"\t\tGive a fixed dest_port for SYN Flooding.\n"
 		"\t-r RATE:\n"
@@ -185,7 +218,7 @@ gen_get_options(int argc, char *argv[])
 {
     int opt = 0;
 
-    while ((opt = getopt(argc, argv, "hi:o:m:b:c:d:f:l:r:t:T:")) != -1) {
+    while ((opt = getopt(argc, argv, "hi:o:m:b:c:d:f:g:l:p:r:s:t:T:w:")) != -1) {
         switch(opt) {
             case 'h':
                 print_usage(argv[0]);
@@ -194,6 +227,12 @@ gen_get_options(int argc, char *argv[])
 				nids_params.filename = (char *)malloc(strlen(optarg));
                 strcpy(nids_params.filename, optarg);
                 break;
+            case 'w':
+                corpus_out = optarg;
+                break;
+            case 'p':
+                corpus_in = optarg;
+                break;
             case 'o':
                 snd_port = atoi(optarg);
               	break;
@@ -214,6 +253,9 @@ gen_get_options(int argc, char *argv[])
                     rte_exit(EXIT_FAILURE, "\nInvalid burst (1 ~ %d).\n", MAX_BURST);
                 }
               	break;
+            case 'g':
+              	tx_gap = (uint16_t)atoi(optarg);
+              	break;
             case 'm':
               	mode_run = atoi(optarg);
                 if (mode_run < 1 || mode_run > 2) {
@@ -232,6 +274,14 @@ gen_get_options(int argc, char *argv[])
 					rte_exit(EXIT_FAILURE, "\nInvalid number of thread (1 ~ %d).\n", NUM_SEND_THREAD);
 				}
               	break;
+#ifdef SEND_THREAD
+            case 's':
+              	replay_speed = atof(optarg);
+				if (replay_speed <= 0) {
+					rte_exit(EXIT_FAILURE, "\nInvalid replay speed (> 0).\n");
+				}
+              	break;
+#endif
 #ifdef STAT_THREAD
             case 'T':
               	stat_interval = atoi(optarg);
@@ -387,6 +437,36 @@ tcp_callback (struct tcp_stream *a_tcp, void ** this_time_not_needed)
 	return ;
 }
 
+/*
+ * Description: Reassemble streams of the pcap file and write them into a
+ * 				corpus file, later runs replay from it with '-p'
+ * */
+static void
+compile_corpus(void)
+{
+	int n;
+
+	if (nids_params.filename == NULL) {
+		fprintf(stderr, "\nA pcap file (-i) is needed to compile a corpus.\n");
+		exit(1);
+	}
+	if (!nids_init ()) {
+		fprintf(stderr,"error, %s\n",nids_errbuf);
+		exit(-1);
+	}
+	nids_register_tcp(tcp_callback);
+
+    printf("\nImport source data from pcap file...\n");
+	nids_run();
+
+	n = corpus_compile(corpus_out);
+	if (n < 0) {
+		exit(1);
+	}
+	printf("\n%d streams written into %s\n", n, corpus_out);
+	exit(0);
+}
+
 /*
  * Initializes a given port using global settings and with the RX buffers
  * coming from the mbuf_pool passed as a parameter.
@@ -404,6 +484,21 @@ port_init(uint16_t port, struct rte_mempool *mbuf_pool)
     if (port >= rte_eth_dev_count_avail())
         return -1;
 
+    /* checksums and chained mbufs are left to the port if it can */
+    struct rte_eth_dev_info dev_info;
+    rte_eth_dev_info_get(port, &dev_info);
+    if ((dev_info.tx_offload_capa & (DEV_TX_OFFLOAD_IPV4_CKSUM | DEV_TX_OFFLOAD_TCP_CKSUM))
+            == (DEV_TX_OFFLOAD_IPV4_CKSUM | DEV_TX_OFFLOAD_TCP_CKSUM)) {
+        port_conf.txmode.offloads |= DEV_TX_OFFLOAD_IPV4_CKSUM | DEV_TX_OFFLOAD_TCP_CKSUM;
+        hw_cksum = true;
+    }
+    if (dev_info.tx_offload_capa & DEV_TX_OFFLOAD_MULTI_SEGS) {
+        port_conf.txmode.offloads |= DEV_TX_OFFLOAD_MULTI_SEGS;
+        tx_multi_seg = true;
+    }
+    printf("Port %u TX offloads: checksum %s, multi-segment %s\n", port,
+            hw_cksum ? "on" : "off", tx_multi_seg ? "on" : "off");
+
     /* Configure the Ethernet device. */
     fflush(stdout);
     retval = rte_eth_dev_configure(port, rx_rings, tx_rings, &port_conf);
@@ -560,6 +655,11 @@ gen_init(int argc, char *argv[]){
 		syn_flood_set = true;
 	init_hash_buf();
     nb_stream = 0;
+
+	/* compiling a corpus needs no port */
+	if (corpus_out != NULL) {
+		compile_corpus();
+	}
     
     /* number of ports */
 	nb_ports = rte_eth_dev_count_avail();
@@ -581,13 +681,18 @@ gen_init(int argc, char *argv[]){
     if (port_init(snd_port, mp) != 0)
         rte_exit(EXIT_FAILURE, "\nCannot init port 0\n");
 
+	rte_eth_stats_get(snd_port, &stats_start);
+
+	/* streams come from a corpus file, libnids is not needed */
+	if (corpus_in != NULL) {
+		return;
+	}
+
 	if (!nids_init ()) {
 		fprintf(stderr,"error, %s\n",nids_errbuf);
 		exit(-1);
 	}
 	
-	rte_eth_stats_get(snd_port, &stats_start);
-
 	nids_register_tcp(tcp_callback);
 }
 
@@ -601,10 +706,19 @@ gen_run(void)
 	pthread_attr_t  attr;
 	cpu_set_t       cpus;
 
-    /* import pcap file and store stream data*/
-    printf("\nImport source data from pcap file...\n");
-    nids_run();
-    printf("\nFinished importing data\n");
+	if (corpus_in != NULL) {
+		/* map precompiled streams, no reassembly and no copy */
+		printf("\nLoad source data from corpus file %s...\n", corpus_in);
+		if (corpus_open(&corpus, corpus_in) < 0) {
+			exit(1);
+		}
+		printf("\nFinished loading %d streams\n", corpus_load(&corpus));
+	} else {
+		/* import pcap file and store stream data*/
+		printf("\nImport source data from pcap file...\n");
+		nids_run();
+		printf("\nFinished importing data\n");
+	}
 
 	/* Initialization of Sunday algorithm */
 	sunday_pre("\r\n\r\n", 4);
@@ -677,5 +791,6 @@ gen_destroy(void)
 #ifndef SEND_THREAD
 	destroy_hash_buf();
 #endif
+	corpus_close(&corpus);
 }
 
@@ -43,6 +43,38 @@ static inline uint16_t checksum(uint16_t *buf, int nbytes, uint32_t sum)
     return (uint16_t)~sum;
 }
 
+// one's complement sum of the given buf added to sum, not folded;
+// partial sums of different parts of a packet can be added together
+static inline uint32_t csum_partial(const void *buf, int nbytes, uint32_t sum)
+{
+    const uint16_t *p = (const uint16_t *)buf;
+    int i;
+
+    for (i = 0; i < nbytes / 2; i++)
+        sum += p[i];
+
+    if (nbytes % 2)
+        sum += ((const uint8_t *)buf)[nbytes-1];
+
+    return sum;
+}
+
+// fold a 32-bit partial sum into the final 16-bit checksum
+static inline uint16_t csum_fold(uint32_t sum)
+{
+    sum = (sum >> 16) + (sum & 0xffff);
+    sum = sum + (sum >> 16);
+
+    return (uint16_t)~sum;
+}
+
+// partial sum of an IPv4 address pair, as found in both IP header and
+// TCP pseudo header
+static inline uint32_t csum_addr(uint32_t saddr, uint32_t daddr)
+{
+    return (saddr >> 16) + (saddr & 0xffff) + (daddr >> 16) + (daddr & 0xffff);
+}
+
 static inline uint16_t tcp_checksum(struct iphdr *ip, struct tcphdr *tcp)
 {
     uint16_t tmp = tcp->check;
@@ -0,0 +1,62 @@
+#ifndef __CORPUS_H__
+#define __CORPUS_H__
+
+#include <stdint.h>
+#include <stddef.h>
+
+/*
+ * Stream corpus: the reassembled payload of every stream of a pcap file,
+ * written once by corpus_compile() and memory mapped read-only afterwards,
+ * so that a replay starts without running libnids again and all sending
+ * threads share one copy of the data.
+ *
+ * Layout (host byte order):
+ *   struct corpus_header
+ *   struct corpus_entry[nb_stream]
+ *   struct seg_info[nb_seg], segments of all streams
+ *   payload, every stream starting on a CORPUS_ALIGN boundary
+ * */
+#define CORPUS_MAGIC        "SGCORPUS"
+#define CORPUS_VERSION      3
+#define CORPUS_ALIGN        64
+
+struct corpus_header {
+    char        magic[8];
+    uint32_t    version;
+    uint32_t    nb_stream;
+    uint64_t    seg_off;        // offset of the segment table in file
+    uint64_t    nb_seg;
+    uint64_t    data_off;       // offset of the payload area in file
+    uint64_t    data_len;       // size of the payload area
+};
+
+struct corpus_entry {
+    uint64_t    off;            // offset of the stream in payload area
+    uint32_t    len;
+    uint32_t    saddr;          // original tuple4
+    uint32_t    daddr;
+    uint16_t    sport;
+    uint16_t    dport;
+    uint64_t    start_us;       // capture time of the first segment
+    uint64_t    seg;            // first segment in segment table
+    uint32_t    nb_seg;
+    uint32_t    reserved;
+};
+
+struct seg_info;
+
+struct corpus {
+    void*                       map;
+    size_t                      map_len;
+    const struct corpus_header* hdr;
+    const struct corpus_entry*  entry;
+    const struct seg_info*      seg;
+    const uint8_t*              data;
+};
+
+int  corpus_compile(const char *path);
+int  corpus_open(struct corpus *c, const char *path);
+int  corpus_load(struct corpus *c);
+void corpus_close(struct corpus *c);
+
+#endif
@@ -49,16 +49,27 @@
 
 #define NUM_SEND_THREAD		20 		//maximal number of sending thread
 
+/* timing wheel of replay mode */
+#define WHEEL_SLOTS         4096    // power of 2
+#define WHEEL_TICK_US       10
+
 /* cut mode */
 #define	EQUAL_DIVIDE        1  	 	// divide buffer into several equal part
 #define	RANDOM_DIVIDE		2		// divide buffer into fragments with random length
 #define	OVERLAP_DIVIDE      3		// divide buffer into fragments which may overlap with other ones
 
+/* a segment of a stream as captured */
+struct seg_info {
+	uint32_t            end;                    // offset of the end of segment in stream data
+	uint32_t            reserved;
+	uint64_t            ts;                     // capture time since the first segment of stream (us)
+};
+
 /* total data of a stream is store in a buf_node struct */
 struct buf_node {
 	struct list_head    list;
 	struct      		tuple4 tup;
-	uint8_t*   			tot_buf;
+	uint8_t*   			tot_buf;				// read-only once imported, may be shared
 	int	    			len;					// size for the whole data for now
     int     			offset;                 // offset of data to send
     uint8_t    			state;                  // state of TCP stream
@@ -72,6 +83,19 @@ struct buf_node {
     uint32_t   			ack_seq;
 	uint32_t   			ts;                 // timestamp
     uint32_t   			ts_peer;            // timestamp in packets sent by opposite direction
+    uint32_t            flow;               // virtual flow number, derives 4-tuple from tup
+    uint32_t            remap;              // added to flow if that 4-tuple was taken
+    uint32_t            addr_sum;           // checksum of saddr and daddr
+
+    /* captured segmentation and timing, shared like tot_buf */
+    struct seg_info*    segs;
+    int                 nb_seg;
+    uint64_t            start_us;           // capture time of the first segment (us)
+    /* replay mode */
+    int                 seg;                // next segment to send
+    uint64_t            base_tsc;           // TSC the stream (re)started at
+    uint64_t            due_tsc;            // TSC the next packet is due at
+    uint64_t            due_tick;
 };
 
 struct hash_table {
@@ -86,6 +110,22 @@ struct mbuf_table {
 	struct rte_mbuf*	m_table[MAX_BURST];    //mbuf table of packets to send
 };
 
+/* Hashed timing wheel over the flows of a thread, tick is WHEEL_TICK_US */
+struct timing_wheel {
+	struct list_head    slot[WHEEL_SLOTS];
+	uint64_t            start_tsc;
+	uint64_t            tick_tsc;
+	uint64_t            cur;                // next tick to expire
+};
+
+/* Per-thread timing error of replay mode, in TSC cycles */
+struct replay_statistics {
+	uint64_t            nb_seg;             // segments sent on schedule
+	uint64_t            err_sum;            // sum of |sent - due|
+	uint64_t            err_max;
+	uint64_t            late;               // segments sent more than a tick late
+};
+
 /* Per-port statistics struct */
 struct dpdk_port_statistics {
 	volatile uint64_t tx;                // number of packets sent
@@ -107,6 +147,10 @@ extern bool 			get_dst_from_file;
 extern char 			dst_addr_file[20];
 extern uint16_t			dst_port;
 extern int				frag_rate;
+extern double           replay_speed;   // speed-up of timing-faithful replay, 0 if disabled
+extern uint16_t         tx_gap;         // interval between two bursts (us)
+extern bool             hw_cksum;       // port computes IP/TCP checksums
+extern bool             tx_multi_seg;   // port sends chained mbufs
 
 extern volatile bool    force_quit;
 extern int      		nb_stream;  // number of streams stored in buffer 
@@ -116,14 +160,26 @@ struct thread_info {
     pthread_t               thread_id;
     struct rte_mempool*     mbuf_pool;
     struct mbuf_table       tx_mbufs;
+    struct mbuf_table       free_mbufs;     // allocated from mbuf_pool in bulk
+    uint64_t                ol_flags;       // TX offloads of flow packets
+#ifdef ZERO_COPY_TX
+    struct rte_mempool*     ext_pool;       // mbufs without data room, attached to payload
+    struct rte_mbuf_ext_shared_info shinfo;
+#endif
     uint8_t                 pkt[PACKET_LEN];
     uint64_t                pre_tsc;
     
     struct tcphdr*          tcph;
     struct iphdr*           iph;
-    struct buf_node**       nodes;
+    uint32_t                ip_sum;         // checksum of constant IP header fields
+
+    struct buf_node*        nodes;          // virtual flows of the thread
+    int                     nb_node;
+
+    struct timing_wheel     wheel;
 
     struct dpdk_port_statistics   stats;
+    struct replay_statistics      rstats;
 };
 extern struct thread_info   th_info[NUM_SEND_THREAD];
 
@@ -144,4 +200,5 @@ void dpdk_tx_flush(void);
 
 void prepare_header(int id);
 int  store_stream_data(struct tuple4 tup, char *data, int length, int flag);
+struct buf_node *link_stream_data(struct tuple4 tup, const uint8_t *data, int length);
 #endif 
@@ -19,6 +19,23 @@
 
 #ifdef SEND_THREAD
 static int                  concur_per_thread;
+
+/* captured streams, shared read-only by the virtual flows of all threads */
+struct stream_ref {
+	uint8_t*        		buf;
+	int             		len;
+	struct tuple4   		tup;
+	struct seg_info*		segs;
+	int             		nb_seg;
+	uint64_t        		start_us;
+};
+static struct stream_ref*   trace;
+static int                  nb_trace;
+
+/* replay mode: TSC cycles per captured microsecond, after speed-up,
+ * and interval the whole trace is replayed at */
+static double               replay_tsc_per_us;
+static uint64_t             replay_period_tsc;
 #endif
 
 char src_ip_addr[16];  //IPv4 address	
@@ -134,7 +151,10 @@ dpdk_send_burst(uint8_t p, uint16_t q, int id, int flag)
     }
 }
 
-/* Description  : flush packets remain in mbufs when exit application */
+/* Description  : flush packets remain in mbufs when exit application,
+ * 				  and give the mbufs taken in bulk but never used back
+ * 				  to their pool
+ * */
 void
 dpdk_tx_flush(void)
 {
@@ -142,30 +162,40 @@ dpdk_tx_flush(void)
     for (i = 0; i < nb_snd_thread; i++ ) {
         if(th_info[i].tx_mbufs.len > 0)
             dpdk_send_burst(snd_port, i, i, 1);
+        th_info[i].tx_mbufs.len = 0;
+        while (th_info[i].free_mbufs.len > 0)
+            rte_pktmbuf_free(th_info[i].free_mbufs.m_table[--th_info[i].free_mbufs.len]);
     }
 }
 
-/* *
- * Description  : send packets in tx buffer with DPDK
+/* Description  : get an mbuf of the thread, mbufs are taken from the pool
+ * 				  a burst at a time
  * */
-static inline int
-dpdk_send_pkt(uint8_t *pkt, int len, uint8_t p, uint16_t q, int id, int flag)
+static inline struct rte_mbuf *
+get_mbuf(int id)
 {
-    struct rte_mbuf   *m;
-    uint32_t ret;
+    struct mbuf_table *cache = &th_info[id].free_mbufs;
 
-    /* allocate rte_mbuf */
-    m  = rte_pktmbuf_alloc(th_info[id].mbuf_pool);
-    if (unlikely(m == NULL)) {
-        printf("allocate mbuf failed.\n");
-        return -1;
+    if (unlikely(cache->len == 0)) {
+        if (rte_pktmbuf_alloc_bulk(th_info[id].mbuf_pool, cache->m_table, MAX_BURST) != 0) {
+            return NULL;
+        }
+        cache->len = MAX_BURST;
     }
-    rte_memcpy((uint8_t *)((uint8_t *)m->buf_addr + m->data_off), (uint8_t *)pkt, len);
-    m->pkt_len  = len;
-    m->data_len = len;
+    return cache->m_table[--cache->len];
+}
+
+/* Description  : add a built packet to TX list, and transmit it with the
+ * 				  ones before once a burst is reached
+ * */
+static inline void
+dpdk_queue_mbuf(struct rte_mbuf *m, uint8_t p, uint16_t q, int id, int flag)
+{
+    /* checksums left to the NIC, see prepare_header() */
+    m->ol_flags = th_info[id].ol_flags;
+    m->l2_len = sizeof(struct ether_hdr);
+    m->l3_len = IP_HEADER_LEN;
 
-    /* Add packet to the TX list. */
-    rte_prefetch0(rte_pktmbuf_mtod(m, void *));
     th_info[id].tx_mbufs.m_table[th_info[id].tx_mbufs.len++] = m;
 
     /* transmit while reaching tx_burst */
@@ -175,16 +205,117 @@ dpdk_send_pkt(uint8_t *pkt, int len, uint8_t p, uint16_t q, int id, int flag)
 #else
     if (th_info[id].tx_mbufs.len >= burst) {
 #endif
-        /* sending interval*/
-        burst_delay(10, id);        
+        /* sending interval, replay mode keeps its own timing */
+        if (replay_speed == 0 && tx_gap > 0)
+            burst_delay(tx_gap, id);        
         dpdk_send_burst(p, q, id, flag);
         /* update size of th_info[id].tx_mbufs.*/
         th_info[id].tx_mbufs.len = 0;
     }
+}
+
+/* *
+ * Description  : send packets in tx buffer with DPDK
+ * */
+static inline int
+dpdk_send_pkt(uint8_t *pkt, int len, uint8_t p, uint16_t q, int id, int flag)
+{
+    struct rte_mbuf   *m;
+
+    m = get_mbuf(id);
+    if (unlikely(m == NULL)) {
+        printf("allocate mbuf failed.\n");
+        return -1;
+    }
+    rte_memcpy(rte_pktmbuf_mtod(m, uint8_t *), pkt, len);
+    m->pkt_len  = len;
+    m->data_len = len;
 
+    dpdk_queue_mbuf(m, p, q, id, flag);
     return 1;  
 }
 
+#ifdef ZERO_COPY_TX
+/* IOVA-contiguous copy of all stream data, payload is attached to packets
+ * from here rather than copied */
+static const struct rte_memzone *payload_zone;
+
+static void
+extbuf_free_cb(void *addr __rte_unused, void *opaque __rte_unused)
+{
+    /* payload lives as long as the application */
+}
+
+/* Description  : mbuf referring to the payload in payload_zone, or NULL if
+ * 				  the payload has to be copied
+ * */
+static inline struct rte_mbuf *
+attach_payload(const uint8_t *payload, uint32_t length, int id)
+{
+    struct rte_mbuf *m;
+    const uint8_t *base;
+
+    if (payload_zone == NULL || !tx_multi_seg) {
+        return NULL;
+    }
+    base = (const uint8_t *)payload_zone->addr;
+    if (payload < base || payload + length > base + payload_zone->len) {
+        return NULL;
+    }
+
+    m = rte_pktmbuf_alloc(th_info[id].ext_pool);
+    if (unlikely(m == NULL)) {
+        return NULL;
+    }
+    rte_mbuf_ext_refcnt_update(&th_info[id].shinfo, 1);
+    rte_pktmbuf_attach_extbuf(m, (void *)payload, payload_zone->iova + (payload - base),
+            length, &th_info[id].shinfo);
+    m->data_len = length;
+    m->pkt_len = length;
+
+    return m;
+}
+#endif
+
+/* *
+ * Description  : send a data packet, header is copied from the thread's
+ * 				  packet buffer and payload straight from stream data (or
+ * 				  attached to the packet without copy, with ZERO_COPY_TX)
+ * */
+static inline int
+dpdk_send_data(uint8_t *hdr, int hdr_len, const uint8_t *payload, uint32_t length,
+        uint8_t p, uint16_t q, int id)
+{
+    struct rte_mbuf   *m;
+#ifdef ZERO_COPY_TX
+    struct rte_mbuf   *m_payload;
+#endif
+
+    m = get_mbuf(id);
+    if (unlikely(m == NULL)) {
+        printf("allocate mbuf failed.\n");
+        return -1;
+    }
+    rte_memcpy(rte_pktmbuf_mtod(m, uint8_t *), hdr, hdr_len);
+    m->data_len = hdr_len;
+
+#ifdef ZERO_COPY_TX
+    m_payload = attach_payload(payload, length, id);
+    if (m_payload != NULL) {
+        m->next = m_payload;
+        m->nb_segs = 2;
+    } else
+#endif
+    {
+        rte_memcpy(rte_pktmbuf_mtod(m, uint8_t *) + hdr_len, payload, length);
+        m->data_len += length;
+    }
+    m->pkt_len = hdr_len + length;
+
+    dpdk_queue_mbuf(m, p, q, id, DATA_PKT);
+    return 1;
+}
+
 /* Description 	: setting common fields for the same stream
  *              4-tuple, identifier, seq, ack
  * */
@@ -192,9 +323,14 @@ static inline void
 set_field(struct buf_node* node)
 {
 #ifdef ORIGINAL_TUPLE4
-    node->saddr = node->tup.saddr;
+    /* virtual flows replaying the same captured stream are told apart by
+     * source port, then by source address (flow 0 keeps the original);
+     * remap moves a flow whose tuple is taken, see reserve_tuple() */
+    uint32_t idx = node->flow + node->remap;
+
+    node->saddr = htonl(ntohl(node->tup.saddr) + (idx >> 16));
     node->daddr = node->tup.daddr;
-    node->sport = node->tup.source;
+    node->sport = node->tup.source + (uint16_t)idx;
     node->dport = node->tup.dest;
 	//printf("%u:%u, %u:%u\n", node->tup.saddr, node->tup.source, node->tup.daddr,node->tup.dest);
 #else
@@ -225,6 +361,130 @@ set_field(struct buf_node* node)
 
 	node->state = TCP_ST_CLOSED;
 	node->offset = 0;
+	node->seg = 0;
+
+	/* addresses are fixed for the lifetime of the flow */
+	node->addr_sum = csum_addr(node->saddr, node->daddr);
+}
+
+#ifdef ORIGINAL_TUPLE4
+/* Derived tuples of the flows set up so far. Flows of different streams,
+ * or of captured streams sharing a tuple, can derive the same one; the
+ * later flow is remapped to a free one while the flows are set up, so no
+ * two flows ever share a tuple on the wire. */
+struct tuple_slot {
+    uint32_t    saddr;
+    uint32_t    daddr;
+    uint16_t    sport;
+    uint16_t    dport;
+    uint32_t    used;
+};
+static struct tuple_slot*   tuple_set;
+static uint32_t             tuple_mask;
+static int                  nb_remapped;
+
+static void
+tuple_set_init(int nb_flow)
+{
+    uint32_t size = 1024;
+
+    while (size < 2 * (uint32_t)nb_flow)
+        size <<= 1;
+    tuple_set = (struct tuple_slot *)calloc(size, sizeof(struct tuple_slot));
+    if (tuple_set == NULL) {
+        printf("Allocate memory for tuple set failed.\n");
+        exit(1);
+    }
+    tuple_mask = size - 1;
+    nb_remapped = 0;
+}
+
+static void
+tuple_set_free(void)
+{
+    if (nb_remapped > 0)
+        printf("%d flows remapped to avoid 4-tuple collisions\n", nb_remapped);
+    free(tuple_set);
+    tuple_set = NULL;
+}
+
+/* Description	: give the flow the tuple derived from its stream and flow
+ * 				  number, or if taken the same one on the first source
+ * 				  address after it that is free, reset its header fields
+ * 				  and keep the tuple for it
+ * */
+static void
+reserve_tuple(struct buf_node *node)
+{
+    struct tuple_slot *slot;
+    uint32_t h;
+
+    node->remap = 0;
+    for (;;) {
+        set_field(node);
+        h = node->saddr ^ (node->daddr * 0x9e3779b9u)
+            ^ (((uint32_t)node->sport << 16 | node->dport) * 0x85ebca6bu);
+        h ^= h >> 16;
+        h *= 0x85ebca6bu;
+        h ^= h >> 13;
+        h *= 0xc2b2ae35u;
+        h ^= h >> 16;
+        for (slot = &tuple_set[h & tuple_mask]; slot->used; 
+             slot = &tuple_set[++h & tuple_mask]) {
+            if (slot->saddr == node->saddr && slot->daddr == node->daddr
+                && slot->sport == node->sport && slot->dport == node->dport)
+                break;
+        }
+        if (!slot->used)
+            break;
+        /* try the next source address; stepping the port would run
+         * into the flows of neighbouring streams one by one */
+        node->remap += 1 << 16;
+    }
+    if (node->remap)
+        nb_remapped++;
+    slot->saddr = node->saddr;
+    slot->daddr = node->daddr;
+    slot->sport = node->sport;
+    slot->dport = node->dport;
+    slot->used = 1;
+}
+#endif
+
+/* Description	: IP checksum of a packet of the flow. Only the addresses,
+ * 				  id and length differ from the thread's header template, so
+ * 				  they are added to the template sum instead of summing the
+ * 				  whole header again.
+ * */
+static inline uint16_t
+flow_ip_checksum(struct buf_node *node, int id)
+{
+	struct iphdr *iph = th_info[id].iph;
+
+	if (th_info[id].ol_flags)
+		return 0;
+	return csum_fold(th_info[id].ip_sum + node->addr_sum + iph->tot_len + iph->id);
+}
+
+/* Description	: TCP checksum of a packet of the flow, pseudo header comes
+ * 				  from the sum cached in the flow
+ * @ payload	: payload not in the thread's packet buffer (or NULL)
+ * @ length		: length of payload
+ * */
+static inline uint16_t
+flow_tcp_checksum(struct buf_node *node, int id, const uint8_t *payload, uint32_t length)
+{
+	struct iphdr *iph = th_info[id].iph;
+	uint16_t tcp_len = ntohs(iph->tot_len) - iph->ihl * 4;
+	uint32_t sum = node->addr_sum + htons(IPPROTO_TCP) + htons(tcp_len);
+
+	/* the NIC adds up the segment, it only needs the pseudo header */
+	if (th_info[id].ol_flags)
+		return (uint16_t)~csum_fold(sum);
+
+	th_info[id].tcph->check = 0;
+	sum = csum_partial(th_info[id].tcph, tcp_len - length, sum);
+	return csum_fold(csum_partial(payload, length, sum));
 }
 
 void 
@@ -265,6 +525,23 @@ prepare_header(int id)
 	th_info[id].iph->saddr = inet_addr("10.0.0.67");
 	th_info[id].iph->daddr = inet_addr("10.0.0.68");
 	th_info[id].iph->protocol = IPPROTO_TCP;
+
+	/* sum of header words that stay the same for every packet, see
+	 * flow_ip_checksum() */
+	struct iphdr tmpl = *th_info[id].iph;
+	tmpl.tot_len = 0;
+	tmpl.id = 0;
+	tmpl.check = 0;
+	tmpl.saddr = 0;
+	tmpl.daddr = 0;
+	th_info[id].ip_sum = csum_partial(&tmpl, sizeof(tmpl), 0);
+
+	/* SYN flood packets carry full checksums computed in software */
+	if (hw_cksum && !syn_flood_set) {
+		th_info[id].ol_flags = PKT_TX_IPV4 | PKT_TX_IP_CKSUM | PKT_TX_TCP_CKSUM;
+	} else {
+		th_info[id].ol_flags = 0;
+	}
     
     /* set tcphdr pointer */
     th_info[id].tcph = (struct tcphdr *)(th_info[id].iph + 1);
@@ -440,7 +717,7 @@ send_syn(struct buf_node* node, uint8_t p, uint16_t q, int id)
         th_info[id].iph->tot_len = htons(IP_HEADER_LEN + TCP_HEADER_LEN + optlen);
         th_info[id].iph->saddr = node->saddr;
         th_info[id].iph->daddr = node->daddr;
-        th_info[id].iph->check = ip_checksum( (struct iphdr *)th_info[id].iph);	
+        th_info[id].iph->check = flow_ip_checksum(node, id);	
         
         ts_recent = 0;
         generate_opt(node->ts, TCP_FLAG_SYN, (uint8_t *)th_info[id].tcph + TCP_HEADER_LEN, optlen, ts_recent);
@@ -454,7 +731,7 @@ send_syn(struct buf_node* node, uint8_t p, uint16_t q, int id)
         th_info[id].tcph->syn = 1;         // SYN
         th_info[id].tcph->psh = 0;
         th_info[id].tcph->ack = 0;
-        th_info[id].tcph->check = tcp_checksum((struct iphdr*)th_info[id].iph, (struct tcphdr*)th_info[id].tcph);	
+        th_info[id].tcph->check = flow_tcp_checksum(node, id, NULL, 0);	
 
         dpdk_send_pkt((uint8_t *)th_info[id].pkt, HEADER_LEN + optlen, p, q, id, 1);
         node->state = TCP_ST_SYN_SENT;
@@ -472,7 +749,7 @@ send_syn(struct buf_node* node, uint8_t p, uint16_t q, int id)
         th_info[id].iph->tot_len = htons(IP_HEADER_LEN + TCP_HEADER_LEN + optlen);
         th_info[id].iph->saddr = node->daddr; //exchange src/dst ip
         th_info[id].iph->daddr = node->saddr;
-        th_info[id].iph->check = ip_checksum((struct iphdr *)th_info[id].iph);	
+        th_info[id].iph->check = flow_ip_checksum(node, id);	
         
         ts_recent = node->ts;
         generate_opt(node->ts_peer, TCP_FLAG_SYN | TCP_FLAG_ACK, (uint8_t *)th_info[id].tcph + TCP_HEADER_LEN, optlen, ts_recent);
@@ -487,7 +764,7 @@ send_syn(struct buf_node* node, uint8_t p, uint16_t q, int id)
         th_info[id].tcph->syn = 1;           // SYN
         th_info[id].tcph->psh = 0;
         th_info[id].tcph->ack = 1;           // ACK
-        th_info[id].tcph->check = tcp_checksum((struct iphdr*)th_info[id].iph, (struct tcphdr*)th_info[id].tcph);	
+        th_info[id].tcph->check = flow_tcp_checksum(node, id, NULL, 0);	
 
         dpdk_send_pkt((uint8_t *)th_info[id].pkt, HEADER_LEN + optlen, p, q, id, 1);
         node->state = TCP_ST_SYN_RCVD;
@@ -506,7 +783,7 @@ send_syn(struct buf_node* node, uint8_t p, uint16_t q, int id)
         th_info[id].iph->tot_len = htons(IP_HEADER_LEN + TCP_HEADER_LEN + optlen);
         th_info[id].iph->saddr = node->saddr; //exchange src/dst ip
         th_info[id].iph->daddr = node->daddr;
-        th_info[id].iph->check = ip_checksum((struct iphdr *)th_info[id].iph);	
+        th_info[id].iph->check = flow_ip_checksum(node, id);	
         
         ts_recent = node->ts_peer;
         generate_opt(node->ts, TCP_FLAG_ACK, (uint8_t *)th_info[id].tcph + TCP_HEADER_LEN, optlen, ts_recent);
@@ -521,7 +798,7 @@ send_syn(struct buf_node* node, uint8_t p, uint16_t q, int id)
         th_info[id].tcph->syn = 0;
         th_info[id].tcph->psh = 0;
         th_info[id].tcph->ack = 1;           // ACK
-        th_info[id].tcph->check = tcp_checksum((struct iphdr*)th_info[id].iph, (struct tcphdr*)th_info[id].tcph);	
+        th_info[id].tcph->check = flow_tcp_checksum(node, id, NULL, 0);	
 
         dpdk_send_pkt((uint8_t *)th_info[id].pkt, HEADER_LEN + optlen, p, q, id, 1);
 
@@ -558,7 +835,7 @@ send_fin(struct buf_node* node, uint8_t p, uint16_t q, int id)
         th_info[id].iph->tot_len = htons(IP_HEADER_LEN + TCP_HEADER_LEN + optlen);
         th_info[id].iph->saddr = node->saddr; //exchange src/dst ip
         th_info[id].iph->daddr = node->daddr;
-        th_info[id].iph->check = ip_checksum((struct iphdr *)th_info[id].iph);	
+        th_info[id].iph->check = flow_ip_checksum(node, id);	
         
         ts_recent = node->ts_peer++;
         generate_opt(++node->ts, TCP_FLAG_FIN | TCP_FLAG_ACK, (uint8_t *)th_info[id].tcph + TCP_HEADER_LEN, optlen, ts_recent);
@@ -572,7 +849,7 @@ send_fin(struct buf_node* node, uint8_t p, uint16_t q, int id)
         th_info[id].tcph->syn = 0;
         th_info[id].tcph->psh = 0;
         th_info[id].tcph->ack = 1;
-        th_info[id].tcph->check = tcp_checksum((struct iphdr*)th_info[id].iph, (struct tcphdr*)th_info[id].tcph);	
+        th_info[id].tcph->check = flow_tcp_checksum(node, id, NULL, 0);	
 
         dpdk_send_pkt((uint8_t *)th_info[id].pkt, HEADER_LEN + optlen, p, q, id, 1);
         node->state = TCP_ST_FIN_SENT_1; 
@@ -590,7 +867,7 @@ send_fin(struct buf_node* node, uint8_t p, uint16_t q, int id)
         th_info[id].iph->tot_len = htons(IP_HEADER_LEN + TCP_HEADER_LEN + optlen);
         th_info[id].iph->saddr = node->daddr; //exchange src/dst ip
         th_info[id].iph->daddr = node->saddr;
-        th_info[id].iph->check = ip_checksum((struct iphdr *)th_info[id].iph);	
+        th_info[id].iph->check = flow_ip_checksum(node, id);	
         
         ts_recent = node->ts++;
         generate_opt(node->ts_peer, TCP_FLAG_FIN | TCP_FLAG_ACK, (uint8_t *)th_info[id].tcph + TCP_HEADER_LEN, optlen, ts_recent);
@@ -604,7 +881,7 @@ send_fin(struct buf_node* node, uint8_t p, uint16_t q, int id)
         th_info[id].tcph->syn = 0;
         th_info[id].tcph->psh = 0;
         th_info[id].tcph->ack = 1;           // ACK
-        th_info[id].tcph->check = tcp_checksum((struct iphdr*)th_info[id].iph, (struct tcphdr*)th_info[id].tcph);	
+        th_info[id].tcph->check = flow_tcp_checksum(node, id, NULL, 0);	
 
         dpdk_send_pkt((uint8_t *)th_info[id].pkt, HEADER_LEN + optlen, p, q, id, 1);
         node->state = TCP_ST_FIN_SENT_2;    
@@ -623,7 +900,7 @@ send_fin(struct buf_node* node, uint8_t p, uint16_t q, int id)
         th_info[id].iph->tot_len = htons(IP_HEADER_LEN + TCP_HEADER_LEN + optlen);
         th_info[id].iph->saddr = node->saddr; //exchange src/dst ip
         th_info[id].iph->daddr = node->daddr;
-        th_info[id].iph->check = ip_checksum((struct iphdr *)th_info[id].iph);	
+        th_info[id].iph->check = flow_ip_checksum(node, id);	
         
         ts_recent = node->ts_peer;
         generate_opt(node->ts, TCP_FLAG_ACK, (uint8_t *)th_info[id].tcph + TCP_HEADER_LEN, optlen, ts_recent);
@@ -637,7 +914,7 @@ send_fin(struct buf_node* node, uint8_t p, uint16_t q, int id)
         th_info[id].tcph->syn = 0;
         th_info[id].tcph->psh = 0;
         th_info[id].tcph->ack = 1;           // ACK
-        th_info[id].tcph->check = tcp_checksum((struct iphdr*)th_info[id].iph, (struct tcphdr*)th_info[id].tcph);	
+        th_info[id].tcph->check = flow_tcp_checksum(node, id, NULL, 0);	
 
         dpdk_send_pkt((uint8_t *)th_info[id].pkt, HEADER_LEN + optlen, p, q, id, 1);
         
@@ -647,6 +924,25 @@ send_fin(struct buf_node* node, uint8_t p, uint16_t q, int id)
         return;
 #endif
 
+#ifdef SEND_THREAD
+        /* For multi-thread mode, to cover as many stream data as possible,
+		 * the flow goes on with another captured stream picked randomly
+		 * (not with ORIGINAL_TUPLE4, its tuple is reserved for its stream)
+		 * */
+#ifndef ORIGINAL_TUPLE4
+		if (nb_trace > 1 && replay_speed == 0) {
+			struct stream_ref *ref = &trace[rand() % nb_trace];
+
+			node->tot_buf = ref->buf;
+			node->len = ref->len;
+			node->tup = ref->tup;
+			node->segs = ref->segs;
+			node->nb_seg = ref->nb_seg;
+			node->start_us = ref->start_us;
+		}
+#endif
+#endif
+
         /* reset header fields */
         set_field(node);
 		/* To cover as many stream data as possible, 
@@ -666,21 +962,6 @@ send_fin(struct buf_node* node, uint8_t p, uint16_t q, int id)
 		struct list_head *buf_list_t = &hash_buf.buf_list[hash_index(tup)];
 
         list_add_head(&node->list, buf_list_t);
-#else
-        /* For multi-thread mode, 
-		 * Exchange stream data held in current buf_node with data in another raw random buf_node
-		 * */
-		int diff = nb_stream - nb_concur - 2;
-		if (diff > 10) {
-			int new_ind = rand() % diff + nb_concur + 1;
- 			uint8_t *tmp_buf = node->tot_buf;
-			int tmp_len = node->len;
-
-			node->tot_buf = th_info[id].nodes[new_ind]->tot_buf;
-			node->len = th_info[id].nodes[new_ind]->len;
-			th_info[id].nodes[new_ind]->tot_buf = tmp_buf;
-			th_info[id].nodes[new_ind]->len = tmp_len;
-		}        
 #endif
     } else {
         printf("Got TCP state fault when ending stream.\n");
@@ -752,31 +1033,28 @@ get_buf_node(struct tuple4 tup, int ind)
 	return NULL;
 }
 
-/* Description 	: insert buf_node to hash table  
- * @ buf		: data of TCP stream
+/* Description 	: link buf_node to hash table, data is referenced, not copied
+ * @ buf		: data of TCP stream, must outlive the buf_node
  * @ length		: length of buf
  * @ tup		: 4-tuple of the TCP stream
  * */
 static struct buf_node *
-insert_buf_node(struct list_head *buf_list, uint8_t *buf, int length, struct tuple4 tup) 
+link_buf_node(struct list_head *buf_list, uint8_t *buf, int length, struct tuple4 tup) 
 {
-    int size_alloc = MAX_BUFFER_SIZE;
 	struct buf_node *buf_entry = malloc(sizeof(struct buf_node));
 
-    /* Used for 'copy_stream_data()' */
-    if (length > size_alloc) {
-        size_alloc = length + 1;
-    }
-
-	buf_entry->tot_buf = (uint8_t *)malloc(size_alloc);
-
-	if(buf_entry == NULL || buf_entry->tot_buf == NULL) {
+	if(buf_entry == NULL) {
 		fprintf(stderr, "Allocate memory for buf_node failed.\n");
 		exit(1);
 	}
 	buf_entry->tup = tup;
-	memcpy(buf_entry->tot_buf, buf, length);
+	buf_entry->tot_buf = buf;
 	buf_entry->len = length;
+    buf_entry->flow = 0;
+    buf_entry->remap = 0;
+    buf_entry->segs = NULL;
+    buf_entry->nb_seg = 0;
+    buf_entry->start_us = 0;
     buf_entry->offset = 0;
     buf_entry->state = TCP_ST_CLOSED;
 
@@ -791,6 +1069,40 @@ insert_buf_node(struct list_head *buf_list, uint8_t *buf, int length, struct tup
 	return buf_entry;
 }
 
+/* Description 	: insert buf_node to hash table  
+ * @ buf		: data of TCP stream
+ * @ length		: length of buf
+ * @ tup		: 4-tuple of the TCP stream
+ * */
+static struct buf_node *
+insert_buf_node(struct list_head *buf_list, uint8_t *buf, int length, struct tuple4 tup) 
+{
+    int size_alloc = MAX_BUFFER_SIZE;
+	uint8_t *tot_buf;
+
+    if (length > size_alloc) {
+        size_alloc = length + 1;
+    }
+
+	tot_buf = (uint8_t *)malloc(size_alloc);
+	if(tot_buf == NULL) {
+		fprintf(stderr, "Allocate memory for buf_node failed.\n");
+		exit(1);
+	}
+	memcpy(tot_buf, buf, length);
+
+	return link_buf_node(buf_list, tot_buf, length, tup);
+}
+
+/* Description: add a stream whose data is already complete (e.g. mapped from
+ * 				a corpus file), data is shared rather than copied
+ * */
+struct buf_node *
+link_stream_data(struct tuple4 tup, const uint8_t *data, int length)
+{
+	return link_buf_node(&hash_buf.buf_list[hash_index(tup)], (uint8_t *)data, length, tup);
+}
+
 /* Generating ACK correspond to PSH/ACK packet sent with send_data_packet */
 static void
 send_ack(struct buf_node *node, uint8_t p, uint16_t q, int id)
@@ -803,7 +1115,7 @@ send_ack(struct buf_node *node, uint8_t p, uint16_t q, int id)
 	th_info[id].iph->tot_len = htons(IP_HEADER_LEN + TCP_HEADER_LEN + optlen);
     th_info[id].iph->saddr = node->daddr;
     th_info[id].iph->daddr = node->saddr;
-    th_info[id].iph->check = ip_checksum((struct iphdr *)th_info[id].iph);	
+    th_info[id].iph->check = flow_ip_checksum(node, id);	
 	
 	ts_recent = node->ts;
     generate_opt(++(node->ts_peer), TCP_FLAG_ACK, (uint8_t *)th_info[id].tcph + TCP_HEADER_LEN, optlen, ts_recent);
@@ -817,7 +1129,7 @@ send_ack(struct buf_node *node, uint8_t p, uint16_t q, int id)
     th_info[id].tcph->fin = 0;
     th_info[id].tcph->ack = 1;
     th_info[id].tcph->psh = 0;
-	th_info[id].tcph->check = tcp_checksum((struct iphdr*)th_info[id].iph, (struct tcphdr*)th_info[id].tcph);	
+	th_info[id].tcph->check = flow_tcp_checksum(node, id, NULL, 0);	
 
     dpdk_send_pkt((uint8_t *)th_info[id].pkt, HEADER_LEN + optlen, p, q, id, 2);
 }
@@ -868,6 +1180,7 @@ send_data_pkt(struct buf_node *node, uint32_t length, uint8_t p, uint16_t q, int
 	int         optlen = 0;
 	int         payload_offset = 0;
     uint32_t    ts_recent;
+    const uint8_t *payload;
 
     uint32_t    rest_len = node->len - node->offset;
     if (length >= rest_len){
@@ -881,7 +1194,7 @@ send_data_pkt(struct buf_node *node, uint32_t length, uint8_t p, uint16_t q, int
 	th_info[id].iph->tot_len = htons(IP_HEADER_LEN + TCP_HEADER_LEN + optlen + length);
     th_info[id].iph->saddr = node->saddr;
     th_info[id].iph->daddr = node->daddr;
-    th_info[id].iph->check = ip_checksum((struct iphdr *)th_info[id].iph);	
+    th_info[id].iph->check = flow_ip_checksum(node, id);	
 	
 	ts_recent = node->ts_peer;
     generate_opt(++(node->ts), TCP_FLAG_ACK, (uint8_t *)th_info[id].tcph + TCP_HEADER_LEN, optlen, ts_recent);
@@ -895,15 +1208,17 @@ send_data_pkt(struct buf_node *node, uint32_t length, uint8_t p, uint16_t q, int
     th_info[id].tcph->fin = 0;
     th_info[id].tcph->ack = 1;
     th_info[id].tcph->psh = 1;
-	th_info[id].tcph->check = tcp_checksum((struct iphdr*)th_info[id].iph, (struct tcphdr*)th_info[id].tcph);	
 
-	/* Fill in the payload */
+	/* payload is sent from stream data, it is not copied into th_info[id].pkt */
 	payload_offset = HEADER_LEN + optlen;
+	payload = (const uint8_t *)node->tot_buf + node->offset;
 
 	/* debug */
 	if (rest_len < 0)
 		fprintf(stderr, "%d %d %d %d\n", length, node->len, node->offset, rest_len);
-	memcpy(((uint8_t *)th_info[id].pkt + payload_offset), ((uint8_t *)node->tot_buf + node->offset), length);
+
+	/* payload is covered by TCP checksum */
+	th_info[id].tcph->check = flow_tcp_checksum(node, id, payload, length);	
 
 #ifdef DUMP_PAYLOAD
     dump_data(node, length);
@@ -915,13 +1230,44 @@ send_data_pkt(struct buf_node *node, uint32_t length, uint8_t p, uint16_t q, int
     node->id++;
     node->seq += length;
 
-    dpdk_send_pkt((uint8_t *)th_info[id].pkt, HEADER_LEN + optlen + length, p, q, id, 2);
+    dpdk_send_data((uint8_t *)th_info[id].pkt, payload_offset, payload, length, p, q, id);
     /* send correspond ACK */
 #ifndef NO_ACK
 	send_ack(node, p, q, id);
 #endif
 }
 
+/* Description: capture time (us) of the packet libnids is handling */
+static inline uint64_t
+capture_time_us(void)
+{
+	if (nids_last_pcap_header == NULL)
+		return 0;
+	return (uint64_t)nids_last_pcap_header->ts.tv_sec * US_PER_S + nids_last_pcap_header->ts.tv_usec;
+}
+
+/* Description: record the segment just appended to stream data,
+ * 				keeping its boundary and capture time for replay mode
+ * */
+static void
+add_segment(struct buf_node *node, uint64_t now_us)
+{
+	/* capacity is the next power of 2, at least 8 */
+	if (node->nb_seg == 0 || (node->nb_seg >= 8 && (node->nb_seg & (node->nb_seg - 1)) == 0)) {
+		int cap = node->nb_seg ? node->nb_seg * 2 : 8;
+
+		node->segs = (struct seg_info *)realloc(node->segs, sizeof(struct seg_info) * cap);
+		if (node->segs == NULL) {
+			fprintf(stderr, "reallocate memory failed.\n");
+			exit(1);
+		}
+	}
+	node->segs[node->nb_seg].end = node->len;
+	node->segs[node->nb_seg].reserved = 0;
+	node->segs[node->nb_seg].ts = now_us - node->start_us;
+	node->nb_seg++;
+}
+
 /* Description: cache total data of streams, where data for the same stream will be stored in the same buffer
  * @ tup	: 4-tuple
  * @ data	: data chunk with message for the same stream
@@ -960,6 +1306,8 @@ store_stream_data(struct tuple4 tup, char *data, int length, int flag)
 			} else {
 				node = insert_buf_node(buf_list_t, (uint8_t *)data, length, tup);
 			}
+			node->start_us = capture_time_us();
+			add_segment(node, node->start_us);
 			
             return 0;
 		} else {	
@@ -978,6 +1326,7 @@ store_stream_data(struct tuple4 tup, char *data, int length, int flag)
                 memcpy(node->tot_buf + node->len, data, length);
                 node->len += length;
             }
+            add_segment(node, capture_time_us());
         }
 	} else if (flag == NIDS_CLOSE) {
 		/* Not used for now !! */
@@ -1072,8 +1421,14 @@ copy_stream_data(int nb_copy)
                 struct list_head *head_tmp = &hash_buf.buf_list[index];
                 /* Giving a same tuple4 does not matter here, 
                  * because tuple4 only matters while reading packets from pcap file.
+                 * Stream data is only read from now on, so the copy shares it.
                  * */
-                insert_buf_node(head_tmp, buf_entry->tot_buf, buf_entry->len, buf_entry->tup);
+                struct buf_node *node = link_buf_node(head_tmp, buf_entry->tot_buf, buf_entry->len, buf_entry->tup);
+                node->segs = buf_entry->segs;
+                node->nb_seg = buf_entry->nb_seg;
+                node->start_us = buf_entry->start_us;
+                node->flow = cnt + 1;
+                set_field(node);
                 
                 if(++cnt >= nb_copy) {
                     printf("Succeed in generating more stream data.(%d)\n", nb_copy);
@@ -1166,6 +1521,21 @@ init_thread_info(void)
             printf("Thread %d, creating mempool failed.\n", i);
             exit(1);
         }
+        th_info[i].free_mbufs.len = 0;
+
+#ifdef ZERO_COPY_TX
+		sprintf(name, "ext_pool_%d", i);
+        th_info[i].ext_pool = rte_pktmbuf_pool_create(name, MAX_MBUF_PER_THREAD,
+			 MBUF_CACHE_SIZE, 0, 0, rte_socket_id());
+        if(th_info[i].ext_pool == NULL) {
+            printf("Thread %d, creating mempool failed.\n", i);
+            exit(1);
+        }
+        /* one reference held for good, payload is never freed by TX */
+        th_info[i].shinfo.free_cb = extbuf_free_cb;
+        th_info[i].shinfo.fcb_opaque = NULL;
+        rte_mbuf_ext_refcnt_set(&th_info[i].shinfo, 1);
+#endif
     }
 }
 
@@ -1274,6 +1644,16 @@ send_streams(void)
         copy_stream_data( nb_concur + 1 - cnt);
     }
     nb_stream = counter();
+#ifdef ORIGINAL_TUPLE4
+    tuple_set_init(nb_stream);
+    for (i = 0; i < size; i++) {
+        struct buf_node *buf_entry;
+        list_for_each_entry(buf_entry, &hash_buf.buf_list[i], list) {
+            reserve_tuple(buf_entry);
+        }
+    }
+    tuple_set_free();
+#endif
 
     /* initialize packet header (ethernet header; IP header; TCP header)*/
 	prepare_header(0);
@@ -1330,61 +1710,306 @@ send_streams(void)
 
 #else    //#ifndef SEND_THREAD
     
-/* Copy data for every single sending thread */
+#ifdef ZERO_COPY_TX
+/* Description	: copy stream data into one IOVA-contiguous memzone, so that
+ * 				  payload can be attached to packets. Payload is copied into
+ * 				  packets if the port cannot send chained mbufs or there is
+ * 				  not enough contiguous memory.
+ * */
+static void
+init_payload_zone(void)
+{
+    int i;
+    size_t total = 0;
+    size_t off = 0;
+
+    for (i = 0; i < nb_trace; i++) {
+        total += trace[i].len;
+    }
+    if (!tx_multi_seg || total == 0) {
+        printf("\nPort does not send chained mbufs, payload is copied.\n");
+        return;
+    }
+
+    payload_zone = rte_memzone_reserve_aligned("sgen_payload", total, rte_socket_id(),
+            RTE_MEMZONE_IOVA_CONTIG, RTE_CACHE_LINE_SIZE);
+    if (payload_zone == NULL) {
+        printf("\nNo IOVA-contiguous memory for %zu bytes of stream data, payload is copied.\n", total);
+        return;
+    }
+
+    for (i = 0; i < nb_trace; i++) {
+        uint8_t *buf = (uint8_t *)payload_zone->addr + off;
+
+        rte_memcpy(buf, trace[i].buf, trace[i].len);
+        trace[i].buf = buf;
+        off += trace[i].len;
+    }
+    printf("\n%zu bytes of stream data sent without copy\n", total);
+}
+#endif
+
+static uint64_t             trace_start_us;
+
+/* Description	: find where the capture starts and how long it lasts,
+ * 				  which sets the replay period
+ * */
+static void
+init_replay_schedule(void)
+{
+    int i;
+    uint64_t end_us = 0;
+    uint64_t period_us;
+
+    trace_start_us = UINT64_MAX;
+    for (i = 0; i < nb_trace; i++) {
+        uint64_t last = trace[i].nb_seg ? trace[i].segs[trace[i].nb_seg - 1].ts : 0;
+
+        if (trace[i].start_us < trace_start_us)
+            trace_start_us = trace[i].start_us;
+        if (trace[i].start_us + last > end_us)
+            end_us = trace[i].start_us + last;
+    }
+
+    replay_tsc_per_us = (double)rte_get_tsc_hz() / US_PER_S / replay_speed;
+    /* the trace repeats once all of it is replayed, at least every tick */
+    period_us = end_us - trace_start_us;
+    if (period_us < WHEEL_TICK_US)
+        period_us = WHEEL_TICK_US;
+    replay_period_tsc = (uint64_t)(period_us * replay_tsc_per_us);
+    if (replay_period_tsc == 0)
+        replay_period_tsc = 1;
+
+    printf("\nReplay %.3fs of capture at speed x%g\n", (double)period_us / US_PER_S, replay_speed);
+}
+
+/* Description	: offset (TSC cycles) of the first start of a flow from the
+ * 				  start of replay. A flow starts when its stream did in the
+ * 				  capture; flows replaying the same stream are spread evenly
+ * 				  over the period so that they do not all start at once.
+ * */
+static uint64_t
+replay_start_offset(struct buf_node *node, int nb_flow)
+{
+    uint32_t nb_copy = (nb_flow + nb_trace - 1) / nb_trace;
+    uint32_t copy = node->flow / nb_trace;
+
+    return (uint64_t)((node->start_us - trace_start_us) * replay_tsc_per_us)
+        + replay_period_tsc * copy / nb_copy;
+}
+
+/* Set up the virtual flows of every sending thread. Concurrency is reached
+ * by replaying each captured stream as many flows with derived 4-tuples,
+ * not by copying streams: all flows share the (read-only) stream data and
+ * only keep their own sequence numbers, offsets and TCP state. */
 static void
 copy_data_per_thread(void)
 {
     int i, k;
     int cnt;
-    int node_size = sizeof(struct buf_node);
     /* TODO: may modify nids_params.n_tcp_streams later*/
     int size = nids_params.n_tcp_streams;
 
     srand((int)time(0));
-    cnt = counter();
-    /* if there is no enough stream data, copy to generate more data*/
-    if (cnt < nb_concur - 1) {
-        copy_stream_data( nb_concur + 1 - cnt);
+    nb_trace = counter();
+    nb_stream = nb_trace;
+    if (nb_trace <= 0) {
+        printf("No stream data to send.\n");
+        exit(1);
     }
-    nb_stream = counter();
-    
-    for(i = 0; i < nb_snd_thread; i++) {
-        th_info[i].nodes = (struct buf_node **)malloc(sizeof(struct buf_node *) * nb_stream);
+
+    trace = (struct stream_ref *)malloc(sizeof(struct stream_ref) * nb_trace);
+    if (trace == NULL) {
+        printf("Allocate memory for stream table failed.\n");
+        exit(1);
     }
 
     cnt = 0;
     for (i = 0; i < size; i++) {
         struct list_head *head = &hash_buf.buf_list[i];
-        struct buf_node *buf_entry, *q;
-        list_for_each_entry_safe(buf_entry, q, head, list) {
-            for (k = 0; k < nb_snd_thread; k++) {
-                th_info[k].nodes[cnt] = (struct buf_node*)malloc(node_size);
-                th_info[k].nodes[cnt]->tot_buf = (uint8_t *)malloc(sizeof(uint8_t) * buf_entry->len);
-                if (th_info[k].nodes[cnt] == NULL || th_info[k].nodes[cnt]->tot_buf == NULL) {
-                    printf("Allocate memory for buf_node failed.\n");
-                    exit(1);
-                }
-                memcpy(th_info[k].nodes[cnt], buf_entry, node_size);
-                memcpy(th_info[k].nodes[cnt]->tot_buf, buf_entry->tot_buf, buf_entry->len);
-                
-                set_field(th_info[k].nodes[cnt]);
-            }
+        struct buf_node *buf_entry;
+        list_for_each_entry(buf_entry, head, list) {
+            trace[cnt].buf = buf_entry->tot_buf;
+            trace[cnt].len = buf_entry->len;
+            trace[cnt].tup = buf_entry->tup;
+            trace[cnt].segs = buf_entry->segs;
+            trace[cnt].nb_seg = buf_entry->nb_seg;
+            trace[cnt].start_us = buf_entry->start_us;
             cnt++;
         }
     }
-    if (cnt < nb_stream) {
-        printf("\nWarning: number of stream copied is less than  number of stream read.(cnt:%d, nb_stream:%d)\n", cnt, nb_stream);
+
+#ifdef ZERO_COPY_TX
+    init_payload_zone();
+#endif
+
+    if (replay_speed > 0) {
+        init_replay_schedule();
+    }
+#ifdef ORIGINAL_TUPLE4
+    tuple_set_init(concur_per_thread * nb_snd_thread);
+#endif
+
+    for (k = 0; k < nb_snd_thread; k++) {
+        th_info[k].nb_node = concur_per_thread;
+        th_info[k].nodes = (struct buf_node *)calloc(concur_per_thread, sizeof(struct buf_node));
+        if (th_info[k].nodes == NULL) {
+            printf("Allocate memory for buf_node failed.\n");
+            exit(1);
+        }
+
+        for (i = 0; i < concur_per_thread; i++) {
+            struct buf_node *node = &th_info[k].nodes[i];
+            /* flows are dealt to threads round-robin, as streams were */
+            uint32_t flow = i * nb_snd_thread + k;
+            struct stream_ref *ref = &trace[flow % nb_trace];
+
+            node->tup = ref->tup;
+            node->tot_buf = ref->buf;
+            node->len = ref->len;
+            node->segs = ref->segs;
+            node->nb_seg = ref->nb_seg;
+            node->start_us = ref->start_us;
+            node->flow = flow;
+#ifdef ORIGINAL_TUPLE4
+            reserve_tuple(node);
+#else
+            set_field(node);
+#endif
+
+            if (replay_speed > 0) {
+                node->base_tsc = replay_start_offset(node, concur_per_thread * nb_snd_thread);
+            }
+        }
     }
+#ifdef ORIGINAL_TUPLE4
+    tuple_set_free();
+#endif
+    printf("\n%d virtual flows replaying %d streams\n", concur_per_thread * nb_snd_thread, nb_trace);
 }
 
-/* Free stream data copied before */
+/* Free virtual flows set up before */
 void
 destroy_data_per_thread(void)
 {
 	int i;
 	for (i = 0; i < nb_snd_thread; i++) {
 		free(th_info[i].nodes);
+		th_info[i].nodes = NULL;
 	}
+	free(trace);
+	trace = NULL;
+}
+
+/* Description	: put a flow into the timing wheel according to its due_tsc */
+static inline void
+wheel_add(struct timing_wheel *w, struct buf_node *node)
+{
+    uint64_t tick = 0;
+
+    if (node->due_tsc > w->start_tsc)
+        tick = (node->due_tsc - w->start_tsc) / w->tick_tsc;
+    /* overdue flows go to the tick being expired */
+    if (tick < w->cur)
+        tick = w->cur;
+    node->due_tick = tick;
+    list_add_tail(&node->list, &w->slot[tick & (WHEEL_SLOTS - 1)]);
+}
+
+/* Description	: send the next packet of a flow in replay mode and schedule
+ * 				  the one after. Data goes out with captured segment
+ * 				  boundaries at captured time; handshake, ACKs and FINs
+ * 				  follow without delay.
+ * */
+static void
+replay_step(struct buf_node *node, int id)
+{
+    uint64_t now = rte_rdtsc();
+
+    if (node->state == TCP_ST_ESTABLISHED) {
+        struct replay_statistics *rs = &th_info[id].rstats;
+        uint32_t end = node->seg < node->nb_seg ? node->segs[node->seg].end : (uint32_t)node->len;
+        uint32_t length = end > (uint32_t)node->offset ? end - node->offset : 1;
+        uint64_t err = now > node->due_tsc ? now - node->due_tsc : node->due_tsc - now;
+
+        rs->nb_seg++;
+        rs->err_sum += err;
+        if (err > rs->err_max)
+            rs->err_max = err;
+        if (now > node->due_tsc + th_info[id].wheel.tick_tsc)
+            rs->late++;
+
+        /* segments larger than MSS (merged by reassembly) are split */
+        if (length > MAX_SEG_SIZE)
+            length = MAX_SEG_SIZE;
+        send_data_pkt(node, length, snd_port, id, id);
+        while (node->seg < node->nb_seg && (uint32_t)node->offset >= node->segs[node->seg].end)
+            node->seg++;
+    } else {
+        send_packet(node, 1, snd_port, id, id);
+    }
+
+    if (node->state == TCP_ST_CLOSED) {
+        /* stream finished, replay it again in the next period */
+        node->base_tsc += replay_period_tsc;
+        node->due_tsc = node->base_tsc;
+    } else if (node->state == TCP_ST_ESTABLISHED && node->seg < node->nb_seg) {
+        node->due_tsc = node->base_tsc + (uint64_t)(node->segs[node->seg].ts * replay_tsc_per_us);
+    } else {
+        node->due_tsc = now;
+    }
+    wheel_add(&th_info[id].wheel, node);
+}
+
+/* Main loop for sending thread in replay mode */
+static void
+replay_loop(int th_id)
+{
+    struct timing_wheel *w = &th_info[th_id].wheel;
+    struct buf_node *node, *q;
+    uint64_t tick;
+    int i, more;
+
+    for (i = 0; i < WHEEL_SLOTS; i++) {
+        init_list_head(&w->slot[i]);
+    }
+    w->tick_tsc = US_TO_TSC(WHEEL_TICK_US);
+    w->start_tsc = rte_rdtsc();
+    w->cur = 0;
+
+    for (i = 0; i < th_info[th_id].nb_node; i++) {
+        node = &th_info[th_id].nodes[i];
+        node->base_tsc += w->start_tsc;
+        node->due_tsc = node->base_tsc;
+        wheel_add(w, node);
+    }
+
+    while (!force_quit) {
+        tick = (rte_rdtsc() - w->start_tsc) / w->tick_tsc;
+
+        while (w->cur <= tick && !force_quit) {
+            struct list_head *slot = &w->slot[w->cur & (WHEEL_SLOTS - 1)];
+
+            /* flows due right away are added back to the current slot */
+            do {
+                more = 0;
+                list_for_each_entry_safe(node, q, slot, list) {
+                    if (node->due_tick > w->cur)
+                        continue;       // a later round of the wheel
+                    list_delete_entry(&node->list);
+                    replay_step(node, th_id);
+                    more = 1;
+                }
+            } while (more && !force_quit);
+            w->cur++;
+        }
+
+        /* packets of this tick are not held back for a full burst */
+        if (th_info[th_id].tx_mbufs.len > 0) {
+            dpdk_send_burst(snd_port, th_id, th_id, DATA_PKT);
+            th_info[th_id].tx_mbufs.len = 0;
+        }
+    }
 }
 
 /* Main loop for sending thread */
@@ -1401,26 +2026,33 @@ send_loop(void* args)
     /* initialize packet header (ethernet header; IP header; TCP header)*/
 	prepare_header(th_id);
 
+    if (replay_speed > 0) {
+        replay_loop(th_id);
+        printf("Thread %d exit.\n", th_id);
+        return NULL;
+    }
+
     n_part = 25 + th_id;
     while(!force_quit) {
         cnt = 0;
 
         /* Sending 'concur_per_thread' packets */
-        for (i = th_id ; i < nb_stream; i+= nb_snd_thread) {
+        for (i = 0; i < th_info[th_id].nb_node; i++) {
+            struct buf_node *node = &th_info[th_id].nodes[i];
             /* skip packets with small payload */
 			#if 0
-            if (is_len_fixed && th_info[th_id].nodes[i]->len < len_cut){
+            if (is_len_fixed && node->len < len_cut){
                 continue;
             }
 			#endif
             /* Keep sending several packets of a stream */
             n_snd = rand() % 3 + 1;         // 1 ~ 3
             while (n_snd--) {
-				if (th_info[th_id].nodes[i]->state == TCP_ST_FIN_SENT_2) {
-					send_packet(th_info[th_id].nodes[i], n_part, snd_port, th_id, th_id);
+				if (node->state == TCP_ST_FIN_SENT_2) {
+					send_packet(node, n_part, snd_port, th_id, th_id);
 					break;
 				} else {
-					send_packet(th_info[th_id].nodes[i], n_part, snd_port, th_id, th_id);
+					send_packet(node, n_part, snd_port, th_id, th_id);
 				}
             }
             cnt++;
@@ -1449,12 +2081,6 @@ run_send_threads(void)
     //int nb_cores = 20;   
     printf("CPU available : %d\nSending Threads :%d(Maximum %d)\n", nb_cores, nb_snd_thread, NUM_SEND_THREAD);
     
-    /* copy total stream data for every thread */
-    copy_data_per_thread();
-	
-	/* Free hash buffer table*/
-	destroy_hash_buf();
-    
     /* concurrency per thread */
     concur_per_thread = nb_concur / nb_snd_thread;
     if(concur_per_thread <= 0) {
@@ -1462,6 +2088,12 @@ run_send_threads(void)
         exit(1);
     }
 
+    /* set up virtual flows of every thread */
+    copy_data_per_thread();
+	
+	/* Free hash buffer table, stream data is kept for the flows */
+	destroy_hash_buf();
+
     /* Initializing !!! */
 	init_thread_info();
 
@@ -1,7 +1,11 @@
 #include "log.h"
 #include "posix_connection.h"
+#include "reactor.h"
+#include "smp.h"
 #include "tcp_server.h"
 
+#include <linux/filter.h>
+
 namespace infgen {
 extern logger net_logger;
 tcp_server::tcp_server()
@@ -21,25 +25,38 @@ bool tcp_server::bind(const socket_address& sa, bool reuse_addr) {
     posix_socket::set_reuseport(fd.get());
     fd.bind(sa.u.sa, sizeof(sa.u.sas));
     fd.listen(listen_queue_);
-
-    local_ = sa;
-    ipv4_addr addr(sa);
-    net_logger.trace("server listening on {}", addr);
-
-    listen_fd_ = std::make_shared<pollable_fd>(fd);
-    listen_fd_->when_readable([=] {
-      listen_fd_->enable_read();
-      accept();
-    });
-    listen_fd_->attach_to_loop();
-
   } catch (std::system_error& e) {
     net_logger.error("fd {} error: {}", fd.get(), e.what());
     return false;
   }
+  return serve(std::move(fd), sa);
+}
+
+bool tcp_server::serve(file_desc fd, const socket_address& sa) {
+  local_ = sa;
+  ipv4_addr addr(sa);
+  net_logger.trace("server listening on {}", addr);
+
+  listen_fd_ = std::make_shared<pollable_fd>(std::move(fd));
+  // accept() drains the backlog
+  listen_fd_->set_edge_triggered(true);
+  listen_fd_->when_readable([=] {
+    listen_fd_->enable_read();
+    accept();
+  });
+  listen_fd_->attach_to_loop();
   return true;
 }
 
+void tcp_server::close() {
+  if (!listen_fd_) {
+    return;
+  }
+  listen_fd_->detach_from_loop();
+  listen_fd_->close_fd();
+  listen_fd_ = nullptr;
+}
+
 svrptr tcp_server::create_tcp_server(const socket_address& sa,
                                      bool reuse_port) {
   svrptr p(new tcp_server());
@@ -51,27 +68,40 @@ svrptr tcp_server::create_tcp_server(const socket_address& sa,
 }
 
 void tcp_server::accept() {
-  file_desc lfd = listen_fd_->get_file_desc();
-  try {
-    socklen_t len = sizeof(local_.u.sas);
-    file_desc cfd = lfd.accept(local_.u.sa, &len);
-
-    sockaddr_in peer, local;
-    cfd.getpeername((sockaddr*)&peer);
-    cfd.getsockname((sockaddr*)&local);
+  int lfd = listen_fd_->get_file_desc().get();
+  // a wildcard listener has to ask every connection for its local address
+  bool wildcard = local_.u.in.sin_addr.s_addr == htonl(INADDR_ANY);
+  for (;;) {
+    sockaddr_in peer, local = local_.u.in;
+    socklen_t len = sizeof(peer);
+    int fd = ::accept4(lfd, (sockaddr*)&peer, &len, SOCK_NONBLOCK | SOCK_CLOEXEC);
+    if (fd < 0) {
+      if (errno == EINTR || errno == ECONNABORTED) {
+        continue;
+      }
+      if (errno != EAGAIN && errno != EWOULDBLOCK) {
+        net_logger.warn("accept error: {}", strerror(errno));
+      }
+      return;
+    }
+    accepted_++;
+    if (wildcard) {
+      len = sizeof(local);
+      ::getsockname(fd, (sockaddr*)&local, &len);
+    }
 
     auto local_sock = socket_address(local);
     auto peer_sock = socket_address(peer);
 
     ipv4_addr addr(peer_sock);
-    net_logger.trace("connection from {} fd {} accept", addr, cfd.get());
+    net_logger.trace("connection from {} fd {} accept", addr, fd);
     connptr con = createcb_();
-    con->attach(cfd.get(), local_sock, peer_sock);
+    con->attach(fd, local_sock, peer_sock);
     if (readycb_) {
       con->when_ready(readycb_);
     }
     if (failedcb_) {
-      con->when_ready(failedcb_);
+      con->when_failed(failedcb_);
     }
     if (disconnect_cb_) {
       con->when_disconnect(disconnect_cb_);
@@ -82,9 +112,105 @@ void tcp_server::accept() {
     if (msgcb_) {
       con->on_message(msgcb_);
     }
+  }
+}
+
+sharded_svrptr sharded_tcp_server::listen(const socket_address& sa, setup_func setup,
+                                          bool steer, std::function<void()> ready) {
+  sharded_svrptr s(new sharded_tcp_server(sa));
+  unsigned n = smp::count;
+  std::vector<file_desc> fds;
+  // One after the other in reactor order: a listener's index in the
+  // reuseport group is the order it started listening in, which is what
+  // the steering program returns.
+  try {
+    for (unsigned i = 0; i < n; i++) {
+      fds.push_back(file_desc::socket(sa.u.in.sin_family,
+                                      SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0));
+      posix_socket::set_reuseport(fds.back().get());
+      fds.back().bind(sa.u.sa, sizeof(sa.u.sas));
+      fds.back().listen(1024);
+    }
   } catch (std::system_error& e) {
-    net_logger.error("accept error: {}", e.what());
+    net_logger.warn("cannot listen on {}: {}", ipv4_addr(sa), e.what());
+    for (auto& fd : fds) {
+      fd.close();
+    }
+    return nullptr;
+  }
+  if (steer && !steer_by_cpu(fds[0].get())) {
+    net_logger.warn("no cpu steering on {}, connections are spread by hash", ipv4_addr(sa));
+  }
+
+  s->shards_.resize(n);
+  s->pending_ = n;
+  for (unsigned i = 0; i < n; i++) {
+    int fd = fds[i].get();
+    smp::submit_to(i, [s, i, fd, setup] {
+      auto svr = std::make_shared<tcp_server>();
+      if (setup) {
+        setup(*svr);
+      }
+      svr->serve(file_desc(fd), s->local_);
+      s->shards_[i] = svr;
+    }, [s, ready] {
+      if (--s->pending_ == 0 && ready) {
+        ready();
+      }
+    });
+  }
+  net_logger.info("listening on {} from {} reactors{}", ipv4_addr(sa), n,
+                  steer ? ", steered by cpu" : "");
+  return s;
+}
+
+void sharded_tcp_server::close(std::function<void(std::vector<uint64_t>)> done) {
+  auto self = shared_from_this();
+  unsigned n = shards_.size();
+  accepted_.assign(n, 0);
+  pending_ = n;
+  for (unsigned i = 0; i < n; i++) {
+    smp::submit_to(i, [self, i] {
+      auto& svr = self->shards_[i];
+      uint64_t accepted = 0;
+      if (svr) {
+        svr->close();
+        accepted = svr->accepted();
+        svr = nullptr;
+      }
+      return accepted;
+    }, std::function<void(uint64_t)>([self, i, done](uint64_t accepted) {
+      self->accepted_[i] = accepted;
+      if (--self->pending_ == 0 && done) {
+        done(self->accepted_);
+      }
+    }));
   }
+}
 
+bool sharded_tcp_server::steer_by_cpu(int fd) {
+  auto& cpus = smp::layout().app;
+  unsigned n = smp::count;
+  if (cpus.size() < n) {
+    return false;
+  }
+  // A = cpu; if (A == cpu of reactor i) return i; ... return n
+  // An index past the group makes the kernel fall back to the hash.
+  std::vector<sock_filter> code;
+  code.push_back(BPF_STMT(BPF_LD | BPF_W | BPF_ABS, uint32_t(SKF_AD_OFF + SKF_AD_CPU)));
+  for (unsigned i = 0; i < n; i++) {
+    code.push_back(BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, cpus[i], 0, 1));
+    code.push_back(BPF_STMT(BPF_RET | BPF_K, i));
+  }
+  code.push_back(BPF_STMT(BPF_RET | BPF_K, n));
+
+  sock_fprog prog;
+  prog.len = code.size();
+  prog.filter = code.data();
+  if (::setsockopt(fd, SOL_SOCKET, SO_ATTACH_REUSEPORT_CBPF, &prog, sizeof(prog)) != 0) {
+    net_logger.warn("SO_ATTACH_REUSEPORT_CBPF: {}", strerror(errno));
+    return false;
+  }
+  return true;
 }
 }  // namespace infgen
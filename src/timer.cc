@@ -13,32 +13,45 @@ size_t timer_manager::size() {
 }
 
 void timer_manager::tick() {
-  if (timers_.empty()) {
-    return;
-  }
-
-  for (auto it = timers_.begin(); it != timers_.end(); it++) {
-    auto now = system_clock::now();
+  // timers that fall due while this runs wait for the next tick, so a
+  // periodic timer that is behind catches up but cannot spin here forever
+  const auto now = system_clock::now();
+  while (!timers_.empty()) {
+    auto it = timers_.begin();
     if (now < it->first) {
       return;
     }
-    it->second.alarm();
     timer t(std::move(it->second));
     timers_.erase(it);
 
-    if (t.count_ != 0) {
+    firing_ = t.id_;
+    firing_cancelled_ = false;
+    t.alarm();
+    firing_.reset();
+
+    if (t.count_ != 0 && !firing_cancelled_) {
       const auto tp = t.id_->first;
-      auto it_new = timers_.insert(std::make_pair(tp, std::move(t)));
-      if (it == timers_.end() || it_new->first < it->first) {
-        it = it_new;
-      }
+      timers_.insert(std::make_pair(tp, std::move(t)));
     }
-
   }
 }
 
-bool timer_manager::cancel(timer_id id) {
-  return true;
+bool timer_manager::cancel(const timer_id &id) {
+  if (!id) {
+    return false;
+  }
+  if (id == firing_) {
+    firing_cancelled_ = true;
+    return true;
+  }
+  auto range = timers_.equal_range(id->first);
+  for (auto it = range.first; it != range.second; it++) {
+    if (it->second.id_ == id) {
+      timers_.erase(it);
+      return true;
+    }
+  }
+  return false;
 }
 
 microseconds timer_manager::latest_timeout() const {
@@ -0,0 +1,453 @@
+#include "log.h"
+#include "reactor.h"
+#include "uring.h"
+
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+namespace infgen {
+
+extern logger net_logger;
+
+static void *map_ring(int fd, size_t len, off_t off) {
+  void *p = ::mmap(nullptr, len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, off);
+  net_logger.fatalif(p == MAP_FAILED, "io_uring mmap failed: {}", strerror(errno));
+  return p;
+}
+
+uring_backend::uring_backend(const config &cfg) {
+  io_uring_params p{};
+  // completions of multishot recvs pile up faster than submissions
+  p.flags = IORING_SETUP_CQSIZE | IORING_SETUP_SINGLE_ISSUER |
+            IORING_SETUP_COOP_TASKRUN | IORING_SETUP_TASKRUN_FLAG;
+  p.cq_entries = cfg.entries * 4;
+  ring_fd_ = ::syscall(__NR_io_uring_setup, cfg.entries, &p);
+  if (ring_fd_ < 0 && errno == EINVAL) {
+    p = io_uring_params{};
+    p.flags = IORING_SETUP_CQSIZE;
+    p.cq_entries = cfg.entries * 4;
+    ring_fd_ = ::syscall(__NR_io_uring_setup, cfg.entries, &p);
+  }
+  net_logger.fatalif(ring_fd_ < 0, "io_uring_setup failed: {}", strerror(errno));
+  features_ = p.features;
+
+  sq_len_ = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+  cq_len_ = p.cq_off.cqes + p.cq_entries * sizeof(io_uring_cqe);
+  if (features_ & IORING_FEAT_SINGLE_MMAP) {
+    sq_len_ = cq_len_ = std::max(sq_len_, cq_len_);
+  }
+  sq_ptr_ = map_ring(ring_fd_, sq_len_, IORING_OFF_SQ_RING);
+  cq_ptr_ = (features_ & IORING_FEAT_SINGLE_MMAP)
+                ? sq_ptr_ : map_ring(ring_fd_, cq_len_, IORING_OFF_CQ_RING);
+  sqes_len_ = p.sq_entries * sizeof(io_uring_sqe);
+  sqes_ = static_cast<io_uring_sqe *>(map_ring(ring_fd_, sqes_len_, IORING_OFF_SQES));
+
+  auto sq = static_cast<char *>(sq_ptr_);
+  sq_head_ = reinterpret_cast<unsigned *>(sq + p.sq_off.head);
+  sq_tail_ = reinterpret_cast<unsigned *>(sq + p.sq_off.tail);
+  sq_mask_ = reinterpret_cast<unsigned *>(sq + p.sq_off.ring_mask);
+  sq_flags_ = reinterpret_cast<unsigned *>(sq + p.sq_off.flags);
+  sq_entries_ = p.sq_entries;
+  auto array = reinterpret_cast<unsigned *>(sq + p.sq_off.array);
+  for (unsigned i = 0; i < sq_entries_; i++) {
+    array[i] = i;
+  }
+  sq_local_tail_ = *sq_tail_;
+
+  auto cq = static_cast<char *>(cq_ptr_);
+  cq_head_ = reinterpret_cast<unsigned *>(cq + p.cq_off.head);
+  cq_tail_ = reinterpret_cast<unsigned *>(cq + p.cq_off.tail);
+  cq_mask_ = reinterpret_cast<unsigned *>(cq + p.cq_off.ring_mask);
+  cqes_ = reinterpret_cast<io_uring_cqe *>(cq + p.cq_off.cqes);
+
+  // the kernel takes at most 32768 buffers per ring
+  nr_bufs_ = 1;
+  while (nr_bufs_ < cfg.buffers && nr_bufs_ < 32768) {
+    nr_bufs_ <<= 1;
+  }
+  buf_size_ = cfg.buffer_size;
+  buf_ring_len_ = nr_bufs_ * sizeof(io_uring_buf);
+  buf_len_ = size_t(nr_bufs_) * buf_size_;
+  void *ring = ::mmap(nullptr, buf_ring_len_, PROT_READ | PROT_WRITE,
+                      MAP_PRIVATE | MAP_ANONYMOUS | MAP_POPULATE, -1, 0);
+  void *bufs = ::mmap(nullptr, buf_len_, PROT_READ | PROT_WRITE,
+                      MAP_PRIVATE | MAP_ANONYMOUS | MAP_POPULATE, -1, 0);
+  net_logger.fatalif(ring == MAP_FAILED || bufs == MAP_FAILED,
+                     "cannot map {} receive buffers: {}", nr_bufs_, strerror(errno));
+  buf_ring_ = static_cast<io_uring_buf_ring *>(ring);
+  buf_base_ = static_cast<char *>(bufs);
+
+  io_uring_buf_reg reg{};
+  reg.ring_addr = reinterpret_cast<uint64_t>(buf_ring_);
+  reg.ring_entries = nr_bufs_;
+  reg.bgid = buffer_group;
+  int r = ::syscall(__NR_io_uring_register, ring_fd_, IORING_REGISTER_PBUF_RING, &reg, 1);
+  net_logger.fatalif(r != 0, "cannot register receive buffers ({}), "
+                     "the uring stack needs Linux 6.0 or later", strerror(errno));
+  for (unsigned i = 0; i < nr_bufs_; i++) {
+    recycle(i);
+  }
+}
+
+uring_backend::~uring_backend() {
+  // closing the ring cancels what is still in flight
+  if (ring_fd_ >= 0) {
+    ::close(ring_fd_);
+  }
+  for (auto &s : socks_) {
+    if (s.owns_fd && s.fd >= 0) {
+      ::close(s.fd);
+    }
+  }
+  ::munmap(sqes_, sqes_len_);
+  if (cq_ptr_ != sq_ptr_) {
+    ::munmap(cq_ptr_, cq_len_);
+  }
+  ::munmap(sq_ptr_, sq_len_);
+  ::munmap(buf_ring_, buf_ring_len_);
+  ::munmap(buf_base_, buf_len_);
+}
+
+io_uring_sqe *uring_backend::get_sqe() {
+  if (sq_local_tail_ - __atomic_load_n(sq_head_, __ATOMIC_ACQUIRE) >= sq_entries_) {
+    // more queued in this iteration than the ring holds
+    enter(to_submit_, 0, 0);
+    net_logger.fatalif(sq_local_tail_ - __atomic_load_n(sq_head_, __ATOMIC_ACQUIRE) >= sq_entries_,
+                       "io_uring submission queue stuck full");
+  }
+  auto sqe = &sqes_[sq_local_tail_ & *sq_mask_];
+  std::memset(sqe, 0, sizeof(*sqe));
+  sq_local_tail_++;
+  to_submit_++;
+  return sqe;
+}
+
+void uring_backend::queue(sock *s, op o, io_uring_sqe *sqe) {
+  sqe->user_data = reinterpret_cast<uint64_t>(s) | o;
+  s->inflight++;
+  s->armed |= 1u << o;
+  engine().start_epoll();
+}
+
+void uring_backend::cancel(sock *s, op o) {
+  if (s->armed & (1u << o)) {
+    auto sqe = get_sqe();
+    sqe->opcode = IORING_OP_ASYNC_CANCEL;
+    sqe->fd = -1;
+    sqe->addr = reinterpret_cast<uint64_t>(s) | o;
+    sqe->user_data = op_cancel;
+  }
+}
+
+int uring_backend::enter(unsigned to_submit, unsigned min_complete, int timeout) {
+  __atomic_store_n(sq_tail_, sq_local_tail_, __ATOMIC_RELEASE);
+  unsigned flags = 0;
+  if (min_complete || (__atomic_load_n(sq_flags_, __ATOMIC_RELAXED) &
+                       (IORING_SQ_TASKRUN | IORING_SQ_CQ_OVERFLOW))) {
+    flags |= IORING_ENTER_GETEVENTS;
+  }
+  io_uring_getevents_arg arg{};
+  __kernel_timespec ts{};
+  void *argp = nullptr;
+  size_t argsz = 0;
+  if (min_complete && timeout > 0 && (features_ & IORING_FEAT_EXT_ARG)) {
+    ts.tv_sec = timeout / 1000;
+    ts.tv_nsec = (timeout % 1000) * 1000000L;
+    arg.ts = reinterpret_cast<uint64_t>(&ts);
+    argp = &arg;
+    argsz = sizeof(arg);
+    flags |= IORING_ENTER_EXT_ARG;
+  }
+  int r = ::syscall(__NR_io_uring_enter, ring_fd_, to_submit, min_complete, flags, argp, argsz);
+  stats_.enters++;
+  if (r < 0) {
+    if (errno != EINTR && errno != EAGAIN && errno != EBUSY && errno != ETIME) {
+      net_logger.warn("io_uring_enter failed: {}", strerror(errno));
+    }
+    return 0;
+  }
+  to_submit_ -= r;
+  stats_.requests += r;
+  return r;
+}
+
+bool uring_backend::poll(int timeout) {
+  bool ready = __atomic_load_n(cq_tail_, __ATOMIC_ACQUIRE) != *cq_head_;
+  // the kernel only posts completions while we are inside a syscall
+  if (to_submit_ || (__atomic_load_n(sq_flags_, __ATOMIC_RELAXED) &
+                     (IORING_SQ_TASKRUN | IORING_SQ_CQ_OVERFLOW))) {
+    enter(to_submit_, (timeout && !ready) ? 1 : 0, timeout);
+  } else if (timeout && !ready) {
+    enter(0, 1, timeout);
+  }
+  return reap() > 0;
+}
+
+unsigned uring_backend::reap() {
+  // a handler may fill the submission queue and get here again
+  if (reaping_) {
+    return 0;
+  }
+  reaping_ = true;
+  unsigned n = 0;
+  unsigned head = *cq_head_;
+  while (head != __atomic_load_n(cq_tail_, __ATOMIC_ACQUIRE)) {
+    auto cqe = cqes_[head & *cq_mask_];
+    __atomic_store_n(cq_head_, ++head, __ATOMIC_RELEASE);
+    n++;
+    if (cqe.user_data == op_cancel) {
+      continue;
+    }
+    auto s = reinterpret_cast<sock *>(cqe.user_data & ~op_mask);
+    auto o = static_cast<op>(cqe.user_data & op_mask);
+    bool more = cqe.flags & IORING_CQE_F_MORE;
+    complete(s, o, cqe.res, cqe.flags);
+    // s is kept until its last request completed
+    if (!more && --s->inflight == 0 && s->closing) {
+      put_sock(s);
+    }
+  }
+  stats_.completions += n;
+  reaping_ = false;
+  return n;
+}
+
+void uring_backend::complete(sock *s, op o, int res, uint32_t flags) {
+  bool more = flags & IORING_CQE_F_MORE;
+  if (!more) {
+    s->armed &= ~(1u << o);
+  }
+  switch (o) {
+  case op_poll_in:
+  case op_poll_out: {
+    // errors and hangups complete either direction, as with epoll
+    int event = o == op_poll_in ? EPOLLIN : EPOLLOUT;
+    if (s->state) {
+      auto &state = *s->state;
+      // a failed or cancelled poll is disarmed too, so the next request
+      // arms it again; only a completed one fires
+      state.events_epoll &= ~event;
+      if (res >= 0 && (state.events_requested & event)) {
+        state.events_requested &= ~event;
+        if (event == EPOLLIN) {
+          state.pollin();
+        } else {
+          state.pollout();
+        }
+      }
+    }
+    break;
+  }
+  case op_connect:
+    if (s->handler) {
+      s->handler->on_connected(res);
+    }
+    break;
+  case op_recv:
+    if (res > 0 && (flags & IORING_CQE_F_BUFFER)) {
+      uint16_t bid = flags >> IORING_CQE_BUFFER_SHIFT;
+      if (s->handler) {
+        s->handler->on_received(buf_base_ + size_t(bid) * buf_size_, res);
+      }
+      recycle(bid);
+    } else if (res == -ENOBUFS) {
+      stats_.no_buffers++;
+    }
+    if (!more && s->handler) {
+      if (res > 0 || res == -ENOBUFS) {
+        // the multishot recv ended, not the stream
+        recv(s);
+      } else {
+        s->handler->on_received(nullptr, res);
+      }
+    }
+    break;
+  case op_send:
+    if (res > 0) {
+      s->send_ptr += res;
+      s->send_left -= res;
+      if (s->send_left == 0) {
+        auto &done = s->out_[s->sending];
+        done.consume(done.size());
+        auto &next = s->out_[s->sending ^ 1];
+        if (!next.empty()) {
+          s->sending ^= 1;
+          s->send_ptr = next.begin();
+          s->send_left = next.size();
+        }
+      }
+      if (s->send_left) {
+        submit_send(s);
+      }
+    } else {
+      s->out_[0].clear();
+      s->out_[1].clear();
+      s->send_left = 0;
+    }
+    if (s->handler) {
+      s->handler->on_sent(res > 0 ? res : (res ? res : -EPIPE));
+    }
+    break;
+  default:
+    break;
+  }
+}
+
+void uring_backend::recycle(uint16_t bid) {
+  // bufs[] of the uapi header is off by the empty struct C++ gives a
+  // size, entries start at the ring itself. Fields are set one by one,
+  // resv of the first entry is the tail.
+  auto &b = reinterpret_cast<io_uring_buf *>(buf_ring_)[buf_tail_ & (nr_bufs_ - 1)];
+  b.addr = reinterpret_cast<uint64_t>(buf_base_ + size_t(bid) * buf_size_);
+  b.len = buf_size_;
+  b.bid = bid;
+  __atomic_store_n(&buf_ring_->tail, ++buf_tail_, __ATOMIC_RELEASE);
+}
+
+uring_backend::sock *uring_backend::get_sock(int fd) {
+  sock *s;
+  if (free_socks_.empty()) {
+    socks_.emplace_back();
+    s = &socks_.back();
+  } else {
+    s = free_socks_.back();
+    free_socks_.pop_back();
+  }
+  s->fd = fd;
+  return s;
+}
+
+void uring_backend::put_sock(sock *s) {
+  if (s->owns_fd) {
+    ::close(s->fd);
+  }
+  s->fd = -1;
+  s->owns_fd = false;
+  s->handler = nullptr;
+  s->state = nullptr;
+  s->inflight = 0;
+  s->armed = 0;
+  s->closing = false;
+  s->out_[0].clear();
+  s->out_[1].clear();
+  s->sending = 0;
+  s->send_ptr = nullptr;
+  s->send_left = 0;
+  free_socks_.push_back(s);
+}
+
+uring_backend::sock *uring_backend::attach(int fd, uring_handler &h) {
+  auto s = get_sock(fd);
+  s->owns_fd = true;
+  s->handler = &h;
+  return s;
+}
+
+void uring_backend::connect(sock *s, const socket_address &peer) {
+  std::memcpy(&s->peer, &peer.u.sas, sizeof(s->peer));
+  s->peer_len = peer.u.sa.sa_family == AF_INET6 ? sizeof(sockaddr_in6) : sizeof(sockaddr_in);
+  auto sqe = get_sqe();
+  sqe->opcode = IORING_OP_CONNECT;
+  sqe->fd = s->fd;
+  sqe->addr = reinterpret_cast<uint64_t>(&s->peer);
+  sqe->off = s->peer_len;
+  queue(s, op_connect, sqe);
+}
+
+void uring_backend::recv(sock *s) {
+  if (s->armed & (1u << op_recv)) {
+    return;
+  }
+  auto sqe = get_sqe();
+  sqe->opcode = IORING_OP_RECV;
+  sqe->fd = s->fd;
+  sqe->ioprio = IORING_RECV_MULTISHOT;
+  sqe->flags = IOSQE_BUFFER_SELECT;
+  sqe->buf_group = buffer_group;
+  queue(s, op_recv, sqe);
+}
+
+void uring_backend::send(sock *s, const void *data, size_t len, bool stable) {
+  if (len == 0) {
+    return;
+  }
+  auto p = static_cast<const char *>(data);
+  if (s->send_left) {
+    // one send at a time keeps the stream in order
+    s->out_[s->sending ^ 1].append(p, len);
+    return;
+  }
+  if (stable) {
+    s->send_ptr = p;
+  } else {
+    auto &out = s->out_[s->sending];
+    out.append(p, len);
+    s->send_ptr = out.begin();
+  }
+  s->send_left = len;
+  submit_send(s);
+}
+
+void uring_backend::submit_send(sock *s) {
+  auto sqe = get_sqe();
+  sqe->opcode = IORING_OP_SEND;
+  sqe->fd = s->fd;
+  sqe->addr = reinterpret_cast<uint64_t>(s->send_ptr);
+  sqe->len = s->send_left;
+  sqe->msg_flags = MSG_NOSIGNAL;
+  queue(s, op_send, sqe);
+}
+
+void uring_backend::close(sock *s) {
+  // what was handed to send() still goes out before the fd is closed
+  s->handler = nullptr;
+  s->closing = true;
+  cancel(s, op_connect);
+  cancel(s, op_recv);
+  if (s->inflight == 0) {
+    put_sock(s);
+  }
+}
+
+void uring_backend::arm_poll(sock *s, op o) {
+  auto sqe = get_sqe();
+  sqe->opcode = IORING_OP_POLL_ADD;
+  sqe->fd = s->fd;
+  sqe->poll32_events = o == op_poll_in ? POLLIN : POLLOUT;
+  queue(s, o, sqe);
+}
+
+void uring_backend::update(poll_state &state, int event) {
+  auto &s = polled_[&state];
+  if (!s) {
+    s = get_sock(state.pollid);
+    s->state = &state;
+  }
+  state.events_requested |= event;
+  for (int e : {EPOLLIN, EPOLLOUT}) {
+    if ((event & e) && !(state.events_epoll & e)) {
+      state.events_epoll |= e;
+      arm_poll(s, e == EPOLLIN ? op_poll_in : op_poll_out);
+    }
+  }
+}
+
+void uring_backend::forget(poll_state &state) {
+  auto it = polled_.find(&state);
+  if (it == polled_.end()) {
+    return;
+  }
+  auto s = it->second;
+  polled_.erase(it);
+  s->state = nullptr;
+  s->closing = true;
+  cancel(s, op_poll_in);
+  cancel(s, op_poll_out);
+  if (s->inflight == 0) {
+    put_sock(s);
+  }
+}
+
+} // namespace infgen
@@ -0,0 +1,178 @@
+#include "log.h"
+#include "reactor.h"
+#include "uring_connection.h"
+
+#include <netinet/tcp.h>
+
+namespace infgen {
+
+extern logger net_logger;
+
+uring_connection::uring_connection(uring_backend &ring) : ring_(ring) {
+  id_ = ++nr_conns;
+}
+
+uring_connection::~uring_connection() {
+  net_logger.trace("connection {} destroyed", get_id());
+  if (state_ != state::closed && state_ != state::disconnect) {
+    close();
+  }
+}
+
+void uring_connection::attach(int fd, socket_address local, socket_address peer) {
+  state_ = state::connecting;
+  peer_closed_ = false;
+  fd_ = fd;
+  local_ = local;
+  peer_ = peer;
+  req_cnt_ = 0;
+
+  assert(sock_ == nullptr);
+  net_logger.trace("construction connection: {}->{}", local_, peer_);
+  sock_ = ring_.attach(fd, *this);
+  ring_.connect(sock_, peer);
+}
+
+void uring_connection::close() {
+  net_logger.trace("closing fd {}", fd_);
+
+  if (state_ == state::closed || state_ == state::disconnect) {
+    net_logger.info("multiple close op detected! please check your code");
+    return;
+  }
+  abandon_handshake();
+  abandon_reconnect();
+  state_ = state::closed;
+  if (sock_) {
+    ring_.close(sock_);
+    sock_ = nullptr;
+  }
+  if (on_closed_) {
+    on_closed_();
+  }
+}
+
+void uring_connection::on_connected(int res) {
+  auto con = shared_from_this();
+  if (res != 0) {
+    net_logger.trace("fd {} connect failed: {}", fd_, strerror(-res));
+    end_handshake(false);
+    // a retry attaches a new socket
+    ring_.close(sock_);
+    sock_ = nullptr;
+    con->set_state(state::failed);
+    if (on_failed_) {
+      on_failed_(con);
+    }
+    return;
+  }
+  end_handshake(true);
+  con->set_state(state::connected);
+  ring_.recv(sock_);
+  if (on_connected_) {
+    net_logger.trace("fd {} connected!", fd_);
+    on_connected_(con);
+  }
+}
+
+unsigned uring_connection::syn_retries() {
+  tcp_info info;
+  socklen_t len = sizeof(info);
+  if (::getsockopt(fd_, IPPROTO_TCP, TCP_INFO, &info, &len) != 0) {
+    return 0;
+  }
+  return info.tcpi_total_retrans;
+}
+
+void uring_connection::on_received(const char *data, int res) {
+  auto con = shared_from_this();
+  if (res <= 0) {
+    if (res < 0) {
+      net_logger.trace("read error on fd {}: {}", fd_, strerror(-res));
+    }
+    state_ = state::disconnect;
+    peer_closed_ = res == 0;
+    cleanup(con);
+    return;
+  }
+  net_logger.trace("fd {} read {} bytes", fd_, res);
+  stat_.collect(IN, res);
+
+  if (on_data_ && input_.empty()) {
+    // parse in the ring's buffer, only a partial message is copied
+    recv_view view(data, res);
+    on_data_(con, view);
+    if (state_ == state::connected && !view.empty()) {
+      input_.append(view.begin(), view.size());
+    }
+    return;
+  }
+  input_.append(data, res);
+  deliver(con);
+  if (state_ == state::connected && on_msg_ && input_.size()) {
+    std::string msg = input_.string();
+    on_msg_(con, msg);
+  }
+}
+
+void uring_connection::on_sent(int res) {
+  if (res > 0) {
+    stat_.collect(OUT, res);
+    net_logger.trace("fd {} send {} bytes", fd_, res);
+    return;
+  }
+  net_logger.trace("send data error: {}", strerror(-res));
+  if (state_ == state::connected) {
+    state_ = state::disconnect;
+    cleanup(shared_from_this());
+  }
+}
+
+bool uring_connection::send_packet(const void *data, std::size_t len) {
+  if (state_ != state::connected) {
+    net_logger.error("fd {} trying to send packet via broken connection!", fd_);
+    return false;
+  }
+  ring_.send(sock_, data, len);
+  return true;
+}
+
+bool uring_connection::send_packet(const std::string &data) {
+  return send_packet(data.data(), data.size());
+}
+
+bool uring_connection::send_packet(const buffer &buf) {
+  return send_packet(buf.begin(), buf.size());
+}
+
+size_t uring_connection::write_some(const void *data, std::size_t len) {
+  // sends queue on the ring and are never cut short
+  return send_packet(data, len) ? len : 0;
+}
+
+bool uring_connection::send_payload(int id, std::size_t off, std::size_t len) {
+  if (state_ != state::connected) {
+    net_logger.error("fd {} trying to send packet via broken connection!", fd_);
+    return false;
+  }
+  // registered payloads stay put, the kernel reads them in place
+  ring_.send(sock_, engine().payload(id).data() + off, len, true);
+  return true;
+}
+
+void uring_connection::reconnect() {
+  net_logger.trace("conn {} reconnecting", get_id());
+  auto conn = shared_from_this();
+  engine().reconnect(conn);
+}
+
+void uring_connection::cleanup(connptr con) {
+  net_logger.trace("fd {} closed by peer", fd_);
+  ring_.close(sock_);
+  sock_ = nullptr;
+  if (on_disconnect_) {
+    on_disconnect_(con);
+  }
+}
+
+} // namespace infgen
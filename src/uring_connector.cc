@@ -0,0 +1,55 @@
+#include "arena.h"
+#include "log.h"
+#include "uring_connection.h"
+#include "uring_connector.h"
+
+namespace infgen {
+
+extern logger net_logger;
+
+file_desc uring_connector::open_socket(socket_address peer, socket_address &local) {
+  // the ring waits for the handshake, the socket need not be non-blocking
+  file_desc fd;
+  try {
+    fd = file_desc::socket(peer.u.in.sin_family, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    posix_socket::set_no_delay(fd.get(), no_delay_);
+  } catch (std::system_error &e) {
+    net_logger.error("socket error: {}", e.what());
+  }
+
+  if (!local.any) {
+    fd.bind(local.u.sa, sizeof(local.u.sas));
+    return fd;
+  }
+  for (;;) {
+    try {
+      local = fetch_address();
+      fd.bind(local.u.sa, sizeof(local.u.sas));
+      return fd;
+    } catch (std::system_error &e) {
+      net_logger.trace("bind error, rebind to another address");
+    }
+  }
+}
+
+connptr uring_connector::connect(socket_address sa, socket_address lo) {
+  nr_conns_++;
+  socket_address local = lo;
+  auto fd = open_socket(sa, local);
+  net_logger.trace("connecting {} from {}", sa, local);
+  auto con = std::allocate_shared<uring_connection>(memory::allocator<uring_connection>(), ring_);
+  con->attach(fd.get(), local, sa);
+  con->start_handshake();
+  return con;
+}
+
+void uring_connector::reconnect(connptr old_conn) {
+  socket_address peer = old_conn->get_peer();
+  socket_address local;
+  auto fd = open_socket(peer, local);
+  net_logger.trace("connecting {} from {}", peer, local);
+  old_conn->attach(fd.get(), local, peer);
+  old_conn->start_handshake();
+}
+
+} // namespace infgen